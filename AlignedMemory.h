@@ -0,0 +1,70 @@
+/* *
+	AlignedMemory.h
+		Allocation of aligned memory blocks (SIMD, direct I/O)
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef ALIGNED_MEMORY_H_
+#define ALIGNED_MEMORY_H_
+
+
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+
+
+namespace rm
+{
+
+	//alignment suitable for direct I/O on all common disks (and for any SIMD load)
+	static const size_t IO_ALIGNMENT = 4096;
+
+	/** \brief Allocate a memory block aligned to the given boundary
+	 *	\param[in] size The size of the block in bytes
+	 *	\param[in] alignment The alignment (power of two, multiple of sizeof(void*))
+	 *	\return NULL if the allocation failed, the block must be released by AlignedFree
+	 */
+	inline void* AlignedAlloc(const size_t size, const size_t alignment)
+	{
+#ifdef _WIN32
+		return _aligned_malloc(size,alignment);
+#else
+		void *p = NULL;
+		if(posix_memalign(&p,alignment,size) != 0)
+		{
+			return NULL;
+		}
+		return p;
+#endif
+	}
+
+	/** \brief Release a block allocated by AlignedAlloc
+	 */
+	inline void AlignedFree(void *p)
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	/** \brief Round size up to a multiple of alignment
+	 */
+	inline size_t AlignUp(const size_t size, const size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+};//namespace rm
+
+
+
+#endif //ALIGNED_MEMORY_H_
@@ -0,0 +1,408 @@
+/* *
+	AsyncSaver.cpp
+		The Implementation of the background saving of camera captures
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "AsyncSaver.h"
+#include "Camera.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//captures waiting in the queues of all the savers, and the ones dropped by the policies
+	static MetricGauge &s_queueLength = MetricsRegistry::Global().Gauge("saver.queueLength");
+	static MetricCounter &s_droppedCaptures = MetricsRegistry::Global().Counter("saver.droppedCaptures");
+	static MetricCounter &s_savedCaptures = MetricsRegistry::Global().Counter("saver.savedCaptures");
+
+	AsyncSaver::AsyncSaver():m_pPool(NULL),m_saving(0),m_stop(false),m_pError(NULL),m_queued(0),m_saved(0),m_streamId(-1)
+	{
+	}
+
+	AsyncSaver::~AsyncSaver()
+	{
+		try
+		{
+			ShutDown();
+		}
+		catch(...)
+		{//the error was for the caller of ShutDown
+		}
+	}
+
+	void AsyncSaver::SetOptions(const Options &options)
+	{
+		m_options = options;
+		m_options.m_queueDepth = max(m_options.m_queueDepth,1);
+		m_options.m_numThreads = max(m_options.m_numThreads,1);
+	}
+
+	void AsyncSaver::ImportSettings(const string &configFn, const char *secName)
+	{
+		Settings settings(configFn);
+		ImportSettings(settings,secName);
+	}
+
+	void AsyncSaver::ImportSettings(const Settings &settings, const char *secName)
+	{
+		Options options = m_options;
+		double dSetting;
+		string strSetting;
+		if(settings.ReadSetting(secName,"saveQueueDepth",dSetting,true))
+		{
+			options.m_queueDepth = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"saveThreads",dSetting,true))
+		{
+			options.m_numThreads = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"savePolicy",strSetting,true))
+		{
+			if(strSetting == "block")
+			{
+				options.m_policy = POLICY_BLOCK;
+			}
+			else if(strSetting == "dropNewest")
+			{
+				options.m_policy = POLICY_DROP_NEWEST;
+			}
+			else if(strSetting == "dropOldest")
+			{
+				options.m_policy = POLICY_DROP_OLDEST;
+			}
+			else
+			{
+				throw("AsyncSaver::ImportSettings: unknown save policy");
+			}
+		}
+		SetOptions(options);
+	}
+
+	void AsyncSaver::Start(const Camera &camera, const string &saveDir, const string &prefix)
+	{
+		if(IsRunning())
+		{
+			throw("AsyncSaver::Start: the saver is already running");
+		}
+		m_saveDir = saveDir;
+		m_savePrefix = prefix;
+		m_imageNames.clear();
+		m_extensions.clear();
+		m_headers.clear();
+		for(int k=0; k<camera.NumImages(); k++)
+		{
+			m_imageNames.push_back(camera.ImageName(k));
+			m_extensions.push_back(camera.FileNameExtension(k));
+			ImageSequenceHeader header;
+			header.m_imaHeight = camera.Height(k);
+			header.m_imaWidth = camera.Width(k);
+			header.m_imaChannels = camera.Channels(k);
+			header.m_imaBytesPerPixel = camera.BytesPerPixel(k);
+			m_headers.push_back(header);
+		}
+
+		m_queued = 0;
+		m_saved = 0;
+		m_droppedIds.clear();
+		m_saveLatency.Reset();
+		m_waitLatency.Reset();
+		m_pError = NULL;
+		m_stop = false;
+		m_pPool = new WorkerPool(m_options.m_numThreads);
+		m_saveThread = thread(&AsyncSaver::SaveLoop,this);
+	}
+
+	bool AsyncSaver::Save(const Camera &camera, const int frameId, const int streamId)
+	{
+		Job job;
+		job.m_frameId = frameId;
+		job.m_streamId = streamId;
+		//all the images of one capture, the camera may publish the next one meanwhile
+		camera.AcquireCapture(job.m_frames);
+		return Queue(job);
+	}
+
+	bool AsyncSaver::Save(const vector<FrameHandle> &frames, const int frameId, const int streamId)
+	{
+		Job job;
+		job.m_frameId = frameId;
+		job.m_streamId = streamId;
+		job.m_frames = frames;
+		return Queue(job);
+	}
+
+	//
+	//Add a capture to the queue, according to the policy if it is full
+	bool AsyncSaver::Queue(const Job &job)
+	{
+		if(!IsRunning())
+		{
+			throw("AsyncSaver::Save: the saver is not running");
+		}
+		const long long before = MonotonicNanoseconds();
+		unique_lock<mutex> lock(m_mutex);
+		bool complete = true;
+		if((int)m_queue.size() >= m_options.m_queueDepth)
+		{
+			switch(m_options.m_policy)
+			{
+			case POLICY_DROP_NEWEST:
+				m_droppedIds.push_back(job.m_frameId);
+				s_droppedCaptures.Add();
+				return false;
+			case POLICY_DROP_OLDEST:
+				m_droppedIds.push_back(m_queue.front().m_frameId);
+				m_queue.pop_front();	//the frames go back to the camera pools
+				s_queueLength.Add(-1);
+				s_droppedCaptures.Add();
+				complete = false;
+				break;
+			default:
+				while((int)m_queue.size() >= m_options.m_queueDepth)
+				{
+					m_cvProducer.wait(lock);
+				}
+				break;
+			}
+		}
+		m_queue.push_back(job);
+		m_queue.back().m_queueTime = MonotonicNanoseconds();
+		if(m_options.m_policy == POLICY_BLOCK)
+		{
+			m_waitLatency.Record(m_queue.back().m_queueTime - before);
+		}
+		m_queued++;
+		s_queueLength.Add(1);
+		lock.unlock();
+		m_cvSaver.notify_one();
+		return complete;
+	}
+
+	void AsyncSaver::Flush()
+	{
+		unique_lock<mutex> lock(m_mutex);
+		while(!m_queue.empty() || m_saving > 0)
+		{
+			m_cvProducer.wait(lock);
+		}
+	}
+
+	//
+	//Let the saver write what is queued, then end its thread
+	void AsyncSaver::ShutDown()
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cvSaver.notify_all();
+		if(m_saveThread.joinable())
+		{
+			m_saveThread.join();
+		}
+		CloseStreams();
+		delete m_pPool;
+		m_pPool = NULL;
+		m_stop = false;
+
+		const char *pError = m_pError;
+		m_pError = NULL;
+		if(pError)
+		{
+			throw(pError);
+		}
+	}
+
+	long long AsyncSaver::QueuedCaptures() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_queued;
+	}
+
+	long long AsyncSaver::SavedCaptures() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_saved;
+	}
+
+	long long AsyncSaver::DroppedCaptures() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return (long long)m_droppedIds.size();
+	}
+
+	vector<int> AsyncSaver::DroppedFrameIds() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_droppedIds;
+	}
+
+	int AsyncSaver::QueueLength() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return (int)m_queue.size();
+	}
+
+	//
+	//Take everything queued at once, so that the pool has work for all its threads
+	void AsyncSaver::SaveLoop()
+	{
+		unique_lock<mutex> lock(m_mutex);
+		while(true)
+		{
+			while(m_queue.empty() && !m_stop)
+			{
+				m_cvSaver.wait(lock);
+			}
+			if(m_queue.empty())
+			{
+				return;
+			}
+			//copying the handles only counts references
+			vector<Job> jobs(m_queue.begin(),m_queue.end());
+			m_queue.clear();
+			s_queueLength.Add(-(long long)jobs.size());
+			m_saving = (int)jobs.size();
+			lock.unlock();
+			m_cvProducer.notify_all();
+
+			const char *pError = NULL;
+			try
+			{
+				SaveBatch(jobs);
+			}
+			catch(const char *pMessage)
+			{
+				pError = pMessage;
+			}
+			catch(...)
+			{
+				pError = "AsyncSaver::SaveLoop: failed to write a capture";
+			}
+			const long long written = MonotonicNanoseconds();
+			vector<int> frameIds(jobs.size());
+			for(size_t i=0; i<jobs.size(); i++)
+			{
+				m_saveLatency.Record(written - jobs[i].m_queueTime);
+				frameIds[i] = jobs[i].m_frameId;
+			}
+			//the buffers go back to the camera pools before the producers are woken
+			jobs.clear();
+
+			lock.lock();
+			if(pError)
+			{//the batch may be partly in the files, none of its captures is complete
+				m_droppedIds.insert(m_droppedIds.end(),frameIds.begin(),frameIds.end());
+				s_droppedCaptures.Add(m_saving);
+				if(!m_pError)
+				{
+					m_pError = pError;
+				}
+			}
+			else
+			{
+				m_saved += m_saving;
+				s_savedCaptures.Add(m_saving);
+			}
+			m_saving = 0;
+			m_cvProducer.notify_all();
+		}
+	}
+
+	//
+	//Split the batch into runs of the same stream id
+	void AsyncSaver::SaveBatch(const vector<Job> &jobs)
+	{
+		size_t begin = 0;
+		while(begin < jobs.size())
+		{
+			size_t end = begin + 1;
+			while(end < jobs.size() && jobs[end].m_streamId == jobs[begin].m_streamId)
+			{
+				end++;
+			}
+			SaveRun(jobs,begin,end);
+			begin = end;
+		}
+	}
+
+	//
+	//Write jobs [begin,end), which have the same stream id
+	void AsyncSaver::SaveRun(const vector<Job> &jobs, const size_t begin, const size_t end)
+	{
+		const int streamId = jobs[begin].m_streamId;
+		const int numImages = (int)m_imageNames.size();
+		if(streamId == -1)
+		{//every frame is a file of its own
+			const int numJobs = (int)(end - begin);
+			m_pPool->ParallelFor(numJobs*numImages,[&](const int task)
+			{
+				const Job &job = jobs[begin + task/numImages];
+				const int k = task%numImages;
+				if(k < (int)job.m_frames.size() && job.m_frames[k].IsValid())
+				{
+					char buffer[64];
+					sprintf(buffer,"%04d",job.m_frameId);
+					cv::imwrite(m_saveDir + m_savePrefix + m_imageNames[k] + buffer + m_extensions[k],job.m_frames[k].Mat());
+				}
+			});
+			return;
+		}
+
+		if(streamId != m_streamId)
+		{
+			OpenStreams(streamId);
+		}
+		//one task per stream, the frames of a stream are written in order
+		m_pPool->ParallelFor(numImages,[&](const int k)
+		{
+			for(size_t i=begin; i<end; i++)
+			{
+				if(k < (int)jobs[i].m_frames.size() && jobs[i].m_frames[k].IsValid())
+				{
+					m_streams[k]->WriteFrameToStream(jobs[i].m_frames[k],jobs[i].m_frameId);
+				}
+			}
+		});
+	}
+
+	void AsyncSaver::OpenStreams(const int streamId)
+	{
+		CloseStreams();
+		char buffer[64];
+		sprintf(buffer,"_stream%03d.bin",streamId);
+		for(size_t k=0; k<m_headers.size(); k++)
+		{
+			ImageSequenceIO *pStream = new ImageSequenceIO;
+			m_streams.push_back(pStream);
+			pStream->SetWriteHeader(m_headers[k]);
+			pStream->OpenWriteStream(m_saveDir + m_savePrefix + m_imageNames[k] + buffer);
+			pStream->WriteHeader();
+		}
+		m_streamId = streamId;
+	}
+
+	void AsyncSaver::CloseStreams()
+	{
+		for(size_t i=0; i<m_streams.size(); i++)
+		{
+			m_streams[i]->CloseWriteStream();
+			delete m_streams[i];
+		}
+		m_streams.clear();
+		m_streamId = -1;
+	}
+
+}
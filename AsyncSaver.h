@@ -0,0 +1,200 @@
+/* *
+	AsyncSaver.h
+		Saving of camera captures on background threads, through a bounded
+		queue with a selectable policy when the disks fall behind
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef ASYNC_SAVER_H_
+#define ASYNC_SAVER_H_
+
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Common.h"
+#include "FileIO.h"
+#include "FramePool.h"
+#include "LatencyTracker.h"
+#include "WorkerPool.h"
+
+
+
+namespace rm
+{
+
+	class Camera;
+
+	/************************************************************//**
+	 *	The AsyncSaver class
+	 *	Takes over the saving part of Camera::SaveData: Save() takes the
+	 *	frames of the latest capture (AcquireCapture, no copy for pooled
+	 *	cameras) and queues them, a saver thread writes the queued
+	 *	captures either as one file per frame and image or into one stream
+	 *	file per image, with the same names as Camera::SaveData:
+	 *		<saveDir><prefix><imageName><frameId %04d><extension>
+	 *		<saveDir><prefix><imageName>_stream<streamId %03d>.bin
+	 *	The saver takes everything queued at once and writes it on a
+	 *	worker pool, one task per image (the frames of an image stay in
+	 *	order in its stream), or per frame and image for single files.
+	 *
+	 *	At most m_queueDepth captures wait (plus the ones being written);
+	 *	when the queue is full the policy decides: wait for the saver,
+	 *	drop the new capture or drop the oldest waiting one. Every dropped
+	 *	capture is counted and its frame id recorded, as are the captures
+	 *	of a batch that failed to be written.
+	 *
+	 *	ShutDown() writes everything queued before it returns: a capture
+	 *	is either reported dropped or in the files.
+	 *
+	 *	Settings (section "AsyncSaver" by default):
+	 *		saveQueueDepth, saveThreads, savePolicy (block|dropNewest|dropOldest)
+	 ***************************************************************/
+	class AsyncSaver
+	{
+	public:
+		/** \brief What Save does when the queue is full
+		 */
+		enum Policy
+		{
+			POLICY_BLOCK = 0,		//wait until the saver took a capture
+			POLICY_DROP_NEWEST,		//drop the capture being saved
+			POLICY_DROP_OLDEST		//drop the oldest waiting capture
+		};
+
+		struct Options
+		{
+			int				m_queueDepth;	//captures that may wait
+			int				m_numThreads;	//threads writing, including the saver thread
+			Policy			m_policy;
+
+			Options():m_queueDepth(8),m_numThreads(2),m_policy(POLICY_BLOCK)
+			{
+			}
+		};
+
+		AsyncSaver();
+		~AsyncSaver();
+
+		/** \brief Set the options, they apply from the next Start
+		 */
+		void SetOptions(const Options &options);
+		const Options& GetOptions() const { return m_options; }
+
+		void ImportSettings(const std::string &configFn, const char *secName = "AsyncSaver");
+		void ImportSettings(const Settings &settings, const char *secName = "AsyncSaver");
+
+		/** \brief Start the saver thread
+		 *	\param[in] camera The image names, extensions and formats are taken from it
+		 *	\param[in] saveDir, prefix As Camera::SetSavePath
+		 */
+		void Start(const Camera &camera, const std::string &saveDir, const std::string &prefix);
+
+		bool IsRunning() const { return m_saveThread.joinable(); }
+
+		/** \brief Queue the latest capture of the camera (AcquireCapture)
+		 *	\param[in] frameId, streamId As Camera::SaveData
+		 *	\return False if a capture was dropped for it (the new one or, with POLICY_DROP_OLDEST, an older one)
+		 */
+		bool Save(const Camera &camera, const int frameId, const int streamId = -1);
+
+		/** \brief Queue frames, one per image of the camera given to Start (invalid handles are skipped)
+		 */
+		bool Save(const std::vector<FrameHandle> &frames, const int frameId, const int streamId = -1);
+
+		/** \brief Wait until everything queued is written
+		 */
+		void Flush();
+
+		/** \brief Write everything queued, stop the saver thread and close the stream files
+		 *	The first error of the saver thread, if any, is thrown.
+		 */
+		void ShutDown();
+
+		/** \brief Captures accepted by Save
+		 */
+		long long QueuedCaptures() const;
+
+		/** \brief Captures completely written
+		 */
+		long long SavedCaptures() const;
+
+		/** \brief Captures dropped by the policy or lost to a write error
+		 */
+		long long DroppedCaptures() const;
+
+		/** \brief Frame ids of the dropped captures, in the order they were dropped
+		 */
+		std::vector<int> DroppedFrameIds() const;
+
+		/** \brief Captures waiting in the queue
+		 */
+		int QueueLength() const;
+
+		/** \brief Save -> written, and the time Save waited for room (POLICY_BLOCK)
+		 */
+		LatencySummary SaveLatency() const { return m_saveLatency.Summary(); }
+		LatencySummary WaitLatency() const { return m_waitLatency.Summary(); }
+
+	private:
+		struct Job
+		{
+			int							m_frameId;
+			int							m_streamId;
+			std::vector<FrameHandle>	m_frames;	//one per image
+			long long					m_queueTime;
+		};
+
+		//not copyable
+		AsyncSaver(const AsyncSaver&);
+		AsyncSaver& operator=(const AsyncSaver&);
+
+		bool Queue(const Job &job);
+		void SaveLoop();
+		void SaveBatch(const std::vector<Job> &jobs);
+		void SaveRun(const std::vector<Job> &jobs, const size_t begin, const size_t end);
+		void OpenStreams(const int streamId);
+		void CloseStreams();
+
+		Options						m_options;
+		std::string					m_saveDir;
+		std::string					m_savePrefix;
+		std::vector<std::string>	m_imageNames;
+		std::vector<std::string>	m_extensions;
+		std::vector<ImageSequenceHeader>	m_headers;	//formats of the stream files
+
+		std::thread					m_saveThread;
+		WorkerPool					*m_pPool;
+		mutable std::mutex			m_mutex;
+		std::condition_variable		m_cvSaver;
+		std::condition_variable		m_cvProducer;
+		std::deque<Job>				m_queue;
+		int							m_saving;		//captures taken by the saver, not written yet
+		bool						m_stop;
+		const char					*m_pError;		//first error of the saver thread
+
+		long long					m_queued;
+		long long					m_saved;
+		std::vector<int>			m_droppedIds;
+		LatencyHistogram			m_saveLatency;
+		LatencyHistogram			m_waitLatency;
+
+		//owned by the saver thread
+		int							m_streamId;		//stream files currently open, -1 = none
+		std::vector<ImageSequenceIO*>	m_streams;	//one per image
+	};
+
+};//namespace rm
+
+
+
+#endif //ASYNC_SAVER_H_
@@ -0,0 +1,564 @@
+/* *
+	AsyncStreamWriter.cpp
+		The Implementation of the background stream writer
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		//O_DIRECT, fallocate
+#endif
+
+#include "AsyncStreamWriter.h"
+#include "AlignedMemory.h"
+#include "Metrics.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//records waiting for the I/O threads of all the writers, and the ones dropped by DROP_OLDEST
+	static MetricGauge &s_queueDepth = MetricsRegistry::Global().Gauge("stream.asyncQueueDepth");
+	static MetricCounter &s_droppedRecords = MetricsRegistry::Global().Counter("stream.droppedRecords");
+
+	AsyncStreamWriter::AsyncStreamWriter():m_ioSlot(-1),m_stop(false),m_flushRequested(0),m_flushDone(0),
+		m_queuedCount(0),m_retiredCount(0),m_dropped(0),m_bytesWritten(0),m_error(false),m_pStaging(NULL),m_stagingFill(0),m_stagingOffset(0),m_pLatencyTracker(NULL)
+#ifdef _WIN32
+		,m_hFile(INVALID_HANDLE_VALUE)
+#else
+		,m_fd(-1)
+#endif
+	{
+	}
+
+	AsyncStreamWriter::~AsyncStreamWriter()
+	{
+		Close();
+	}
+
+	//
+	//Create the file, allocate the slots and start the I/O thread
+	bool AsyncStreamWriter::Open(const string &fileName, const Options &options)
+	{
+		Close();
+		m_options = options;
+		if(m_options.m_numSlots < 2)
+		{
+			m_options.m_numSlots = 2;
+		}
+		m_options.m_coalesceSize = AlignUp(m_options.m_coalesceSize > 0 ? m_options.m_coalesceSize : IO_ALIGNMENT,IO_ALIGNMENT);
+
+#ifdef _WIN32
+		DWORD flags = FILE_ATTRIBUTE_NORMAL;
+		if(m_options.m_directIO)
+		{
+			flags |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+		}
+		HANDLE hFile = CreateFileA(fileName.c_str(),GENERIC_WRITE,FILE_SHARE_READ,NULL,CREATE_ALWAYS,flags,NULL);
+		if(hFile == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		m_hFile = hFile;
+		if(m_options.m_preallocateSize > 0)
+		{
+			FILE_ALLOCATION_INFO allocInfo;
+			allocInfo.AllocationSize.QuadPart = m_options.m_preallocateSize;
+			SetFileInformationByHandle(hFile,FileAllocationInfo,&allocInfo,sizeof(allocInfo));	//best effort
+		}
+#else
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+		if(m_options.m_directIO)
+		{
+			flags |= O_DIRECT;
+		}
+#endif
+		m_fd = open(fileName.c_str(),flags,0644);
+		if(m_fd < 0 && m_options.m_directIO)
+		{//e.g. tmpfs does not support O_DIRECT
+			m_options.m_directIO = false;
+			m_fd = open(fileName.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+		}
+		if(m_fd < 0)
+		{
+			return false;
+		}
+#ifdef __linux__
+		if(m_options.m_preallocateSize > 0)
+		{
+			//reserve the blocks without changing the file size, best effort
+			fallocate(m_fd,FALLOC_FL_KEEP_SIZE,0,(off_t)m_options.m_preallocateSize);
+		}
+#endif
+#endif
+
+		m_pStaging = (unsigned char*)AlignedAlloc(m_options.m_coalesceSize,IO_ALIGNMENT);
+		if(!m_pStaging)
+		{
+			ReleaseFile();
+			return false;
+		}
+		m_stagingFill = 0;
+		m_stagingOffset = 0;
+
+		m_slots.resize(m_options.m_numSlots);
+		m_free.clear();
+		m_queued.clear();
+		for(int i=0; i<m_options.m_numSlots; i++)
+		{
+			Slot &slot = m_slots[i];
+			slot.m_capacity = AlignUp(m_options.m_slotSize,IO_ALIGNMENT);
+			slot.m_pData = slot.m_capacity > 0 ? (unsigned char*)AlignedAlloc(slot.m_capacity,IO_ALIGNMENT) : NULL;
+			if(!slot.m_pData)
+			{
+				slot.m_capacity = 0;
+			}
+			slot.m_size = 0;
+			slot.m_tag = 0;
+			slot.m_isRecord = false;
+			slot.m_hasTiming = false;
+			m_free.push_back(m_options.m_numSlots - 1 - i);
+		}
+		m_ioSlot = -1;
+		m_stop = false;
+		m_flushRequested = m_flushDone = 0;
+		m_flushPoints.clear();
+		m_queuedCount = m_retiredCount = 0;
+		m_dropped = 0;
+		m_bytesWritten = 0;
+		m_error = false;
+		m_writtenRecords.clear();
+		m_stagedTimings.clear();
+
+		m_ioThread = thread(&AsyncStreamWriter::IoLoop,this);
+		return true;
+	}
+
+	//
+	//Drain the queue, sync the file and release everything
+	void AsyncStreamWriter::Close()
+	{
+		if(m_ioThread.joinable())
+		{
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_cvIo.notify_one();
+			m_ioThread.join();
+		}
+		ReleaseFile();
+		for(size_t i=0; i<m_slots.size(); i++)
+		{
+			if(m_slots[i].m_pData)
+			{
+				AlignedFree(m_slots[i].m_pData);
+			}
+		}
+		m_slots.clear();
+		m_free.clear();
+		m_queued.clear();
+		if(m_pStaging)
+		{
+			AlignedFree(m_pStaging);
+			m_pStaging = NULL;
+		}
+	}
+
+	void AsyncStreamWriter::Write(const void *pData, const size_t size)
+	{
+		Enqueue(NULL,0,pData,size,0,false,NULL);
+	}
+
+	bool AsyncStreamWriter::WriteRecord(const void *pPrefix, const size_t prefixSize, const void *pData, const size_t dataSize, const long long tag,
+		const FrameTiming *pTiming)
+	{
+		if(!IsOpen())
+		{
+			return false;
+		}
+		Enqueue(pPrefix,prefixSize,pData,dataSize,tag,true,pTiming);
+		return true;
+	}
+
+	bool AsyncStreamWriter::Flush()
+	{
+		if(!IsOpen())
+		{
+			return false;
+		}
+		unique_lock<mutex> lock(m_mutex);
+		const long long ticket = ++m_flushRequested;
+		FlushPoint point = {ticket,m_queuedCount};
+		m_flushPoints.push_back(point);
+		m_cvIo.notify_one();
+		m_cvProducer.wait(lock,[&]{ return m_flushDone >= ticket; });
+		return !m_error;
+	}
+
+	int AsyncStreamWriter::QueueOccupancy() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return (int)m_queued.size() + (m_ioSlot >= 0 ? 1 : 0);
+	}
+
+	long long AsyncStreamWriter::DroppedRecords() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_dropped;
+	}
+
+	long long AsyncStreamWriter::BytesWritten() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_bytesWritten;
+	}
+
+	bool AsyncStreamWriter::HasError() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_error;
+	}
+
+	//
+	//Get a slot for the producer, applying the backpressure policy when the ring is full
+	int AsyncStreamWriter::AcquireSlot(unique_lock<mutex> &lock)
+	{
+		while(true)
+		{
+			if(!m_free.empty())
+			{
+				int idx = m_free.back();
+				m_free.pop_back();
+				return idx;
+			}
+			if(m_options.m_policy == BACKPRESSURE_DROP_OLDEST && !m_queued.empty() && m_slots[m_queued.front()].m_isRecord)
+			{
+				int idx = m_queued.front();
+				m_queued.pop_front();
+				m_retiredCount++;
+				m_dropped++;
+				s_queueDepth.Add(-1);
+				s_droppedRecords.Add();
+				return idx;
+			}
+			m_cvProducer.wait(lock);
+		}
+	}
+
+	void AsyncStreamWriter::Enqueue(const void *pPrefix, const size_t prefixSize, const void *pData, const size_t dataSize,
+		const long long tag, const bool isRecord, const FrameTiming *pTiming)
+	{
+		int idx;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			idx = AcquireSlot(lock);
+		}
+		//the slot is owned by this thread now, copy outside the lock
+		Slot &slot = m_slots[idx];
+		const size_t size = prefixSize + dataSize;
+		if(size > slot.m_capacity)
+		{//only happens until the slots have seen the largest record
+			unsigned char *pData = (unsigned char*)AlignedAlloc(AlignUp(size,IO_ALIGNMENT),IO_ALIGNMENT);
+			if(!pData)
+			{//the slot keeps its old buffer and goes back to the ring
+				{
+					lock_guard<mutex> lock(m_mutex);
+					m_free.push_back(idx);
+				}
+				m_cvProducer.notify_all();
+				throw("AsyncStreamWriter::Enqueue: not enough memory");
+			}
+			if(slot.m_pData)
+			{
+				AlignedFree(slot.m_pData);
+			}
+			slot.m_pData = pData;
+			slot.m_capacity = AlignUp(size,IO_ALIGNMENT);
+		}
+		if(prefixSize > 0)
+		{
+			memcpy(slot.m_pData,pPrefix,prefixSize);
+		}
+		memcpy(slot.m_pData + prefixSize,pData,dataSize);
+		slot.m_size = size;
+		slot.m_tag = tag;
+		slot.m_isRecord = isRecord;
+		slot.m_hasTiming = (pTiming != NULL);
+		if(pTiming)
+		{
+			slot.m_timing = *pTiming;
+		}
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_queued.push_back(idx);
+			m_queuedCount++;
+		}
+		s_queueDepth.Add(1);
+		m_cvIo.notify_one();
+	}
+
+	//
+	//Check if the oldest Flush can be served: the records queued before it are written or dropped
+	bool AsyncStreamWriter::FlushDue() const
+	{
+		return !m_flushPoints.empty() && m_flushPoints.front().m_position <= m_retiredCount;
+	}
+
+	//
+	//The I/O thread: move the queued slots into the staging buffer and write it out
+	//whenever it is full or the queue runs empty. A Flush is served between two records
+	//as soon as it is due, so that a steady producer does not postpone it
+	void AsyncStreamWriter::IoLoop()
+	{
+		unique_lock<mutex> lock(m_mutex);
+		while(true)
+		{
+			m_cvIo.wait(lock,[&]{ return !m_queued.empty() || m_stop || FlushDue(); });
+			if(FlushDue())
+			{
+				//every due flush is served by the same sync
+				long long ticket = 0;
+				while(FlushDue())
+				{
+					ticket = m_flushPoints.front().m_ticket;
+					m_flushPoints.pop_front();
+				}
+				lock.unlock();
+				WriteStaging(true);
+				bool ok = SyncFile();
+				lock.lock();
+				m_error = m_error || !ok;
+				m_flushDone = ticket;
+				m_cvProducer.notify_all();
+			}
+			else if(!m_queued.empty())
+			{
+				const int idx = m_queued.front();
+				m_queued.pop_front();
+				m_retiredCount++;
+				s_queueDepth.Add(-1);
+				m_ioSlot = idx;
+				const bool drained = m_queued.empty();
+				lock.unlock();
+
+				const Slot &slot = m_slots[idx];
+				if(slot.m_isRecord)
+				{
+					RecordInfo info;
+					info.m_offset = m_stagingOffset + (long long)m_stagingFill;
+					info.m_tag = slot.m_tag;
+					m_writtenRecords.push_back(info);
+				}
+				Stage(slot.m_pData,slot.m_size);
+				if(slot.m_hasTiming && m_pLatencyTracker)
+				{//recorded by the next write to the OS
+					m_stagedTimings.push_back(slot.m_timing);
+				}
+				if(drained)
+				{//nothing more to coalesce with, do not keep the data back
+					WriteStaging(false);
+				}
+
+				lock.lock();
+				m_ioSlot = -1;
+				m_free.push_back(idx);
+				m_cvProducer.notify_all();
+			}
+			else if(m_stop)
+			{
+				break;
+			}
+		}
+		lock.unlock();
+		WriteStaging(true);
+		bool ok = true;
+		if(m_options.m_preallocateSize > 0 || m_options.m_directIO)
+		{//give back the reserved blocks that were not used and cut the padding of the last block
+			ok = TrimFile(m_stagingOffset + (long long)m_stagingFill);
+		}
+		ok = SyncFile() && ok;
+		lock.lock();
+		m_error = m_error || !ok;
+	}
+
+	void AsyncStreamWriter::Stage(const unsigned char *pData, size_t size)
+	{
+		while(size > 0)
+		{
+			size_t n = m_options.m_coalesceSize - m_stagingFill;
+			if(n > size)
+			{
+				n = size;
+			}
+			memcpy(m_pStaging + m_stagingFill,pData,n);
+			m_stagingFill += n;
+			pData += n;
+			size -= n;
+			if(m_stagingFill == m_options.m_coalesceSize)
+			{
+				WriteStaging(false);
+			}
+		}
+	}
+
+	//
+	//Hand the staged bytes to the OS. With direct I/O only whole blocks can be written,
+	//the partial block at the end is kept (and rewritten later) unless final is set, in
+	//which case it is written zero padded; the padding is cut off by the IO thread on
+	//Close only, cutting the file here would also free the preallocated blocks.
+	void AsyncStreamWriter::WriteStaging(const bool final)
+	{
+		if(m_stagingFill == 0)
+		{
+			return;
+		}
+		bool ok = true;
+		size_t written = m_stagingFill;
+		if(!m_options.m_directIO)
+		{
+			ok = WriteAt(m_stagingOffset,m_pStaging,m_stagingFill);
+		}
+		else
+		{
+			written = m_stagingFill - m_stagingFill % IO_ALIGNMENT;
+			if(final && written < m_stagingFill)
+			{
+				const size_t padded = AlignUp(m_stagingFill,IO_ALIGNMENT);
+				memset(m_pStaging + m_stagingFill,0,padded - m_stagingFill);
+				ok = WriteAt(m_stagingOffset,m_pStaging,padded);
+			}
+			else if(written > 0)
+			{
+				ok = WriteAt(m_stagingOffset,m_pStaging,written);
+			}
+		}
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_bytesWritten += (long long)written;
+			m_error = m_error || !ok;
+		}
+		if(!m_stagedTimings.empty())
+		{
+			const long long now = MonotonicNanoseconds();
+			for(size_t i=0; i<m_stagedTimings.size(); i++)
+			{
+				m_pLatencyTracker->RecordWritten(m_stagedTimings[i],now);
+			}
+			m_stagedTimings.clear();
+		}
+		if(written < m_stagingFill)
+		{//keep the tail, it starts on a block boundary
+			memmove(m_pStaging,m_pStaging + written,m_stagingFill - written);
+		}
+		m_stagingOffset += (long long)written;
+		m_stagingFill -= written;
+	}
+
+#ifdef _WIN32
+
+	bool AsyncStreamWriter::WriteAt(const long long offset, const void *pData, const size_t size)
+	{
+		const unsigned char *p = (const unsigned char*)pData;
+		size_t remaining = size;
+		long long pos = offset;
+		while(remaining > 0)
+		{
+			DWORD chunk = remaining > (1u<<30) ? (1u<<30) : (DWORD)remaining;
+			OVERLAPPED ov;
+			memset(&ov,0,sizeof(ov));
+			ov.Offset = (DWORD)(pos & 0xffffffff);
+			ov.OffsetHigh = (DWORD)(pos >> 32);
+			DWORD done = 0;
+			if(!WriteFile(m_hFile,p,chunk,&done,&ov) || done == 0)
+			{
+				return false;
+			}
+			p += done;
+			pos += done;
+			remaining -= done;
+		}
+		return true;
+	}
+
+	bool AsyncStreamWriter::SyncFile()
+	{
+		return FlushFileBuffers(m_hFile) != 0;
+	}
+
+	bool AsyncStreamWriter::TrimFile(const long long size)
+	{
+		LARGE_INTEGER pos;
+		pos.QuadPart = size;
+		return SetFilePointerEx(m_hFile,pos,NULL,FILE_BEGIN) && SetEndOfFile(m_hFile);
+	}
+
+	void AsyncStreamWriter::ReleaseFile()
+	{
+		if(m_hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+	}
+
+#else
+
+	bool AsyncStreamWriter::WriteAt(const long long offset, const void *pData, const size_t size)
+	{
+		const unsigned char *p = (const unsigned char*)pData;
+		size_t remaining = size;
+		off_t pos = (off_t)offset;
+		while(remaining > 0)
+		{
+			ssize_t done = pwrite(m_fd,p,remaining,pos);
+			if(done <= 0)
+			{
+				return false;
+			}
+			p += done;
+			pos += done;
+			remaining -= (size_t)done;
+		}
+		return true;
+	}
+
+	bool AsyncStreamWriter::SyncFile()
+	{
+		return fsync(m_fd) == 0;
+	}
+
+	//
+	//Setting the size frees the blocks reserved past it, even if the size does not change
+	bool AsyncStreamWriter::TrimFile(const long long size)
+	{
+		return ftruncate(m_fd,(off_t)size) == 0;
+	}
+
+	void AsyncStreamWriter::ReleaseFile()
+	{
+		if(m_fd >= 0)
+		{
+			close(m_fd);
+			m_fd = -1;
+		}
+	}
+
+#endif
+
+}
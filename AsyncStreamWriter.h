@@ -0,0 +1,225 @@
+/* *
+	AsyncStreamWriter.h
+		Background writer for stream files
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef ASYNC_STREAM_WRITER_H_
+#define ASYNC_STREAM_WRITER_H_
+
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "LatencyTracker.h"
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The AsyncStreamWriter class
+	 *	Records are copied into a preallocated ring of aligned slots and
+	 *	written by a dedicated I/O thread, which coalesces consecutive
+	 *	records into large writes. The calling (capture) thread only pays
+	 *	for one memcpy per record.
+	 *	Optionally the file is opened for direct I/O (O_DIRECT /
+	 *	FILE_FLAG_NO_BUFFERING) and preallocated.
+	 ***************************************************************/
+	class AsyncStreamWriter
+	{
+	public:
+		/** \brief What to do when all the slots are in use
+		 */
+		enum BackpressurePolicy
+		{
+			BACKPRESSURE_BLOCK = 0,		//wait for the I/O thread
+			BACKPRESSURE_DROP_OLDEST	//discard the oldest queued record and count it
+		};
+
+		/** \brief Writer configuration
+		 */
+		struct Options
+		{
+			int					m_numSlots;			//number of records that can be queued
+			size_t				m_slotSize;			//initial size of each slot (grows if a larger record comes)
+			size_t				m_coalesceSize;		//size of the write issued to the OS
+			BackpressurePolicy	m_policy;
+			bool				m_directIO;			//bypass the OS page cache
+			long long			m_preallocateSize;	//bytes reserved on disk when opening (the unused part is freed on Close), 0 = none
+
+			Options():m_numSlots(64),m_slotSize(0),m_coalesceSize(8<<20),m_policy(BACKPRESSURE_BLOCK),
+				m_directIO(false),m_preallocateSize(0)
+			{
+			}
+		};
+
+		/** \brief Position of a record that made it to the file
+		 */
+		struct RecordInfo
+		{
+			long long			m_offset;
+			long long			m_tag;
+		};
+
+	public:
+		AsyncStreamWriter();
+		~AsyncStreamWriter();
+
+		/** \brief Create the file and start the I/O thread
+		 *	\param[in] fileName The file to write
+		 *	\param[in] options The writer configuration
+		 *	\return False if the file can not be created
+		 */
+		bool Open(const std::string &fileName, const Options &options = Options());
+
+		/** \brief Write all the queued records, make them durable and stop the I/O thread
+		 */
+		void Close();
+
+		/** \brief Check if the writer is open
+		 */
+		bool IsOpen() const { return m_ioThread.joinable(); }
+
+		/** \brief Queue raw data that must never be dropped (e.g. the stream header)
+		 *	\param[in] pData The data to be written
+		 *	\param[in] size Size of the data in bytes
+		 */
+		void Write(const void *pData, const size_t size);
+
+		/** \brief Queue one record made of a small prefix and a payload
+		 *	The record is the unit discarded by BACKPRESSURE_DROP_OLDEST
+		 *	\param[in] pPrefix The record prefix (e.g. the frame id)
+		 *	\param[in] prefixSize Size of the prefix in bytes
+		 *	\param[in] pData The record payload (e.g. the pixels)
+		 *	\param[in] dataSize Size of the payload in bytes
+		 *	\param[in] tag User value reported back through WrittenRecords()
+		 *	\param[in] pTiming [optional] Capture timing, recorded in the latency tracker once the record is written
+		 *	\return False if the record was dropped right away (writer closed)
+		 */
+		bool WriteRecord(const void *pPrefix, const size_t prefixSize, const void *pData, const size_t dataSize, const long long tag,
+			const FrameTiming *pTiming = NULL);
+
+		/** \brief Set the tracker receiving the written latency of the records (NULL = none)
+		 *	Must be called while the writer is closed
+		 */
+		void SetLatencyTracker(LatencyTracker *pTracker) { m_pLatencyTracker = pTracker; }
+
+		/** \brief Block until everything queued so far is on the disk (fsync / FlushFileBuffers)
+		 *	The flush is served as soon as the records queued before it are written, records
+		 *	queued afterwards do not delay it. With direct I/O the file may end with the zero
+		 *	padding of its last block until Close.
+		 *	\return False if an I/O error occured
+		 */
+		bool Flush();
+
+		/** \brief Number of records currently queued or being written
+		 */
+		int QueueOccupancy() const;
+
+		/** \brief Number of slots
+		 */
+		int QueueCapacity() const { return m_options.m_numSlots; }
+
+		/** \brief Number of records discarded because of BACKPRESSURE_DROP_OLDEST
+		 */
+		long long DroppedRecords() const;
+
+		/** \brief Number of bytes handed to the OS so far
+		 */
+		long long BytesWritten() const;
+
+		/** \brief Check if a write to the file failed
+		 */
+		bool HasError() const;
+
+		/** \brief The records written to the file, in file order.
+		 *	Only valid after Close()
+		 */
+		const std::vector<RecordInfo>& WrittenRecords() const { return m_writtenRecords; }
+
+	private:
+		struct Slot
+		{
+			unsigned char		*m_pData;
+			size_t				m_capacity;
+			size_t				m_size;
+			long long			m_tag;
+			bool				m_isRecord;		//droppable
+			bool				m_hasTiming;
+			FrameTiming			m_timing;
+		};
+
+		//a Flush waiting for the records queued before it
+		struct FlushPoint
+		{
+			long long			m_ticket;
+			long long			m_position;		//m_queuedCount when requested
+		};
+
+		//not copyable
+		AsyncStreamWriter(const AsyncStreamWriter&);
+		AsyncStreamWriter& operator=(const AsyncStreamWriter&);
+
+		int AcquireSlot(std::unique_lock<std::mutex> &lock);
+		void Enqueue(const void *pPrefix, const size_t prefixSize, const void *pData, const size_t dataSize,
+			const long long tag, const bool isRecord, const FrameTiming *pTiming);
+		void IoLoop();
+		void Stage(const unsigned char *pData, size_t size);
+		void WriteStaging(const bool final);
+		bool WriteAt(const long long offset, const void *pData, const size_t size);
+		bool FlushDue() const;
+		bool SyncFile();
+		bool TrimFile(const long long size);
+		void ReleaseFile();
+
+		Options						m_options;
+		std::vector<Slot>			m_slots;
+		std::deque<int>				m_queued;		//slots waiting for the I/O thread, oldest first
+		std::vector<int>			m_free;
+		int							m_ioSlot;		//slot being copied by the I/O thread, -1 if none
+		bool						m_stop;
+		long long					m_flushRequested;
+		long long					m_flushDone;
+		std::deque<FlushPoint>		m_flushPoints;	//oldest first
+		long long					m_queuedCount;	//slots ever queued
+		long long					m_retiredCount;	//slots ever taken off the queue (staged or dropped)
+		long long					m_dropped;
+		long long					m_bytesWritten;
+		bool						m_error;
+
+		//owned by the I/O thread
+		unsigned char				*m_pStaging;
+		size_t						m_stagingFill;
+		long long					m_stagingOffset;	//file offset of the first staged byte
+		std::vector<RecordInfo>		m_writtenRecords;
+		std::vector<FrameTiming>	m_stagedTimings;	//records staged since the last write
+		LatencyTracker				*m_pLatencyTracker;
+
+		mutable std::mutex			m_mutex;
+		std::condition_variable		m_cvIo;
+		std::condition_variable		m_cvProducer;
+		std::thread					m_ioThread;
+
+#ifdef _WIN32
+		void						*m_hFile;
+#else
+		int							m_fd;
+#endif
+	};
+
+};//namespace rm
+
+
+
+#endif //ASYNC_STREAM_WRITER_H_
@@ -0,0 +1,169 @@
+/* *
+	BayerKernels.cpp
+		The Implementation of the demosaicing kernels
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "BayerKernels.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//bands below this height are not worth a thread
+	static const int MIN_BAND_ROWS = 32;
+	//rows of context converted with every band, even to keep the Bayer phase
+	static const int BAND_CONTEXT_ROWS = 2;
+
+	//
+	//Position of the red sample in the 2x2 Bayer cell for a cvtColor code
+	//(the cvtColor names refer to the second row, CV_BayerBG2BGR is an RGGB sensor)
+	static void RedPosition(const int code, int &row, int &col)
+	{
+		switch(code)
+		{
+		case CV_BayerBG2BGR:	//RGGB
+			row = 0; col = 0;
+			break;
+		case CV_BayerGB2BGR:	//GRBG
+			row = 0; col = 1;
+			break;
+		case CV_BayerGR2BGR:	//GBRG
+			row = 1; col = 0;
+			break;
+		case CV_BayerRG2BGR:	//BGGR
+			row = 1; col = 1;
+			break;
+		default:
+			throw("DemosaicDownscale: unsupported Bayer code");
+		}
+	}
+
+	void DemosaicParallel(const cv::Mat &raw, cv::Mat &bgr, const int code, WorkerPool *pPool)
+	{
+		const int numThreads = pPool ? pPool->NumThreads() : 1;
+		if(numThreads <= 1 || raw.rows < 2*MIN_BAND_ROWS)
+		{
+			cv::cvtColor(raw,bgr,code);
+			return;
+		}
+		bgr.create(raw.rows,raw.cols,CV_MAKETYPE(raw.depth(),3));
+
+		//two bands per thread to even out the load, band starts are even
+		int numBands = min(2*numThreads,raw.rows/MIN_BAND_ROWS);
+		int bandRows = (raw.rows + numBands - 1)/numBands;
+		bandRows += bandRows & 1;
+		numBands = (raw.rows + bandRows - 1)/bandRows;
+
+		const cv::Mat &src = raw;
+		cv::Mat &dst = bgr;
+		pPool->ParallelFor(numBands,[&](int b)
+		{
+			const int r0 = b*bandRows;
+			const int r1 = min(raw.rows,r0 + bandRows);
+			const int c0 = max(0,r0 - BAND_CONTEXT_ROWS);
+			const int c1 = min(raw.rows,r1 + BAND_CONTEXT_ROWS);
+			cv::Mat band;
+			cv::cvtColor(src.rowRange(c0,c1),band,code);
+			cv::Mat dstBand = dst.rowRange(r0,r1);
+			band.rowRange(r0 - c0,r1 - c0).copyTo(dstBand);
+		});
+	}
+
+	//
+	//Average the samples of every 2x2 cell in the scale x scale blocks of the output rows [y0,y1)
+	template<typename T>
+	static void DownscaleRows(const cv::Mat &raw, cv::Mat &bgr, const int redRow, const int redCol, const int scale,
+		const int y0, const int y1)
+	{
+		const int cells = scale/2;
+		const unsigned int numRB = cells*cells;		//red and blue samples per block
+		const unsigned int numG = 2*numRB;
+		vector<unsigned int> sums(3*bgr.cols);
+		for(int y=y0; y<y1; y++)
+		{
+			std::fill(sums.begin(),sums.end(),0u);
+			for(int cy=0; cy<cells; cy++)
+			{
+				const int r = y*scale + 2*cy;
+				const T *pRed = (const T*)raw.ptr(r + redRow);
+				const T *pBlue = (const T*)raw.ptr(r + 1 - redRow);
+				for(int x=0; x<bgr.cols; x++)
+				{
+					unsigned int sumB = 0, sumG = 0, sumR = 0;
+					for(int cx=0; cx<cells; cx++)
+					{
+						const int c = x*scale + 2*cx;
+						sumR += pRed[c + redCol];
+						sumG += pRed[c + 1 - redCol] + pBlue[c + redCol];
+						sumB += pBlue[c + 1 - redCol];
+					}
+					sums[3*x] += sumB;
+					sums[3*x+1] += sumG;
+					sums[3*x+2] += sumR;
+				}
+			}
+			T *pOut = (T*)bgr.ptr(y);
+			for(int x=0; x<bgr.cols; x++)
+			{
+				pOut[3*x] = (T)((sums[3*x] + numRB/2)/numRB);
+				pOut[3*x+1] = (T)((sums[3*x+1] + numG/2)/numG);
+				pOut[3*x+2] = (T)((sums[3*x+2] + numRB/2)/numRB);
+			}
+		}
+	}
+
+	void DemosaicDownscale(const cv::Mat &raw, cv::Mat &bgr, const int code, const int scale, WorkerPool *pPool)
+	{
+		if(scale < 2 || (scale & 1) || scale > 16)
+		{
+			throw("DemosaicDownscale: the scale must be even and at most 16");
+		}
+		if(raw.channels() != 1 || (raw.depth() != CV_8U && raw.depth() != CV_16U))
+		{
+			throw("DemosaicDownscale: the raw frame must be CV_8U or CV_16U");
+		}
+		int redRow, redCol;
+		RedPosition(code,redRow,redCol);
+		bgr.create(raw.rows/scale,raw.cols/scale,CV_MAKETYPE(raw.depth(),3));
+		if(bgr.rows == 0 || bgr.cols == 0)
+		{
+			return;
+		}
+
+		const int numThreads = pPool ? pPool->NumThreads() : 1;
+		const int numChunks = min(numThreads,max(1,bgr.rows*scale/MIN_BAND_ROWS));
+		const int chunkRows = (bgr.rows + numChunks - 1)/numChunks;
+		const bool is16 = (raw.depth() == CV_16U);
+		auto run = [&](int k)
+		{
+			const int y0 = k*chunkRows;
+			const int y1 = min(bgr.rows,y0 + chunkRows);
+			if(is16)
+			{
+				DownscaleRows<unsigned short>(raw,bgr,redRow,redCol,scale,y0,y1);
+			}
+			else
+			{
+				DownscaleRows<unsigned char>(raw,bgr,redRow,redCol,scale,y0,y1);
+			}
+		};
+		if(numChunks > 1)
+		{
+			pPool->ParallelFor(numChunks,run);
+		}
+		else
+		{
+			run(0);
+		}
+	}
+
+}
@@ -0,0 +1,52 @@
+/* *
+	BayerKernels.h
+		Demosaicing of raw Bayer frames: band parallel full resolution
+		and fused demosaic + downscale previews
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef BAYER_KERNELS_H_
+#define BAYER_KERNELS_H_
+
+
+#include <opencv2\opencv.hpp>
+
+
+
+namespace rm
+{
+
+	class WorkerPool;
+
+	/** \brief Full resolution demosaic split into row bands that run on the pool
+	 *	Every band is converted with cv::cvtColor together with two rows of context
+	 *	above and below, and band starts are even, so the result is identical to a
+	 *	single cv::cvtColor over the whole frame.
+	 *	\param[in] raw The Bayer mosaic, CV_8U or CV_16U
+	 *	\param[out] bgr The BGR image (same depth as raw)
+	 *	\param[in] code The cv::cvtColor Bayer code, e.g. CV_BayerBG2BGR
+	 *	\param[in] pPool The threads, NULL = cv::cvtColor on the calling thread
+	 */
+	void DemosaicParallel(const cv::Mat &raw, cv::Mat &bgr, const int code, WorkerPool *pPool = NULL);
+
+	/** \brief Demosaic and downscale in one pass, without the full resolution image
+	 *	Every scale x scale block gives one pixel: the average of its red, green
+	 *	and blue samples. Much cheaper than cvtColor + resize, meant for previews.
+	 *	\param[in] raw The Bayer mosaic, CV_8U or CV_16U
+	 *	\param[out] bgr The BGR image of (rows/scale) x (cols/scale), same depth as raw
+	 *	\param[in] code The cv::cvtColor Bayer code, e.g. CV_BayerBG2BGR
+	 *	\param[in] scale Even downscale factor (2 = half, 4 = quarter resolution)
+	 *	\param[in] pPool The threads, NULL = the calling thread
+	 */
+	void DemosaicDownscale(const cv::Mat &raw, cv::Mat &bgr, const int code, const int scale, WorkerPool *pPool = NULL);
+
+};//namespace rm
+
+
+
+#endif //BAYER_KERNELS_H_
@@ -0,0 +1,343 @@
+/* *
+	BufferedCamera.cpp
+		The Implementation of the lock-free capture handoff
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "BufferedCamera.h"
+#include "Metrics.h"
+
+#include <vector>
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	static MetricCounter &s_captures = MetricsRegistry::Global().Counter("camera.captures");
+	static MetricCounter &s_droppedCaptures = MetricsRegistry::Global().Counter("camera.droppedCaptures");
+	static MetricHistogram &s_setLockWait = MetricsRegistry::Global().Histogram("camera.setLockNs");
+
+	struct BufferedCamera::Slot
+	{
+		vector<cv::Mat>			m_images;	//headers on m_frames, unless reallocated by the producer
+		vector<FrameHandle>		m_frames;
+		atomic<int>				m_pins;		//number of readers using the slot
+		long long				m_sequence;
+		FrameTiming				m_timing;
+
+		Slot():m_pins(0),m_sequence(0)
+		{
+		}
+	};
+
+	//returned when nothing was captured yet
+	static const cv::Mat s_emptyImage;
+	static const FrameTiming s_noTiming;
+
+	/* *
+		Captures pinned through SetLock by the current thread. Kept per thread so
+		that the legacy lock API needs no mutex: different consumer threads can
+		hold locks on different captures of the same camera at the same time.
+	* */
+	struct ThreadLock
+	{
+		const BufferedCamera		*m_pCamera;
+		BufferedCamera::Slot		*m_pSlot;
+		int							m_depth;
+	};
+	static thread_local vector<ThreadLock> t_locks;
+
+	static ThreadLock* FindThreadLock(const BufferedCamera *pCamera)
+	{
+		for(size_t i=0; i<t_locks.size(); i++)
+		{
+			if(t_locks[i].m_pCamera == pCamera)
+			{
+				return &t_locks[i];
+			}
+		}
+		return NULL;
+	}
+
+
+	/******************************/
+	/* CaptureRef                 */
+	/******************************/
+
+	BufferedCamera::CaptureRef::CaptureRef():m_pSlot(NULL)
+	{
+	}
+
+	BufferedCamera::CaptureRef::CaptureRef(Slot *pSlot):m_pSlot(pSlot)
+	{
+	}
+
+	BufferedCamera::CaptureRef::CaptureRef(CaptureRef &&other):m_pSlot(other.m_pSlot)
+	{
+		other.m_pSlot = NULL;
+	}
+
+	BufferedCamera::CaptureRef& BufferedCamera::CaptureRef::operator=(CaptureRef &&other)
+	{
+		if(this != &other)
+		{
+			Release();
+			m_pSlot = other.m_pSlot;
+			other.m_pSlot = NULL;
+		}
+		return *this;
+	}
+
+	BufferedCamera::CaptureRef::~CaptureRef()
+	{
+		Release();
+	}
+
+	const cv::Mat& BufferedCamera::CaptureRef::Image(const int index) const
+	{
+		if(!m_pSlot || index < 0 || index >= (int)m_pSlot->m_images.size())
+		{
+			return s_emptyImage;
+		}
+		return m_pSlot->m_images[index];
+	}
+
+	long long BufferedCamera::CaptureRef::Sequence() const
+	{
+		return m_pSlot ? m_pSlot->m_sequence : 0;
+	}
+
+	const FrameTiming& BufferedCamera::CaptureRef::Timing() const
+	{
+		return m_pSlot ? m_pSlot->m_timing : s_noTiming;
+	}
+
+	void BufferedCamera::CaptureRef::Release()
+	{
+		if(m_pSlot)
+		{
+			m_pSlot->m_pins--;
+			m_pSlot = NULL;
+		}
+	}
+
+
+	/******************************/
+	/* BufferedCamera             */
+	/******************************/
+
+	BufferedCamera::BufferedCamera(const int numSlots):m_numSlots(numSlots < 3 ? 3 : numSlots),m_writeSlot(-1),
+		m_latestSlot(-1),m_published(0),m_dropped(0),m_pLatencyTracker(&LatencyTracker::Global())
+	{
+		m_pSlots = new Slot[m_numSlots];
+	}
+
+	BufferedCamera::~BufferedCamera()
+	{
+		delete [] m_pSlots;
+	}
+
+	//
+	//Pin the latest slot. The producer never writes into the latest slot, and it only
+	//picks a slot that has no pins; so once the slot is pinned and is still the latest,
+	//its content is complete and stays untouched until it is unpinned.
+	BufferedCamera::Slot* BufferedCamera::PinLatest() const
+	{
+		while(true)
+		{
+			const int latest = m_latestSlot.load();
+			if(latest < 0)
+			{
+				return NULL;
+			}
+			Slot &slot = m_pSlots[latest];
+			slot.m_pins++;
+			if(m_latestSlot.load() == latest)
+			{
+				return &slot;
+			}
+			//a newer capture was published in between, the slot may be refilled
+			slot.m_pins--;
+		}
+	}
+
+	BufferedCamera::CaptureRef BufferedCamera::AcquireLatest() const
+	{
+		return CaptureRef(PinLatest());
+	}
+
+	bool BufferedCamera::BeginCapture()
+	{
+		const int latest = m_latestSlot.load();
+		//keep the slot of the previous (unpublished) attempt if it is still free
+		if(m_writeSlot >= 0 && m_writeSlot != latest && m_pSlots[m_writeSlot].m_pins.load() == 0)
+		{
+			m_pSlots[m_writeSlot].m_timing = FrameTiming();
+			m_pSlots[m_writeSlot].m_timing.m_grabTime = MonotonicNanoseconds();
+			return true;
+		}
+		for(int i=1; i<=m_numSlots; i++)
+		{
+			const int candidate = (latest + i + m_numSlots) % m_numSlots;
+			if(candidate != latest && m_pSlots[candidate].m_pins.load() == 0)
+			{
+				m_writeSlot = candidate;
+				//NumImages is virtual, so the slot is sized here and not in the constructor
+				Slot &slot = m_pSlots[candidate];
+				slot.m_timing = FrameTiming();
+				slot.m_timing.m_grabTime = MonotonicNanoseconds();
+				const int numImages = NumImages();
+				slot.m_images.resize(numImages);
+				slot.m_frames.resize(numImages);
+				for(int k=0; k<numImages; k++)
+				{
+					//frames still held by consumers stay with them, the pool provides another buffer
+					slot.m_frames[k] = FramePoolFor(k).Acquire();
+					slot.m_images[k] = slot.m_frames[k].Mat();
+				}
+				return true;
+			}
+		}
+		m_writeSlot = -1;
+		m_dropped++;
+		s_droppedCaptures.Add();
+		return false;
+	}
+
+	cv::Mat& BufferedCamera::CaptureImage(const int index)
+	{
+		if(m_writeSlot < 0)
+		{
+			throw("BufferedCamera::CaptureImage: no capture started");
+		}
+		return m_pSlots[m_writeSlot].m_images.at(index);
+	}
+
+	void BufferedCamera::SetCaptureTiming(const long long grabTime, const long long deviceTime)
+	{
+		if(m_writeSlot < 0)
+		{
+			throw("BufferedCamera::SetCaptureTiming: no capture started");
+		}
+		FrameTiming &timing = m_pSlots[m_writeSlot].m_timing;
+		if(grabTime > 0)
+		{
+			timing.m_grabTime = grabTime;
+		}
+		timing.m_deviceTime = deviceTime;
+	}
+
+	void BufferedCamera::PublishCapture()
+	{
+		if(m_writeSlot < 0)
+		{
+			throw("BufferedCamera::PublishCapture: no capture started");
+		}
+		Slot &slot = m_pSlots[m_writeSlot];
+		slot.m_timing.m_availableTime = MonotonicNanoseconds();
+		for(size_t k=0; k<slot.m_images.size(); k++)
+		{
+			if(slot.m_images[k].data != slot.m_frames[k].Mat().data)
+			{//reallocated by the producer
+				slot.m_frames[k] = FrameHandle::Wrap(slot.m_images[k]);
+			}
+			slot.m_frames[k].SetTiming(slot.m_timing);
+		}
+		if(m_pLatencyTracker)
+		{
+			m_pLatencyTracker->RecordAvailable(slot.m_timing);
+		}
+		slot.m_sequence = m_published.load() + 1;
+		m_latestSlot.store(m_writeSlot);
+		m_published++;
+		m_writeSlot = -1;
+		s_captures.Add();
+	}
+
+	FrameHandle BufferedCamera::AcquireFrame(const int index) const
+	{
+		CaptureRef capture = AcquireLatest();
+		if(!capture.IsValid() || index < 0 || index >= (int)capture.m_pSlot->m_frames.size())
+		{
+			return FrameHandle();
+		}
+		return capture.m_pSlot->m_frames[index];
+	}
+
+	bool BufferedCamera::AcquireCapture(vector<FrameHandle> &frames) const
+	{
+		CaptureRef capture = AcquireLatest();
+		if(!capture.IsValid())
+		{
+			frames.clear();
+			return false;
+		}
+		//the handles keep the frames, the slot can be reused once the capture is unpinned
+		frames = capture.m_pSlot->m_frames;
+		return true;
+	}
+
+	bool BufferedCamera::SetLock() const
+	{
+		ThreadLock *pLock = FindThreadLock(this);
+		if(pLock)
+		{
+			pLock->m_depth++;
+			return true;
+		}
+		const long long before = MonotonicNanoseconds();
+		Slot *pSlot = PinLatest();
+		s_setLockWait.Record(MonotonicNanoseconds() - before);
+		if(!pSlot)
+		{
+			return false;
+		}
+		ThreadLock lock = {this,pSlot,1};
+		t_locks.push_back(lock);
+		return true;
+	}
+
+	const cv::Mat& BufferedCamera::GetImage(const int index) const
+	{
+		ThreadLock *pLock = FindThreadLock(this);
+		const Slot *pSlot = NULL;
+		if(pLock)
+		{
+			pSlot = pLock->m_pSlot;
+		}
+		else
+		{//old behaviour without lock: whatever is the latest now
+			const int latest = m_latestSlot.load();
+			pSlot = (latest >= 0) ? &m_pSlots[latest] : NULL;
+		}
+		if(!pSlot || index < 0 || index >= (int)pSlot->m_images.size())
+		{
+			return s_emptyImage;
+		}
+		return pSlot->m_images[index];
+	}
+
+	bool BufferedCamera::ReleaseLock() const
+	{
+		ThreadLock *pLock = FindThreadLock(this);
+		if(!pLock)
+		{
+			return false;
+		}
+		if(--pLock->m_depth == 0)
+		{
+			pLock->m_pSlot->m_pins--;
+			*pLock = t_locks.back();
+			t_locks.pop_back();
+		}
+		return true;
+	}
+
+}
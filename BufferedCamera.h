@@ -0,0 +1,193 @@
+/* *
+	BufferedCamera.h
+		Camera base class with a lock-free handoff of the captured images
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef BUFFERED_CAMERA_H_
+#define BUFFERED_CAMERA_H_
+
+
+#include <atomic>
+
+#include "Camera.h"
+#include "LatencyTracker.h"
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The BufferedCamera class
+	 *	Implements the image access part of the Camera interface with a
+	 *	set of capture slots (at least three, i.e. triple buffering):
+	 *	the grab thread fills a free slot and publishes it as the latest
+	 *	capture, readers pin the latest slot while they use it. Neither
+	 *	side ever waits for the other and nothing is copied.
+	 *
+	 *	Derived classes fill the images in GrabOne():
+	 *		if(BeginCapture())
+	 *		{
+	 *			cv::Mat &ima = CaptureImage(0);	//pooled buffer of the camera format
+	 *			...
+	 *			PublishCapture();
+	 *		}
+	 *	The images are pooled frames, AcquireFrame hands them out without
+	 *	copying and they stay valid as long as the consumer holds them.
+	 *	Every capture is stamped on the monotonic clock when it begins and
+	 *	when it is published, the difference goes to the latency tracker.
+	 *
+	 *	SetLock/GetImage/ReleaseLock keep working: SetLock pins the latest
+	 *	capture for the calling thread, so that all GetImage calls until
+	 *	ReleaseLock see the same capture.
+	 ***************************************************************/
+	class BufferedCamera : public Camera
+	{
+	public:
+		struct Slot;
+
+		/************************************************************//**
+		 *	A pinned capture, the slot is not reused before the CaptureRef
+		 *	is destroyed or released
+		 ***************************************************************/
+		class CaptureRef
+		{
+		public:
+			CaptureRef();
+			CaptureRef(CaptureRef &&other);
+			CaptureRef& operator=(CaptureRef &&other);
+			~CaptureRef();
+
+			/** \brief False if nothing was captured yet
+			 */
+			bool IsValid() const { return m_pSlot != NULL; }
+
+			/** \brief An image of the capture
+			 *	\param[in] index The index of the internal camera(or image), default=0
+			 */
+			const cv::Mat& Image(const int index = 0) const;
+
+			/** \brief Number of the capture (1 for the first published one)
+			 */
+			long long Sequence() const;
+
+			/** \brief Timestamps of the capture
+			 */
+			const FrameTiming& Timing() const;
+
+			/** \brief Unpin the capture before destruction
+			 */
+			void Release();
+
+		private:
+			friend class BufferedCamera;
+			explicit CaptureRef(Slot *pSlot);
+			//not copyable
+			CaptureRef(const CaptureRef&);
+			CaptureRef& operator=(const CaptureRef&);
+
+			Slot				*m_pSlot;
+		};
+
+		virtual ~BufferedCamera();
+
+		/** \brief Pin the latest capture for the calling thread (nested calls are counted)
+		 *	\return False if nothing was captured yet
+		 */
+		virtual bool SetLock() const;
+
+		/** \brief The image of the capture pinned by SetLock, or of the latest capture
+		 *	if the calling thread holds no lock
+		 *	\param[in] index The index of the internal camera(or image), default=0
+		 */
+		virtual const cv::Mat& GetImage(const int index = 0) const;
+
+		/** \brief Unpin the capture pinned by SetLock
+		 *	\return False if the calling thread holds no lock
+		 */
+		virtual bool ReleaseLock() const;
+
+		/** \brief Share an image of the latest capture (no copy)
+		 *	\param[in] index The index of the internal camera(or image), default=0
+		 */
+		virtual FrameHandle AcquireFrame(const int index = 0) const;
+
+		/** \brief Share all the images of the latest capture (no copy)
+		 *	\param[out] frames One frame per image, empty if nothing was captured yet
+		 */
+		virtual bool AcquireCapture(std::vector<FrameHandle> &frames) const;
+
+		/** \brief Pin the latest complete capture
+		 *	\return An invalid reference if nothing was captured yet
+		 */
+		CaptureRef AcquireLatest() const;
+
+		/** \brief Number of published captures
+		 */
+		long long PublishedCaptures() const { return m_published.load(); }
+
+		/** \brief Number of captures dropped because every slot was pinned by readers
+		 */
+		long long DroppedCaptures() const { return m_dropped.load(); }
+
+		/** \brief Set the tracker receiving the grab -> available latency (NULL = none)
+		 *	The default is LatencyTracker::Global()
+		 */
+		void SetLatencyTracker(LatencyTracker *pTracker) { m_pLatencyTracker = pTracker; }
+
+	protected:
+		/** \brief Create the slots
+		 *	\param[in] numSlots Number of capture slots, 2 + the number of captures that can be
+		 *	pinned at the same time without dropping new ones (minimum 3)
+		 */
+		explicit BufferedCamera(const int numSlots = 4);
+
+		/** \brief Select a free slot for the next capture (grab thread only)
+		 *	\return False if every slot is pinned, the capture should be skipped
+		 */
+		bool BeginCapture();
+
+		/** \brief An image of the capture being filled, between BeginCapture and PublishCapture
+		 *	The Mat is a frame from FramePoolFor(index). If it is reallocated (e.g. because the
+		 *	actual image size differs), the new buffer is published instead.
+		 *	\param[in] index The index of the internal camera(or image), default=0
+		 */
+		cv::Mat& CaptureImage(const int index = 0);
+
+		/** \brief Replace the timestamps of the capture being filled
+		 *	\param[in] grabTime Monotonic ns when the device delivered the data, 0 = keep the BeginCapture time
+		 *	\param[in] deviceTime Timestamp of the device clock
+		 */
+		void SetCaptureTiming(const long long grabTime, const long long deviceTime);
+
+		/** \brief Make the filled slot the latest capture
+		 */
+		void PublishCapture();
+
+	private:
+		//not copyable
+		BufferedCamera(const BufferedCamera&);
+		BufferedCamera& operator=(const BufferedCamera&);
+
+		Slot* PinLatest() const;
+
+		Slot						*m_pSlots;
+		int							m_numSlots;
+		int							m_writeSlot;	//-1 = none
+		std::atomic<int>			m_latestSlot;	//-1 = nothing published yet
+		std::atomic<long long>		m_published;
+		std::atomic<long long>		m_dropped;
+		LatencyTracker				*m_pLatencyTracker;
+	};
+
+};//namespace rm
+
+
+
+#endif //BUFFERED_CAMERA_H_
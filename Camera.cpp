@@ -0,0 +1,129 @@
+/* *
+	Camera.cpp
+		The Implementation of the common parts of the Camera interface
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "Camera.h"
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	Camera::Camera()
+	{
+	}
+
+	Camera::~Camera()
+	{
+		for(size_t i=0; i<m_framePools.size(); i++)
+		{
+			delete m_framePools[i];
+		}
+	}
+
+	//
+	//Copy the latest image into a pooled frame
+	FrameHandle Camera::AcquireFrame(const int index) const
+	{
+		FrameHandle frame;
+		if(!SetLock())
+		{
+			return frame;
+		}
+		//the capture time is not known here, only when the image was taken over
+		FrameTiming timing;
+		timing.m_availableTime = MonotonicNanoseconds();
+		try
+		{
+			frame = CopyToFrame(GetImage(index),index,timing);
+		}
+		catch(...)
+		{//the camera must not stay locked, e.g. if the frame can not be allocated
+			ReleaseLock();
+			throw;
+		}
+		ReleaseLock();
+		return frame;
+	}
+
+	//
+	//Copy all the images of the latest capture into pooled frames under one lock
+	bool Camera::AcquireCapture(vector<FrameHandle> &frames) const
+	{
+		frames.clear();
+		if(!SetLock())
+		{
+			return false;
+		}
+		FrameTiming timing;
+		timing.m_availableTime = MonotonicNanoseconds();
+		const int numImages = NumImages();
+		frames.resize(numImages);
+		bool valid = numImages > 0;
+		try
+		{
+			for(int k=0; k<numImages; k++)
+			{
+				frames[k] = CopyToFrame(GetImage(k),k,timing);
+				valid = valid && frames[k].IsValid();
+			}
+		}
+		catch(...)
+		{//as AcquireFrame
+			ReleaseLock();
+			frames.clear();
+			throw;
+		}
+		ReleaseLock();
+		if(!valid)
+		{
+			frames.clear();
+		}
+		return valid;
+	}
+
+	FramePool& Camera::FramePoolFor(const int index) const
+	{
+		FramePool &pool = PoolAt(index);
+		pool.Configure(Height(index),Width(index),FramePool::TypeOf(Channels(index),BytesPerPixel(index)));
+		return pool;
+	}
+
+	FrameHandle Camera::CopyToFrame(const cv::Mat &image, const int index, const FrameTiming &timing) const
+	{
+		FrameHandle frame;
+		if(!image.empty())
+		{
+			//the pool follows the image actually delivered, which may differ from the configured format
+			FramePool &pool = PoolAt(index);
+			pool.Configure(image.rows,image.cols,image.type());
+			frame = pool.Acquire();
+			image.copyTo(frame.Mat());
+			frame.SetTiming(timing);
+		}
+		return frame;
+	}
+
+	FramePool& Camera::PoolAt(const int index) const
+	{
+		lock_guard<mutex> lock(m_framePoolMutex);
+		if(index >= (int)m_framePools.size())
+		{
+			m_framePools.resize(index + 1,NULL);
+		}
+		if(!m_framePools[index])
+		{
+			m_framePools[index] = new FramePool;
+		}
+		return *m_framePools[index];
+	}
+
+}
@@ -14,11 +14,13 @@
 
 #include <string>
 #include <vector>
+#include <mutex>
 #include <math.h>
 
 #include "Common.h"
 
 #include "CameraSettings.h"
+#include "FramePool.h"
 
 // forward declaration
 namespace cv
@@ -38,7 +40,8 @@ namespace rm
 	class Camera
 	{		
 	public:
-			
+		Camera();
+		virtual ~Camera();
 		
 		/** \brief Perform one capture (could be multiple images)	
 		 */
@@ -124,6 +127,25 @@ namespace rm
 		 */
 		virtual bool ReleaseLock() const = 0;
 
+		/** \brief Get the latest image as a reference counted frame
+		 *	Unlike GetImage, the frame stays valid (and unchanged) after new captures
+		 *	until the handle is released. The default implementation copies the image
+		 *	into a pooled buffer under SetLock/ReleaseLock; cameras that capture into
+		 *	pooled frames return them without copying.
+		 *	\param[in] index The index of the internal camera(or image), default=0
+		 *	\return An invalid handle if no image is available
+		 */
+		virtual FrameHandle AcquireFrame(const int index = 0) const;
+
+		/** \brief Get all the images of the latest capture as reference counted frames
+		 *	Unlike calling AcquireFrame for every index, all the frames come from the
+		 *	same capture. The default implementation copies the images under a single
+		 *	SetLock/ReleaseLock.
+		 *	\param[out] frames One frame per image (NumImages()), empty if no image is available
+		 *	\return False if no image is available
+		 */
+		virtual bool AcquireCapture(std::vector<FrameHandle> &frames) const;
+
 		/** \brief Return the number of images per capture.
 		 *	\return The number of images captured
 		 */
@@ -188,6 +210,24 @@ namespace rm
 		/**	\brief Stop the camera
 		 */
 		virtual void ShutDown() = 0;
+
+	protected:
+		/** \brief The frame pool of an image, configured with the current Height(), Width(),
+		 *	Channels() and BytesPerPixel() of that image
+		 *	\param[in] index The index of the internal camera(or image)
+		 */
+		FramePool& FramePoolFor(const int index) const;
+
+	private:
+		//not copyable
+		Camera(const Camera&);
+		Camera& operator=(const Camera&);
+
+		FramePool& PoolAt(const int index) const;
+		FrameHandle CopyToFrame(const cv::Mat &image, const int index, const FrameTiming &timing) const;
+
+		mutable std::vector<FramePool*>	m_framePools;	//one per image, created on first use
+		mutable std::mutex				m_framePoolMutex;
 	};
 
 	
@@ -247,6 +287,15 @@ namespace rm
 		}
 	}
 
+	//
+	//The 8-bit versions are vectorized, see VisibleKernels.h
+	template<>
+	void VisibleDepth<unsigned char>(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth);
+	template<>
+	void VisibleDepthRGB<unsigned char>(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth);
+	template<>
+	void VisibleIr<unsigned char>(const uInt16 *pIr, unsigned char *pVisibleIr, const int size);
+
 
 };//namespace rm
 
@@ -0,0 +1,350 @@
+/* *
+	FramePool.cpp
+		The Implementation of the frame pool
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "FramePool.h"
+#include "AlignedMemory.h"
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	/* *
+		The shared part of a pool. It lives until the pool and every buffer
+		that is still in use are gone (m_users counts both).
+	* */
+	struct FramePool::Storage
+	{
+		mutable mutex					m_mutex;
+		vector<FrameHandle::Buffer*>	m_free;
+		int								m_height;
+		int								m_width;
+		int								m_type;
+		int								m_generation;	//incremented when the format changes
+		int								m_numAllocated;	//buffers of the current generation
+		bool							m_closed;		//the pool was destroyed
+		atomic<int>						m_users;
+
+		Storage():m_height(0),m_width(0),m_type(-1),m_generation(0),m_numAllocated(0),m_closed(false),m_users(1)
+		{
+		}
+
+		void Return(FrameHandle::Buffer *pBuffer);
+		void Unuse()
+		{
+			if(--m_users == 0)
+			{
+				delete this;
+			}
+		}
+	};
+
+	struct FrameHandle::Buffer
+	{
+		cv::Mat						m_image;
+		unsigned char				*m_pData;		//aligned block, NULL for wrapped images
+		atomic<int>					m_refs;
+		FramePool::Storage			*m_pOwner;		//NULL for wrapped images
+		int							m_generation;
+		FrameTiming					m_timing;
+
+		Buffer():m_pData(NULL),m_refs(0),m_pOwner(NULL),m_generation(0)
+		{
+		}
+		~Buffer()
+		{
+			m_image.release();
+			if(m_pData)
+			{
+				AlignedFree(m_pData);
+			}
+		}
+	};
+
+	//returned by invalid handles
+	static cv::Mat s_emptyImage;
+	static const FrameTiming s_noTiming;
+
+	void FramePool::Storage::Return(FrameHandle::Buffer *pBuffer)
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			if(!m_closed && pBuffer->m_generation == m_generation)
+			{
+				m_free.push_back(pBuffer);
+				return;
+			}
+		}
+		//the pool is gone or the format changed
+		delete pBuffer;
+		Unuse();
+	}
+
+
+	/******************************/
+	/* FrameHandle                */
+	/******************************/
+
+	FrameHandle::FrameHandle():m_pBuffer(NULL)
+	{
+	}
+
+	FrameHandle::FrameHandle(Buffer *pBuffer):m_pBuffer(pBuffer)
+	{
+		if(m_pBuffer)
+		{
+			m_pBuffer->m_refs++;
+		}
+	}
+
+	FrameHandle::FrameHandle(const FrameHandle &other):m_pBuffer(other.m_pBuffer)
+	{
+		if(m_pBuffer)
+		{
+			m_pBuffer->m_refs++;
+		}
+	}
+
+	FrameHandle& FrameHandle::operator=(const FrameHandle &other)
+	{
+		if(m_pBuffer != other.m_pBuffer)
+		{
+			if(other.m_pBuffer)
+			{
+				other.m_pBuffer->m_refs++;
+			}
+			Release();
+			m_pBuffer = other.m_pBuffer;
+		}
+		return *this;
+	}
+
+	FrameHandle::~FrameHandle()
+	{
+		Release();
+	}
+
+	FrameHandle FrameHandle::Wrap(const cv::Mat &image)
+	{
+		Buffer *pBuffer = new Buffer;
+		pBuffer->m_image = image;
+		return FrameHandle(pBuffer);
+	}
+
+	const cv::Mat& FrameHandle::Mat() const
+	{
+		return m_pBuffer ? m_pBuffer->m_image : s_emptyImage;
+	}
+
+	cv::Mat& FrameHandle::Mat()
+	{
+		return m_pBuffer ? m_pBuffer->m_image : s_emptyImage;
+	}
+
+	const FrameTiming& FrameHandle::Timing() const
+	{
+		return m_pBuffer ? m_pBuffer->m_timing : s_noTiming;
+	}
+
+	void FrameHandle::SetTiming(const FrameTiming &timing)
+	{
+		if(m_pBuffer)
+		{
+			m_pBuffer->m_timing = timing;
+		}
+	}
+
+	int FrameHandle::UseCount() const
+	{
+		return m_pBuffer ? m_pBuffer->m_refs.load() : 0;
+	}
+
+	void FrameHandle::Release()
+	{
+		if(!m_pBuffer)
+		{
+			return;
+		}
+		Buffer *pBuffer = m_pBuffer;
+		m_pBuffer = NULL;
+		if(--pBuffer->m_refs == 0)
+		{
+			if(pBuffer->m_pOwner)
+			{
+				pBuffer->m_pOwner->Return(pBuffer);
+			}
+			else
+			{
+				delete pBuffer;
+			}
+		}
+	}
+
+
+	/******************************/
+	/* FramePool                  */
+	/******************************/
+
+	FramePool::FramePool():m_pStorage(new Storage)
+	{
+	}
+
+	FramePool::FramePool(const int height, const int width, const int type, const int numPreallocated):m_pStorage(new Storage)
+	{
+		Configure(height,width,type,numPreallocated);
+	}
+
+	FramePool::~FramePool()
+	{
+		vector<FrameHandle::Buffer*> buffers;
+		{
+			lock_guard<mutex> lock(m_pStorage->m_mutex);
+			m_pStorage->m_closed = true;
+			buffers.swap(m_pStorage->m_free);
+		}
+		for(size_t i=0; i<buffers.size(); i++)
+		{
+			delete buffers[i];
+			m_pStorage->m_users--;	//cannot reach 0, the pool holds its own reference
+		}
+		m_pStorage->Unuse();
+	}
+
+	void FramePool::Configure(const int height, const int width, const int type, const int numPreallocated)
+	{
+		vector<FrameHandle::Buffer*> buffers;
+		{
+			lock_guard<mutex> lock(m_pStorage->m_mutex);
+			if(height != m_pStorage->m_height || width != m_pStorage->m_width || type != m_pStorage->m_type)
+			{
+				m_pStorage->m_height = height;
+				m_pStorage->m_width = width;
+				m_pStorage->m_type = type;
+				m_pStorage->m_generation++;
+				m_pStorage->m_numAllocated = 0;
+				buffers.swap(m_pStorage->m_free);
+			}
+		}
+		for(size_t i=0; i<buffers.size(); i++)
+		{
+			delete buffers[i];
+			m_pStorage->m_users--;
+		}
+
+		//preallocate
+		vector<FrameHandle> frames;
+		while(NumAllocated() < numPreallocated)
+		{
+			frames.push_back(Acquire());
+			if(!frames.back().IsValid())
+			{
+				break;
+			}
+		}
+	}
+
+	FrameHandle FramePool::Acquire()
+	{
+		Storage &storage = *m_pStorage;
+		int height, width, type, generation;
+		{
+			lock_guard<mutex> lock(storage.m_mutex);
+			if(!storage.m_free.empty())
+			{
+				FrameHandle::Buffer *pBuffer = storage.m_free.back();
+				storage.m_free.pop_back();
+				pBuffer->m_timing = FrameTiming();
+				return FrameHandle(pBuffer);
+			}
+			height = storage.m_height;
+			width = storage.m_width;
+			type = storage.m_type;
+			generation = storage.m_generation;
+			if(type < 0 || height <= 0 || width <= 0)
+			{
+				return FrameHandle();
+			}
+			storage.m_numAllocated++;
+		}
+
+		//allocate outside the lock
+		FrameHandle::Buffer *pBuffer = new FrameHandle::Buffer;
+		const size_t step = (size_t)width * CV_ELEM_SIZE(type);
+		pBuffer->m_pData = (unsigned char*)AlignedAlloc(AlignUp(height*step,IO_ALIGNMENT),IO_ALIGNMENT);
+		if(!pBuffer->m_pData)
+		{
+			delete pBuffer;
+			lock_guard<mutex> lock(storage.m_mutex);
+			storage.m_numAllocated--;
+			throw("FramePool::Acquire: out of memory");
+		}
+		pBuffer->m_image = cv::Mat(height,width,type,pBuffer->m_pData,step);
+		pBuffer->m_pOwner = m_pStorage;
+		pBuffer->m_generation = generation;
+		storage.m_users++;
+		return FrameHandle(pBuffer);
+	}
+
+	int FramePool::Height() const
+	{
+		lock_guard<mutex> lock(m_pStorage->m_mutex);
+		return m_pStorage->m_height;
+	}
+
+	int FramePool::Width() const
+	{
+		lock_guard<mutex> lock(m_pStorage->m_mutex);
+		return m_pStorage->m_width;
+	}
+
+	int FramePool::Type() const
+	{
+		lock_guard<mutex> lock(m_pStorage->m_mutex);
+		return m_pStorage->m_type;
+	}
+
+	int FramePool::NumAllocated() const
+	{
+		lock_guard<mutex> lock(m_pStorage->m_mutex);
+		return m_pStorage->m_numAllocated;
+	}
+
+	int FramePool::NumFree() const
+	{
+		lock_guard<mutex> lock(m_pStorage->m_mutex);
+		return (int)m_pStorage->m_free.size();
+	}
+
+	int FramePool::TypeOf(const int channels, const int bytesPerPixel)
+	{
+		if(channels < 1 || channels > 4)
+		{
+			return -1;
+		}
+		switch(bytesPerPixel)
+		{
+		case 1:
+			return CV_MAKETYPE(CV_8U,channels);
+		case 2:
+			return CV_MAKETYPE(CV_16U,channels);
+		case 4:
+			return CV_MAKETYPE(CV_32F,channels);
+		default:
+			return -1;
+		}
+	}
+
+}
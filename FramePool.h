@@ -0,0 +1,150 @@
+/* *
+	FramePool.h
+		Reference counted frames with recycled, aligned buffers
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef FRAME_POOL_H_
+#define FRAME_POOL_H_
+
+
+#include <stddef.h>
+
+#include "LatencyTracker.h"
+
+// forward declaration
+namespace cv
+{
+	class Mat;
+};
+
+
+
+namespace rm
+{
+
+	class FramePool;
+
+	/************************************************************//**
+	 *	The FrameHandle class
+	 *	A shared reference to an image buffer. Copying a handle only
+	 *	increments a counter; when the last handle is released, a pooled
+	 *	buffer goes back to its FramePool instead of being freed.
+	 *	Handles may be copied and released from any thread.
+	 ***************************************************************/
+	class FrameHandle
+	{
+	public:
+		struct Buffer;
+
+		FrameHandle();
+		FrameHandle(const FrameHandle &other);
+		FrameHandle& operator=(const FrameHandle &other);
+		~FrameHandle();
+
+		/** \brief Share an existing image (not pooled), e.g. one allocated by a camera SDK
+		 */
+		static FrameHandle Wrap(const cv::Mat &image);
+
+		/** \brief False for an empty handle
+		 */
+		bool IsValid() const { return m_pBuffer != NULL; }
+
+		/** \brief The image, a header on the shared buffer (empty for an invalid handle)
+		 */
+		const cv::Mat& Mat() const;
+		cv::Mat& Mat();
+
+		/** \brief The timing of the capture the frame holds
+		 */
+		const FrameTiming& Timing() const;
+
+		/** \brief Set the timing (by the producer, before the frame is shared)
+		 */
+		void SetTiming(const FrameTiming &timing);
+
+		/** \brief Number of handles sharing the buffer
+		 */
+		int UseCount() const;
+
+		/** \brief Drop the reference before destruction
+		 */
+		void Release();
+
+	private:
+		friend class FramePool;
+		explicit FrameHandle(Buffer *pBuffer);
+
+		Buffer				*m_pBuffer;
+	};
+
+
+	/************************************************************//**
+	 *	The FramePool class
+	 *	Hands out frames of one format. The buffers are allocated once
+	 *	(aligned to IO_ALIGNMENT, rows are contiguous) and reused as
+	 *	soon as all handles to them are released, so steady state
+	 *	capture does not allocate. The pool may be destroyed while
+	 *	frames are still in use, they are freed on release then.
+	 ***************************************************************/
+	class FramePool
+	{
+	public:
+		struct Storage;
+
+		FramePool();
+
+		/** \brief Create the pool
+		 *	\param[in] height, width, type The frame format (OpenCV type)
+		 *	\param[in] numPreallocated Number of buffers allocated right away
+		 */
+		FramePool(const int height, const int width, const int type, const int numPreallocated = 0);
+		~FramePool();
+
+		/** \brief Change the frame format, buffers of the old format are freed (on release if in use)
+		 *	Nothing happens if the format does not change.
+		 */
+		void Configure(const int height, const int width, const int type, const int numPreallocated = 0);
+
+		/** \brief Get a frame, a new buffer is allocated only if all buffers are in use
+		 *	\return An invalid handle if no format is configured
+		 */
+		FrameHandle Acquire();
+
+		int Height() const;
+		int Width() const;
+		int Type() const;
+
+		/** \brief Number of buffers owned by the pool (free or in use)
+		 */
+		int NumAllocated() const;
+
+		/** \brief Number of buffers ready for Acquire
+		 */
+		int NumFree() const;
+
+		/** \brief OpenCV type for the camera description of an image
+		 *	\param[in] channels Number of channels
+		 *	\param[in] bytesPerPixel Bytes per channel: 1, 2 or 4 (float)
+		 *	\return -1 if not supported
+		 */
+		static int TypeOf(const int channels, const int bytesPerPixel);
+
+	private:
+		//not copyable
+		FramePool(const FramePool&);
+		FramePool& operator=(const FramePool&);
+
+		Storage				*m_pStorage;
+	};
+
+};//namespace rm
+
+
+
+#endif //FRAME_POOL_H_
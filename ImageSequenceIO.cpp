@@ -9,12 +9,32 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 #include <opencv2\opencv.hpp>
 
 #include "Common.h"
 #include "FileIO.h"
+#include "MappedFile.h"
+#include "AsyncStreamWriter.h"
+#include "StreamFormat.h"
+#include "StreamCodec.h"
+#include "WorkerPool.h"
+#include "LatencyTracker.h"
+#include "FramePool.h"
+#include "TypedImageSequence.h"
+#include "BayerKernels.h"
+#include "Metrics.h"
+#include "MultiTrackStream.h"
 
 using namespace std;
 
@@ -22,6 +42,98 @@ using namespace std;
 namespace rm
 {
 
+	//large enough for the record prefix of any stream version
+	static const size_t MAX_RECORD_PREFIX_SIZE = 64;
+	//ReadFrames reads the records between two frames of a batch rather than seeking over them
+	//if they are at most this large, and reads at most this much at once
+	static const long long BATCH_MAX_GAP = 1<<20;
+	static const long long BATCH_MAX_RUN = 4<<20;
+
+	//records handed to the writers (queued ones included) and records read, all streams of the process
+	static MetricCounter &s_framesWritten = MetricsRegistry::Global().Counter("stream.framesWritten");
+	static MetricCounter &s_bytesWritten = MetricsRegistry::Global().Counter("stream.bytesWritten");
+	static MetricCounter &s_framesRead = MetricsRegistry::Global().Counter("stream.framesRead");
+	static MetricCounter &s_bytesRead = MetricsRegistry::Global().Counter("stream.bytesRead");
+
+	/* *
+		Frame index: maps a frame id to the byte offset of its record
+		(see StreamFormat.h) in the stream file. The index is kept in a
+		sidecar file (stream file name + ".idx") so that the stream layout
+		stays unchanged and legacy readers are not affected.
+		Sidecar layout: [int magic][int version][int64 stream size][int64 count][entries]
+	* */
+	struct FrameIndexEntry
+	{
+		long long	m_offset;
+		int			m_frameId;
+		int			m_reserved;
+	};
+	static const int FRAME_INDEX_MAGIC = 0x58494d52;	//"RMIX"
+	static const int FRAME_INDEX_VERSION = 1;
+
+	static string FrameIndexFileName(const string &streamFn)
+	{
+		return streamFn + ".idx";
+	}
+
+	static long long FileSize(const string &fileName)
+	{
+		ifstream ifs(fileName,ios::in|ios::binary|ios::ate);
+		if(!ifs.is_open())
+		{
+			return -1;
+		}
+		return (long long)ifs.tellg();
+	}
+
+	//
+	//Save the index, streamSize is stored to detect stale sidecars of rewritten streams
+	static bool SaveFrameIndex(const string &streamFn, const vector<FrameIndexEntry> &index, const long long streamSize)
+	{
+		ofstream ofs(FrameIndexFileName(streamFn),ios::out|ios::binary);
+		if(!ofs.is_open())
+		{
+			return false;
+		}
+		long long count = (long long)index.size();
+		ofs.write((const char*)&FRAME_INDEX_MAGIC,sizeof(int));
+		ofs.write((const char*)&FRAME_INDEX_VERSION,sizeof(int));
+		ofs.write((const char*)&streamSize,sizeof(long long));
+		ofs.write((const char*)&count,sizeof(long long));
+		if(count > 0)
+		{
+			ofs.write((const char*)&index[0],count*sizeof(FrameIndexEntry));
+		}
+		return ofs.good();
+	}
+
+	//
+	//Load the index, fails if the sidecar is missing, corrupted or does not match the stream
+	static bool LoadFrameIndex(const string &streamFn, const long long streamSize, vector<FrameIndexEntry> &index)
+	{
+		ifstream ifs(FrameIndexFileName(streamFn),ios::in|ios::binary);
+		if(!ifs.is_open())
+		{
+			return false;
+		}
+		int magic = 0, version = 0;
+		long long size = -1, count = -1;
+		ifs.read((char*)&magic,sizeof(int));
+		ifs.read((char*)&version,sizeof(int));
+		ifs.read((char*)&size,sizeof(long long));
+		ifs.read((char*)&count,sizeof(long long));
+		if(!ifs.good() || magic != FRAME_INDEX_MAGIC || version != FRAME_INDEX_VERSION || size != streamSize || count < 0)
+		{
+			return false;
+		}
+		index.resize((size_t)count);
+		if(count > 0)
+		{
+			ifs.read((char*)&index[0],count*sizeof(FrameIndexEntry));
+		}
+		return ifs.good() || (count == 0);
+	}
+
 
 
 	/******************************/
@@ -37,39 +149,122 @@ namespace rm
 
 		//IO streams
 		ofstream				m_ofs;
+		//Background writing, replaces m_ofs when enabled
+		AsyncStreamWriter		m_asyncWriter;
+		AsyncStreamWriter::Options	m_asyncOptions;
+		bool					m_useAsyncWrite;
 		ifstream				m_ifs;
+		//Memory mapped reading (zero-copy), m_ifs is used when the file can not be mapped
+		MappedFile				m_mappedFile;
+		bool					m_useMemoryMap;
+		size_t					m_mapOffset;		//offset of the next frame record in the mapped file
+		size_t					m_mapAdvisedEnd;	//end of the range already requested from the OS
+		int						m_readImageType;
+		//per-frame kernels of the pixel format (TypedImageSequence.h), selected when the stream is opened
+		const FrameKernels		*m_pReadKernels;
+		const FrameKernels		*m_pWriteKernels;	//selected in WriteHeader
 		//Image parameters
 		ImageSequenceHeader		m_writeHeader;	//for writing
+		ImageSequenceHeader		m_storedHeader;	//for writing: the frames as stored (region, binning)
 		ImageSequenceHeader		m_readHeader;	//for reading
+		StreamFormat			m_writeFormat;
+		StreamFormat			m_writtenFormat;	//m_writeFormat as in the header of the writing stream (slice count resolved)
+		StreamFormat			m_readFormat;
+		size_t					m_readHeaderSize;
+		//Frame compression, the slices of a frame are (de)compressed in parallel,
+		//the same threads demosaic the row bands of a frame
+		WorkerPool				*m_pCodecPool;	//created on first use
+		int						m_codecThreads;
+		vector<unsigned char>	m_readPayload;	//compressed frame read through m_ifs
+		vector<unsigned char>	m_writePayload;
+		cv::Mat					m_writeStaging;	//region or binned frame being written
+		vector< vector<unsigned char> >	m_codecScratch;	//one per slice
+		vector< vector<unsigned char> >	m_readCodecScratch;	//for decoding, which may run on the prefetch thread
 		//Image data
 		cv::Mat					m_readStreamImage;
+		cv::Mat					m_regionBuffer;		//rows holding the last read region (read through m_ifs or decoded)
 		cv::Mat					m_processedImage;	//processed from read image
+		bool					m_processedValid;	//false until the read image is demosaiced (on first access)
+		cv::Mat					m_previewImage;		//downscaled read image
+		int						m_previewScale;		//scale of m_previewImage, 0 = not computed
 		int						m_readFrameId;
+		FrameTiming				m_readTiming;		//grab and device time of the last read frame (v3 streams)
+		LatencyTracker			*m_pLatencyTracker;	//receives the written latency, NULL = none
+		//Frame index of the reading stream (built on demand) and of the writing stream
+		vector<FrameIndexEntry>	m_readIndex;
+		unordered_map<int,size_t>	m_readIndexLookup;	//frame id -> position in m_readIndex
+		bool					m_readIndexValid;
+		vector<FrameIndexEntry>	m_writeIndex;
+		long long				m_writeOffset;
 
 		int						m_bayerPattern;	//m_bayerPattern =-1 indicates no demosaicing
+		bool					m_parallelDemosaic;
+		//Parallel parsing: number of worker threads (0 = one per core, 1 = serial) and
+		//the maximum number of frames in flight between the reader and the writer
+		int						m_parseThreads;
+		int						m_parseQueueDepth;
+		//Read-ahead: a background thread reads (and decodes) the frames following the last
+		//read one into a ring of slots, so that ReadNextImage does not wait for the disk
+		struct PrefetchSlot
+		{
+			cv::Mat				m_image;
+			int					m_frameId;
+			FrameTiming			m_timing;
+			long long			m_nextOffset;	//of the record following the frame
+		};
+		int						m_prefetchDepth;		//max frames read ahead, 0 = read on demand
+		int						m_prefetchTarget;		//frames currently read ahead, adapted to the consumer
+		int						m_prefetchFullReads;	//consecutive reads that found the ring full
+		vector<PrefetchSlot>	m_prefetchSlots;
+		deque<int>				m_prefetchReady;		//slots holding frames, in stream order
+		deque<int>				m_prefetchFree;
+		int						m_prefetchHeld;			//slot of the last read frame, -1 = none
+		bool					m_prefetchStop;
+		bool					m_prefetchEnd;			//the thread reached the end of the stream (or an error)
+		const char				*m_prefetchError;
+		long long				m_prefetchOffset;		//of the record following the last read frame
+		long long				m_prefetchStalls;		//reads that had to wait for the thread
+		//Batched reading (ReadFrames)
+		FramePool				m_batchPool;			//reused while the batch format stays the same
+		vector<unsigned char>	m_batchStaging;			//a run of records read at once
+		cv::Mat					m_batchDecoded;			//decoded frame before the conversion to float
+		thread					m_prefetchThread;
+		mutex					m_prefetchMutex;
+		condition_variable		m_prefetchCvReady;
+		condition_variable		m_prefetchCvSpace;
 		
 		//Parser Configuration
 		string					m_readStreamFn;
 		string					m_writeStreamFn;
 		SequenceFileNames		m_writeFnManager;
 
+		//Multi-track streams, all the images of a capture in one record (MultiTrackStream.h)
+		MultiTrackStreamWriter	m_trackWriter;
+		MultiTrackStreamReader	m_trackReader;
+
 
 	public:
-		State(ImageSequenceIO *pOwner):m_pOwner(pOwner),m_bayerPattern(-1)
+		State(ImageSequenceIO *pOwner):m_pOwner(pOwner),m_useAsyncWrite(false),m_useMemoryMap(false),m_mapOffset(0),m_mapAdvisedEnd(0),
+			m_readImageType(-1),m_pReadKernels(NULL),m_pWriteKernels(NULL),m_readHeaderSize(0),m_pCodecPool(NULL),m_codecThreads(0),m_processedValid(false),m_previewScale(0),m_pLatencyTracker(&LatencyTracker::Global()),m_readIndexValid(false),m_writeOffset(0),m_bayerPattern(-1),
+			m_parallelDemosaic(true),m_parseThreads(0),m_parseQueueDepth(0),m_prefetchDepth(0),m_prefetchTarget(0),m_prefetchFullReads(0),
+			m_prefetchHeld(-1),m_prefetchStop(false),m_prefetchEnd(false),m_prefetchError(NULL),m_prefetchOffset(0),m_prefetchStalls(0)
 		{
 			ResetWriteFns();
 		}
 		~State()
 		{
 			m_pOwner = NULL;
-			if(m_ofs.is_open())
-			{
-				m_ofs.close();
-			}
+			StopPrefetch(false);
+			CloseWriteStream();
 			if(m_ifs.is_open())
 			{
 				m_ifs.close();
 			}
+			m_mappedFile.Close();
+			if(m_pCodecPool)
+			{
+				delete m_pCodecPool;
+			}
 		}
 		void ResetWriteFns()
 		{
@@ -115,6 +310,18 @@ namespace rm
 			
 			ResetWriteFns();
 			m_pOwner->OpenReadStream(m_readStreamFn);
+
+			int numWorkers = m_parseThreads;
+			if(numWorkers <= 0)
+			{
+				numWorkers = (int)thread::hardware_concurrency();
+			}
+			if(numWorkers > 1)
+			{
+				ParseStreamPipelined(numWorkers,m_parseQueueDepth > 0 ? m_parseQueueDepth : 4*numWorkers);
+				m_pOwner->CloseReadStream();
+				return;
+			}
 		
 			cout<<"Saving Frame ";
 			while(true)
@@ -135,6 +342,1166 @@ namespace rm
 		}
 
 
+		//
+		//Read the header from the mapped file or the input stream
+		void ReadHeader()
+		{
+			bool ok;
+			if(m_mappedFile.IsOpen())
+			{
+				ok = DecodeStreamHeader(m_mappedFile.Data(),m_mappedFile.Size(),m_readHeader,m_readFormat,m_readHeaderSize);
+				m_mapOffset = m_readHeaderSize;
+				m_mapAdvisedEnd = m_readHeaderSize;
+			}
+			else
+			{
+				ok = ReadStreamHeader(m_ifs,m_readHeader,m_readFormat,m_readHeaderSize);
+			}
+			if(!ok)
+			{
+				throw("ImageSequenceIO::OpenReadStream: error in reading header - file too short or unknown version");
+			}
+		}
+
+		//
+		//Check if the frames are read into m_readStreamImage's own buffer (as opposed to
+		//pointing into the mapped file)
+		bool ReadsIntoBuffer() const
+		{
+			return !m_mappedFile.IsOpen() || m_readFormat.m_codec != STREAM_CODEC_NONE;
+		}
+
+		void AllocateReadImage()
+		{
+			m_readStreamImage.create(m_readHeader.m_imaHeight,m_readHeader.m_imaWidth,m_readImageType);
+			if(m_bayerPattern == -1)
+			{
+				m_processedImage = m_readStreamImage;	//just reference
+			}
+		}
+
+		WorkerPool& CodecPool()
+		{
+			if(!m_pCodecPool)
+			{
+				m_pCodecPool = new WorkerPool(m_codecThreads);
+			}
+			return *m_pCodecPool;
+		}
+
+		//
+		//A new frame was read (or the stream closed), drop what was derived from the previous one
+		void InvalidateProcessedImages()
+		{
+			m_processedValid = false;
+			m_previewScale = 0;
+		}
+
+		//
+		//The read image, demosaiced on first access so that frames that are only
+		//skimmed (frame id, raw data, previews) do not pay for it
+		const cv::Mat& ProcessedImage()
+		{
+			if(m_bayerPattern != -1 && !m_processedValid && !m_readStreamImage.empty())
+			{
+				DemosaicParallel(m_readStreamImage,m_processedImage,m_bayerPattern,m_parallelDemosaic ? &CodecPool() : NULL);
+				m_processedValid = true;
+			}
+			return m_processedImage;
+		}
+
+		//
+		//The read image downscaled by scale, Bayer frames are demosaiced and downscaled in one pass
+		const cv::Mat& PreviewImage(const int scale)
+		{
+			if(scale <= 1)
+			{
+				return ProcessedImage();
+			}
+			if(m_previewScale != scale)
+			{
+				if(m_readStreamImage.empty())
+				{
+					m_previewImage.release();
+				}
+				else if(m_bayerPattern != -1)
+				{
+					DemosaicDownscale(m_readStreamImage,m_previewImage,m_bayerPattern,scale,m_parallelDemosaic ? &CodecPool() : NULL);
+				}
+				else
+				{
+					cv::resize(m_readStreamImage,m_previewImage,cv::Size(m_readStreamImage.cols/scale,m_readStreamImage.rows/scale),0,0,CV_INTER_AREA);
+				}
+				m_previewScale = scale;
+			}
+			return m_previewImage;
+		}
+
+		//
+		//Compress image into m_writePayload: [int sliceSize[n]][slice 0][slice 1]...
+		//return the payload size
+		int EncodePayload(const cv::Mat &image)
+		{
+			const int numSlices = m_writtenFormat.m_codecSlices;
+			const int rows = image.rows;
+			const int channels = m_pWriteKernels->m_channels;
+			const int samplesPerRow = image.cols * channels;
+			const int bytesPerSample = m_pWriteKernels->m_bytesPerSample;
+			const size_t rowBytes = m_pWriteKernels->RowBytes(image.cols);
+			const size_t tableSize = numSlices*sizeof(int);
+
+			//every slice is coded into its own worst case sized area, then the areas are packed
+			vector<size_t> areaOffsets(numSlices);
+			size_t total = tableSize;
+			for(int k=0; k<numSlices; k++)
+			{
+				const int sliceRows = rows*(k+1)/numSlices - rows*k/numSlices;
+				areaOffsets[k] = total;
+				total += RmzCompressBound(sliceRows*rowBytes);
+			}
+			if(m_writePayload.size() < total)
+			{
+				m_writePayload.resize(total);
+			}
+			m_codecScratch.resize(numSlices);
+			vector<int> sliceSizes(numSlices);
+			unsigned char *pPayload = &m_writePayload[0];
+			CodecPool().ParallelFor(numSlices,[&](int k)
+			{
+				const int row0 = rows*k/numSlices;
+				const int sliceRows = rows*(k+1)/numSlices - row0;
+				vector<unsigned char> &scratch = m_codecScratch[k];
+				if(scratch.size() < RmzCompressScratchSize(sliceRows*rowBytes))
+				{
+					scratch.resize(RmzCompressScratchSize(sliceRows*rowBytes));
+				}
+				sliceSizes[k] = (int)RmzCompress(image.ptr(row0),(size_t)image.step,sliceRows,samplesPerRow,
+					channels,bytesPerSample,pPayload + areaOffsets[k],&scratch[0]);
+			});
+			size_t size = tableSize;
+			for(int k=0; k<numSlices; k++)
+			{
+				memmove(pPayload + size,pPayload + areaOffsets[k],sliceSizes[k]);
+				size += sliceSizes[k];
+			}
+			memcpy(pPayload,&sliceSizes[0],tableSize);
+			return (int)size;
+		}
+
+		//
+		//Parse the slice table at the beginning of a payload written by EncodePayload:
+		//slice k is the bytes [offsets[k], offsets[k+1]) of the payload
+		void SliceOffsets(const unsigned char *pTable, const size_t payloadSize, vector<size_t> &offsets) const
+		{
+			const int numSlices = m_readFormat.m_codecSlices;
+			const size_t tableSize = numSlices*sizeof(int);
+			if(m_readFormat.m_codec != STREAM_CODEC_RMZ || payloadSize < tableSize)
+			{
+				throw("ImageSequenceIO::ReadNextImage: unknown codec or corrupted frame");
+			}
+			vector<int> sliceSizes(numSlices);
+			memcpy(&sliceSizes[0],pTable,tableSize);
+			offsets.resize(numSlices + 1);
+			offsets[0] = tableSize;
+			for(int k=0; k<numSlices; k++)
+			{
+				offsets[k + 1] = offsets[k] + sliceSizes[k];
+				if(sliceSizes[k] < 0 || offsets[k + 1] > payloadSize)
+				{
+					throw("ImageSequenceIO::ReadNextImage: corrupted frame");
+				}
+			}
+		}
+
+		//
+		//Decompress the slices [first, end) of a frame into image, which holds the rows of these
+		//slices only; pSlices points to the data of slice first
+		void DecodeSlices(const unsigned char *pSlices, const vector<size_t> &offsets, const int first, const int end, cv::Mat &image)
+		{
+			const int numSlices = m_readFormat.m_codecSlices;
+			const int rows = m_readHeader.m_imaHeight;
+			const int firstRow = rows*first/numSlices;
+			const int channels = m_pReadKernels->m_channels;
+			const int samplesPerRow = image.cols * channels;
+			const int bytesPerSample = m_pReadKernels->m_bytesPerSample;
+			const size_t rowBytes = m_pReadKernels->RowBytes(image.cols);
+			m_readCodecScratch.resize(numSlices);
+			vector<char> sliceOk(end - first,0);
+			CodecPool().ParallelFor(end - first,[&](int i)
+			{
+				const int k = first + i;
+				const int row0 = rows*k/numSlices;
+				const int sliceRows = rows*(k+1)/numSlices - row0;
+				vector<unsigned char> &scratch = m_readCodecScratch[k];
+				if(scratch.size() < sliceRows*rowBytes + 1)
+				{
+					scratch.resize(sliceRows*rowBytes + 1);
+				}
+				sliceOk[i] = RmzDecompress(pSlices + (offsets[k] - offsets[first]),offsets[k + 1] - offsets[k],image.ptr(row0 - firstRow),
+					(size_t)image.step,sliceRows,samplesPerRow,channels,bytesPerSample,&scratch[0]);
+			});
+			for(int i=0; i<end - first; i++)
+			{
+				if(!sliceOk[i])
+				{
+					throw("ImageSequenceIO::ReadNextImage: corrupted frame");
+				}
+			}
+		}
+
+		//
+		//Decompress a payload written by EncodePayload into image (allocated)
+		void DecodePayload(const unsigned char *pPayload, const size_t payloadSize, cv::Mat &image)
+		{
+			vector<size_t> offsets;
+			SliceOffsets(pPayload,payloadSize,offsets);
+			DecodeSlices(pPayload + offsets[0],offsets,0,m_readFormat.m_codecSlices,image);
+		}
+
+		//
+		//Read a region of the next record into m_readStreamImage (a view of the rows holding it): only
+		//the rows of the region are read from raw frames (pointed to in the mapped file), only the
+		//slices holding them are read and decoded from compressed frames. With demosaicing
+		//the region must start on an even row and column, so that it keeps the Bayer pattern
+		//return false if the end of the stream is reached
+		bool ReadRegion(const cv::Rect &region)
+		{
+			const int height = m_readHeader.m_imaHeight;
+			const int width = m_readHeader.m_imaWidth;
+			if(region.x < 0 || region.y < 0 || region.width <= 0 || region.height <= 0 ||
+				region.x + region.width > width || region.y + region.height > height)
+			{
+				throw("ImageSequenceIO::ReadNextImageRegion: the region is not inside the frame");
+			}
+			if(m_bayerPattern != -1 && (region.x % 2 != 0 || region.y % 2 != 0))
+			{
+				throw("ImageSequenceIO::ReadNextImageRegion: the region of a Bayer frame must start on an even row and column");
+			}
+			StopPrefetch(true);
+			const bool mapped = m_mappedFile.IsOpen();
+			const size_t prefixSize = m_readFormat.RecordPrefixSize();
+			const long long recordStart = ReadOffset();
+			unsigned char prefixBuffer[MAX_RECORD_PREFIX_SIZE];
+			const unsigned char *pPrefix = prefixBuffer;
+			if(mapped)
+			{
+				if(m_mapOffset + prefixSize > m_mappedFile.Size())
+				{
+					return false;
+				}
+				pPrefix = m_mappedFile.Data() + m_mapOffset;
+			}
+			else if(!m_ifs.read((char*)prefixBuffer,prefixSize))
+			{
+				return false;
+			}
+			StreamRecordPrefix prefix;
+			DecodeRecordPrefix(m_readFormat,pPrefix,m_readHeader.totalSize(),prefix);
+			const long long payloadStart = recordStart + (long long)prefixSize;
+			const long long recordEnd = payloadStart + prefix.m_payloadSize;
+			if(prefix.m_payloadSize < 0 || (mapped && recordEnd > (long long)m_mappedFile.Size()))
+			{//truncated record
+				return false;
+			}
+
+			const size_t rowBytes = m_pReadKernels->RowBytes(width);
+			size_t bytesRead = prefixSize;
+			int bandRow0;	//frame row of the first row of the band
+			cv::Mat band;
+			if(m_readFormat.m_codec == STREAM_CODEC_NONE)
+			{
+				if(prefix.m_payloadSize != m_readHeader.totalSize())
+				{
+					throw("ImageSequenceIO::ReadNextImageRegion: corrupted frame");
+				}
+				bandRow0 = region.y;
+				const long long bandStart = payloadStart + (long long)(region.y*rowBytes);
+				if(mapped)
+				{
+					band = cv::Mat(region.height,width,m_readImageType,(void*)(m_mappedFile.Data() + bandStart));
+				}
+				else
+				{
+					m_regionBuffer.create(region.height,width,m_readImageType);
+					m_ifs.seekg(bandStart);
+					if(!m_ifs.read((char*)m_regionBuffer.ptr(),region.height*rowBytes))
+					{
+						return false;
+					}
+					band = m_regionBuffer;
+				}
+				bytesRead += region.height*rowBytes;
+			}
+			else
+			{
+				const int numSlices = m_readFormat.m_codecSlices;
+				const size_t tableSize = numSlices*sizeof(int);
+				if(prefix.m_payloadSize < (int)tableSize)
+				{
+					throw("ImageSequenceIO::ReadNextImageRegion: corrupted frame");
+				}
+				//slices [first, end) hold the rows of the region
+				int first = 0;
+				while(height*(first + 1)/numSlices <= region.y)
+				{
+					first++;
+				}
+				int end = first + 1;
+				while(end < numSlices && height*end/numSlices < region.y + region.height)
+				{
+					end++;
+				}
+				vector<size_t> offsets;
+				const unsigned char *pSlices;
+				if(mapped)
+				{
+					SliceOffsets(m_mappedFile.Data() + payloadStart,prefix.m_payloadSize,offsets);
+					pSlices = m_mappedFile.Data() + payloadStart + offsets[first];
+				}
+				else
+				{
+					m_readPayload.resize(tableSize);
+					if(!m_ifs.read((char*)&m_readPayload[0],tableSize))
+					{
+						return false;
+					}
+					SliceOffsets(&m_readPayload[0],prefix.m_payloadSize,offsets);
+					m_readPayload.resize(offsets[end] - offsets[first] + 1);
+					m_ifs.seekg(payloadStart + (long long)offsets[first]);
+					if(!m_ifs.read((char*)&m_readPayload[0],offsets[end] - offsets[first]))
+					{
+						return false;
+					}
+					pSlices = &m_readPayload[0];
+				}
+				bandRow0 = height*first/numSlices;
+				m_regionBuffer.create(height*end/numSlices - bandRow0,width,m_readImageType);
+				DecodeSlices(pSlices,offsets,first,end,m_regionBuffer);
+				band = m_regionBuffer;
+				bytesRead += tableSize + offsets[end] - offsets[first];
+			}
+			SetReadOffset(recordEnd);
+			m_readStreamImage = band(cv::Rect(region.x,region.y - bandRow0,region.width,region.height));
+			m_readFrameId = prefix.m_frameId;
+			m_readTiming.m_grabTime = prefix.m_grabTime;
+			m_readTiming.m_deviceTime = prefix.m_deviceTime;
+			if(m_bayerPattern == -1)
+			{
+				m_processedImage = m_readStreamImage;	//just reference
+			}
+			s_framesRead.Add();
+			s_bytesRead.Add(bytesRead);
+			return true;
+		}
+
+		//
+		//The stored part of a camera frame (see StreamFormat): the region, binned
+		cv::Mat StoredImage(const cv::Mat &image)
+		{
+			const StreamFormat &format = m_writtenFormat;
+			const int binning = format.m_binning;
+			const cv::Rect region(format.m_roiWidth > 0 ? format.m_roiX : 0,format.m_roiWidth > 0 ? format.m_roiY : 0,
+				m_storedHeader.m_imaWidth*binning,m_storedHeader.m_imaHeight*binning);
+			if(image.cols < region.x + region.width || image.rows < region.y + region.height)
+			{
+				throw("ImageSequenceIO::WriteImageToStream: the image is smaller than the header");
+			}
+			if(binning == 1)
+			{
+				if(format.m_codec != STREAM_CODEC_NONE)
+				{//the codec reads the rows where they are
+					return image(region);
+				}
+				image(region).copyTo(m_writeStaging);
+				return m_writeStaging;
+			}
+			if(image.type() != m_pWriteKernels->m_type)
+			{
+				throw("ImageSequenceIO::WriteImageToStream: the image format differs from the header");
+			}
+			const cv::Mat source = image(region);
+			const int rows = m_storedHeader.m_imaHeight;
+			m_writeStaging.create(rows,m_storedHeader.m_imaWidth,image.type());
+			//row bands in parallel, like the demosaicing
+			const int numBands = min(CodecPool().NumThreads(),rows);
+			CodecPool().ParallelFor(numBands,[&](int k)
+			{
+				const int row0 = rows*k/numBands;
+				const int row1 = rows*(k+1)/numBands;
+				const cv::Mat src = source.rowRange(row0*binning,row1*binning);
+				cv::Mat dst = m_writeStaging.rowRange(row0,row1);
+				m_pWriteKernels->Bin(src,dst,binning);
+			});
+			return m_writeStaging;
+		}
+
+		//
+		//Point image to the next record of the mapped file (or decode it)
+		//return false if the end of the file is reached
+		bool MapNextImage(cv::Mat &image, int &frameId, FrameTiming &timing)
+		{
+			const size_t prefixSize = m_readFormat.RecordPrefixSize();
+			if(m_mapOffset + prefixSize > m_mappedFile.Size())
+			{
+				return false;
+			}
+			const unsigned char *pRecord = m_mappedFile.Data() + m_mapOffset;
+			StreamRecordPrefix prefix;
+			DecodeRecordPrefix(m_readFormat,pRecord,m_readHeader.totalSize(),prefix);
+			const size_t recordSize = prefixSize + (size_t)prefix.m_payloadSize;
+			if(prefix.m_payloadSize < 0 || m_mapOffset + recordSize > m_mappedFile.Size())
+			{//truncated record
+				return false;
+			}
+			frameId = prefix.m_frameId;
+			timing.m_grabTime = prefix.m_grabTime;
+			timing.m_deviceTime = prefix.m_deviceTime;
+			const unsigned char *pPayload = pRecord + prefixSize;
+			if(m_readFormat.m_codec == STREAM_CODEC_NONE)
+			{
+				if(prefix.m_payloadSize != m_readHeader.totalSize())
+				{
+					throw("ImageSequenceIO::ReadNextImage: corrupted frame");
+				}
+				//header only, the pixels stay in the mapping (copy-on-write if modified by the caller)
+				image = cv::Mat(m_readHeader.m_imaHeight,m_readHeader.m_imaWidth,m_readImageType,(void*)pPayload);
+			}
+			else
+			{
+				image.create(m_readHeader.m_imaHeight,m_readHeader.m_imaWidth,m_readImageType);
+				DecodePayload(pPayload,prefix.m_payloadSize,image);
+			}
+			m_mapOffset += recordSize;
+			s_framesRead.Add();
+			s_bytesRead.Add(recordSize);
+
+			//keep a few frames ahead in flight so that the consumer never waits on a page fault
+			const size_t readAhead = 8*recordSize;
+			if(m_mapAdvisedEnd < m_mapOffset + readAhead/2)
+			{
+				size_t start = m_mapAdvisedEnd > m_mapOffset ? m_mapAdvisedEnd : m_mapOffset;
+				m_mappedFile.WillNeed(start,m_mapOffset + readAhead - start);
+				m_mapAdvisedEnd = m_mapOffset + readAhead;
+			}
+			return true;
+		}
+
+		//
+		//Close whichever writer is in use and save the frame index
+		void CloseWriteStream()
+		{
+			if(m_trackWriter.IsOpen())
+			{
+				m_trackWriter.Close();
+			}
+			if(m_ofs.is_open())
+			{
+				m_ofs.close();
+				m_ofs.clear();
+				SaveWriteIndex();
+			}
+			if(m_asyncWriter.IsOpen())
+			{
+				m_asyncWriter.Close();
+				//dropped records are not in the file, so the index comes from the writer
+				const vector<AsyncStreamWriter::RecordInfo> &records = m_asyncWriter.WrittenRecords();
+				m_writeIndex.resize(records.size());
+				for(size_t i=0; i<records.size(); i++)
+				{
+					m_writeIndex[i].m_offset = records[i].m_offset;
+					m_writeIndex[i].m_frameId = (int)records[i].m_tag;
+					m_writeIndex[i].m_reserved = 0;
+				}
+				m_writeOffset = FileSize(m_writeStreamFn);
+				SaveWriteIndex();
+			}
+		}
+
+		//
+		//Write the index sidecar of the writing stream (after the stream is closed)
+		void SaveWriteIndex()
+		{
+			if(!m_writeIndex.empty())
+			{
+				SaveFrameIndex(m_writeStreamFn,m_writeIndex,m_writeOffset);
+			}
+			m_writeIndex.clear();
+			m_writeOffset = 0;
+		}
+
+		void ResetReadIndex()
+		{
+			m_readIndex.clear();
+			m_readIndexLookup.clear();
+			m_readIndexValid = false;
+		}
+
+		//
+		//Rebuild the index by visiting only the prefix of every record
+		void ScanReadIndex(const long long streamSize)
+		{
+			const size_t prefixSize = m_readFormat.RecordPrefixSize();
+			unsigned char prefixBuffer[MAX_RECORD_PREFIX_SIZE];
+			StreamRecordPrefix prefix;
+			FrameIndexEntry entry;
+			entry.m_reserved = 0;
+			//separate stream, so that the current reading position is not disturbed
+			ifstream ifs;
+			if(!m_mappedFile.IsOpen())
+			{
+				ifs.open(m_readStreamFn,ios::in|ios::binary);
+			}
+			long long offset = (long long)m_readHeaderSize;
+			while(offset + (long long)prefixSize <= streamSize)
+			{
+				const unsigned char *pPrefix = prefixBuffer;
+				if(m_mappedFile.IsOpen())
+				{
+					pPrefix = m_mappedFile.Data() + offset;
+				}
+				else
+				{
+					ifs.seekg(offset);
+					if(!ifs.read((char*)prefixBuffer,prefixSize))
+					{
+						break;
+					}
+				}
+				DecodeRecordPrefix(m_readFormat,pPrefix,m_readHeader.totalSize(),prefix);
+				const long long recordSize = (long long)prefixSize + prefix.m_payloadSize;
+				if(prefix.m_payloadSize < 0 || offset + recordSize > streamSize)
+				{//truncated record
+					break;
+				}
+				entry.m_offset = offset;
+				entry.m_frameId = prefix.m_frameId;
+				m_readIndex.push_back(entry);
+				offset += recordSize;
+			}
+		}
+
+		//
+		//Load the index of the reading stream from its sidecar, or rebuild it (and cache it) for legacy files
+		void BuildReadIndex()
+		{
+			if(m_readIndexValid)
+			{
+				return;
+			}
+			ResetReadIndex();
+			const long long streamSize = m_mappedFile.IsOpen() ? (long long)m_mappedFile.Size() : FileSize(m_readStreamFn);
+			if(!LoadFrameIndex(m_readStreamFn,streamSize,m_readIndex))
+			{
+				m_readIndex.clear();
+				ScanReadIndex(streamSize);
+				SaveFrameIndex(m_readStreamFn,m_readIndex,streamSize);	//best effort, the directory may be read-only
+			}
+			m_readIndexLookup.reserve(m_readIndex.size());
+			for(size_t i=0; i<m_readIndex.size(); i++)
+			{
+				m_readIndexLookup[m_readIndex[i].m_frameId] = i;
+			}
+			m_readIndexValid = true;
+		}
+
+		//
+		//Position the reading stream at the record of the given frame
+		bool SeekToFrame(const int frameId)
+		{
+			StopPrefetch(false);
+			BuildReadIndex();
+			unordered_map<int,size_t>::const_iterator it = m_readIndexLookup.find(frameId);
+			if(it == m_readIndexLookup.end())
+			{
+				return false;
+			}
+			const long long offset = m_readIndex[it->second].m_offset;
+			if(m_mappedFile.IsOpen())
+			{
+				m_mapOffset = (size_t)offset;
+				m_mapAdvisedEnd = m_mapOffset;
+			}
+			else
+			{
+				m_ifs.clear();
+				m_ifs.seekg(offset);
+			}
+			if(ReadsIntoBuffer() && m_readStreamImage.empty())
+			{//released when the end of the stream was reached
+				AllocateReadImage();
+			}
+			return true;
+		}
+
+		//
+		//Read the frames at index positions first, first+stride... into consecutive row bands of batch.
+		//Records that are close in the file are read as one run (the skipped records included), so
+		//that a batch costs a few large reads instead of one per frame
+		int ReadFrames(const int firstFrameId, const int count, const int stride, const float floatScale, FrameHandle &batch)
+		{
+			StopPrefetch(false);
+			BuildReadIndex();
+			unordered_map<int,size_t>::const_iterator it = m_readIndexLookup.find(firstFrameId);
+			if(it == m_readIndexLookup.end() || count <= 0 || stride <= 0)
+			{
+				return 0;
+			}
+			vector<size_t> positions;
+			for(size_t pos=it->second; pos<m_readIndex.size() && (int)positions.size()<count; pos+=stride)
+			{
+				positions.push_back(pos);
+			}
+
+			const int height = m_readHeader.m_imaHeight;
+			const int width = m_readHeader.m_imaWidth;
+			const int channels = m_pReadKernels->m_channels;
+			const bool toFloat = floatScale > 0;
+			const int type = toFloat ? m_pReadKernels->m_floatType : m_readImageType;
+			if(m_batchPool.Height() != count*height || m_batchPool.Width() != width || m_batchPool.Type() != type)
+			{
+				m_batchPool.Configure(count*height,width,type);
+			}
+			batch = m_batchPool.Acquire();
+			cv::Mat &batchImage = batch.Mat();
+			const size_t frameSize = (size_t)m_readHeader.totalSize();
+			const size_t prefixSize = m_readFormat.RecordPrefixSize();
+			const long long streamSize = m_mappedFile.IsOpen() ? (long long)m_mappedFile.Size() : FileSize(m_readStreamFn);
+
+			size_t done = 0;
+			long long nextOffset = -1;
+			while(done < positions.size())
+			{
+				//a run: the following frames are added while the gap to them is small and the run fits the staging limit
+				size_t end = done + 1;
+				long long runStart = m_readIndex[positions[done]].m_offset;
+				long long runEnd = RecordEnd(positions[done],streamSize);
+				while(end < positions.size() && m_readIndex[positions[end]].m_offset - runEnd <= BATCH_MAX_GAP &&
+					RecordEnd(positions[end],streamSize) - runStart <= BATCH_MAX_RUN)
+				{
+					runEnd = RecordEnd(positions[end],streamSize);
+					end++;
+				}
+				const unsigned char *pRun;
+				if(m_mappedFile.IsOpen())
+				{
+					m_mappedFile.WillNeed((size_t)runStart,(size_t)(runEnd - runStart));
+					pRun = m_mappedFile.Data() + runStart;
+				}
+				else
+				{
+					m_batchStaging.resize((size_t)(runEnd - runStart));
+					m_ifs.clear();
+					m_ifs.seekg(runStart);
+					if(!m_ifs.read((char*)&m_batchStaging[0],m_batchStaging.size()))
+					{//truncated stream
+						break;
+					}
+					pRun = &m_batchStaging[0];
+				}
+
+				for(; done<end; done++)
+				{
+					const FrameIndexEntry &entry = m_readIndex[positions[done]];
+					const unsigned char *pRecord = pRun + (entry.m_offset - runStart);
+					StreamRecordPrefix prefix;
+					DecodeRecordPrefix(m_readFormat,pRecord,(int)frameSize,prefix);
+					if(prefix.m_frameId != entry.m_frameId || prefix.m_payloadSize < 0 ||
+						entry.m_offset + (long long)(prefixSize + prefix.m_payloadSize) > runEnd)
+					{
+						throw("ImageSequenceIO::ReadFrames: corrupted frame or stale index");
+					}
+					const unsigned char *pPayload = pRecord + prefixSize;
+					cv::Mat target = batchImage.rowRange((int)done*height,((int)done + 1)*height);
+					if(m_readFormat.m_codec == STREAM_CODEC_NONE)
+					{
+						if(prefix.m_payloadSize != (int)frameSize)
+						{
+							throw("ImageSequenceIO::ReadFrames: corrupted frame");
+						}
+						if(toFloat)
+						{
+							m_pReadKernels->ToFloat(pPayload,(float*)target.ptr(),(size_t)height*width*channels,floatScale);
+						}
+						else
+						{
+							memcpy(target.ptr(),pPayload,frameSize);
+						}
+					}
+					else if(toFloat)
+					{
+						m_batchDecoded.create(height,width,m_readImageType);
+						DecodePayload(pPayload,prefix.m_payloadSize,m_batchDecoded);
+						m_pReadKernels->ToFloat(m_batchDecoded.ptr(),(float*)target.ptr(),(size_t)height*width*channels,floatScale);
+					}
+					else
+					{
+						DecodePayload(pPayload,prefix.m_payloadSize,target);
+					}
+					nextOffset = entry.m_offset + (long long)(prefixSize + prefix.m_payloadSize);
+					s_framesRead.Add();
+					s_bytesRead.Add(prefixSize + prefix.m_payloadSize);
+				}
+			}
+			//ReadNextImage continues after the last frame of the batch
+			if(nextOffset >= 0)
+			{
+				SetReadOffset(nextOffset);
+				if(ReadsIntoBuffer() && m_readStreamImage.empty())
+				{
+					AllocateReadImage();
+				}
+			}
+			return (int)done;
+		}
+
+		//
+		//End of the record at an index position (the next record, as the index is in file order)
+		long long RecordEnd(const size_t position, const long long streamSize) const
+		{
+			return (position + 1 < m_readIndex.size()) ? m_readIndex[position + 1].m_offset : streamSize;
+		}
+
+		//
+		//Read the next record into image (allocated, or pointed into the mapped file) without any processing
+		//return false if the end of the stream is reached
+		bool ReadRecord(cv::Mat &image, int &frameId, FrameTiming &timing)
+		{
+			if(m_mappedFile.IsOpen())
+			{
+				return MapNextImage(image,frameId,timing);
+			}
+			unsigned char prefixBuffer[MAX_RECORD_PREFIX_SIZE];
+			StreamRecordPrefix prefix;
+			if(!m_ifs.read((char*)prefixBuffer,m_readFormat.RecordPrefixSize()))
+			{
+				return false;
+			}
+			DecodeRecordPrefix(m_readFormat,prefixBuffer,m_readHeader.totalSize(),prefix);
+			if(prefix.m_payloadSize < 0)
+			{
+				return false;
+			}
+			frameId = prefix.m_frameId;
+			timing.m_grabTime = prefix.m_grabTime;
+			timing.m_deviceTime = prefix.m_deviceTime;
+			image.create(m_readHeader.m_imaHeight,m_readHeader.m_imaWidth,m_readImageType);
+			if(m_readFormat.m_codec == STREAM_CODEC_NONE)
+			{
+				if(prefix.m_payloadSize != m_readHeader.totalSize())
+				{
+					throw("ImageSequenceIO::ReadNextImage: corrupted frame");
+				}
+				m_ifs.read((char*)image.ptr(),m_readHeader.totalSize());
+				if(!m_ifs.good())
+				{
+					return false;
+				}
+			}
+			else
+			{
+				m_readPayload.resize(prefix.m_payloadSize);
+				if(prefix.m_payloadSize > 0 && !m_ifs.read((char*)&m_readPayload[0],prefix.m_payloadSize))
+				{
+					return false;
+				}
+				DecodePayload(m_readPayload.empty() ? NULL : &m_readPayload[0],m_readPayload.size(),image);
+			}
+			s_framesRead.Add();
+			s_bytesRead.Add(m_readFormat.RecordPrefixSize() + prefix.m_payloadSize);
+			return true;
+		}
+
+		//
+		//Read the next record into m_readStreamImage, from the prefetch ring if read-ahead is on
+		//return false if the end of the stream is reached
+		bool ReadNextRawImage()
+		{
+			const bool ok = (m_prefetchDepth > 0) ? NextPrefetched() : ReadRecord(m_readStreamImage,m_readFrameId,m_readTiming);
+			if(ok && m_bayerPattern == -1)
+			{
+				m_processedImage = m_readStreamImage;	//just reference
+			}
+			return ok;
+		}
+
+		//
+		//Offset of the next record of the reading stream
+		long long ReadOffset()
+		{
+			return m_mappedFile.IsOpen() ? (long long)m_mapOffset : (long long)m_ifs.tellg();
+		}
+
+		void SetReadOffset(const long long offset)
+		{
+			if(m_mappedFile.IsOpen())
+			{
+				m_mapOffset = (size_t)offset;
+				m_mapAdvisedEnd = m_mapOffset;
+			}
+			else
+			{
+				m_ifs.clear();
+				m_ifs.seekg(offset);
+			}
+		}
+
+		//
+		//Start the read-ahead thread at the current reading position. The thread owns the
+		//reading stream (and the decoding buffers) until StopPrefetch
+		void StartPrefetch()
+		{
+			if(m_readFormat.m_codec != STREAM_CODEC_NONE)
+			{
+				CodecPool();	//created here, the consumer may use it for demosaicing at the same time
+			}
+			m_prefetchSlots.resize(m_prefetchDepth + 1);	//+1 for the frame held by the consumer
+			m_prefetchReady.clear();
+			m_prefetchFree.clear();
+			for(int i=0; i<(int)m_prefetchSlots.size(); i++)
+			{
+				m_prefetchFree.push_back(i);
+			}
+			m_prefetchHeld = -1;
+			m_prefetchTarget = min(2,m_prefetchDepth);
+			m_prefetchFullReads = 0;
+			m_prefetchStop = false;
+			m_prefetchEnd = false;
+			m_prefetchError = NULL;
+			m_prefetchOffset = ReadOffset();
+			m_prefetchThread = thread(&State::PrefetchLoop,this);
+		}
+
+		void PrefetchLoop()
+		{
+			const bool mapped = m_mappedFile.IsOpen() && m_readFormat.m_codec == STREAM_CODEC_NONE;
+			while(true)
+			{
+				int index;
+				{
+					unique_lock<mutex> lock(m_prefetchMutex);
+					m_prefetchCvSpace.wait(lock,[&]{ return m_prefetchStop ||
+						((int)m_prefetchReady.size() < m_prefetchTarget && !m_prefetchFree.empty()); });
+					if(m_prefetchStop)
+					{
+						return;
+					}
+					index = m_prefetchFree.front();
+					m_prefetchFree.pop_front();
+				}
+				PrefetchSlot &slot = m_prefetchSlots[index];
+				const char *pError = NULL;
+				bool ok;
+				try
+				{
+					ok = ReadRecord(slot.m_image,slot.m_frameId,slot.m_timing);
+					if(ok && mapped)
+					{//fault the pages in here rather than on the consumer thread
+						const volatile unsigned char *pData = slot.m_image.ptr();
+						const size_t size = m_readHeader.totalSize();
+						unsigned char sum = 0;
+						for(size_t k=0; k<size; k+=4096)
+						{
+							sum += pData[k];
+						}
+						(void)sum;
+					}
+					slot.m_nextOffset = ok ? ReadOffset() : 0;
+				}
+				catch(const char *pMessage)
+				{
+					pError = pMessage;
+					ok = false;
+				}
+				catch(...)
+				{
+					pError = "ImageSequenceIO::ReadNextImage: failed to read ahead";
+					ok = false;
+				}
+				{
+					lock_guard<mutex> lock(m_prefetchMutex);
+					if(ok)
+					{
+						m_prefetchReady.push_back(index);
+					}
+					else
+					{
+						m_prefetchFree.push_back(index);
+						m_prefetchEnd = true;
+						m_prefetchError = pError;
+					}
+				}
+				m_prefetchCvReady.notify_one();
+				if(!ok)
+				{
+					return;
+				}
+			}
+		}
+
+		//
+		//Take the next frame of the ring. The depth grows when the consumer has to wait (the
+		//disk or the decoding is the bottleneck, so more frames must be in flight to absorb its
+		//jitter) and shrinks when the ring stays full (the consumer is the bottleneck, the frames
+		//read ahead only hold memory)
+		bool NextPrefetched()
+		{
+			if(!m_prefetchThread.joinable())
+			{
+				StartPrefetch();
+			}
+			int index;
+			{
+				unique_lock<mutex> lock(m_prefetchMutex);
+				if(m_prefetchHeld >= 0)
+				{
+					m_prefetchFree.push_back(m_prefetchHeld);
+					m_prefetchHeld = -1;
+				}
+				if(m_prefetchReady.empty() && !m_prefetchEnd)
+				{
+					m_prefetchStalls++;
+					m_prefetchTarget = min(2*m_prefetchTarget,m_prefetchDepth);
+					m_prefetchFullReads = 0;
+					m_prefetchCvSpace.notify_one();
+					m_prefetchCvReady.wait(lock,[&]{ return !m_prefetchReady.empty() || m_prefetchEnd; });
+				}
+				else if((int)m_prefetchReady.size() >= m_prefetchTarget && ++m_prefetchFullReads >= 4*m_prefetchDepth)
+				{
+					m_prefetchTarget = max(m_prefetchTarget - 1,min(2,m_prefetchDepth));
+					m_prefetchFullReads = 0;
+				}
+				if(m_prefetchReady.empty())
+				{
+					if(m_prefetchError)
+					{
+						const char *pError = m_prefetchError;
+						m_prefetchError = NULL;
+						throw(pError);
+					}
+					return false;
+				}
+				index = m_prefetchReady.front();
+				m_prefetchReady.pop_front();
+				m_prefetchHeld = index;
+			}
+			m_prefetchCvSpace.notify_one();
+			const PrefetchSlot &slot = m_prefetchSlots[index];
+			m_readStreamImage = slot.m_image;
+			m_readFrameId = slot.m_frameId;
+			m_readTiming = slot.m_timing;
+			m_prefetchOffset = slot.m_nextOffset;
+			return true;
+		}
+
+		//
+		//Stop the read-ahead thread, the frames read ahead are discarded. With reposition,
+		//the reading stream moves back to the record following the last read frame
+		void StopPrefetch(const bool reposition)
+		{
+			if(!m_prefetchThread.joinable())
+			{
+				return;
+			}
+			{
+				lock_guard<mutex> lock(m_prefetchMutex);
+				m_prefetchStop = true;
+			}
+			m_prefetchCvSpace.notify_all();
+			m_prefetchThread.join();
+			if(reposition && (m_mappedFile.IsOpen() || m_ifs.is_open()))
+			{
+				SetReadOffset(m_prefetchOffset);
+			}
+			//m_readStreamImage keeps the buffer of the last read frame
+			m_prefetchSlots.clear();
+			m_prefetchReady.clear();
+			m_prefetchFree.clear();
+			m_prefetchHeld = -1;
+		}
+
+		//
+		//Pipelined parsing: the calling thread reads the frames, a pool of workers does the
+		//demosaicing and the image encoding, and a writer thread saves the encoded files in
+		//frame order. At most queueDepth frames are in flight at any time.
+		void ParseStreamPipelined(const int numWorkers, const int queueDepth)
+		{
+			struct Task
+			{
+				long long			m_seq;
+				int					m_index;	//index of the output file
+				cv::Mat				m_image;
+				string				m_fileName;
+				vector<uchar>		m_encoded;
+				bool				m_ok;
+			};
+			mutex						mtx;
+			condition_variable			cvWork, cvDone, cvSpace;
+			deque<Task*>				workQueue;
+			map<long long,Task*>		doneTasks;	//reorder buffer for the writer
+			long long					issued = 0, written = 0;
+			bool						readerFinished = false;
+			bool						failed = false;
+			const int					bayerPattern = m_bayerPattern;
+			const char					*pReadError = NULL;
+
+			//the threads are joined before any error leaves this function
+			vector<thread> workers;
+			thread writer;
+			try
+			{
+				for(int i=0; i<numWorkers; i++)
+				{
+					workers.push_back(thread([&]()
+					{
+						while(true)
+						{
+							Task *pTask = NULL;
+							{
+								unique_lock<mutex> lock(mtx);
+								cvWork.wait(lock,[&]{ return !workQueue.empty() || readerFinished; });
+								if(workQueue.empty())
+								{
+									return;
+								}
+								pTask = workQueue.front();
+								workQueue.pop_front();
+							}
+							try
+							{
+								cv::Mat processed;
+								if(bayerPattern != -1)
+								{
+									cv::cvtColor(pTask->m_image,processed,bayerPattern);
+								}
+								else
+								{
+									processed = pTask->m_image;
+								}
+								size_t dot = pTask->m_fileName.rfind('.');
+								const string ext = (dot == string::npos) ? string(".png") : pTask->m_fileName.substr(dot);
+								pTask->m_ok = cv::imencode(ext,processed,pTask->m_encoded);
+							}
+							catch(...)
+							{
+								pTask->m_ok = false;
+							}
+							pTask->m_image.release();
+							{
+								lock_guard<mutex> lock(mtx);
+								doneTasks[pTask->m_seq] = pTask;
+							}
+							cvDone.notify_one();
+						}
+					}));
+				}
+
+				writer = thread([&]()
+				{
+					while(true)
+					{
+						Task *pTask = NULL;
+						{
+							unique_lock<mutex> lock(mtx);
+							cvDone.wait(lock,[&]{ return doneTasks.count(written) || (readerFinished && written == issued); });
+							map<long long,Task*>::iterator it = doneTasks.find(written);
+							if(it == doneTasks.end())
+							{
+								return;
+							}
+							pTask = it->second;
+							doneTasks.erase(it);
+						}
+						bool ok = pTask->m_ok;
+						if(ok)
+						{
+							ofstream ofs(pTask->m_fileName,ios::out|ios::binary);
+							ok = ofs.is_open() && ofs.write((const char*)pTask->m_encoded.data(),pTask->m_encoded.size()).good();
+						}
+						if(ok)
+						{
+							cout<<pTask->m_index<<"..";
+						}
+						delete pTask;
+						{
+							lock_guard<mutex> lock(mtx);
+							written++;
+							failed = failed || !ok;
+						}
+						cvSpace.notify_one();
+					}
+				});
+
+				cout<<"Saving Frame ";
+				while(true)
+				{
+					{
+						unique_lock<mutex> lock(mtx);
+						cvSpace.wait(lock,[&]{ return issued - written < queueDepth; });
+						if(failed)
+						{
+							break;
+						}
+					}
+					if(!ReadNextRawImage())
+					{
+						break;
+					}
+					Task *pTask = new Task;
+					pTask->m_seq = issued;
+					pTask->m_ok = false;
+					//the mapped image stays valid until the stream is closed, the stream buffer is reused
+					pTask->m_image = ReadsIntoBuffer() ? m_readStreamImage.clone() : m_readStreamImage;
+					pTask->m_fileName = m_writeFnManager.NextFileName();
+					pTask->m_index = m_writeFnManager.m_currentIndex;
+					{
+						lock_guard<mutex> lock(mtx);
+						workQueue.push_back(pTask);
+						issued++;
+					}
+					cvWork.notify_one();
+				}
+			}
+			catch(const char *pMessage)
+			{
+				pReadError = pMessage;
+			}
+			catch(...)
+			{
+				pReadError = "ImageSequenceIO::ParseStream: failed to read the stream";
+			}
+			{
+				lock_guard<mutex> lock(mtx);
+				readerFinished = true;
+			}
+			cvWork.notify_all();
+			cvDone.notify_all();
+			for(size_t i=0; i<workers.size(); i++)
+			{
+				workers[i].join();
+			}
+			if(writer.joinable())
+			{
+				writer.join();
+			}
+			for(map<long long,Task*>::iterator it=doneTasks.begin(); it!=doneTasks.end(); ++it)
+			{//left over if the writer could not be started
+				delete it->second;
+			}
+			m_readStreamImage.release();
+			m_processedImage.release();
+
+			if(pReadError)
+			{
+				throw(pReadError);
+			}
+			if(failed)
+			{
+				throw("ImageSequenceIO::ParseStream: failed to encode or save a frame");
+			}
+			cout<<"Finished! "<<issued<<" has been read from the stream file!"<<endl;
+			m_writeFnManager.m_endIndex = m_writeFnManager.m_currentIndex;
+		}
+
 		void SetBayerPattern(const string &pattern)
 		{
 			if(pattern == "RGGB")
@@ -178,21 +1545,57 @@ namespace rm
 	//Close the reading stream
 	void ImageSequenceIO::CloseReadStream()
 	{
+		m_pState->StopPrefetch(false);
+		m_pState->m_trackReader.Close();
 		if(m_pState->m_ifs.is_open())
 		{
 			m_pState->m_ifs.close();
 			m_pState->m_ifs.clear();
 		}
+		if(m_pState->m_mappedFile.IsOpen())
+		{
+			//the images only reference the mapping
+			m_pState->m_readStreamImage.release();
+			m_pState->m_processedImage.release();
+			m_pState->m_mappedFile.Close();
+		}
+		m_pState->InvalidateProcessedImages();
+		m_pState->m_previewImage.release();
+		m_pState->ResetReadIndex();
 	}
 	//
 	//Close the writing stream
 	void ImageSequenceIO::CloseWriteStream()
 	{
-		if(m_pState->m_ofs.is_open())
-		{
-			m_pState->m_ofs.close();
-			m_pState->m_ofs.clear();
-		}
+		m_pState->CloseWriteStream();
+	}
+
+	//
+	//Make everything written so far durable (the file stream can only hand it to the OS)
+	bool ImageSequenceIO::FlushWriteStream()
+	{
+		if(m_pState->m_asyncWriter.IsOpen())
+		{
+			return m_pState->m_asyncWriter.Flush();
+		}
+		m_pState->m_ofs.flush();
+		return m_pState->m_ofs.good();
+	}
+
+	//
+	//Enable/disable background writing for the streams opened afterwards
+	void ImageSequenceIO::SetAsyncWrite(const bool enable, const AsyncStreamWriter::Options &options)
+	{
+		m_pState->m_useAsyncWrite = enable;
+		m_pState->m_asyncOptions = options;
+	}
+
+	//
+	//The background writer of the current writing stream (queue occupancy, dropped frames...),
+	//NULL if the stream is written synchronously
+	const AsyncStreamWriter* ImageSequenceIO::AsyncWriter() const
+	{
+		return m_pState->m_asyncWriter.IsOpen() ? &m_pState->m_asyncWriter : NULL;
 	}
 	
 	//
@@ -242,38 +1645,31 @@ namespace rm
 		{
 			m_pState->m_readStreamFn = fileName;
 		}
-		m_pState->m_ifs.open(fileName,ios::in|ios::binary);
-		if(!m_pState->m_ifs.is_open())
+		//try the zero-copy path first, fall back to the file stream if the file can not be mapped
+		if(!m_pState->m_useMemoryMap || !m_pState->m_mappedFile.Open(fileName,MappedFile::ACCESS_SEQUENTIAL))
 		{
-			throw("ImageSequenceIO::OpenReadStream: failed to open the file stream");
+			m_pState->m_ifs.open(fileName,ios::in|ios::binary);
+			if(!m_pState->m_ifs.is_open())
+			{
+				throw("ImageSequenceIO::OpenReadStream: failed to open the file stream");
+			}
 		}
 
-		ImageSequenceHeader &header = m_pState->m_readHeader;
-		m_pState->m_ifs.read((char*)&(header.m_imaHeight),sizeof(int));
-		m_pState->m_ifs.read((char*)&(header.m_imaWidth),sizeof(int));
-		m_pState->m_ifs.read((char*)&(header.m_imaChannels),sizeof(int));
-		m_pState->m_ifs.read((char*)&(header.m_imaBytesPerPixel),sizeof(int));
+		m_pState->ReadHeader();
+		m_pState->m_prefetchStalls = 0;
 
-		//allocate space
-		if(header.m_imaChannels == 3 && header.m_imaBytesPerPixel == 1)
-		{//regular color image
-			m_pState->m_readStreamImage.create(header.m_imaHeight,header.m_imaWidth,CV_8UC3);
-		}
-		else if(header.m_imaChannels == 1 && header.m_imaBytesPerPixel == 1)
-		{//regular gray scale image
-			m_pState->m_readStreamImage.create(header.m_imaHeight,header.m_imaWidth,CV_8U);
-		}
-		else if(header.m_imaChannels == 1 && header.m_imaBytesPerPixel == 2)
-		{//16-bit image
-			m_pState->m_readStreamImage.create(header.m_imaHeight,header.m_imaWidth,CV_16U);
-		}
-		else
+		//image format (v1 streams: derived from channels and bytes per pixel), the frames
+		//are then read through the kernels of the format
+		m_pState->m_readImageType = m_pState->m_readFormat.m_pixelFormat;
+		m_pState->m_pReadKernels = FindFrameKernels(m_pState->m_readImageType);
+		if(!m_pState->m_pReadKernels || PixelFormatFromHeader(m_pState->m_readHeader) != m_pState->m_readImageType)
 		{
 			throw("ImageSequenceIO::OpenReadStream: error in reading header - unknown image format");
 		}
-		if(m_pState->m_bayerPattern == -1)
+		//allocate space (the uncompressed mapped path points into the file instead)
+		if(m_pState->ReadsIntoBuffer())
 		{
-			m_pState->m_processedImage = m_pState->m_readStreamImage;	//just reference
+			m_pState->AllocateReadImage();
 		}
 	}
 	
@@ -283,11 +1679,30 @@ namespace rm
 	{
 		CloseWriteStream();
 		m_pState->m_writeStreamFn = fileName;
-		m_pState->m_ofs.open(fileName,ios::out|ios::binary);
-		if(!m_pState->m_ofs.is_open())
+		if(m_pState->m_useAsyncWrite)
 		{
-			throw("ImageSequenceIO::OpenWriteStream: failed to open the file stream");
+			AsyncStreamWriter::Options options = m_pState->m_asyncOptions;
+			ImageSequenceHeader stored;
+			if(options.m_slotSize == 0 && m_pState->m_writeFormat.StoredHeader(m_pState->m_writeHeader,stored) && stored.totalSize() > 0)
+			{//preallocate the slots if the header is already known
+				options.m_slotSize = m_pState->m_writeFormat.RecordPrefixSize() + stored.totalSize();
+			}
+			m_pState->m_asyncWriter.SetLatencyTracker(m_pState->m_pLatencyTracker);
+			if(!m_pState->m_asyncWriter.Open(fileName,options))
+			{
+				throw("ImageSequenceIO::OpenWriteStream: failed to open the file stream");
+			}
+		}
+		else
+		{
+			m_pState->m_ofs.open(fileName,ios::out|ios::binary);
+			if(!m_pState->m_ofs.is_open())
+			{
+				throw("ImageSequenceIO::OpenWriteStream: failed to open the file stream");
+			}
 		}
+		m_pState->m_writeIndex.clear();
+		m_pState->m_writeOffset = 0;
 	}
 	
 	void ImageSequenceIO::ImportSettings(const std::string &configFn, const char* secName /*= "ImageSequenceIO"*/)
@@ -315,6 +1730,142 @@ namespace rm
 		{
 			m_pState->SetBayerPattern(strSetting);
 		}
+		if(settings.ReadSetting(secName,"parallelDemosaic",dSetting,true))
+		{
+			m_pState->m_parallelDemosaic = (dSetting != 0);
+		}
+		if(settings.ReadSetting(secName,"memoryMap",dSetting,true))
+		{
+			m_pState->m_useMemoryMap = (dSetting != 0);
+		}
+		if(settings.ReadSetting(secName,"parseThreads",dSetting,true))
+		{
+			m_pState->m_parseThreads = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"parseQueueDepth",dSetting,true))
+		{
+			m_pState->m_parseQueueDepth = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"prefetchDepth",dSetting,true))
+		{
+			SetPrefetchDepth((int)dSetting);
+		}
+		//stream format for writing
+		if(settings.ReadSetting(secName,"streamVersion",dSetting,true))
+		{
+			m_pState->m_writeFormat.m_version = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"codec",strSetting,true))
+		{
+			m_pState->m_writeFormat.m_codec = (strSetting == "rmz") ? STREAM_CODEC_RMZ : STREAM_CODEC_NONE;
+		}
+		if(settings.ReadSetting(secName,"codecSlices",dSetting,true))
+		{
+			m_pState->m_writeFormat.m_codecSlices = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"codecThreads",dSetting,true) && !m_pState->m_pCodecPool)
+		{
+			m_pState->m_codecThreads = (int)dSetting;
+		}
+		//stored part of the camera frames
+		if(settings.ReadSetting(secName,"roiX",dSetting,true))
+		{
+			m_pState->m_writeFormat.m_roiX = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"roiY",dSetting,true))
+		{
+			m_pState->m_writeFormat.m_roiY = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"roiWidth",dSetting,true))
+		{
+			m_pState->m_writeFormat.m_roiWidth = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"roiHeight",dSetting,true))
+		{
+			m_pState->m_writeFormat.m_roiHeight = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"binning",dSetting,true))
+		{
+			m_pState->m_writeFormat.m_binning = (int)dSetting;
+		}
+		//background writing
+		AsyncStreamWriter::Options &asyncOptions = m_pState->m_asyncOptions;
+		if(settings.ReadSetting(secName,"asyncWrite",dSetting,true))
+		{
+			m_pState->m_useAsyncWrite = (dSetting != 0);
+		}
+		if(settings.ReadSetting(secName,"asyncWriteSlots",dSetting,true))
+		{
+			asyncOptions.m_numSlots = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"asyncWriteDropOldest",dSetting,true))
+		{
+			asyncOptions.m_policy = (dSetting != 0) ? AsyncStreamWriter::BACKPRESSURE_DROP_OLDEST : AsyncStreamWriter::BACKPRESSURE_BLOCK;
+		}
+		if(settings.ReadSetting(secName,"asyncWriteDirectIO",dSetting,true))
+		{
+			asyncOptions.m_directIO = (dSetting != 0);
+		}
+		if(settings.ReadSetting(secName,"asyncWritePreallocateMB",dSetting,true))
+		{
+			asyncOptions.m_preallocateSize = (long long)(dSetting * 1024 * 1024);
+		}
+	}
+
+	//
+	//Enable/disable memory mapped (zero-copy) reading for the streams opened afterwards
+	void ImageSequenceIO::SetMemoryMapped(const bool enable)
+	{
+		m_pState->m_useMemoryMap = enable;
+	}
+
+	//
+	//Read up to depth frames ahead on a background thread (0 = read on demand, the default).
+	//Can be changed while reading, the stream continues after the last read frame
+	void ImageSequenceIO::SetPrefetchDepth(const int depth)
+	{
+		m_pState->StopPrefetch(true);
+		m_pState->m_prefetchDepth = max(depth,0);
+	}
+
+	int ImageSequenceIO::PrefetchDepth() const
+	{
+		return m_pState->m_prefetchDepth;
+	}
+
+	//
+	//Number of reads that waited for the read-ahead thread, i.e. replay was limited by the disk or the decoding
+	long long ImageSequenceIO::PrefetchStalls() const
+	{
+		lock_guard<mutex> lock(m_pState->m_prefetchMutex);
+		return m_pState->m_prefetchStalls;
+	}
+
+	//
+	//Set the format (version, codec...) of the streams written afterwards
+	void ImageSequenceIO::SetWriteFormat(const StreamFormat &format)
+	{
+		m_pState->m_writeFormat = format;
+		m_pState->m_writtenFormat = format;
+	}
+
+	const StreamFormat& ImageSequenceIO::GetWriteFormat() const
+	{
+		return m_pState->m_writeFormat;
+	}
+
+	//
+	//Get the format of the reading stream
+	const StreamFormat& ImageSequenceIO::GetReadFormat() const
+	{
+		return m_pState->m_readFormat;
+	}
+
+	//
+	//Check if the current reading stream is memory mapped
+	bool ImageSequenceIO::IsMemoryMapped() const
+	{
+		return m_pState->m_mappedFile.IsOpen();
 	}
 
 
@@ -338,26 +1889,45 @@ namespace rm
 	//If the end of file is reached, the return -1
 	int ImageSequenceIO::ReadNextImage()
 	{
-		char *pImaData = (char*)(m_pState->m_readStreamImage.ptr());
-		m_pState->m_ifs.read((char*)(&m_pState->m_readFrameId),sizeof(int));
-		m_pState->m_ifs.read(pImaData,m_pState->m_readHeader.totalSize());
-		if(m_pState->m_ifs.eof())
+		if(!m_pState->ReadNextRawImage())
 		{
 			m_pState->m_readStreamImage.release();
 			m_pState->m_processedImage.release();
+			m_pState->m_previewImage.release();
+			m_pState->InvalidateProcessedImages();
 			return -1;
 		}
-		if(m_pState->m_bayerPattern != -1)
-		{
-			cv::cvtColor(m_pState->m_readStreamImage,m_pState->m_processedImage,m_pState->m_bayerPattern);
-		}
+		//demosaicing is done by LastReadFrame
+		m_pState->InvalidateProcessedImages();
 		return m_pState->m_readFrameId;
 	}
 	
-	//last frame read through ReadNextImage
+	//last frame read through ReadNextImage (demosaiced on first call if demosaicing is on)
 	const cv::Mat& ImageSequenceIO::LastReadFrame() const
 	{
-		return m_pState->m_processedImage;
+		return m_pState->ProcessedImage();
+	}
+
+	//
+	//Last read frame as stored in the stream, i.e. the Bayer mosaic of raw color streams
+	const cv::Mat& ImageSequenceIO::LastReadRawFrame() const
+	{
+		return m_pState->m_readStreamImage;
+	}
+
+	//
+	//Last read frame at 1/scale resolution (scale 2 = half, 4 = quarter)
+	//Bayer frames are demosaiced and downscaled in one pass, the scale must be even for them
+	const cv::Mat& ImageSequenceIO::LastReadPreview(const int scale) const
+	{
+		return m_pState->PreviewImage(scale);
+	}
+
+	//
+	//Demosaic the row bands of a frame in parallel (default) or on the calling thread
+	void ImageSequenceIO::SetParallelDemosaic(const bool enable)
+	{
+		m_pState->m_parallelDemosaic = enable;
 	}
 
 	const int ImageSequenceIO::LastReadFrameId() const
@@ -365,16 +1935,106 @@ namespace rm
 		return m_pState->m_readFrameId;
 	}
 
+	//
+	//Grab and device time of the last read frame, zero for streams older than v3
+	const FrameTiming& ImageSequenceIO::LastReadFrameTiming() const
+	{
+		return m_pState->m_readTiming;
+	}
+
+	//
+	//Set the tracker receiving the written latency of camera frames
+	void ImageSequenceIO::SetLatencyTracker(LatencyTracker *pTracker)
+	{
+		m_pState->m_pLatencyTracker = pTracker;
+	}
+
+	//
+	//Number of frames in the reading stream (builds the frame index if needed)
+	int ImageSequenceIO::NumFrames()
+	{
+		m_pState->BuildReadIndex();
+		return (int)m_pState->m_readIndex.size();
+	}
+
+	//
+	//Position the reading stream so that the next ReadNextImage returns the given frame
+	//return false if the frame is not in the stream
+	bool ImageSequenceIO::SeekToFrame(const int frameId)
+	{
+		return m_pState->SeekToFrame(frameId);
+	}
+
+	//
+	//Read count frames, starting at frame firstFrameId and taking every stride-th frame in stream
+	//order, into one contiguous and aligned buffer (see FramePool) of count*height rows: frame k is
+	//rows [k*height, (k+1)*height). With floatScale > 0 the frames are converted to float and
+	//multiplied by floatScale (e.g. 0.001 for depth in mm to m) while they are copied.
+	//return the number of frames read, less than count at the end of the stream
+	int ImageSequenceIO::ReadFrames(const int firstFrameId, const int count, FrameHandle &batch, const int stride /*= 1*/,
+		const float floatScale /*= 0*/)
+	{
+		return m_pState->ReadFrames(firstFrameId,count,stride,floatScale,batch);
+	}
+
+	//
+	//Random access read of the given frame, same return value as ReadNextImage
+	int ImageSequenceIO::ReadFrame(const int frameId)
+	{
+		if(!m_pState->SeekToFrame(frameId))
+		{
+			return -1;
+		}
+		return ReadNextImage();
+	}
+
+	//
+	//Read a region (in stored frame coordinates) of the next frame, reading only the rows that hold it.
+	//LastReadFrame and LastReadRawFrame return the region, Bayer frames need an even x and y to keep
+	//their pattern. Same return value as ReadNextImage
+	int ImageSequenceIO::ReadNextImageRegion(const cv::Rect &region)
+	{
+		if(!m_pState->ReadRegion(region))
+		{
+			m_pState->m_readStreamImage.release();
+			m_pState->m_processedImage.release();
+			m_pState->m_previewImage.release();
+			m_pState->InvalidateProcessedImages();
+			return -1;
+		}
+		m_pState->InvalidateProcessedImages();
+		return m_pState->m_readFrameId;
+	}
+
+	//
+	//Random access read of a region of the given frame, same return value as ReadNextImage
+	int ImageSequenceIO::ReadFrameRegion(const int frameId, const cv::Rect &region)
+	{
+		if(!m_pState->SeekToFrame(frameId))
+		{
+			return -1;
+		}
+		return ReadNextImageRegion(region);
+	}
+
 	void ImageSequenceIO::SaveCurrentReadFrame()
 	{
-		cv::imwrite(m_pState->m_writeFnManager.NextFileName(),m_pState->m_processedImage);
+		cv::imwrite(m_pState->m_writeFnManager.NextFileName(),LastReadFrame());
 	}
 	
+	//
+	//Size of the writing stream so far, including the records queued for background writing
+	long long ImageSequenceIO::WriteStreamSize() const
+	{
+		return m_pState->m_writeOffset;
+	}
+
 	//
 	//Set header for writing stream
 	void ImageSequenceIO::SetWriteHeader(const ImageSequenceHeader &header)
 	{
 		m_pState->m_writeHeader = header;
+		m_pState->m_storedHeader = header;
 	}
 
 	//
@@ -389,20 +2049,265 @@ namespace rm
 			throw("ImageSequenceIO::WriteHeader: header is not well defined");
 		}
 #endif
-		m_pState->m_ofs.write((char*)&(header.m_imaHeight),sizeof(int));
-		m_pState->m_ofs.write((char*)&(header.m_imaWidth),sizeof(int));
-		m_pState->m_ofs.write((char*)&(header.m_imaChannels),sizeof(int));
-		m_pState->m_ofs.write((char*)&(header.m_imaBytesPerPixel),sizeof(int));
+		const StreamFormat &format = m_pState->m_writeFormat;
+		const int pixelFormat = PixelFormatFromHeader(header);
+		if(pixelFormat == -1 || (format.m_pixelFormat >= 0 && format.m_pixelFormat != pixelFormat))
+		{//the readers could not open the stream
+			throw("ImageSequenceIO::WriteHeader: unsupported image format");
+		}
+		m_pState->m_pWriteKernels = FindFrameKernels(pixelFormat);
+		if(format.m_version == STREAM_VERSION_LEGACY && format.m_codec != STREAM_CODEC_NONE)
+		{
+			throw("ImageSequenceIO::WriteHeader: compression needs stream version 2");
+		}
+		//the header describes the stored frames, the camera frame size goes into the geometry fields
+		ImageSequenceHeader &stored = m_pState->m_storedHeader;
+		if(format.HasGeometry() && format.m_version == STREAM_VERSION_LEGACY)
+		{
+			throw("ImageSequenceIO::WriteHeader: regions and binning need stream version 2");
+		}
+		if(format.m_roiWidth <= 0 && (format.m_roiWidth < 0 || format.m_roiX != 0 || format.m_roiY != 0 || format.m_roiHeight != 0))
+		{//without a width the region would be ignored and the whole frame stored
+			throw("ImageSequenceIO::WriteHeader: the region is only partially specified");
+		}
+		if(!format.StoredHeader(header,stored))
+		{
+			throw("ImageSequenceIO::WriteHeader: the region is not inside the frame or the binning is invalid");
+		}
+		//resolved for this stream only, the next stream may have taller frames
+		StreamFormat &written = m_pState->m_writtenFormat;
+		written = format;
+		written.m_sourceHeight = header.m_imaHeight;
+		written.m_sourceWidth = header.m_imaWidth;
+		if(written.m_codec != STREAM_CODEC_NONE)
+		{
+			if(written.m_codecSlices <= 0)
+			{
+				written.m_codecSlices = m_pState->CodecPool().NumThreads();
+			}
+			if(written.m_codecSlices > stored.m_imaHeight)
+			{
+				written.m_codecSlices = stored.m_imaHeight;
+			}
+		}
+		else
+		{
+			written.m_codecSlices = 1;
+		}
 
+		vector<unsigned char> buffer;
+		EncodeStreamHeader(stored,written,buffer);
+		if(m_pState->m_asyncWriter.IsOpen())
+		{
+			m_pState->m_asyncWriter.Write(&buffer[0],buffer.size());
+		}
+		else
+		{
+			m_pState->m_ofs.write((const char*)&buffer[0],buffer.size());
+		}
+		m_pState->m_writeOffset = (long long)buffer.size();
 	}
 
 	//
-	//Write an image to the stream
+	//Write an image to the stream, the capture time is not known here, so it is recorded as 0
+	//(the time of the write is not the grab time, and would pace a replay on the writer)
 	void ImageSequenceIO::WriteImageToStream(const cv::Mat &image, const int frameId)
 	{
-		m_pState->m_ofs.write((char*)&m_pState->m_readFrameId,sizeof(int));
-		m_pState->m_ofs.write((const char*)image.ptr(),m_pState->m_writeHeader.totalSize());
+		WriteImageToStream(image,frameId,FrameTiming());
+	}
+
+	//
+	//Write a captured frame with its timing to the stream
+	void ImageSequenceIO::WriteFrameToStream(const FrameHandle &frame, const int frameId)
+	{
+		WriteImageToStream(frame.Mat(),frameId,frame.Timing());
+	}
+
+	//
+	//Write an image to the stream. The written latency is tracked for frames
+	//that were published by a camera (m_availableTime is set).
+	//With a region or binning in the write format, only the stored part of the image is written
+	void ImageSequenceIO::WriteImageToStream(const cv::Mat &image, const int frameId, const FrameTiming &timing)
+	{
+		const StreamFormat &format = m_pState->m_writtenFormat;
+		const bool track = m_pState->m_pLatencyTracker && timing.m_availableTime > 0;
+		const cv::Mat stored = format.HasGeometry() ? m_pState->StoredImage(image) : image;
+		StreamRecordPrefix prefix;
+		prefix.m_frameId = frameId;
+		prefix.m_grabTime = timing.m_grabTime;
+		prefix.m_deviceTime = timing.m_deviceTime;
+		prefix.m_payloadSize = m_pState->m_storedHeader.totalSize();
+		const unsigned char *pPayload = stored.ptr();
+		if(format.m_codec == STREAM_CODEC_RMZ)
+		{
+			prefix.m_payloadSize = m_pState->EncodePayload(stored);
+			pPayload = &m_pState->m_writePayload[0];
+		}
+		unsigned char prefixBuffer[MAX_RECORD_PREFIX_SIZE];
+		const size_t prefixSize = format.RecordPrefixSize();
+		EncodeRecordPrefix(format,prefix,prefixBuffer);
+		s_framesWritten.Add();
+		s_bytesWritten.Add(prefixSize + prefix.m_payloadSize);
+
+		if(m_pState->m_asyncWriter.IsOpen())
+		{//the index is built from the records that actually made it to the file
+			m_pState->m_asyncWriter.WriteRecord(prefixBuffer,prefixSize,pPayload,prefix.m_payloadSize,frameId,track ? &timing : NULL);
+			m_pState->m_writeOffset += prefixSize + prefix.m_payloadSize;
+			return;
+		}
+		FrameIndexEntry entry;
+		entry.m_offset = m_pState->m_writeOffset;
+		entry.m_frameId = frameId;
+		entry.m_reserved = 0;
+		m_pState->m_writeIndex.push_back(entry);
+
+		m_pState->m_ofs.write((const char*)prefixBuffer,prefixSize);
+		m_pState->m_ofs.write((const char*)pPayload,prefix.m_payloadSize);
+		m_pState->m_writeOffset += prefixSize + prefix.m_payloadSize;
+		if(track)
+		{
+			m_pState->m_pLatencyTracker->RecordWritten(timing,MonotonicNanoseconds());
+		}
 	}
 	
 
+	/******************************/
+	/* Multi-track streams        */
+	/******************************/
+
+	//
+	//Open a multi-track stream for writing, one track per image of a capture.
+	//The records always go through a background writer, with the options of SetAsyncWrite
+	void ImageSequenceIO::OpenTrackWriteStream(const string &fileName, const vector<TrackInfo> &tracks)
+	{
+		CloseWriteStream();
+		MultiTrackStreamWriter &writer = m_pState->m_trackWriter;
+		writer.ClearTracks();
+		for(size_t t=0; t<tracks.size(); t++)
+		{
+			writer.AddTrack(tracks[t].m_header,tracks[t].m_name,tracks[t].m_codec);
+		}
+		writer.SetAsyncOptions(m_pState->m_asyncOptions);
+		writer.SetLatencyTracker(m_pState->m_pLatencyTracker);
+		m_pState->m_writeStreamFn = fileName;
+		writer.Open(fileName);
+	}
+
+	//
+	//One track per image of the camera, compressed with the codec of the write format
+	void ImageSequenceIO::OpenTrackWriteStream(const string &fileName, const Camera &camera)
+	{
+		CloseWriteStream();
+		MultiTrackStreamWriter &writer = m_pState->m_trackWriter;
+		writer.ClearTracks();
+		writer.AddCameraTracks(camera,m_pState->m_writeFormat.m_codec);
+		writer.SetAsyncOptions(m_pState->m_asyncOptions);
+		writer.SetLatencyTracker(m_pState->m_pLatencyTracker);
+		m_pState->m_writeStreamFn = fileName;
+		writer.Open(fileName);
+	}
+
+	void ImageSequenceIO::WriteCaptureToStream(const vector<cv::Mat> &images, const int frameId, const FrameTiming &timing)
+	{
+		if(!m_pState->m_trackWriter.IsOpen())
+		{
+			throw("ImageSequenceIO::WriteCaptureToStream: no multi-track stream is open for writing");
+		}
+		m_pState->m_trackWriter.WriteCapture(images,frameId,timing);
+	}
+
+	//
+	//Write all the images of the latest capture of the camera as one record
+	void ImageSequenceIO::WriteCaptureToStream(const Camera &camera, const int frameId)
+	{
+		if(!m_pState->m_trackWriter.IsOpen())
+		{
+			throw("ImageSequenceIO::WriteCaptureToStream: no multi-track stream is open for writing");
+		}
+		m_pState->m_trackWriter.WriteCapture(camera,frameId);
+	}
+
+	//
+	//Open a multi-track stream for reading, memory mapped if SetMemoryMapped is on
+	void ImageSequenceIO::OpenTrackReadStream(const string &fileName)
+	{
+		CloseReadStream();
+		m_pState->m_readStreamFn = fileName;
+		m_pState->m_trackReader.SetMemoryMapped(m_pState->m_useMemoryMap);
+		m_pState->m_trackReader.Open(fileName);
+	}
+
+	int ImageSequenceIO::NumTracks() const
+	{
+		return m_pState->m_trackReader.NumTracks();
+	}
+
+	//
+	//Geometry, format and name of a track of the reading stream
+	const TrackInfo& ImageSequenceIO::GetReadTrack(const int track) const
+	{
+		if(track < 0 || track >= m_pState->m_trackReader.NumTracks())
+		{
+			throw("ImageSequenceIO::GetReadTrack: no such track");
+		}
+		return m_pState->m_trackReader.Track(track);
+	}
+
+	int ImageSequenceIO::FindReadTrack(const string &name) const
+	{
+		return m_pState->m_trackReader.FindTrack(name);
+	}
+
+	//
+	//Read all the tracks of the next capture, LastReadFrameId and LastReadFrameTiming follow it
+	//If the end of file is reached, the return -1
+	int ImageSequenceIO::ReadNextCapture()
+	{
+		MultiTrackStreamReader &reader = m_pState->m_trackReader;
+		if(!reader.IsOpen())
+		{
+			throw("ImageSequenceIO::ReadNextCapture: no multi-track stream is open for reading");
+		}
+		m_pState->m_readFrameId = reader.ReadNextCapture();
+		m_pState->m_readTiming = reader.LastReadFrameTiming();
+		return m_pState->m_readFrameId;
+	}
+
+	//
+	//Read one track of the next capture, the others are skipped without reading them
+	int ImageSequenceIO::ReadNextTrack(const int track)
+	{
+		MultiTrackStreamReader &reader = m_pState->m_trackReader;
+		if(!reader.IsOpen())
+		{
+			throw("ImageSequenceIO::ReadNextTrack: no multi-track stream is open for reading");
+		}
+		m_pState->m_readFrameId = reader.ReadNextTrack(track);
+		m_pState->m_readTiming = reader.LastReadFrameTiming();
+		return m_pState->m_readFrameId;
+	}
+
+	//
+	//Move to the capture of a frame id, false if it is not in the stream
+	bool ImageSequenceIO::SeekToCapture(const int frameId)
+	{
+		return m_pState->m_trackReader.IsOpen() && m_pState->m_trackReader.SeekToCapture(frameId);
+	}
+
+	int ImageSequenceIO::NumCaptures()
+	{
+		return m_pState->m_trackReader.IsOpen() ? m_pState->m_trackReader.NumCaptures() : 0;
+	}
+
+	//
+	//An image of the last read capture, empty if the track was skipped, valid until the next read
+	const cv::Mat& ImageSequenceIO::LastReadTrack(const int track) const
+	{
+		if(track < 0 || track >= m_pState->m_trackReader.NumTracks())
+		{
+			throw("ImageSequenceIO::LastReadTrack: no such track");
+		}
+		return m_pState->m_trackReader.LastReadTrack(track);
+	}
+
 }
\ No newline at end of file
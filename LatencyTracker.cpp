@@ -0,0 +1,207 @@
+/* *
+	LatencyTracker.cpp
+		The Implementation of the latency histograms
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "LatencyTracker.h"
+
+#include <chrono>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	long long MonotonicNanoseconds()
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+
+	/******************************/
+	/* LatencyHistogram           */
+	/******************************/
+
+	LatencyHistogram::LatencyHistogram()
+	{
+		Reset();
+	}
+
+	//
+	//Values below 2^SUB_BUCKET_BITS have a bucket each, above that every power of two
+	//is split into 2^SUB_BUCKET_BITS buckets
+	int LatencyHistogram::BucketOf(const long long ns)
+	{
+		const unsigned long long v = (ns > 0) ? (unsigned long long)ns : 0;
+		if(v < (1u << SUB_BUCKET_BITS))
+		{
+			return (int)v;
+		}
+		int exponent = 63;
+		while(!(v >> exponent))
+		{
+			exponent--;
+		}
+		const int sub = (int)((v >> (exponent - SUB_BUCKET_BITS)) & ((1u << SUB_BUCKET_BITS) - 1));
+		return ((exponent - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub;
+	}
+
+	//
+	//Middle of the bucket
+	long long LatencyHistogram::BucketValue(const int bucket)
+	{
+		if(bucket < (1 << SUB_BUCKET_BITS))
+		{
+			return bucket;
+		}
+		const int exponent = (bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+		const long long sub = bucket & ((1 << SUB_BUCKET_BITS) - 1);
+		const long long width = 1LL << (exponent - SUB_BUCKET_BITS);
+		return (((1LL << SUB_BUCKET_BITS) + sub) * width) + width/2;
+	}
+
+	void LatencyHistogram::Record(const long long ns)
+	{
+		const long long v = (ns > 0) ? ns : 0;
+		m_buckets[BucketOf(v)].fetch_add(1,memory_order_relaxed);
+		m_sum.fetch_add(v,memory_order_relaxed);
+		long long max = m_max.load(memory_order_relaxed);
+		while(v > max && !m_max.compare_exchange_weak(max,v,memory_order_relaxed))
+		{
+		}
+		m_count.fetch_add(1,memory_order_relaxed);
+	}
+
+	long long LatencyHistogram::Percentile(const double fraction) const
+	{
+		const long long count = m_count.load();
+		if(count == 0)
+		{
+			return 0;
+		}
+		long long rank = (long long)(fraction*count + 0.5);
+		if(rank < 1)
+		{
+			rank = 1;
+		}
+		long long seen = 0;
+		for(int i=0; i<NUM_BUCKETS; i++)
+		{
+			seen += m_buckets[i].load(memory_order_relaxed);
+			if(seen >= rank)
+			{
+				const long long value = BucketValue(i);
+				const long long max = m_max.load();
+				return (value < max) ? value : max;
+			}
+		}
+		return m_max.load();
+	}
+
+	long long LatencyHistogram::Mean() const
+	{
+		const long long count = m_count.load();
+		return count > 0 ? m_sum.load()/count : 0;
+	}
+
+	LatencySummary LatencyHistogram::Summary() const
+	{
+		LatencySummary summary;
+		summary.m_count = Count();
+		summary.m_mean = Mean();
+		summary.m_p50 = Percentile(0.5);
+		summary.m_p99 = Percentile(0.99);
+		summary.m_max = Max();
+		return summary;
+	}
+
+	void LatencyHistogram::Add(const LatencyHistogram &other)
+	{
+		for(int i=0; i<NUM_BUCKETS; i++)
+		{
+			const long long n = other.m_buckets[i].load(memory_order_relaxed);
+			if(n > 0)
+			{
+				m_buckets[i].fetch_add(n,memory_order_relaxed);
+			}
+		}
+		m_sum.fetch_add(other.m_sum.load(memory_order_relaxed),memory_order_relaxed);
+		const long long v = other.m_max.load(memory_order_relaxed);
+		long long max = m_max.load(memory_order_relaxed);
+		while(v > max && !m_max.compare_exchange_weak(max,v,memory_order_relaxed))
+		{
+		}
+		m_count.fetch_add(other.m_count.load(memory_order_relaxed),memory_order_relaxed);
+	}
+
+	void LatencyHistogram::Reset()
+	{
+		for(int i=0; i<NUM_BUCKETS; i++)
+		{
+			m_buckets[i] = 0;
+		}
+		m_count = 0;
+		m_sum = 0;
+		m_max = 0;
+	}
+
+
+	/******************************/
+	/* LatencyTracker             */
+	/******************************/
+
+	void LatencyTracker::RecordAvailable(const FrameTiming &timing)
+	{
+		if(timing.m_grabTime > 0 && timing.m_availableTime > 0)
+		{
+			m_histograms[STAGE_GRAB_TO_AVAILABLE].Record(timing.m_availableTime - timing.m_grabTime);
+		}
+	}
+
+	void LatencyTracker::RecordWritten(const FrameTiming &timing, const long long writtenTime)
+	{
+		if(timing.m_availableTime > 0)
+		{
+			m_histograms[STAGE_AVAILABLE_TO_WRITTEN].Record(writtenTime - timing.m_availableTime);
+		}
+		if(timing.m_grabTime > 0)
+		{
+			m_histograms[STAGE_GRAB_TO_WRITTEN].Record(writtenTime - timing.m_grabTime);
+		}
+	}
+
+	void LatencyTracker::Reset()
+	{
+		for(int i=0; i<NUM_STAGES; i++)
+		{
+			m_histograms[i].Reset();
+		}
+	}
+
+	const char* LatencyTracker::StageName(const Stage stage)
+	{
+		switch(stage)
+		{
+		case STAGE_GRAB_TO_AVAILABLE:
+			return "grabToAvailable";
+		case STAGE_AVAILABLE_TO_WRITTEN:
+			return "availableToWritten";
+		case STAGE_GRAB_TO_WRITTEN:
+			return "grabToWritten";
+		default:
+			return "unknown";
+		}
+	}
+
+	LatencyTracker& LatencyTracker::Global()
+	{
+		static LatencyTracker tracker;
+		return tracker;
+	}
+
+}
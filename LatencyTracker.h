@@ -0,0 +1,153 @@
+/* *
+	LatencyTracker.h
+		Frame timestamps and latency histograms of the capture pipeline
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef LATENCY_TRACKER_H_
+#define LATENCY_TRACKER_H_
+
+
+#include <atomic>
+
+
+
+namespace rm
+{
+
+	/** \brief Current time of the monotonic clock in nanoseconds
+	 *	All frame timestamps use this clock, so they can be compared across cameras
+	 */
+	long long MonotonicNanoseconds();
+
+	/** \brief The timing of one capture
+	 */
+	struct FrameTiming
+	{
+		long long			m_grabTime;			//monotonic ns, when the capture started (or the SDK delivered it)
+		long long			m_availableTime;	//monotonic ns, when the capture was published to consumers
+		long long			m_deviceTime;		//device clock, 0 if the camera has none
+
+		FrameTiming():m_grabTime(0),m_availableTime(0),m_deviceTime(0)
+		{
+		}
+	};
+
+	/** \brief Statistics of a histogram, all values in nanoseconds
+	 */
+	struct LatencySummary
+	{
+		long long			m_count;
+		long long			m_mean;
+		long long			m_p50;
+		long long			m_p99;
+		long long			m_max;
+	};
+
+
+	/************************************************************//**
+	 *	The LatencyHistogram class
+	 *	Log-linear buckets (16 per power of two, i.e. about 6% resolution)
+	 *	from 1 ns to years. Recording is lock-free and can be done from
+	 *	any number of threads.
+	 ***************************************************************/
+	class LatencyHistogram
+	{
+	public:
+		LatencyHistogram();
+
+		/** \brief Add a sample
+		 *	\param[in] ns The duration in nanoseconds (negative values count as 0)
+		 */
+		void Record(const long long ns);
+
+		/** \brief Value below which the given fraction of the samples lie
+		 *	\param[in] fraction In [0,1], e.g. 0.99
+		 */
+		long long Percentile(const double fraction) const;
+
+		long long Count() const { return m_count.load(); }
+		long long Max() const { return m_max.load(); }
+		long long Mean() const;
+
+		LatencySummary Summary() const;
+
+		/** \brief Add the samples of another histogram (e.g. to combine per-thread histograms)
+		 */
+		void Add(const LatencyHistogram &other);
+
+		void Reset();
+
+	private:
+		static const int SUB_BUCKET_BITS = 4;
+		static const int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+		//not copyable
+		LatencyHistogram(const LatencyHistogram&);
+		LatencyHistogram& operator=(const LatencyHistogram&);
+
+		static int BucketOf(const long long ns);
+		static long long BucketValue(const int bucket);
+
+		std::atomic<long long>		m_buckets[NUM_BUCKETS];
+		std::atomic<long long>		m_count;
+		std::atomic<long long>		m_sum;
+		std::atomic<long long>		m_max;
+	};
+
+
+	/************************************************************//**
+	 *	The LatencyTracker class
+	 *	One histogram per pipeline stage:
+	 *	grab -> available (published by the camera) -> written (handed to the OS)
+	 ***************************************************************/
+	class LatencyTracker
+	{
+	public:
+		enum Stage
+		{
+			STAGE_GRAB_TO_AVAILABLE = 0,
+			STAGE_AVAILABLE_TO_WRITTEN,
+			STAGE_GRAB_TO_WRITTEN,
+			NUM_STAGES
+		};
+
+		/** \brief Record grab -> available
+		 */
+		void RecordAvailable(const FrameTiming &timing);
+
+		/** \brief Record available -> written and grab -> written
+		 *	\param[in] timing The timing of the frame
+		 *	\param[in] writtenTime Monotonic ns when the frame was written
+		 */
+		void RecordWritten(const FrameTiming &timing, const long long writtenTime);
+
+		const LatencyHistogram& Histogram(const Stage stage) const { return m_histograms[stage]; }
+		LatencyHistogram& Histogram(const Stage stage) { return m_histograms[stage]; }
+
+		LatencySummary Summary(const Stage stage) const { return m_histograms[stage].Summary(); }
+
+		void Reset();
+
+		/** \brief Short name of a stage, e.g. for reports
+		 */
+		static const char* StageName(const Stage stage);
+
+		/** \brief The tracker used by cameras and writers unless they are given another one
+		 */
+		static LatencyTracker& Global();
+
+	private:
+		LatencyHistogram			m_histograms[NUM_STAGES];
+	};
+
+};//namespace rm
+
+
+
+#endif //LATENCY_TRACKER_H_
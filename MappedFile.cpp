@@ -0,0 +1,198 @@
+/* *
+	MappedFile.cpp
+		The Implementation of the read-only file mapping
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace rm
+{
+
+	MappedFile::MappedFile():m_pData(NULL),m_size(0)
+#ifdef _WIN32
+		,m_hFile(INVALID_HANDLE_VALUE),m_hMapping(NULL)
+#endif
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+
+#ifdef _WIN32
+
+	bool MappedFile::Open(const std::string &fileName, const AccessHint hint)
+	{
+		Close();
+		DWORD flags = FILE_ATTRIBUTE_NORMAL;
+		if(hint == ACCESS_SEQUENTIAL)
+		{
+			flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+		}
+		else if(hint == ACCESS_RANDOM)
+		{
+			flags |= FILE_FLAG_RANDOM_ACCESS;
+		}
+		HANDLE hFile = CreateFileA(fileName.c_str(),GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,flags,NULL);
+		if(hFile == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if(!GetFileSizeEx(hFile,&fileSize) || fileSize.QuadPart == 0 ||
+			(unsigned long long)fileSize.QuadPart > (unsigned long long)((size_t)-1))
+		{
+			CloseHandle(hFile);
+			return false;
+		}
+		HANDLE hMapping = CreateFileMappingA(hFile,NULL,PAGE_WRITECOPY,0,0,NULL);
+		if(hMapping == NULL)
+		{
+			CloseHandle(hFile);
+			return false;
+		}
+		void *pView = MapViewOfFile(hMapping,FILE_MAP_COPY,0,0,0);
+		if(pView == NULL)
+		{
+			CloseHandle(hMapping);
+			CloseHandle(hFile);
+			return false;
+		}
+		m_hFile = hFile;
+		m_hMapping = hMapping;
+		m_pData = (unsigned char*)pView;
+		m_size = (size_t)fileSize.QuadPart;
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if(m_pData)
+		{
+			UnmapViewOfFile(m_pData);
+			m_pData = NULL;
+		}
+		if(m_hMapping)
+		{
+			CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+		}
+		if(m_hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+		m_size = 0;
+	}
+
+	//
+	//FILE_FLAG_SEQUENTIAL_SCAN already makes the cache manager read ahead aggressively,
+	//so the explicit hints are not needed on Windows
+	void MappedFile::WillNeed(const size_t offset, const size_t length) const
+	{
+	}
+
+	void MappedFile::DontNeed(const size_t offset, const size_t length) const
+	{
+	}
+
+#else
+
+	bool MappedFile::Open(const std::string &fileName, const AccessHint hint)
+	{
+		Close();
+		int fd = open(fileName.c_str(),O_RDONLY);
+		if(fd < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd,&st) != 0 || st.st_size <= 0 ||
+			(unsigned long long)st.st_size > (unsigned long long)((size_t)-1))
+		{
+			close(fd);
+			return false;
+		}
+		//private + writable: reads share the page cache, stray writes only touch a private copy
+		void *pView = mmap(NULL,(size_t)st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+		close(fd);	//the mapping keeps its own reference to the file
+		if(pView == MAP_FAILED)
+		{
+			return false;
+		}
+		m_pData = (unsigned char*)pView;
+		m_size = (size_t)st.st_size;
+
+		if(hint == ACCESS_SEQUENTIAL)
+		{
+			madvise(m_pData,m_size,MADV_SEQUENTIAL);
+		}
+		else if(hint == ACCESS_RANDOM)
+		{
+			madvise(m_pData,m_size,MADV_RANDOM);
+		}
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if(m_pData)
+		{
+			munmap(m_pData,m_size);
+			m_pData = NULL;
+		}
+		m_size = 0;
+	}
+
+	//
+	//madvise needs page aligned addresses, so round the range outwards
+	static bool PageRange(const size_t fileSize, const size_t offset, const size_t length, size_t &begin, size_t &len)
+	{
+		if(offset >= fileSize || length == 0)
+		{
+			return false;
+		}
+		static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		size_t end = (length > fileSize - offset) ? fileSize : offset + length;
+		begin = offset - offset % pageSize;
+		len = end - begin;
+		return true;
+	}
+
+	void MappedFile::WillNeed(const size_t offset, const size_t length) const
+	{
+		size_t begin, len;
+		if(m_pData && PageRange(m_size,offset,length,begin,len))
+		{
+			madvise(m_pData + begin,len,MADV_WILLNEED);
+		}
+	}
+
+	void MappedFile::DontNeed(const size_t offset, const size_t length) const
+	{
+		size_t begin, len;
+		if(m_pData && PageRange(m_size,offset,length,begin,len))
+		{
+			//for a private mapping this would drop modified pages, which is fine for read-only use
+			madvise(m_pData + begin,len,MADV_DONTNEED);
+		}
+	}
+
+#endif
+
+}
@@ -0,0 +1,101 @@
+/* *
+	MappedFile.h
+		Read-only memory mapping of (large) data files
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+
+#include <string>
+#include <stddef.h>
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The MappedFile class
+	 *	Maps a whole file into the address space so that its content
+	 *	can be accessed without copying through stream buffers.
+	 *	The view is private (copy-on-write): pages are shared with the
+	 *	page cache until somebody writes into them, the file itself is
+	 *	never modified.
+	 ***************************************************************/
+	class MappedFile
+	{
+	public:
+		/** \brief Access pattern hints passed to the OS when mapping
+		 */
+		enum AccessHint
+		{
+			ACCESS_NORMAL = 0,
+			ACCESS_SEQUENTIAL,
+			ACCESS_RANDOM
+		};
+
+	public:
+		MappedFile();
+		~MappedFile();
+
+		/** \brief Map the given file
+		 *	\param[in] fileName The file to be mapped
+		 *	\param[in] hint The expected access pattern
+		 *	\return False if the file could not be opened or mapped (e.g. empty file,
+		 *	or a file larger than the address space), the caller should fall back to regular IO
+		 */
+		bool Open(const std::string &fileName, const AccessHint hint = ACCESS_SEQUENTIAL);
+
+		/** \brief Unmap the file, all pointers obtained through Data() become invalid
+		 */
+		void Close();
+
+		/** \brief Check if a file is currently mapped
+		 */
+		bool IsOpen() const { return m_pData != NULL; }
+
+		/** \brief The beginning of the mapped file
+		 */
+		const unsigned char* Data() const { return m_pData; }
+
+		/** \brief The size of the mapped file in bytes
+		 */
+		size_t Size() const { return m_size; }
+
+		/** \brief Ask the OS to start reading the given range into the page cache
+		 *	\param[in] offset Byte offset of the range (will be page aligned internally)
+		 *	\param[in] length Length of the range in bytes
+		 */
+		void WillNeed(const size_t offset, const size_t length) const;
+
+		/** \brief Tell the OS the given range will not be accessed again soon
+		 *	\param[in] offset Byte offset of the range (will be page aligned internally)
+		 *	\param[in] length Length of the range in bytes
+		 */
+		void DontNeed(const size_t offset, const size_t length) const;
+
+	private:
+		//not copyable
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		unsigned char			*m_pData;
+		size_t					m_size;
+#ifdef _WIN32
+		void					*m_hFile;
+		void					*m_hMapping;
+#endif
+	};
+
+};//namespace rm
+
+
+
+#endif //MAPPED_FILE_H_
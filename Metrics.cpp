@@ -0,0 +1,398 @@
+/* *
+	Metrics.cpp
+		The Implementation of the metrics registry
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "Metrics.h"
+#include "RobotSocket.h"
+#include "AlignedMemory.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//prefix of the dump targets that are Unix domain sockets
+	static const char UNIX_SOCKET_PREFIX[] = "unix:";
+
+	int MetricShard()
+	{
+		static atomic<int> s_nextShard(0);
+		static thread_local int t_shard = -1;
+		if(t_shard < 0)
+		{
+			t_shard = s_nextShard.fetch_add(1,memory_order_relaxed) % METRIC_SHARDS;
+		}
+		return t_shard;
+	}
+
+
+	/******************************/
+	/* Metrics                    */
+	/******************************/
+
+	MetricCounter::MetricCounter()
+	{
+		Reset();
+	}
+
+	void* MetricCounter::operator new(size_t size)
+	{
+		void *p = AlignedAlloc(size,METRIC_CACHE_LINE);
+		if(!p)
+		{
+			throw bad_alloc();
+		}
+		return p;
+	}
+
+	void MetricCounter::operator delete(void *p)
+	{
+		AlignedFree(p);
+	}
+
+	long long MetricCounter::Value() const
+	{
+		long long sum = 0;
+		for(int i=0; i<METRIC_SHARDS; i++)
+		{
+			sum += m_shards[i].m_value.load(memory_order_relaxed);
+		}
+		return sum;
+	}
+
+	void MetricCounter::Reset()
+	{
+		for(int i=0; i<METRIC_SHARDS; i++)
+		{
+			m_shards[i].m_value = 0;
+		}
+	}
+
+	MetricGauge::MetricGauge():m_value(0),m_max(0)
+	{
+	}
+
+	void MetricGauge::Reset()
+	{
+		m_value = 0;
+		m_max = 0;
+	}
+
+	MetricHistogram::MetricHistogram()
+	{
+	}
+
+	LatencySummary MetricHistogram::Summary() const
+	{
+		LatencyHistogram sum;
+		for(int i=0; i<METRIC_SHARDS; i++)
+		{
+			sum.Add(m_shards[i]);
+		}
+		return sum.Summary();
+	}
+
+	void MetricHistogram::Reset()
+	{
+		for(int i=0; i<METRIC_SHARDS; i++)
+		{
+			m_shards[i].Reset();
+		}
+	}
+
+
+	/******************************/
+	/* Snapshot                   */
+	/******************************/
+
+	string MetricsSnapshot::ToText() const
+	{
+		char buffer[512];
+		string text;
+		sprintf(buffer,"time %lld\n",m_time);
+		text += buffer;
+		for(map<string,long long>::const_iterator it=m_counters.begin(); it!=m_counters.end(); ++it)
+		{
+			sprintf(buffer," %lld\n",it->second);
+			text += it->first + buffer;
+		}
+		for(map<string,GaugeValue>::const_iterator it=m_gauges.begin(); it!=m_gauges.end(); ++it)
+		{
+			sprintf(buffer," %lld %lld\n",it->second.m_value,it->second.m_max);
+			text += it->first + buffer;
+		}
+		for(map<string,LatencySummary>::const_iterator it=m_histograms.begin(); it!=m_histograms.end(); ++it)
+		{
+			const LatencySummary &s = it->second;
+			sprintf(buffer," %lld %lld %lld %lld %lld\n",s.m_count,s.m_mean,s.m_p50,s.m_p99,s.m_max);
+			text += it->first + buffer;
+		}
+		return text;
+	}
+
+	string MetricsSnapshot::ToJson() const
+	{
+		char buffer[512];
+		string json;
+		sprintf(buffer,"{\"time\": %lld, \"counters\": {",m_time);
+		json += buffer;
+		for(map<string,long long>::const_iterator it=m_counters.begin(); it!=m_counters.end(); ++it)
+		{
+			sprintf(buffer,"\": %lld",it->second);
+			json += string(it == m_counters.begin() ? "\"" : ", \"") + it->first + buffer;
+		}
+		json += "}, \"gauges\": {";
+		for(map<string,GaugeValue>::const_iterator it=m_gauges.begin(); it!=m_gauges.end(); ++it)
+		{
+			sprintf(buffer,"\": {\"value\": %lld, \"max\": %lld}",it->second.m_value,it->second.m_max);
+			json += string(it == m_gauges.begin() ? "\"" : ", \"") + it->first + buffer;
+		}
+		json += "}, \"histograms\": {";
+		for(map<string,LatencySummary>::const_iterator it=m_histograms.begin(); it!=m_histograms.end(); ++it)
+		{
+			const LatencySummary &s = it->second;
+			sprintf(buffer,"\": {\"count\": %lld, \"mean\": %lld, \"p50\": %lld, \"p99\": %lld, \"max\": %lld}",
+				s.m_count,s.m_mean,s.m_p50,s.m_p99,s.m_max);
+			json += string(it == m_histograms.begin() ? "\"" : ", \"") + it->first + buffer;
+		}
+		json += "}}\n";
+		return json;
+	}
+
+
+	/******************************/
+	/* Registry                   */
+	/******************************/
+
+	MetricsRegistry::MetricsRegistry():m_stopDump(false),m_dumpInterval(1000),m_dumpFormat(DUMP_JSON)
+	{
+	}
+
+	MetricsRegistry::~MetricsRegistry()
+	{
+		StopDump();
+		for(map<string,MetricCounter*>::iterator it=m_counters.begin(); it!=m_counters.end(); ++it)
+		{
+			delete it->second;
+		}
+		for(map<string,MetricGauge*>::iterator it=m_gauges.begin(); it!=m_gauges.end(); ++it)
+		{
+			delete it->second;
+		}
+		for(map<string,MetricHistogram*>::iterator it=m_histograms.begin(); it!=m_histograms.end(); ++it)
+		{
+			delete it->second;
+		}
+	}
+
+	MetricCounter& MetricsRegistry::Counter(const string &name)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		MetricCounter *&pCounter = m_counters[name];
+		if(!pCounter)
+		{
+			pCounter = new MetricCounter;
+		}
+		return *pCounter;
+	}
+
+	MetricGauge& MetricsRegistry::Gauge(const string &name)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		MetricGauge *&pGauge = m_gauges[name];
+		if(!pGauge)
+		{
+			pGauge = new MetricGauge;
+		}
+		return *pGauge;
+	}
+
+	MetricHistogram& MetricsRegistry::Histogram(const string &name)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		MetricHistogram *&pHistogram = m_histograms[name];
+		if(!pHistogram)
+		{
+			pHistogram = new MetricHistogram;
+		}
+		return *pHistogram;
+	}
+
+	MetricsSnapshot MetricsRegistry::Snapshot() const
+	{
+		MetricsSnapshot snapshot;
+		lock_guard<mutex> lock(m_mutex);
+		snapshot.m_time = MonotonicNanoseconds();
+		for(map<string,MetricCounter*>::const_iterator it=m_counters.begin(); it!=m_counters.end(); ++it)
+		{
+			snapshot.m_counters[it->first] = it->second->Value();
+		}
+		for(map<string,MetricGauge*>::const_iterator it=m_gauges.begin(); it!=m_gauges.end(); ++it)
+		{
+			MetricsSnapshot::GaugeValue value = {it->second->Value(),it->second->Max()};
+			snapshot.m_gauges[it->first] = value;
+		}
+		for(map<string,MetricHistogram*>::const_iterator it=m_histograms.begin(); it!=m_histograms.end(); ++it)
+		{
+			snapshot.m_histograms[it->first] = it->second->Summary();
+		}
+		return snapshot;
+	}
+
+	void MetricsRegistry::Reset()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		for(map<string,MetricCounter*>::iterator it=m_counters.begin(); it!=m_counters.end(); ++it)
+		{
+			it->second->Reset();
+		}
+		for(map<string,MetricGauge*>::iterator it=m_gauges.begin(); it!=m_gauges.end(); ++it)
+		{
+			it->second->Reset();
+		}
+		for(map<string,MetricHistogram*>::iterator it=m_histograms.begin(); it!=m_histograms.end(); ++it)
+		{
+			it->second->Reset();
+		}
+	}
+
+	//
+	//Send a snapshot over a Unix domain stream socket, one connection per snapshot
+	static bool SendToUnixSocket(const string &path, const string &text)
+	{
+#ifdef _WIN32
+		return false;
+#else
+		sockaddr_un address;
+		memset(&address,0,sizeof(address));
+		if(path.size() >= sizeof(address.sun_path))
+		{
+			return false;
+		}
+		address.sun_family = AF_UNIX;
+		strcpy(address.sun_path,path.c_str());
+		SOCKET theSocket = socket(AF_UNIX,SOCK_STREAM,0);
+		if(theSocket == INVALID_SOCKET)
+		{
+			return false;
+		}
+		if(connect(theSocket,(const sockaddr*)&address,sizeof(address)) != 0)
+		{//nobody listens
+			closesocket(theSocket);
+			return false;
+		}
+		size_t sent = 0;
+		while(sent < text.size())
+		{
+			const int n = (int)send(theSocket,text.c_str() + sent,text.size() - sent,SOCKET_SEND_FLAGS);
+			if(n <= 0)
+			{
+				break;
+			}
+			sent += n;
+		}
+		closesocket(theSocket);
+		return sent == text.size();
+#endif
+	}
+
+	//
+	//Write a snapshot to a file through a temporary file, so that readers never see a partial one
+	static bool ReplaceFile(const string &fileName, const string &text)
+	{
+		const string tempName = fileName + ".tmp";
+		{
+			ofstream ofs(tempName.c_str(),ios::out | ios::trunc | ios::binary);
+			if(!ofs || !ofs.write(text.c_str(),text.size()))
+			{
+				return false;
+			}
+		}
+#ifdef _WIN32
+		remove(fileName.c_str());
+#endif
+		return rename(tempName.c_str(),fileName.c_str()) == 0;
+	}
+
+	bool MetricsRegistry::Dump(const string &target, const DumpFormat format) const
+	{
+		const MetricsSnapshot snapshot = Snapshot();
+		const string text = (format == DUMP_JSON) ? snapshot.ToJson() : snapshot.ToText();
+		if(target.compare(0,sizeof(UNIX_SOCKET_PREFIX) - 1,UNIX_SOCKET_PREFIX) == 0)
+		{
+			return SendToUnixSocket(target.substr(sizeof(UNIX_SOCKET_PREFIX) - 1),text);
+		}
+		return ReplaceFile(target,text);
+	}
+
+	bool MetricsRegistry::StartDump(const string &target, const int intervalMs, const DumpFormat format)
+	{
+#ifdef _WIN32
+		if(target.compare(0,sizeof(UNIX_SOCKET_PREFIX) - 1,UNIX_SOCKET_PREFIX) == 0)
+		{
+			return false;
+		}
+#endif
+		StopDump();
+		m_dumpTarget = target;
+		m_dumpInterval = max(intervalMs,1);
+		m_dumpFormat = format;
+		m_stopDump = false;
+		m_dumpThread = thread(&MetricsRegistry::DumpLoop,this);
+		return true;
+	}
+
+	void MetricsRegistry::StopDump()
+	{
+		{
+			lock_guard<mutex> lock(m_dumpMutex);
+			m_stopDump = true;
+		}
+		m_cvDump.notify_all();
+		if(m_dumpThread.joinable())
+		{
+			m_dumpThread.join();
+		}
+	}
+
+	void MetricsRegistry::DumpLoop()
+	{
+		unique_lock<mutex> lock(m_dumpMutex);
+		while(true)
+		{
+			const bool stop = m_cvDump.wait_for(lock,chrono::milliseconds(m_dumpInterval),[this]{ return m_stopDump; });
+			lock.unlock();
+			Dump(m_dumpTarget,m_dumpFormat);
+			lock.lock();
+			if(stop)
+			{
+				return;
+			}
+		}
+	}
+
+	MetricsRegistry& MetricsRegistry::Global()
+	{
+		//never destroyed: threads may update metrics while the process exits
+		static MetricsRegistry *pRegistry = new MetricsRegistry;
+		return *pRegistry;
+	}
+
+}
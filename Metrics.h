@@ -0,0 +1,266 @@
+/* *
+	Metrics.h
+		Process wide counters, gauges and histograms of the capture, stream
+		and robot code, with snapshots and a periodic dump
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "LatencyTracker.h"
+
+
+
+namespace rm
+{
+
+	/**********************************************************************/
+	//	Metrics
+	//	Counters and histograms are split into METRIC_SHARDS parts, every
+	//	thread updates the part of its own (picked on its first update), so
+	//	that threads updating the same metric do not share a cache line; the
+	//	parts are added up when the metric is read. An update is one relaxed
+	//	atomic add, cheap enough for once per frame or per command.
+	//
+	//	Metrics are created by name on first use and live as long as the
+	//	registry, so instrumented code keeps a reference:
+	//		static MetricCounter &s_frames = MetricsRegistry::Global().Counter("camera.captures");
+	//		s_frames.Add();
+	//	Names are "<component>.<what>", durations are in ns and end in "Ns".
+	/**********************************************************************/
+
+	static const int METRIC_SHARDS = 8;
+	static const int METRIC_CACHE_LINE = 64;
+
+	/** \brief The shard of the calling thread, in [0, METRIC_SHARDS)
+	 */
+	int MetricShard();
+
+	/************************************************************//**
+	 *	The MetricCounter class
+	 *	A monotonically increasing count (frames, bytes...)
+	 ***************************************************************/
+	class MetricCounter
+	{
+	public:
+		MetricCounter();
+
+		//the shards are cache line aligned, which new does not guarantee before C++17
+		static void* operator new(size_t size);
+		static void operator delete(void *p);
+
+		void Add(const long long n = 1)
+		{
+			m_shards[MetricShard()].m_value.fetch_add(n,std::memory_order_relaxed);
+		}
+
+		/** \brief Sum of all the shards
+		 */
+		long long Value() const;
+
+		void Reset();
+
+	private:
+		//not copyable
+		MetricCounter(const MetricCounter&);
+		MetricCounter& operator=(const MetricCounter&);
+
+		//one cache line per shard, so that threads on different shards do not share lines
+		struct alignas(METRIC_CACHE_LINE) Shard
+		{
+			std::atomic<long long>	m_value;
+		};
+
+		Shard					m_shards[METRIC_SHARDS];
+	};
+
+	/************************************************************//**
+	 *	The MetricGauge class
+	 *	A current level (queue depth...) and the highest level seen
+	 ***************************************************************/
+	class MetricGauge
+	{
+	public:
+		MetricGauge();
+
+		void Set(const long long value)
+		{
+			m_value.store(value,std::memory_order_relaxed);
+			UpdateMax(value);
+		}
+
+		void Add(const long long n)
+		{
+			UpdateMax(m_value.fetch_add(n,std::memory_order_relaxed) + n);
+		}
+
+		long long Value() const { return m_value.load(std::memory_order_relaxed); }
+		long long Max() const { return m_max.load(std::memory_order_relaxed); }
+
+		void Reset();
+
+	private:
+		//not copyable
+		MetricGauge(const MetricGauge&);
+		MetricGauge& operator=(const MetricGauge&);
+
+		void UpdateMax(const long long value)
+		{
+			long long max = m_max.load(std::memory_order_relaxed);
+			while(value > max && !m_max.compare_exchange_weak(max,value,std::memory_order_relaxed))
+			{
+			}
+		}
+
+		std::atomic<long long>	m_value;
+		std::atomic<long long>	m_max;
+	};
+
+	/************************************************************//**
+	 *	The MetricHistogram class
+	 *	A distribution of durations (see LatencyHistogram)
+	 ***************************************************************/
+	class MetricHistogram
+	{
+	public:
+		MetricHistogram();
+
+		void Record(const long long ns)
+		{
+			m_shards[MetricShard()].Record(ns);
+		}
+
+		/** \brief Statistics of all the shards
+		 */
+		LatencySummary Summary() const;
+
+		void Reset();
+
+	private:
+		//not copyable
+		MetricHistogram(const MetricHistogram&);
+		MetricHistogram& operator=(const MetricHistogram&);
+
+		LatencyHistogram		m_shards[METRIC_SHARDS];
+	};
+
+	/** \brief The values of all the metrics at one time
+	 */
+	struct MetricsSnapshot
+	{
+		struct GaugeValue
+		{
+			long long			m_value;
+			long long			m_max;
+		};
+
+		long long									m_time;		//monotonic ns
+		std::map<std::string,long long>				m_counters;
+		std::map<std::string,GaugeValue>			m_gauges;
+		std::map<std::string,LatencySummary>		m_histograms;
+
+		/** \brief One metric per line: "name value", "name value max", "name count mean p50 p99 max"
+		 */
+		std::string ToText() const;
+
+		/** \brief {"time": ..., "counters": {...}, "gauges": {...}, "histograms": {...}}
+		 */
+		std::string ToJson() const;
+	};
+
+
+	/************************************************************//**
+	 *	The MetricsRegistry class
+	 *	Owns the metrics of a process (Global()) or of a test. The dump
+	 *	thread writes a snapshot every interval to a file (replaced, so
+	 *	that it always holds one complete snapshot) or, for targets
+	 *	"unix:<path>", sends it to a Unix domain stream socket (one
+	 *	connection per snapshot, nothing is sent while nobody listens).
+	 ***************************************************************/
+	class MetricsRegistry
+	{
+	public:
+		enum DumpFormat
+		{
+			DUMP_TEXT = 0,
+			DUMP_JSON
+		};
+
+		MetricsRegistry();
+		~MetricsRegistry();
+
+		/** \brief The metric of a name, created on first use; the reference stays valid
+		 */
+		MetricCounter& Counter(const std::string &name);
+		MetricGauge& Gauge(const std::string &name);
+		MetricHistogram& Histogram(const std::string &name);
+
+		MetricsSnapshot Snapshot() const;
+
+		/** \brief Set all the metrics to zero (they stay registered)
+		 */
+		void Reset();
+
+		/** \brief Start writing a snapshot every interval
+		 *	\param[in] target A file name, or "unix:<socket path>"
+		 *	\param[in] intervalMs Time between two snapshots
+		 *	\param[in] format Text or JSON
+		 *	\return False if the target is not supported on this platform
+		 */
+		bool StartDump(const std::string &target, const int intervalMs, const DumpFormat format = DUMP_JSON);
+
+		/** \brief Write a last snapshot and stop the dump thread
+		 */
+		void StopDump();
+
+		/** \brief Write one snapshot to a target, as the dump thread does
+		 *	\return False if it could not be written
+		 */
+		bool Dump(const std::string &target, const DumpFormat format) const;
+
+		/** \brief The registry of the process, used by the instrumented classes
+		 */
+		static MetricsRegistry& Global();
+
+	private:
+		//not copyable
+		MetricsRegistry(const MetricsRegistry&);
+		MetricsRegistry& operator=(const MetricsRegistry&);
+
+		void DumpLoop();
+
+		mutable std::mutex							m_mutex;
+		std::map<std::string,MetricCounter*>		m_counters;
+		std::map<std::string,MetricGauge*>			m_gauges;
+		std::map<std::string,MetricHistogram*>		m_histograms;
+
+		//dump thread
+		std::thread									m_dumpThread;
+		std::mutex									m_dumpMutex;
+		std::condition_variable						m_cvDump;
+		bool										m_stopDump;
+		std::string									m_dumpTarget;
+		int											m_dumpInterval;
+		DumpFormat									m_dumpFormat;
+	};
+
+};//namespace rm
+
+
+
+#endif //METRICS_H_
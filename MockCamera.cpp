@@ -0,0 +1,450 @@
+/* *
+	MockCamera.cpp
+		The Implementation of the synthetic camera
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "MockCamera.h"
+#include "FileIO.h"
+
+#include <stdio.h>
+#include <chrono>
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//number of precomputed pattern frames, the capture cycles through them
+	static const int NUM_PATTERNS = 8;
+
+	struct MockCamera::Image
+	{
+		string				m_name;
+		int					m_height;
+		int					m_width;
+		int					m_type;
+		vector<cv::Mat>		m_patterns;
+	};
+
+	MockCamera::MockCamera():m_frameRate(0),m_nextGrabTime(0),m_numGrabbed(0),m_extension(".png"),m_stopGrab(false),
+		m_streamId(-1),m_asyncSave(false)
+	{
+	}
+
+	MockCamera::~MockCamera()
+	{
+		try
+		{
+			ShutDown();
+		}
+		catch(...)
+		{//a saver error was for the caller of ShutDown, the streams are closed anyway
+		}
+		ClearImages();
+	}
+
+	void MockCamera::AddImage(const string &name, const int height, const int width, const int type)
+	{
+		if(m_grabThread.joinable())
+		{//the grab thread reads the images
+			throw("MockCamera::AddImage: the camera is grabbing");
+		}
+		if(type != CV_8UC3 && type != CV_8U && type != CV_16U)
+		{
+			throw("MockCamera::AddImage: unsupported image format");
+		}
+		Image *pImage = new Image;
+		pImage->m_name = name;
+		pImage->m_height = height;
+		pImage->m_width = width;
+		pImage->m_type = type;
+		BuildPatterns(*pImage);
+		m_images.push_back(pImage);
+	}
+
+	void MockCamera::ClearImages()
+	{
+		if(m_grabThread.joinable())
+		{
+			throw("MockCamera::ClearImages: the camera is grabbing");
+		}
+		CloseStreams();
+		for(size_t i=0; i<m_images.size(); i++)
+		{
+			delete m_images[i];
+		}
+		m_images.clear();
+	}
+
+	void MockCamera::SetFrameRate(const float frameRate)
+	{
+		m_frameRate = frameRate;
+		m_nextGrabTime = 0;
+	}
+
+	void MockCamera::SetAsyncSave(const bool enable)
+	{
+		CloseStreams();
+		m_asyncSave = enable;
+	}
+
+	//
+	//Diagonal ramps that move with the pattern index. The 16-bit images look like
+	//depth maps (0.5m to 4.5m in mm), so that they compress like real data.
+	void MockCamera::BuildPatterns(Image &image)
+	{
+		image.m_patterns.resize(NUM_PATTERNS);
+		for(int p=0; p<NUM_PATTERNS; p++)
+		{
+			cv::Mat &pattern = image.m_patterns[p];
+			pattern.create(image.m_height,image.m_width,image.m_type);
+			for(int r=0; r<image.m_height; r++)
+			{
+				if(image.m_type == CV_16U)
+				{
+					uInt16 *pRow = (uInt16*)pattern.ptr(r);
+					for(int c=0; c<image.m_width; c++)
+					{
+						pRow[c] = (uInt16)(500 + (r*3 + c + p*16) % 4000);
+					}
+				}
+				else if(image.m_type == CV_8U)
+				{
+					unsigned char *pRow = pattern.ptr(r);
+					for(int c=0; c<image.m_width; c++)
+					{
+						pRow[c] = (unsigned char)(r + c + p*8);
+					}
+				}
+				else
+				{
+					unsigned char *pRow = pattern.ptr(r);
+					for(int c=0; c<image.m_width; c++)
+					{
+						pRow[3*c] = (unsigned char)(c + p*8);
+						pRow[3*c+1] = (unsigned char)r;
+						pRow[3*c+2] = (unsigned char)((r + c)/2);
+					}
+				}
+			}
+		}
+	}
+
+	void MockCamera::GrabOne()
+	{
+		if(m_frameRate > 0)
+		{//pace to the frame rate, do not try to catch up after a stall
+			const long long period = (long long)(1e9/m_frameRate);
+			long long now = MonotonicNanoseconds();
+			if(m_nextGrabTime == 0 || now > m_nextGrabTime + period)
+			{
+				m_nextGrabTime = now;
+			}
+			if(m_nextGrabTime > now)
+			{
+				this_thread::sleep_for(chrono::nanoseconds(m_nextGrabTime - now));
+			}
+			m_nextGrabTime += period;
+		}
+
+		if(!BeginCapture())
+		{//all slots held by readers, like a real camera this capture is lost
+			m_numGrabbed++;
+			return;
+		}
+		for(size_t k=0; k<m_images.size(); k++)
+		{
+			m_images[k]->m_patterns[m_numGrabbed % NUM_PATTERNS].copyTo(CaptureImage((int)k));
+		}
+		//the frame counter serves as device clock
+		SetCaptureTiming(0,m_numGrabbed);
+		PublishCapture();
+		m_numGrabbed++;
+	}
+
+	const string& MockCamera::FileNameExtension(const int index) const
+	{
+		return m_extension;
+	}
+
+	int MockCamera::Height(const int index) const
+	{
+		return m_images.at(index)->m_height;
+	}
+
+	int MockCamera::Width(const int index) const
+	{
+		return m_images.at(index)->m_width;
+	}
+
+	float MockCamera::FrameRate(const int index) const
+	{
+		return m_frameRate;
+	}
+
+	int MockCamera::TriggerMode(const int index) const
+	{
+		return 0;
+	}
+
+	void MockCamera::ConfigCamera(const CameraSettings &camSettings, const int index)
+	{
+	}
+
+	int MockCamera::Channels(const int index) const
+	{
+		return m_images.at(index)->m_type == CV_8UC3 ? 3 : 1;
+	}
+
+	int MockCamera::BytesPerPixel(const int index) const
+	{
+		return m_images.at(index)->m_type == CV_16U ? 2 : 1;
+	}
+
+	bool MockCamera::IsVizEnabled(const int index) const
+	{
+		return true;
+	}
+
+	void MockCamera::GetVizImage(cv::Mat &vizIma, const int index) const
+	{
+		FrameHandle frame = AcquireFrame(index);
+		const cv::Mat &image = frame.Mat();
+		if(image.empty())
+		{
+			vizIma.release();
+			return;
+		}
+		if(image.type() == CV_16U)
+		{
+			vizIma.create(image.rows,image.cols,CV_8U);
+			VisibleDepth((const uInt16*)image.ptr(),vizIma.ptr(),image.rows*image.cols);
+		}
+		else
+		{
+			image.copyTo(vizIma);
+		}
+	}
+
+	int MockCamera::NumImages() const
+	{
+		return (int)m_images.size();
+	}
+
+	const string& MockCamera::ImageName(const int index) const
+	{
+		return m_images.at(index)->m_name;
+	}
+
+	void MockCamera::ImportSettings(const string &fn, const char *secName)
+	{
+		Settings settings(fn);
+		ImportSettings(settings,secName);
+	}
+
+	//
+	//A free running camera is stopped while its images are replaced and restarted afterwards
+	void MockCamera::ImportSettings(const Settings &settings, const char *secName)
+	{
+		const bool grabbing = m_grabThread.joinable();
+		StopGrab();
+		double dSetting;
+		string strSetting;
+		int numImages = 1;
+		if(settings.ReadSetting(secName,"numImages",dSetting,true))
+		{
+			numImages = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"frameRate",dSetting,true))
+		{
+			SetFrameRate((float)dSetting);
+		}
+		if(settings.ReadSetting(secName,"asyncSave",dSetting,true))
+		{
+			SetAsyncSave(dSetting != 0);
+		}
+		m_saver.ImportSettings(settings,secName);
+		ClearImages();
+		for(int i=0; i<numImages; i++)
+		{
+			char key[32];
+			int height = 480, width = 640, type = CV_16U;
+			sprintf(key,"height%d",i);
+			if(settings.ReadSetting(secName,key,dSetting,true))
+			{
+				height = (int)dSetting;
+			}
+			sprintf(key,"width%d",i);
+			if(settings.ReadSetting(secName,key,dSetting,true))
+			{
+				width = (int)dSetting;
+			}
+			sprintf(key,"format%d",i);
+			if(settings.ReadSetting(secName,key,strSetting,true))
+			{
+				if(strSetting == "8UC3")
+				{
+					type = CV_8UC3;
+				}
+				else if(strSetting == "8U")
+				{
+					type = CV_8U;
+				}
+				else if(strSetting == "16U")
+				{
+					type = CV_16U;
+				}
+				else
+				{
+					throw("MockCamera::ImportSettings: unknown image format");
+				}
+			}
+			string name;
+			sprintf(key,"name%d",i);
+			if(!settings.ReadSetting(secName,key,name,true))
+			{
+				sprintf(key,"image%d",i);
+				name = key;
+			}
+			AddImage(name,height,width,type);
+		}
+		if(grabbing)
+		{
+			StartGrab();
+		}
+	}
+
+	int MockCamera::Init(void* pData)
+	{
+		if(m_images.empty())
+		{//VGA depth like most of our sensors
+			AddImage("depth",480,640,CV_16U);
+		}
+		return 0;
+	}
+
+	//
+	//Capture continuously on a thread of its own, like a free running camera
+	void MockCamera::StartGrab()
+	{
+		if(m_grabThread.joinable())
+		{
+			return;
+		}
+		m_stopGrab = false;
+		m_grabThread = thread(&MockCamera::GrabLoop,this);
+	}
+
+	void MockCamera::GrabLoop()
+	{
+		while(!m_stopGrab)
+		{
+			GrabOne();
+		}
+	}
+
+	void MockCamera::StopGrab()
+	{
+		m_stopGrab = true;
+		if(m_grabThread.joinable())
+		{
+			m_grabThread.join();
+		}
+	}
+
+	void MockCamera::SetSavePath(const string &saveDir,const string &prefix)
+	{
+		m_saveDir = saveDir;
+		if(!m_saveDir.empty() && m_saveDir[m_saveDir.size()-1] != '/' && m_saveDir[m_saveDir.size()-1] != '\\')
+		{
+			m_saveDir += "/";
+		}
+		m_savePrefix = prefix;
+		CloseStreams();
+	}
+
+	void MockCamera::SaveData(const int frameId, const int streamId)
+	{
+		if(PublishedCaptures() == 0)
+		{//nothing captured yet
+			return;
+		}
+		if(m_asyncSave)
+		{
+			if(!m_saver.IsRunning())
+			{
+				m_saver.Start(*this,m_saveDir,m_savePrefix);
+			}
+			m_saver.Save(*this,frameId,streamId);
+			return;
+		}
+		//all the images of one capture, the grab thread may publish the next one meanwhile
+		vector<FrameHandle> frames;
+		if(!AcquireCapture(frames))
+		{
+			return;
+		}
+		char buffer[64];
+		if(streamId == -1)
+		{
+			for(size_t k=0; k<frames.size(); k++)
+			{
+				sprintf(buffer,"%04d",frameId);
+				cv::imwrite(m_saveDir + m_savePrefix + ImageName((int)k) + buffer + m_extension,frames[k].Mat());
+			}
+			return;
+		}
+
+		if(streamId != m_streamId)
+		{
+			CloseStreams();
+			for(int k=0; k<NumImages(); k++)
+			{
+				sprintf(buffer,"_stream%03d.bin",streamId);
+				ImageSequenceIO *pStream = new ImageSequenceIO;
+				m_streams.push_back(pStream);
+				ImageSequenceHeader header;
+				header.m_imaHeight = Height(k);
+				header.m_imaWidth = Width(k);
+				header.m_imaChannels = Channels(k);
+				header.m_imaBytesPerPixel = BytesPerPixel(k);
+				pStream->SetWriteHeader(header);
+				pStream->OpenWriteStream(m_saveDir + m_savePrefix + ImageName(k) + buffer);
+				pStream->WriteHeader();
+			}
+			m_streamId = streamId;
+		}
+		for(size_t k=0; k<frames.size() && k<m_streams.size(); k++)
+		{
+			m_streams[k]->WriteFrameToStream(frames[k],frameId);
+		}
+	}
+
+	//
+	//Close the stream files of both save paths, then report the error of the saver thread if any
+	void MockCamera::CloseStreams()
+	{
+		for(size_t i=0; i<m_streams.size(); i++)
+		{
+			m_streams[i]->CloseWriteStream();
+			delete m_streams[i];
+		}
+		m_streams.clear();
+		m_streamId = -1;
+		m_saver.ShutDown();
+	}
+
+	void MockCamera::ShutDown()
+	{
+		StopGrab();
+		CloseStreams();
+	}
+
+}
@@ -0,0 +1,128 @@
+/* *
+	MockCamera.h
+		A synthetic camera for testing and benchmarking without hardware
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef MOCK_CAMERA_H_
+#define MOCK_CAMERA_H_
+
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "BufferedCamera.h"
+#include "AsyncSaver.h"
+
+
+
+namespace rm
+{
+
+	class ImageSequenceIO;
+
+	/************************************************************//**
+	 *	The MockCamera class
+	 *	Generates moving test patterns for any number of images per
+	 *	capture (8UC3, 8U or 16U), either as fast as possible or paced
+	 *	to a frame rate. A capture costs one memcpy per image, about
+	 *	what a real SDK costs when it hands over a DMA buffer.
+	 *
+	 *	Settings (section "Camera" by default, like every camera):
+	 *		numImages, frameRate (0 = unbounded),
+	 *		height<i>, width<i>, format<i> (8UC3|8U|16U), name<i>,
+	 *		asyncSave (0|1) and the AsyncSaver settings
+	 ***************************************************************/
+	class MockCamera : public BufferedCamera
+	{
+	public:
+		MockCamera();
+		virtual ~MockCamera();
+
+		/** \brief Add an image to every capture (not while grabbing)
+		 *	\param[in] name The image name (used for file names)
+		 *	\param[in] height, width The resolution
+		 *	\param[in] type CV_8UC3, CV_8U or CV_16U
+		 */
+		void AddImage(const std::string &name, const int height, const int width, const int type);
+
+		/** \brief Remove all the images (not while grabbing)
+		 */
+		void ClearImages();
+
+		/** \brief Set the pace of GrabOne
+		 *	\param[in] frameRate Captures per second, 0 = as fast as possible
+		 */
+		void SetFrameRate(const float frameRate);
+
+		/** \brief Save through an AsyncSaver instead of in SaveData (default false)
+		 *	The saver is started by the first SaveData and drained by ShutDown or SetSavePath.
+		 */
+		void SetAsyncSave(const bool enable);
+
+		/** \brief The saver used with SetAsyncSave, for its options and counters
+		 */
+		AsyncSaver& Saver() { return m_saver; }
+		const AsyncSaver& Saver() const { return m_saver; }
+
+		//Camera interface
+		virtual void GrabOne();
+		virtual const std::string& FileNameExtension(const int index = 0) const;
+		virtual int Height(const int index = 0) const;
+		virtual int Width(const int index = 0) const;
+		virtual float FrameRate(const int index = 0) const;
+		virtual int TriggerMode(const int index = 0) const;
+		virtual void ConfigCamera(const CameraSettings &camSettings, const int index = 0);
+		virtual int Channels(const int index = 0) const;
+		virtual int BytesPerPixel(const int index = 0) const;
+		virtual bool IsVizEnabled(const int index = 0) const;
+		virtual void GetVizImage(cv::Mat &vizIma, const int index = 0) const;
+		virtual int NumImages() const;
+		virtual const std::string& ImageName(const int index = 0) const;
+		virtual void ImportSettings(const std::string &fn, const char *secName = "Camera");
+		virtual void ImportSettings(const Settings &settings, const char *secName = "Camera");
+		virtual int Init(void* pData = NULL);
+		virtual void StartGrab();
+		virtual void SetSavePath(const std::string &saveDir,const std::string &prefix);
+		virtual void SaveData(const int frameId, const int streamId = -1);
+		virtual void ShutDown();
+
+	private:
+		struct Image;
+
+		void BuildPatterns(Image &image);
+		void GrabLoop();
+		void StopGrab();
+		void CloseStreams();
+
+		std::vector<Image*>			m_images;
+		float						m_frameRate;
+		long long					m_nextGrabTime;	//monotonic ns, 0 = not started
+		long long					m_numGrabbed;
+		std::string					m_extension;
+
+		//free running capture thread (StartGrab)
+		std::thread					m_grabThread;
+		std::atomic<bool>			m_stopGrab;
+
+		//saving
+		std::string					m_saveDir;
+		std::string					m_savePrefix;
+		int							m_streamId;		//stream files currently open, -1 = none
+		std::vector<ImageSequenceIO*>	m_streams;	//one per image
+		bool						m_asyncSave;
+		AsyncSaver					m_saver;
+	};
+
+};//namespace rm
+
+
+
+#endif //MOCK_CAMERA_H_
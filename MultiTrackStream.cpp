@@ -0,0 +1,547 @@
+/* *
+	MultiTrackStream.cpp
+		The Implementation of the multi-track stream writer and reader
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "MultiTrackStream.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include <opencv2\opencv.hpp>
+
+#include "Camera.h"
+#include "FramePool.h"
+#include "StreamCodec.h"
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//number of int fields before the track entries
+	static const int MULTI_TRACK_HEADER_FIELDS = 6;
+	//number of int fields of a track entry, followed by the name
+	static const int MULTI_TRACK_ENTRY_FIELDS = 8;
+	static const size_t MULTI_TRACK_ENTRY_SIZE = MULTI_TRACK_ENTRY_FIELDS*sizeof(int) + MULTI_TRACK_NAME_SIZE;
+
+	//
+	//[int frameId][int numTracks][int64 grabTime][int64 deviceTime][int payloadSize[numTracks]]
+	static size_t RecordPrefixSize(const int numTracks)
+	{
+		return 2*sizeof(int) + 2*sizeof(long long) + numTracks*sizeof(int);
+	}
+
+	bool IsMultiTrackStream(const std::string &fileName)
+	{
+		ifstream ifs(fileName.c_str(),ios::in|ios::binary);
+		int magic = 0;
+		return ifs.read((char*)&magic,sizeof(int)) && magic == MULTI_TRACK_MAGIC;
+	}
+
+
+	/******************************/
+	/* MultiTrackStreamWriter     */
+	/******************************/
+
+	MultiTrackStreamWriter::MultiTrackStreamWriter():m_pLatencyTracker(&LatencyTracker::Global())
+	{
+	}
+
+	MultiTrackStreamWriter::~MultiTrackStreamWriter()
+	{
+		Close();
+	}
+
+	int MultiTrackStreamWriter::AddTrack(const ImageSequenceHeader &header, const std::string &name, const int codec /*= STREAM_CODEC_NONE*/)
+	{
+		if(m_writer.IsOpen())
+		{
+			throw("MultiTrackStreamWriter::AddTrack: the stream is already open");
+		}
+		TrackInfo track;
+		track.m_header = header;
+		track.m_pixelFormat = FramePool::TypeOf(header.m_imaChannels,header.m_imaBytesPerPixel);
+		track.m_codec = codec;
+		track.m_name = name.substr(0,MULTI_TRACK_NAME_SIZE - 1);
+		if(track.m_pixelFormat < 0 || header.totalSize() <= 0)
+		{
+			throw("MultiTrackStreamWriter::AddTrack: unsupported image format");
+		}
+		if(codec != STREAM_CODEC_NONE && codec != STREAM_CODEC_RMZ)
+		{
+			throw("MultiTrackStreamWriter::AddTrack: unknown codec");
+		}
+		m_tracks.push_back(track);
+		return (int)m_tracks.size() - 1;
+	}
+
+	void MultiTrackStreamWriter::AddCameraTracks(const Camera &camera, const int codec /*= STREAM_CODEC_NONE*/)
+	{
+		for(int i=0; i<camera.NumImages(); i++)
+		{
+			ImageSequenceHeader header;
+			header.m_imaHeight = camera.Height(i);
+			header.m_imaWidth = camera.Width(i);
+			header.m_imaChannels = camera.Channels(i);
+			header.m_imaBytesPerPixel = camera.BytesPerPixel(i);
+			AddTrack(header,camera.ImageName(i),codec);
+		}
+	}
+
+	void MultiTrackStreamWriter::ClearTracks()
+	{
+		if(m_writer.IsOpen())
+		{
+			throw("MultiTrackStreamWriter::ClearTracks: the stream is open");
+		}
+		m_tracks.clear();
+	}
+
+	void MultiTrackStreamWriter::SetAsyncOptions(const AsyncStreamWriter::Options &options)
+	{
+		m_asyncOptions = options;
+	}
+
+	void MultiTrackStreamWriter::SetLatencyTracker(LatencyTracker *pTracker)
+	{
+		m_pLatencyTracker = pTracker;
+	}
+
+	void MultiTrackStreamWriter::Open(const std::string &fileName)
+	{
+		Close();
+		if(m_tracks.empty())
+		{
+			throw("MultiTrackStreamWriter::Open: no track");
+		}
+		const int numTracks = (int)m_tracks.size();
+		size_t recordBound = RecordPrefixSize(numTracks);
+		for(int t=0; t<numTracks; t++)
+		{
+			const size_t rawSize = m_tracks[t].m_header.totalSize();
+			recordBound += (m_tracks[t].m_codec == STREAM_CODEC_RMZ) ? RmzCompressBound(rawSize) : rawSize;
+		}
+		AsyncStreamWriter::Options options = m_asyncOptions;
+		if(options.m_slotSize == 0)
+		{
+			options.m_slotSize = recordBound;
+		}
+		m_writer.SetLatencyTracker(m_pLatencyTracker);
+		if(!m_writer.Open(fileName,options))
+		{
+			throw("MultiTrackStreamWriter::Open: failed to open the file stream");
+		}
+
+		const size_t headerSize = MULTI_TRACK_HEADER_FIELDS*sizeof(int) + numTracks*MULTI_TRACK_ENTRY_SIZE;
+		vector<unsigned char> header(headerSize,0);
+		const int fields[MULTI_TRACK_HEADER_FIELDS] = {MULTI_TRACK_MAGIC,MULTI_TRACK_VERSION,(int)headerSize,numTracks,0,0};
+		memcpy(&header[0],fields,sizeof(fields));
+		for(int t=0; t<numTracks; t++)
+		{
+			const TrackInfo &track = m_tracks[t];
+			const int entry[MULTI_TRACK_ENTRY_FIELDS] =
+			{
+				track.m_header.m_imaHeight,
+				track.m_header.m_imaWidth,
+				track.m_header.m_imaChannels,
+				track.m_header.m_imaBytesPerPixel,
+				track.m_pixelFormat,
+				track.m_codec,
+				0,
+				0
+			};
+			unsigned char *pEntry = &header[sizeof(fields) + t*MULTI_TRACK_ENTRY_SIZE];
+			memcpy(pEntry,entry,sizeof(entry));
+			memcpy(pEntry + sizeof(entry),track.m_name.c_str(),track.m_name.size());
+		}
+		m_writer.Write(&header[0],header.size());
+		m_prefix.resize(RecordPrefixSize(numTracks));
+		m_record.reserve(recordBound);
+	}
+
+	void MultiTrackStreamWriter::Close()
+	{
+		if(m_writer.IsOpen())
+		{
+			m_writer.Close();
+		}
+	}
+
+	void MultiTrackStreamWriter::WriteCapture(const std::vector<cv::Mat> &images, const int frameId, const FrameTiming &timing)
+	{
+		WriteCapture(images.empty() ? NULL : &images[0],(int)images.size(),frameId,timing);
+	}
+
+	//
+	//The payloads are gathered into one record, which is the unit the background writer queues (and drops)
+	void MultiTrackStreamWriter::WriteCapture(const cv::Mat *pImages, const int count, const int frameId, const FrameTiming &timing)
+	{
+		if(!m_writer.IsOpen())
+		{
+			throw("MultiTrackStreamWriter::WriteCapture: the stream is not open");
+		}
+		const int numTracks = (int)m_tracks.size();
+		if(count != numTracks)
+		{
+			throw("MultiTrackStreamWriter::WriteCapture: one image per track is needed");
+		}
+		m_record.clear();
+		unsigned char *pSizes = &m_prefix[2*sizeof(int) + 2*sizeof(long long)];
+		for(int t=0; t<numTracks; t++)
+		{
+			const TrackInfo &track = m_tracks[t];
+			const cv::Mat &image = pImages[t];
+			const size_t rowSize = (size_t)track.m_header.m_imaWidth*track.m_header.m_imaChannels*track.m_header.m_imaBytesPerPixel;
+			if(image.rows != track.m_header.m_imaHeight || image.cols*image.elemSize() != rowSize)
+			{
+				throw("MultiTrackStreamWriter::WriteCapture: the image does not match its track");
+			}
+			const size_t start = m_record.size();
+			int payloadSize;
+			if(track.m_codec == STREAM_CODEC_RMZ)
+			{
+				const size_t rawSize = rowSize*image.rows;
+				m_record.resize(start + RmzCompressBound(rawSize));
+				m_scratch.resize(RmzCompressScratchSize(rawSize));
+				payloadSize = (int)RmzCompress(image.ptr(),image.step,image.rows,track.m_header.m_imaWidth*track.m_header.m_imaChannels,
+					track.m_header.m_imaChannels,track.m_header.m_imaBytesPerPixel,&m_record[start],&m_scratch[0]);
+				m_record.resize(start + payloadSize);
+			}
+			else
+			{
+				payloadSize = (int)(rowSize*image.rows);
+				m_record.resize(start + payloadSize);
+				for(int r=0; r<image.rows; r++)
+				{
+					memcpy(&m_record[start + r*rowSize],image.ptr(r),rowSize);
+				}
+			}
+			memcpy(pSizes + t*sizeof(int),&payloadSize,sizeof(int));
+		}
+		memcpy(&m_prefix[0],&frameId,sizeof(int));
+		memcpy(&m_prefix[sizeof(int)],&numTracks,sizeof(int));
+		memcpy(&m_prefix[2*sizeof(int)],&timing.m_grabTime,sizeof(long long));
+		memcpy(&m_prefix[2*sizeof(int) + sizeof(long long)],&timing.m_deviceTime,sizeof(long long));
+
+		const bool track = m_pLatencyTracker && timing.m_availableTime > 0;
+		m_writer.WriteRecord(&m_prefix[0],m_prefix.size(),m_record.empty() ? NULL : &m_record[0],m_record.size(),frameId,track ? &timing : NULL);
+	}
+
+	//
+	//All the tracks come from one capture, its frames are held until the record is queued
+	void MultiTrackStreamWriter::WriteCapture(const Camera &camera, const int frameId)
+	{
+		const int numTracks = (int)m_tracks.size();
+		vector<FrameHandle> frames;
+		if(!camera.AcquireCapture(frames) || (int)frames.size() < numTracks)
+		{
+			throw("MultiTrackStreamWriter::WriteCapture: no image available");
+		}
+		vector<cv::Mat> images(numTracks);
+		for(int t=0; t<numTracks; t++)
+		{
+			images[t] = frames[t].Mat();
+		}
+		WriteCapture(images,frameId,frames[0].Timing());
+	}
+
+
+	/******************************/
+	/* MultiTrackStreamReader     */
+	/******************************/
+
+	MultiTrackStreamReader::MultiTrackStreamReader():m_memoryMapped(false),m_fileSize(0),m_headerSize(0),m_nextOffset(0),
+		m_readFrameId(-1),m_indexValid(false)
+	{
+	}
+
+	MultiTrackStreamReader::~MultiTrackStreamReader()
+	{
+		Close();
+	}
+
+	void MultiTrackStreamReader::SetMemoryMapped(const bool enable)
+	{
+		m_memoryMapped = enable;
+	}
+
+	void MultiTrackStreamReader::Open(const std::string &fileName)
+	{
+		Close();
+		if(!m_memoryMapped || !m_mappedFile.Open(fileName))
+		{
+			m_ifs.open(fileName.c_str(),ios::in|ios::binary);
+			if(!m_ifs.is_open())
+			{
+				throw("MultiTrackStreamReader::Open: failed to open the file stream");
+			}
+			m_ifs.seekg(0,ios::end);
+			m_fileSize = (long long)m_ifs.tellg();
+		}
+		else
+		{
+			m_fileSize = (long long)m_mappedFile.Size();
+		}
+
+		int fields[MULTI_TRACK_HEADER_FIELDS];
+		if(!ReadBytes(0,fields,sizeof(fields)) || fields[0] != MULTI_TRACK_MAGIC || fields[1] < 1 || fields[1] > MULTI_TRACK_VERSION ||
+			fields[3] <= 0 || fields[2] < (int)(sizeof(fields) + fields[3]*MULTI_TRACK_ENTRY_SIZE))
+		{
+			Close();
+			throw("MultiTrackStreamReader::Open: error in reading header - not a multi-track stream");
+		}
+		m_headerSize = (size_t)fields[2];
+		const int numTracks = fields[3];
+		m_tracks.resize(numTracks);
+		for(int t=0; t<numTracks; t++)
+		{
+			unsigned char entry[MULTI_TRACK_ENTRY_SIZE];
+			int values[MULTI_TRACK_ENTRY_FIELDS];
+			if(!ReadBytes(sizeof(fields) + t*MULTI_TRACK_ENTRY_SIZE,entry,sizeof(entry)))
+			{
+				Close();
+				throw("MultiTrackStreamReader::Open: error in reading header - file too short");
+			}
+			memcpy(values,entry,sizeof(values));
+			TrackInfo &track = m_tracks[t];
+			track.m_header.m_imaHeight = values[0];
+			track.m_header.m_imaWidth = values[1];
+			track.m_header.m_imaChannels = values[2];
+			track.m_header.m_imaBytesPerPixel = values[3];
+			track.m_pixelFormat = values[4];
+			track.m_codec = values[5];
+			const char *pName = (const char*)entry + sizeof(values);
+			track.m_name.assign(pName,strnlen(pName,MULTI_TRACK_NAME_SIZE));
+			if(track.m_pixelFormat != FramePool::TypeOf(values[2],values[3]) || track.m_header.totalSize() <= 0)
+			{
+				Close();
+				throw("MultiTrackStreamReader::Open: error in reading header - unknown image format");
+			}
+		}
+		m_images.assign(numTracks,cv::Mat());
+		m_payloadSizes.resize(numTracks);
+		m_nextOffset = (long long)m_headerSize;
+	}
+
+	void MultiTrackStreamReader::Close()
+	{
+		//the images may point into the mapped file
+		m_images.clear();
+		m_mappedFile.Close();
+		if(m_ifs.is_open())
+		{
+			m_ifs.close();
+		}
+		m_ifs.clear();
+		m_tracks.clear();
+		m_index.clear();
+		m_indexValid = false;
+		m_fileSize = 0;
+		m_nextOffset = 0;
+		m_readFrameId = -1;
+		m_readTiming = FrameTiming();
+	}
+
+	int MultiTrackStreamReader::FindTrack(const std::string &name) const
+	{
+		for(size_t t=0; t<m_tracks.size(); t++)
+		{
+			if(m_tracks[t].m_name == name)
+			{
+				return (int)t;
+			}
+		}
+		return -1;
+	}
+
+	bool MultiTrackStreamReader::ReadBytes(const long long offset, void *pDst, const size_t size)
+	{
+		if(offset < 0 || offset + (long long)size > m_fileSize)
+		{
+			return false;
+		}
+		if(m_mappedFile.IsOpen())
+		{
+			memcpy(pDst,m_mappedFile.Data() + offset,size);
+			return true;
+		}
+		m_ifs.clear();
+		m_ifs.seekg(offset,ios::beg);
+		return (bool)m_ifs.read((char*)pDst,size);
+	}
+
+	//
+	//Parse the record prefix at offset, fails at the end of the file and for a truncated last record
+	bool MultiTrackStreamReader::ReadPrefix(const long long offset, std::vector<int> &sizes, int &frameId, FrameTiming &timing, long long &recordSize)
+	{
+		const int numTracks = (int)m_tracks.size();
+		const size_t prefixSize = RecordPrefixSize(numTracks);
+		unsigned char prefix[256];
+		vector<unsigned char> largePrefix;
+		unsigned char *pPrefix = prefix;
+		if(prefixSize > sizeof(prefix))
+		{
+			largePrefix.resize(prefixSize);
+			pPrefix = &largePrefix[0];
+		}
+		if(!ReadBytes(offset,pPrefix,prefixSize))
+		{
+			return false;
+		}
+		int count;
+		memcpy(&frameId,pPrefix,sizeof(int));
+		memcpy(&count,pPrefix + sizeof(int),sizeof(int));
+		memcpy(&timing.m_grabTime,pPrefix + 2*sizeof(int),sizeof(long long));
+		memcpy(&timing.m_deviceTime,pPrefix + 2*sizeof(int) + sizeof(long long),sizeof(long long));
+		if(count != numTracks)
+		{
+			throw("MultiTrackStreamReader::ReadNextCapture: corrupted capture");
+		}
+		recordSize = (long long)prefixSize;
+		for(int t=0; t<numTracks; t++)
+		{
+			memcpy(&sizes[t],pPrefix + 2*sizeof(int) + 2*sizeof(long long) + t*sizeof(int),sizeof(int));
+			if(sizes[t] < 0)
+			{
+				throw("MultiTrackStreamReader::ReadNextCapture: corrupted capture");
+			}
+			recordSize += sizes[t];
+		}
+		return offset + recordSize <= m_fileSize;
+	}
+
+	int MultiTrackStreamReader::ReadNextCapture()
+	{
+		return ReadRecord(-1);
+	}
+
+	int MultiTrackStreamReader::ReadNextTrack(const int track)
+	{
+		if(track < 0 || track >= (int)m_tracks.size())
+		{
+			throw("MultiTrackStreamReader::ReadNextTrack: no such track");
+		}
+		return ReadRecord(track);
+	}
+
+	//
+	//Read the tracks of the next record (all of them for track == -1), the skipped
+	//tracks are left empty
+	int MultiTrackStreamReader::ReadRecord(const int track)
+	{
+		int frameId;
+		long long recordSize;
+		FrameTiming timing;
+		if(m_tracks.empty() || !ReadPrefix(m_nextOffset,m_payloadSizes,frameId,timing,recordSize))
+		{
+			return -1;
+		}
+		long long offset = m_nextOffset + (long long)RecordPrefixSize((int)m_tracks.size());
+		for(size_t t=0; t<m_tracks.size(); t++)
+		{
+			const TrackInfo &info = m_tracks[t];
+			const int payloadSize = m_payloadSizes[t];
+			cv::Mat &image = m_images[t];
+			if(track >= 0 && track != (int)t)
+			{
+				image = cv::Mat();
+				offset += payloadSize;
+				continue;
+			}
+			const int rawSize = info.m_header.totalSize();
+			const unsigned char *pMapped = m_mappedFile.IsOpen() ? m_mappedFile.Data() + offset : NULL;
+			if(info.m_codec == STREAM_CODEC_NONE)
+			{
+				if(payloadSize != rawSize)
+				{
+					throw("MultiTrackStreamReader::ReadNextCapture: corrupted capture");
+				}
+				if(pMapped)
+				{//zero-copy, the mapping is private so the image may even be modified
+					image = cv::Mat(info.m_header.m_imaHeight,info.m_header.m_imaWidth,info.m_pixelFormat,(void*)pMapped);
+				}
+				else
+				{
+					image.create(info.m_header.m_imaHeight,info.m_header.m_imaWidth,info.m_pixelFormat);
+					ReadBytes(offset,image.ptr(),rawSize);
+				}
+			}
+			else
+			{
+				if(!pMapped)
+				{
+					m_payload.resize(max(payloadSize,1));
+					ReadBytes(offset,&m_payload[0],payloadSize);
+				}
+				image.create(info.m_header.m_imaHeight,info.m_header.m_imaWidth,info.m_pixelFormat);
+				m_scratch.resize(rawSize);
+				if(info.m_codec != STREAM_CODEC_RMZ ||
+					!RmzDecompress(pMapped ? pMapped : &m_payload[0],payloadSize,image.ptr(),image.step,image.rows,
+					info.m_header.m_imaWidth*info.m_header.m_imaChannels,info.m_header.m_imaChannels,info.m_header.m_imaBytesPerPixel,&m_scratch[0]))
+				{
+					throw("MultiTrackStreamReader::ReadNextCapture: unknown codec or corrupted capture");
+				}
+			}
+			offset += payloadSize;
+		}
+		m_nextOffset += recordSize;
+		m_readFrameId = frameId;
+		m_readTiming = timing;
+		return frameId;
+	}
+
+	//
+	//Walk the record prefixes, the payloads are skipped
+	void MultiTrackStreamReader::BuildIndex()
+	{
+		m_index.clear();
+		FrameTiming timing;
+		vector<int> sizes(m_tracks.size());
+		long long offset = (long long)m_headerSize, recordSize;
+		int frameId;
+		while(!m_tracks.empty() && ReadPrefix(offset,sizes,frameId,timing,recordSize))
+		{
+			m_index.push_back(make_pair(frameId,offset));
+			offset += recordSize;
+		}
+		m_indexValid = true;
+	}
+
+	int MultiTrackStreamReader::NumCaptures()
+	{
+		if(!m_indexValid)
+		{
+			BuildIndex();
+		}
+		return (int)m_index.size();
+	}
+
+	bool MultiTrackStreamReader::SeekToCapture(const int frameId)
+	{
+		if(!m_indexValid)
+		{
+			BuildIndex();
+		}
+		for(size_t i=0; i<m_index.size(); i++)
+		{
+			if(m_index[i].first == frameId)
+			{
+				m_nextOffset = m_index[i].second;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	const cv::Mat& MultiTrackStreamReader::LastReadTrack(const int track) const
+	{
+		return m_images[track];
+	}
+
+}
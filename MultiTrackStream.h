@@ -0,0 +1,247 @@
+/* *
+	MultiTrackStream.h
+		Stream files holding all the images of a capture (e.g. color, depth
+		and IR) as tracks of differing formats, interleaved per capture
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef MULTI_TRACK_STREAM_H_
+#define MULTI_TRACK_STREAM_H_
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "Common.h"
+#include "FileIO.h"
+#include "AsyncStreamWriter.h"
+#include "MappedFile.h"
+#include "StreamFormat.h"
+#include "LatencyTracker.h"
+
+// forward declaration
+namespace cv
+{
+	class Mat;
+};
+
+
+
+namespace rm
+{
+
+	class Camera;
+
+	/**********************************************************************/
+	//	Multi-track stream layout
+	//	header: [int magic][int version][int headerSize][int numTracks][int flags][int reserved]
+	//		followed by one entry per track:
+	//		[int height][int width][int channels][int bytesPerPixel][int pixelFormat]
+	//		[int codec][int reserved][int reserved][char name[32]]
+	//	records, one per capture:
+	//		[int frameId][int numTracks][int64 grabTime][int64 deviceTime]
+	//		[int payloadSize[numTracks]] followed by the payloads in track order.
+	//	The payload sizes come first so that a reader can skip the tracks it
+	//	does not need without reading them. A RMZ payload is one coded slice
+	//	(see StreamCodec.h). Readers skip headerSize bytes, so fields can be
+	//	appended to the header.
+	/**********************************************************************/
+
+	static const int MULTI_TRACK_MAGIC = 0x544d4d52;	//"RMMT"
+	static const int MULTI_TRACK_VERSION = 1;
+	static const int MULTI_TRACK_NAME_SIZE = 32;
+
+	/** \brief One image of a capture
+	 */
+	struct TrackInfo
+	{
+		ImageSequenceHeader		m_header;
+		int						m_pixelFormat;	//OpenCV type
+		int						m_codec;		//StreamCodecId
+		std::string				m_name;			//at most MULTI_TRACK_NAME_SIZE-1 characters are stored
+	};
+
+	/** \brief Check if a file is a multi-track stream
+	 */
+	bool IsMultiTrackStream(const std::string &fileName);
+
+
+	/************************************************************//**
+	 *	The MultiTrackStreamWriter class
+	 *	Writes every capture as one record holding all its images, through
+	 *	a background writer (AsyncStreamWriter), so the images of a capture
+	 *	stay adjacent on the disk and a single file replaces the one stream
+	 *	per image that Camera::SaveData writes.
+	 *
+	 *		MultiTrackStreamWriter writer;
+	 *		writer.AddCameraTracks(camera);
+	 *		writer.Open("scan.rmt");
+	 *		while(...)
+	 *		{
+	 *			camera.GrabOne();
+	 *			writer.WriteCapture(camera,frameId++);
+	 *		}
+	 *		writer.Close();
+	 ***************************************************************/
+	class MultiTrackStreamWriter
+	{
+	public:
+		MultiTrackStreamWriter();
+		~MultiTrackStreamWriter();
+
+		/** \brief Add a track, before Open
+		 *	\param[in] header The image geometry
+		 *	\param[in] name The track name, e.g. the image name of the camera
+		 *	\param[in] codec STREAM_CODEC_NONE or STREAM_CODEC_RMZ
+		 *	\return The track index
+		 */
+		int AddTrack(const ImageSequenceHeader &header, const std::string &name, const int codec = STREAM_CODEC_NONE);
+
+		/** \brief Add one track per image of the camera (NumImages()), with its current format
+		 */
+		void AddCameraTracks(const Camera &camera, const int codec = STREAM_CODEC_NONE);
+
+		void ClearTracks();
+		int NumTracks() const { return (int)m_tracks.size(); }
+		const TrackInfo& Track(const int track) const { return m_tracks[track]; }
+
+		/** \brief Options of the background writer
+		 */
+		void SetAsyncOptions(const AsyncStreamWriter::Options &options);
+
+		/** \brief Set the tracker receiving the written latency of camera captures
+		 */
+		void SetLatencyTracker(LatencyTracker *pTracker);
+
+		/** \brief Create the file and write the header
+		 */
+		void Open(const std::string &fileName);
+
+		/** \brief Write everything queued and close the file
+		 */
+		void Close();
+
+		bool IsOpen() const { return m_writer.IsOpen(); }
+
+		/** \brief Write a capture
+		 *	\param[in] pImages One image per track, in track order
+		 *	\param[in] count Number of images, must be NumTracks()
+		 */
+		void WriteCapture(const cv::Mat *pImages, const int count, const int frameId, const FrameTiming &timing);
+		void WriteCapture(const std::vector<cv::Mat> &images, const int frameId, const FrameTiming &timing);
+
+		/** \brief Write the latest capture of the camera (Camera::AcquireCapture, all the images of one capture)
+		 */
+		void WriteCapture(const Camera &camera, const int frameId);
+
+		/** \brief Captures dropped by the background writer (AsyncStreamWriter::BACKPRESSURE_DROP_OLDEST)
+		 */
+		long long DroppedCaptures() const { return m_writer.DroppedRecords(); }
+
+	private:
+		//not copyable
+		MultiTrackStreamWriter(const MultiTrackStreamWriter&);
+		MultiTrackStreamWriter& operator=(const MultiTrackStreamWriter&);
+
+		std::vector<TrackInfo>		m_tracks;
+		AsyncStreamWriter			m_writer;
+		AsyncStreamWriter::Options	m_asyncOptions;
+		LatencyTracker				*m_pLatencyTracker;
+		std::vector<unsigned char>	m_prefix;
+		std::vector<unsigned char>	m_record;	//the payloads of a capture
+		std::vector<unsigned char>	m_scratch;	//for the codec
+	};
+
+
+	/************************************************************//**
+	 *	The MultiTrackStreamReader class
+	 *	Reads a whole capture, or a single track of it: the other tracks
+	 *	are skipped by their sizes, their bytes are not read (or, for
+	 *	memory mapped files, not touched).
+	 ***************************************************************/
+	class MultiTrackStreamReader
+	{
+	public:
+		MultiTrackStreamReader();
+		~MultiTrackStreamReader();
+
+		/** \brief Read the files opened afterwards through memory mapping,
+		 *	uncompressed tracks are then returned without copying
+		 */
+		void SetMemoryMapped(const bool enable);
+
+		void Open(const std::string &fileName);
+		void Close();
+		bool IsOpen() const { return !m_tracks.empty(); }
+
+		int NumTracks() const { return (int)m_tracks.size(); }
+		const TrackInfo& Track(const int track) const { return m_tracks[track]; }
+
+		/** \brief Index of the track with the given name, -1 if there is none
+		 */
+		int FindTrack(const std::string &name) const;
+
+		/** \brief Read all the tracks of the next capture
+		 *	\return The frame id, -1 if the end of the stream is reached
+		 */
+		int ReadNextCapture();
+
+		/** \brief Read one track of the next capture and skip the others
+		 *	\return The frame id, -1 if the end of the stream is reached
+		 */
+		int ReadNextTrack(const int track);
+
+		/** \brief Move to the capture of a frame id (the capture positions are scanned on first use)
+		 *	\return False if the frame id is not in the stream
+		 */
+		bool SeekToCapture(const int frameId);
+
+		/** \brief Number of complete captures in the stream
+		 */
+		int NumCaptures();
+
+		/** \brief An image of the last read capture, empty if the track was skipped.
+		 *	Valid until the next read
+		 */
+		const cv::Mat& LastReadTrack(const int track) const;
+		int LastReadFrameId() const { return m_readFrameId; }
+		const FrameTiming& LastReadFrameTiming() const { return m_readTiming; }
+
+	private:
+		//not copyable
+		MultiTrackStreamReader(const MultiTrackStreamReader&);
+		MultiTrackStreamReader& operator=(const MultiTrackStreamReader&);
+
+		bool ReadBytes(const long long offset, void *pDst, const size_t size);
+		bool ReadPrefix(const long long offset, std::vector<int> &sizes, int &frameId, FrameTiming &timing, long long &recordSize);
+		int ReadRecord(const int track);
+		void BuildIndex();
+
+		bool						m_memoryMapped;
+		std::ifstream				m_ifs;
+		MappedFile					m_mappedFile;
+		long long					m_fileSize;
+		std::vector<TrackInfo>		m_tracks;
+		size_t						m_headerSize;
+		long long					m_nextOffset;		//of the next record
+		std::vector<int>			m_payloadSizes;
+		std::vector<cv::Mat>		m_images;			//one per track
+		std::vector<unsigned char>	m_payload;			//coded track read through m_ifs
+		std::vector<unsigned char>	m_scratch;
+		int							m_readFrameId;
+		FrameTiming					m_readTiming;
+		std::vector< std::pair<int,long long> >	m_index;	//frame id, record offset
+		bool						m_indexValid;
+	};
+
+};//namespace rm
+
+
+
+#endif //MULTI_TRACK_STREAM_H_
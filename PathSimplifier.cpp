@@ -0,0 +1,247 @@
+/* *
+	PathSimplifier.cpp
+		The Implementation of the path simplifier
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "PathSimplifier.h"
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//the blends at both ends of a segment must not overlap (the controller stops the program if they do)
+	static const double BLEND_SEGMENT_FRACTION = 0.45;
+	//shorter segments are treated as pure rotations
+	static const double MIN_SEGMENT_LENGTH = 1e-9;
+	//RDP is simplified in windows of this many poses. Paths that wind around (helices, spirals)
+	//make the splits peel off one turn at a time, which is quadratic in the window size;
+	//the price is at most one extra waypoint per window.
+	static const int WINDOW_POSES = 1<<16;
+
+	PathSimplifier::PathSimplifier():m_positionTolerance(0.0002f),m_rotationTolerance(0.002f),m_blendRadius(0)
+	{
+		memset(&m_statistics,0,sizeof(m_statistics));
+	}
+
+	void PathSimplifier::SetTolerance(const float position, const float rotation)
+	{
+		m_positionTolerance = max(position,0.0f);
+		m_rotationTolerance = max(rotation,0.0f);
+	}
+
+	void PathSimplifier::SetBlendRadius(const float radius)
+	{
+		m_blendRadius = max(radius,0.0f);
+	}
+
+	PathSimplifier::Quaternion PathSimplifier::FromRotationVector(const RobotPose &pose)
+	{
+		const double rx = pose.m_rx, ry = pose.m_ry, rz = pose.m_rz;
+		const double angle = sqrt(rx*rx + ry*ry + rz*rz);
+		Quaternion q;
+		if(angle < 1e-12)
+		{
+			q.m_w = 1;
+			q.m_x = 0.5*rx;
+			q.m_y = 0.5*ry;
+			q.m_z = 0.5*rz;
+			return q;
+		}
+		const double s = sin(0.5*angle)/angle;
+		q.m_w = cos(0.5*angle);
+		q.m_x = rx*s;
+		q.m_y = ry*s;
+		q.m_z = rz*s;
+		return q;
+	}
+
+	//
+	//Rotation angle between two orientations, q and -q are the same orientation
+	double PathSimplifier::Angle(const Quaternion &a, const Quaternion &b)
+	{
+		const double dot = fabs(a.m_w*b.m_w + a.m_x*b.m_x + a.m_y*b.m_y + a.m_z*b.m_z);
+		return 2*acos(min(dot,1.0));
+	}
+
+	PathSimplifier::Quaternion PathSimplifier::Slerp(const Quaternion &a, const Quaternion &b, const double t)
+	{
+		double dot = a.m_w*b.m_w + a.m_x*b.m_x + a.m_y*b.m_y + a.m_z*b.m_z;
+		const double sign = dot < 0 ? -1 : 1;
+		dot *= sign;
+		double wa, wb;
+		if(dot > 0.9995)
+		{//nearly the same orientation, linear is exact enough
+			wa = 1 - t;
+			wb = t;
+		}
+		else
+		{
+			const double theta = acos(dot);
+			const double s = sin(theta);
+			wa = sin((1 - t)*theta)/s;
+			wb = sin(t*theta)/s;
+		}
+		wb *= sign;
+		Quaternion q;
+		q.m_w = wa*a.m_w + wb*b.m_w;
+		q.m_x = wa*a.m_x + wb*b.m_x;
+		q.m_y = wa*a.m_y + wb*b.m_y;
+		q.m_z = wa*a.m_z + wb*b.m_z;
+		const double norm = sqrt(q.m_w*q.m_w + q.m_x*q.m_x + q.m_y*q.m_y + q.m_z*q.m_z);
+		q.m_w /= norm;
+		q.m_x /= norm;
+		q.m_y /= norm;
+		q.m_z /= norm;
+		return q;
+	}
+
+	//
+	//Deviation of pose i from the movel between poses a and b: distance to the segment, and
+	//angle to the orientation interpolated at the closest point (along the rotation for pure rotations)
+	void PathSimplifier::Deviation(const RobotPose *pPoses, const int a, const int b, const int i, double &position, double &rotation) const
+	{
+		const RobotPose &pa = pPoses[a];
+		const RobotPose &pb = pPoses[b];
+		const RobotPose &pi = pPoses[i];
+		const double sx = pb.m_x - pa.m_x, sy = pb.m_y - pa.m_y, sz = pb.m_z - pa.m_z;
+		const double dx = pi.m_x - pa.m_x, dy = pi.m_y - pa.m_y, dz = pi.m_z - pa.m_z;
+		const double length2 = sx*sx + sy*sy + sz*sz;
+		double t = 0;
+		if(length2 > MIN_SEGMENT_LENGTH*MIN_SEGMENT_LENGTH)
+		{
+			t = min(max((dx*sx + dy*sy + dz*sz)/length2,0.0),1.0);
+		}
+		else
+		{
+			const double total = Angle(m_orientations[a],m_orientations[b]);
+			if(total > 0)
+			{
+				t = min(Angle(m_orientations[a],m_orientations[i])/total,1.0);
+			}
+		}
+		const double ex = dx - t*sx, ey = dy - t*sy, ez = dz - t*sz;
+		position = sqrt(ex*ex + ey*ey + ez*ez);
+		rotation = Angle(m_orientations[i],Slerp(m_orientations[a],m_orientations[b],t));
+	}
+
+	int PathSimplifier::Simplify(const std::vector<RobotPose> &path, std::vector<RobotPose> &poses, std::vector<float> &blendRadii)
+	{
+		return Simplify(path.empty() ? NULL : &path[0],(int)path.size(),poses,blendRadii);
+	}
+
+	//
+	//Split the segment at the pose that is furthest out of tolerance until all the
+	//dropped poses are within it. Iterative, the recursion of dense paths is too deep for the stack.
+	int PathSimplifier::Simplify(const RobotPose *pPoses, const int count, std::vector<RobotPose> &poses, std::vector<float> &blendRadii)
+	{
+		poses.clear();
+		blendRadii.clear();
+		m_kept.clear();
+		memset(&m_statistics,0,sizeof(m_statistics));
+		m_statistics.m_inputPoses = max(count,0);
+		if(count <= 0)
+		{
+			return 0;
+		}
+
+		m_orientations.resize(count);
+		for(int i=0; i<count; i++)
+		{
+			m_orientations[i] = FromRotationVector(pPoses[i]);
+		}
+		//a zero tolerance keeps every pose that deviates at all
+		const double positionScale = 1.0/max((double)m_positionTolerance,1e-12);
+		const double rotationScale = 1.0/max((double)m_rotationTolerance,1e-12);
+
+		m_kept.push_back(0);
+		m_stack.clear();
+		for(int start=0; start<count-1; start+=WINDOW_POSES)
+		{
+			const int end = min(start + WINDOW_POSES,count - 1);
+			m_kept.push_back(end);
+			if(end - start > 1)
+			{
+				m_stack.push_back(start);
+				m_stack.push_back(end);
+			}
+		}
+		while(!m_stack.empty())
+		{
+			const int b = m_stack.back();
+			m_stack.pop_back();
+			const int a = m_stack.back();
+			m_stack.pop_back();
+
+			double worst = 0, maxPosition = 0, maxRotation = 0;
+			int worstIndex = -1;
+			for(int i=a+1; i<b; i++)
+			{
+				double position, rotation;
+				Deviation(pPoses,a,b,i,position,rotation);
+				const double error = max(position*positionScale,rotation*rotationScale);
+				if(error > worst)
+				{
+					worst = error;
+					worstIndex = i;
+				}
+				maxPosition = max(maxPosition,position);
+				maxRotation = max(maxRotation,rotation);
+			}
+			if(worst > 1)
+			{
+				m_kept.push_back(worstIndex);
+				if(worstIndex - a > 1)
+				{
+					m_stack.push_back(a);
+					m_stack.push_back(worstIndex);
+				}
+				if(b - worstIndex > 1)
+				{
+					m_stack.push_back(worstIndex);
+					m_stack.push_back(b);
+				}
+			}
+			else
+			{
+				m_statistics.m_maxPositionDeviation = max(m_statistics.m_maxPositionDeviation,maxPosition);
+				m_statistics.m_maxRotationDeviation = max(m_statistics.m_maxRotationDeviation,maxRotation);
+			}
+		}
+		sort(m_kept.begin(),m_kept.end());
+
+		const int kept = (int)m_kept.size();
+		poses.resize(kept);
+		blendRadii.assign(kept,0.0f);
+		for(int k=0; k<kept; k++)
+		{
+			poses[k] = pPoses[m_kept[k]];
+		}
+		if(m_blendRadius > 0)
+		{
+			for(int k=1; k+1<kept; k++)
+			{
+				const RobotPose &p0 = poses[k-1], &p1 = poses[k], &p2 = poses[k+1];
+				const double before = sqrt((double)(p1.m_x - p0.m_x)*(p1.m_x - p0.m_x) + (double)(p1.m_y - p0.m_y)*(p1.m_y - p0.m_y) +
+					(double)(p1.m_z - p0.m_z)*(p1.m_z - p0.m_z));
+				const double after = sqrt((double)(p2.m_x - p1.m_x)*(p2.m_x - p1.m_x) + (double)(p2.m_y - p1.m_y)*(p2.m_y - p1.m_y) +
+					(double)(p2.m_z - p1.m_z)*(p2.m_z - p1.m_z));
+				blendRadii[k] = (float)min((double)m_blendRadius,BLEND_SEGMENT_FRACTION*min(before,after));
+			}
+		}
+
+		m_statistics.m_outputPoses = kept;
+		m_statistics.m_compressionRatio = (double)count/kept;
+		return kept;
+	}
+
+}
@@ -0,0 +1,117 @@
+/* *
+	PathSimplifier.h
+		Reduces dense robot paths to the waypoints needed to stay within
+		a position and orientation tolerance, with blend radii
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef PATH_SIMPLIFIER_H_
+#define PATH_SIMPLIFIER_H_
+
+
+#include <vector>
+
+#include "TrajectoryStreamer.h"
+
+
+
+namespace rm
+{
+
+	/** \brief What a simplification did
+	 */
+	struct PathStatistics
+	{
+		int					m_inputPoses;
+		int					m_outputPoses;
+		double				m_compressionRatio;		//input poses / output poses
+		double				m_maxPositionDeviation;	//m, of a dropped pose from the simplified path
+		double				m_maxRotationDeviation;	//rad
+	};
+
+
+	/************************************************************//**
+	 *	The PathSimplifier class
+	 *	Ramer-Douglas-Peucker in 6-DoF: a pose is dropped if it lies within
+	 *	the position tolerance of the straight segment between the kept
+	 *	poses around it, and its orientation within the rotation tolerance
+	 *	of the orientation interpolated (slerp) at the same place, which is
+	 *	how movel moves between two waypoints.
+	 *
+	 *	The kept waypoints get a blend radius so that the robot does not
+	 *	stop at each of them; the radius is limited to less than half of
+	 *	the adjacent segments so that blends never overlap. Blending rounds
+	 *	the corners by up to about the radius, the tolerance applies to the
+	 *	waypoints. The first and the last pose are never blended.
+	 *
+	 *		PathSimplifier simplifier;
+	 *		simplifier.SetTolerance(0.0002f,0.002f);
+	 *		simplifier.SetBlendRadius(0.001f);
+	 *		simplifier.Simplify(densePath,poses,radii);
+	 *		streamer.SendTrajectory(poses,radii);
+	 ***************************************************************/
+	class PathSimplifier
+	{
+	public:
+		PathSimplifier();
+
+		/** \brief Max deviation of the simplified path (default 0.2mm and 0.002rad)
+		 *	\param[in] position Max distance in m
+		 *	\param[in] rotation Max rotation angle in rad
+		 */
+		void SetTolerance(const float position, const float rotation);
+
+		/** \brief Blend radius of the kept waypoints in m (default 0 = stop at every waypoint)
+		 */
+		void SetBlendRadius(const float radius);
+
+		/** \brief Simplify a path
+		 *	\param[in] pPoses The dense path
+		 *	\param[in] count Number of poses
+		 *	\param[out] poses The kept poses, the first and the last pose are always kept
+		 *	\param[out] blendRadii The blend radius of each kept pose
+		 *	\return Number of kept poses
+		 */
+		int Simplify(const RobotPose *pPoses, const int count, std::vector<RobotPose> &poses, std::vector<float> &blendRadii);
+		int Simplify(const std::vector<RobotPose> &path, std::vector<RobotPose> &poses, std::vector<float> &blendRadii);
+
+		/** \brief Indices (into the dense path) of the poses kept by the last Simplify
+		 */
+		const std::vector<int>& KeptIndices() const { return m_kept; }
+
+		/** \brief Statistics of the last Simplify
+		 */
+		const PathStatistics& Statistics() const { return m_statistics; }
+
+	private:
+		struct Quaternion
+		{
+			double			m_w, m_x, m_y, m_z;
+		};
+
+		static Quaternion FromRotationVector(const RobotPose &pose);
+		static double Angle(const Quaternion &a, const Quaternion &b);
+		static Quaternion Slerp(const Quaternion &a, const Quaternion &b, const double t);
+
+		void Deviation(const RobotPose *pPoses, const int a, const int b, const int i, double &position, double &rotation) const;
+
+		float						m_positionTolerance;
+		float						m_rotationTolerance;
+		float						m_blendRadius;
+
+		std::vector<Quaternion>		m_orientations;		//of the dense path, reused
+		std::vector<int>			m_stack;			//segments left to check, reused
+		std::vector<int>			m_kept;
+		PathStatistics				m_statistics;
+	};
+
+};//namespace rm
+
+
+
+#endif //PATH_SIMPLIFIER_H_
@@ -0,0 +1,173 @@
+/* *
+	PixelFormat.h
+		Compile-time description of the pixel formats of image sequence
+		streams, the conversion kernels and the run-time dispatch to them
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef PIXEL_FORMAT_H_
+#define PIXEL_FORMAT_H_
+
+
+#include <stddef.h>
+
+#include <opencv2\opencv.hpp>
+
+#include "FileIO.h"
+
+
+
+namespace rm
+{
+
+	/**********************************************************************/
+	//	Stream pixel formats
+	//	A stream stores the number of channels and the bytes per sample in
+	//	its header (ImageSequenceHeader) and, from v2 on, the OpenCV type.
+	//	The supported formats are 8U, 8UC3, 16U, 16UC3, 32F and 32FC3; 4-byte
+	//	samples are always float (the processing outputs).
+	//	PixelTraits<T,CN> describes a format at compile time, so typed code
+	//	(see TypedImageSequence.h) checks the format once and then works on
+	//	T without branching on the format per frame or per pixel. Untyped
+	//	code selects the specialization of a kernel with DispatchPixelFormat.
+	/**********************************************************************/
+
+	/** \brief OpenCV depth of a sample type
+	 */
+	template<typename T> struct SampleDepth;
+	template<> struct SampleDepth<unsigned char> { enum { VALUE = CV_8U }; };
+	template<> struct SampleDepth<unsigned short> { enum { VALUE = CV_16U }; };
+	template<> struct SampleDepth<float> { enum { VALUE = CV_32F }; };
+
+	/** \brief Type of a whole pixel: the sample itself for one channel, cv::Vec otherwise
+	 */
+	template<typename T, int CN> struct PixelOf { typedef cv::Vec<T,CN> Type; };
+	template<typename T> struct PixelOf<T,1> { typedef T Type; };
+
+	/************************************************************//**
+	 *	The PixelTraits struct
+	 *	A stream pixel format: CN interleaved channels of type T
+	 ***************************************************************/
+	template<typename T, int CN>
+	struct PixelTraits
+	{
+		typedef T								Sample;
+		typedef typename PixelOf<T,CN>::Type	Pixel;
+
+		enum
+		{
+			CHANNELS = CN,
+			BYTES_PER_SAMPLE = sizeof(T),
+			TYPE = CV_MAKETYPE(SampleDepth<T>::VALUE,CN)	//OpenCV type
+		};
+
+		/** \brief Check if a header describes this format
+		 */
+		static bool Matches(const ImageSequenceHeader &header)
+		{
+			return header.m_imaChannels == CN && header.m_imaBytesPerPixel == (int)sizeof(T);
+		}
+
+		/** \brief Fill the format fields of a header
+		 */
+		static void SetHeader(ImageSequenceHeader &header, const int height, const int width)
+		{
+			header.m_imaHeight = height;
+			header.m_imaWidth = width;
+			header.m_imaChannels = CN;
+			header.m_imaBytesPerPixel = (int)sizeof(T);
+		}
+	};
+
+	typedef PixelTraits<unsigned char,1>	Pixel8U;
+	typedef PixelTraits<unsigned char,3>	Pixel8UC3;
+	typedef PixelTraits<unsigned short,1>	Pixel16U;
+	typedef PixelTraits<unsigned short,3>	Pixel16UC3;
+	typedef PixelTraits<float,1>			Pixel32F;
+	typedef PixelTraits<float,3>			Pixel32FC3;
+
+	/** \brief Check if an OpenCV type is one of the stream pixel formats
+	 */
+	inline bool IsStreamPixelFormat(const int type)
+	{
+		switch(type)
+		{
+		case Pixel8U::TYPE:
+		case Pixel8UC3::TYPE:
+		case Pixel16U::TYPE:
+		case Pixel16UC3::TYPE:
+		case Pixel32F::TYPE:
+		case Pixel32FC3::TYPE:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/** \brief Call func.template Run<Traits>() with the PixelTraits of an OpenCV type
+	 *	\return False if the type is not a stream pixel format, func is not called
+	 */
+	template<class Func>
+	bool DispatchPixelFormat(const int type, Func &func)
+	{
+		switch(type)
+		{
+		case Pixel8U::TYPE:
+			func.template Run<Pixel8U>();
+			return true;
+		case Pixel8UC3::TYPE:
+			func.template Run<Pixel8UC3>();
+			return true;
+		case Pixel16U::TYPE:
+			func.template Run<Pixel16U>();
+			return true;
+		case Pixel16UC3::TYPE:
+			func.template Run<Pixel16UC3>();
+			return true;
+		case Pixel32F::TYPE:
+			func.template Run<Pixel32F>();
+			return true;
+		case Pixel32FC3::TYPE:
+			func.template Run<Pixel32FC3>();
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/** \brief pDst[i] = pSrc[i]*scale
+	 *	\param[in] count Number of samples (pixels * channels)
+	 */
+	template<typename Src, typename Dst>
+	inline void ScaleSamples(const Src *pSrc, Dst *pDst, const size_t count, const float scale)
+	{
+		for(size_t i=0; i<count; i++)
+		{
+			pDst[i] = static_cast<Dst>(pSrc[i]*scale);
+		}
+	}
+
+	/** \brief pDst[i] = pSrc[i]*scale + offset, rounded and clamped to [0, maxValue], for an integer Dst
+	 *	(e.g. float to 8 or 16-bit for display)
+	 */
+	template<typename Src, typename Dst>
+	inline void ScaleSamplesClamped(const Src *pSrc, Dst *pDst, const size_t count, const float scale, const float offset,
+		const float maxValue)
+	{
+		for(size_t i=0; i<count; i++)
+		{
+			const float value = pSrc[i]*scale + offset;
+			pDst[i] = static_cast<Dst>(value < 0 ? 0 : (value > maxValue ? maxValue : value + 0.5f));
+		}
+	}
+
+};//namespace rm
+
+
+
+#endif //PIXEL_FORMAT_H_
@@ -8,89 +8,43 @@
 * */
 
 //#include "StdAfx.h"
+//the socket layer goes first, on Windows it has to come before Windows.h
+#include "RobotSocket.h"
 #include "Robot.h"
+#include "TrajectoryStreamer.h"
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <vector>
 #include <string>
-#include <Windows.h>
 #include <time.h>
 
 #define NETWORK_ERROR -1
 #define NETWORK_OK     0
 
+//the connection functions return NULL on failure
+#define NO_SOCKET		((SOCKET)0)
+//give up on an unreachable controller instead of waiting for the system timeout
+#define CONNECT_TIMEOUT_MS	5000
+
 SOCKET initializeSocket(const char * IPaddress, int port)
 {
-	WSADATA wsaData;   
-	WORD sockVersion;
-	int nret;
-	sockVersion = MAKEWORD(1, 1);
-
-    if (WSAStartup(sockVersion, &wsaData) != 0) 
+	// Initializing the socket library (once per process)
+	if (!rm::SocketStartup()) 
 	{
-        printf("WSAStartup failed.\n") ;
-		//return NETWORK_ERROR;
-		return NULL;
+		printf("WSAStartup failed.\n") ;
+		return NO_SOCKET;
 	}
 	else
 		printf("Initialization Success.\n");
-	// Initializing Winsock
-	WSAStartup(sockVersion, &wsaData);
-	LPHOSTENT hostEntry;
-	// Create the listening socket
-
-	//////// For Website (TEST ONLY)
-	hostEntry = gethostbyname(IPaddress);
-	//////// End of For Website (TEST ONLY)
-
-	//////// For Static IP address
-	//in_addr iaHost;
-	//iaHost.s_addr = inet_addr("192.168.0.0");
-	//hostEntry = gethostbyaddr((const char *)&iaHost, sizeof(struct in_addr), AF_INET);
-	//////// End of For Static IP address
-
-	if (!hostEntry)
-	{
-		nret = WSAGetLastError();
-		printf("No Host Found!\n");
-		WSACleanup();
-		//return NETWORK_ERROR;
-		return NULL;
-	}
-	else
-		printf("Successfully Found Host!\n");
-	// Create the socket
-	SOCKET theSocket;
-	theSocket = socket(AF_INET,			// Go over TCP/IP
-			   SOCK_STREAM,			// This is a stream-oriented socket
-			   IPPROTO_TCP);		// Use TCP rather than UDP
+
+	// Resolve the host (a numeric address does not touch DNS), create the socket
+	// and connect, trying every address of the host
+	SOCKET theSocket = rm::ConnectSocket(IPaddress, port, CONNECT_TIMEOUT_MS);
 	if (theSocket == INVALID_SOCKET)
 	{
-		nret = WSAGetLastError();
-		printf("Can't Create Socket!\n");
-		WSACleanup();
-		//return NETWORK_ERROR;
-		return NULL;
-	}
-	else
-		printf("Successfully Create Socket!\n");
-	// Fill a SOCKADDR_IN struct with address information
-	SOCKADDR_IN serverInfo;
-	serverInfo.sin_family = AF_INET;
-	serverInfo.sin_addr = *((LPIN_ADDR)*hostEntry->h_addr_list);
-	serverInfo.sin_port = htons(port);   // define port
-	// Connect to the server
-	nret = connect(theSocket,
-		       (LPSOCKADDR)&serverInfo,
-		       sizeof(struct sockaddr));
-	if (nret == SOCKET_ERROR)
-	{
-		nret = WSAGetLastError();
-		printf("Can't Connect Socket!\n");
-		WSACleanup();
-		//return NETWORK_ERROR;
-		return NULL;
+		printf("Can't Connect Socket! (error %d)\n", rm::SocketLastError());
+		return NO_SOCKET;
 	}
 	else
 	{
@@ -99,99 +53,58 @@ SOCKET initializeSocket(const char * IPaddress, int port)
 	}
 }
 
-SOCKET initializeSocket_New(int port)
+SOCKET initializeSocket_New(const char * bindAddress, int port)
 {
-    WSADATA wsaData;//creating a WSADATA object called wsaData
-   
-
-	//char *sendbuf1 = "(0.639, 0.12753, 0.46554, -0.4498, 2.1959, -0.2090)";
-	//movel(p[0.516, -0.118, 0.41422, 0.0877, 2.677, -0.116], a = 0.002, v=0.001)\n
-    //char *sendbuf2 = "(0.516, 0.14289, 0.63727, 0.1544, 2.4503, -0.227)";
-	
-	int iResult;//used to initialize winsock
-    
-	// Initialize Winsock
-    iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
-    if (iResult != 0)
-	{
-        printf("WSAStartup failed with error: %d\n", iResult);
-        return NULL;
-    }
-    SOCKET ListenSocket = INVALID_SOCKET; //declare socket ListenSocket to listen for client connections
-    SOCKET ClientSocket = INVALID_SOCKET; //declare socket ClientSocket to aceept connections from clients
-
-    // Create a SOCKET for connecting to server
-    ListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (ListenSocket == INVALID_SOCKET) 
+	// Initializing the socket library (once per process)
+	if (!rm::SocketStartup())
 	{
-        printf("socket failed with error: %ld\n", WSAGetLastError());
-        WSACleanup();
-        return NULL;
-    }
-	else
-		printf("Successfully Create Socket!\n");
-    // The socket address to be passed to bind
-    sockaddr_in service;
-	// The sockaddr_in structure specifies the address family,
-    // IP address, and port for the socket that is being bound.
-    service.sin_family = AF_INET;
-    service.sin_addr.s_addr = inet_addr("192.168.0.5");
-    service.sin_port = htons(port);
-    //----------------------
-    // Bind the socket.
-    iResult = bind(ListenSocket, (SOCKADDR *) &service, sizeof (service));
-    if (iResult == SOCKET_ERROR) {
-        printf("bind failed with error %u\n", WSAGetLastError());
-        closesocket(ListenSocket);
-        WSACleanup();
-        return NULL;
-    }
-	else
-		printf("Successfully Bind Socket!\n");
-    //listen for client cconnections
-	iResult = listen(ListenSocket, SOMAXCONN);
-    if (iResult == SOCKET_ERROR) 
+		printf("WSAStartup failed.\n");
+		return NO_SOCKET;
+	}
+
+	// Create, bind and listen, NULL or "" binds all interfaces
+	SOCKET ListenSocket = rm::ListenSocket(bindAddress, port);
+	if (ListenSocket == INVALID_SOCKET) 
 	{
-        printf("listen failed with error: %d\n", WSAGetLastError());
-        closesocket(ListenSocket);
-        WSACleanup();
-        return NULL;
-    }
+		printf("bind/listen on %s:%d failed with error %d\n", bindAddress ? bindAddress : "*", port, rm::SocketLastError());
+		return NO_SOCKET;
+	}
 	else
 		printf("Successfully Listening Socket!\n");
-    // Accept a client socket
-    ClientSocket = accept(ListenSocket, NULL, NULL);
-    if (ClientSocket == INVALID_SOCKET) 
+	// Accept a client socket
+	SOCKET ClientSocket = rm::AcceptSocket(ListenSocket, -1);
+	// No longer need server socket
+	rm::CloseSocket(ListenSocket);
+	if (ClientSocket == INVALID_SOCKET) 
 	{
-        printf("accept failed with error: %d\n", WSAGetLastError());
-        closesocket(ListenSocket);
-        WSACleanup();
-        return NULL;
-    }
+		printf("accept failed with error: %d\n", rm::SocketLastError());
+		return NO_SOCKET;
+	}
 	else
 		printf("Successfully Accept Client Socket!\n");
-    // No longer need server socket
-    closesocket(ListenSocket);
 	return ClientSocket;
 }
 
+SOCKET initializeSocket_New(int port)
+{
+	// The address of the robot network interface of the lab PC
+	return initializeSocket_New("192.168.0.5", port);
+}
+
 int sendCoordinates(float x, float y, float z, float rx, float ry, float rz, float a, float v, SOCKET theSocket)
 {
 		// Send Data
+	// One command per call, use rm::TrajectoryStreamer for paths
 	int status;
-//	char buffer[256];		// Declaring a buffer on the stack
-	char *buffer = new char[DEFAULT_BUFLEN];	// or on the heap
-	ZeroMemory(buffer, DEFAULT_BUFLEN);
-	// strcpy(buffer, "Pretend this is important data.");
-	int n=0;
-	n = sprintf(buffer, "movel(p[%f, %f, %f, %f, %f, %f], a=%f, v=%f)\n", x,y ,z,rx,ry,rz,a,v);
-	printf("Sending... ");
-	cout<<buffer<<endl;
+	char buffer[rm::MAX_MOVEL_LENGTH + 1];		// Declaring a buffer on the stack
+	rm::RobotPose pose = {x, y, z, rx, ry, rz};
+	int n = rm::EncodeMoveL(buffer, pose, a, v);
+	buffer[n] = 0;
+	printf("Sending... %s", buffer);
 	status = send(theSocket,
 	    buffer,
-	    strlen(buffer),	// Note that this specifies the length of the string; not the size of the entire buffer
-	    0);			// Most often is zero, but see MSDN for other options
-	delete [] buffer;		// If and only if the heap declaration was used
+	    n,		// Note that this specifies the length of the string; not the size of the entire buffer
+	    SOCKET_SEND_FLAGS);	// 0 on Windows, no SIGPIPE elsewhere
 	if (status == SOCKET_ERROR)
 	{
 		printf("Can't Connect Socket!\n");
@@ -218,12 +131,16 @@ char receiveCoordinates(SOCKET theSocket)
 	////n = recv(theSocket, buffer, 256, 0); 
 	//cout<<buffer<<endl;
 
+	// Blocking, use rm::RobotStateReceiver for pose feedback in a control loop
 	printf("Receiving... \n");
 
-	char *buffer2 = new char[1024];	// or on the heap
-	ZeroMemory(buffer2, 1024);
-	n = recv(theSocket, buffer2, 1024, 0); 
-	return *buffer2;
+	char buffer2[1024];		// on the stack, the heap buffer leaked on every call
+	n = recv(theSocket, buffer2, sizeof(buffer2), 0); 
+	if (n <= 0)
+	{
+		return 0;
+	}
+	return buffer2[0];
 }
 
 
@@ -0,0 +1,274 @@
+/* *
+	RobotLink.cpp
+		The Implementation of the robot link
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "RobotLink.h"
+
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//how often the link thread checks for Stop while nothing happens
+	static const int LINK_POLL_MS = 50;
+	static const size_t DEFAULT_OUTBOX_LIMIT = 1 << 20;
+
+	RobotLink::RobotLink():m_port(0),m_connectTimeout(2000),m_reconnectMin(100),m_reconnectMax(5000),m_stop(false),
+		m_connected(false),m_socket(INVALID_SOCKET),m_outboxLimit(DEFAULT_OUTBOX_LIMIT),m_writeWatched(false),m_connects(0),
+		m_bytesReceived(0),m_bytesSent(0),m_bytesDropped(0)
+	{
+	}
+
+	RobotLink::~RobotLink()
+	{
+		Stop();
+	}
+
+	void RobotLink::SetConnectTimeout(const int milliseconds)
+	{
+		m_connectTimeout = milliseconds;
+	}
+
+	void RobotLink::SetReconnectDelay(const int minMs, const int maxMs)
+	{
+		m_reconnectMin = max(minMs,1);
+		m_reconnectMax = max(maxMs,m_reconnectMin);
+	}
+
+	void RobotLink::SetOutboxLimit(const size_t bytes)
+	{
+		lock_guard<mutex> lock(m_sendMutex);
+		m_outboxLimit = bytes;
+	}
+
+	void RobotLink::SetDataHandler(const DataHandler &handler)
+	{
+		m_dataHandler = handler;
+	}
+
+	void RobotLink::SetConnectHandler(const ConnectHandler &handler)
+	{
+		m_connectHandler = handler;
+	}
+
+	void RobotLink::Start(const std::string &host, const int port)
+	{
+		if(m_thread.joinable())
+		{
+			throw("RobotLink::Start: the link is already running");
+		}
+		m_host = host;
+		m_port = port;
+		m_stop = false;
+		m_thread = thread(&RobotLink::LinkLoop,this);
+	}
+
+	void RobotLink::Stop()
+	{
+		m_stop = true;
+		if(m_thread.joinable())
+		{
+			m_thread.join();
+		}
+	}
+
+	int RobotLink::Send(const char *pData, const int size)
+	{
+		lock_guard<mutex> lock(m_sendMutex);
+		if(m_socket == INVALID_SOCKET)
+		{
+			return NETWORK_ERROR;
+		}
+		if(m_outbox.size() + size > m_outboxLimit)
+		{//make room with what the socket takes now
+			FlushOutbox();
+		}
+		//the backlog is bounded, a controller that stops reading must not grow it without limit
+		//(a single message larger than the limit still goes out when nothing is queued)
+		if(!m_outbox.empty() && m_outbox.size() + size > m_outboxLimit)
+		{
+			m_bytesDropped.fetch_add(size,memory_order_relaxed);
+			return NETWORK_ERROR;
+		}
+		m_outbox.insert(m_outbox.end(),pData,pData + size);
+		//a failed write is noticed by the link thread, which reconnects
+		FlushOutbox();
+		return NETWORK_OK;
+	}
+
+	//
+	//Write as much of the outbox as the socket takes without blocking
+	//return false if the connection failed
+	bool RobotLink::FlushOutbox()
+	{
+		size_t sent = 0;
+		while(sent < m_outbox.size())
+		{
+			const int status = send(m_socket,&m_outbox[sent],(int)(m_outbox.size() - sent),SOCKET_SEND_FLAGS);
+			if(status == SOCKET_ERROR)
+			{
+				if(SocketWouldBlock(SocketLastError()))
+				{
+					break;
+				}
+				return false;
+			}
+			sent += status;
+		}
+		m_outbox.erase(m_outbox.begin(),m_outbox.begin() + sent);
+		m_bytesSent.fetch_add(sent,memory_order_relaxed);
+		return true;
+	}
+
+	//
+	//Read until the socket has nothing more, hand the bytes to the data handler
+	//return false if the connection was closed or failed
+	bool RobotLink::ReadAll()
+	{
+		while(true)
+		{
+			const int received = recv(m_socket,m_receiveBuffer,sizeof(m_receiveBuffer),0);
+			if(received > 0)
+			{
+				m_bytesReceived.fetch_add(received,memory_order_relaxed);
+				if(m_dataHandler)
+				{
+					m_dataHandler(m_receiveBuffer,received);
+				}
+				continue;
+			}
+			if(received == SOCKET_ERROR && SocketWouldBlock(SocketLastError()))
+			{
+				return true;
+			}
+			return false;
+		}
+	}
+
+	bool RobotLink::Connect(EventPoller &poller)
+	{
+		SOCKET theSocket = ConnectSocket(m_host.c_str(),m_port,m_connectTimeout,true);
+		if(theSocket == INVALID_SOCKET)
+		{
+			return false;
+		}
+		SetSocketNoDelay(theSocket);
+		if(!poller.Add(theSocket,EventPoller::EVENT_READ))
+		{
+			CloseSocket(theSocket);
+			return false;
+		}
+		{
+			lock_guard<mutex> lock(m_sendMutex);
+			m_socket = theSocket;
+		}
+		m_writeWatched = false;
+		m_connects.fetch_add(1);
+		m_connected = true;
+		if(m_connectHandler)
+		{
+			m_connectHandler(true);
+		}
+		return true;
+	}
+
+	void RobotLink::Disconnect(EventPoller &poller)
+	{
+		{
+			lock_guard<mutex> lock(m_sendMutex);
+			if(m_socket == INVALID_SOCKET)
+			{
+				return;
+			}
+			poller.Remove(m_socket);
+			CloseSocket(m_socket);
+			m_socket = INVALID_SOCKET;
+			//the rest of a command would be garbage on the next connection
+			m_bytesDropped.fetch_add(m_outbox.size(),memory_order_relaxed);
+			m_outbox.clear();
+		}
+		m_connected = false;
+		if(m_connectHandler)
+		{
+			m_connectHandler(false);
+		}
+	}
+
+	void RobotLink::SleepUnlessStopped(const int milliseconds)
+	{
+		for(int slept=0; slept<milliseconds && !m_stop; slept+=LINK_POLL_MS)
+		{
+			this_thread::sleep_for(chrono::milliseconds(min(LINK_POLL_MS,milliseconds - slept)));
+		}
+	}
+
+	//
+	//Connect (with backoff), then wait for the socket and do the reads and the writes
+	//that Send left over, until the connection fails
+	void RobotLink::LinkLoop()
+	{
+		EventPoller poller;
+		vector<EventPoller::Event> events;
+		int reconnectDelay = m_reconnectMin;
+		while(!m_stop)
+		{
+			if(!m_connected)
+			{
+				if(!Connect(poller))
+				{
+					SleepUnlessStopped(reconnectDelay);
+					reconnectDelay = min(2*reconnectDelay,m_reconnectMax);
+					continue;
+				}
+				reconnectDelay = m_reconnectMin;
+			}
+
+			//watch for writability only while there is something to write
+			bool pending;
+			{
+				lock_guard<mutex> lock(m_sendMutex);
+				pending = !m_outbox.empty();
+			}
+			if(pending != m_writeWatched)
+			{
+				poller.Modify(m_socket,EventPoller::EVENT_READ | (pending ? EventPoller::EVENT_WRITE : 0));
+				m_writeWatched = pending;
+			}
+
+			if(poller.Wait(events,LINK_POLL_MS) < 0)
+			{
+				Disconnect(poller);
+				continue;
+			}
+			bool ok = true;
+			for(size_t i=0; i<events.size() && ok; i++)
+			{
+				if(events[i].m_events & (EventPoller::EVENT_READ | EventPoller::EVENT_ERROR))
+				{
+					ok = ReadAll();
+				}
+				if(ok && (events[i].m_events & EventPoller::EVENT_WRITE))
+				{
+					lock_guard<mutex> lock(m_sendMutex);
+					ok = FlushOutbox();
+				}
+			}
+			if(!ok)
+			{
+				Disconnect(poller);
+			}
+		}
+		Disconnect(poller);
+	}
+
+}
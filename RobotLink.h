@@ -0,0 +1,142 @@
+/* *
+	RobotLink.h
+		A connection to the robot controller that is kept alive by an
+		event loop thread: connect timeouts, reconnects, non-blocking IO
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef ROBOT_LINK_H_
+#define ROBOT_LINK_H_
+
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+#include "RobotSocket.h"
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The RobotLink class
+	 *	Connects to the controller on a thread of its own and reconnects
+	 *	(with a growing delay) whenever the connection fails. Received
+	 *	bytes go to the data handler on the link thread, e.g.
+	 *		RobotStateReceiver receiver(INVALID_SOCKET,100);
+	 *		link.SetDataHandler([&](const char *p, int n){ receiver.Feed(p,n); });
+	 *	Send() writes right away from the calling thread; what the socket
+	 *	does not take is queued and written by the link thread. The queue
+	 *	is bounded (SetOutboxLimit), the bytes refused because it is full
+	 *	and the bytes still queued when the connection is lost are counted
+	 *	by BytesDropped().
+	 ***************************************************************/
+	class RobotLink
+	{
+	public:
+		typedef std::function<void(const char *pData, const int size)>	DataHandler;
+		typedef std::function<void(const bool connected)>				ConnectHandler;
+
+		RobotLink();
+		~RobotLink();
+
+		/** \brief Max time for one connection attempt (default 2000ms)
+		 */
+		void SetConnectTimeout(const int milliseconds);
+
+		/** \brief Delay before reconnecting, doubled after every failure up to maxMs (default 100ms to 5000ms)
+		 */
+		void SetReconnectDelay(const int minMs, const int maxMs);
+
+		/** \brief Max bytes queued while the socket does not take them (default 1MB)
+		 *	A Send that does not fit is refused as a whole, so that no partial command goes out
+		 *	(a single larger message is accepted when nothing is queued)
+		 */
+		void SetOutboxLimit(const size_t bytes);
+
+		/** \brief Called on the link thread with the received bytes, set before Start
+		 */
+		void SetDataHandler(const DataHandler &handler);
+
+		/** \brief Called on the link thread when the connection is made or lost, set before Start
+		 */
+		void SetConnectHandler(const ConnectHandler &handler);
+
+		/** \brief Start the link thread
+		 *	\param[in] host Host name or address of the controller
+		 *	\param[in] port The port
+		 */
+		void Start(const std::string &host, const int port);
+
+		/** \brief Close the connection and stop the link thread
+		 */
+		void Stop();
+
+		bool IsConnected() const { return m_connected.load(); }
+
+		/** \brief Send bytes, thread safe
+		 *	\return NETWORK_OK (0), NETWORK_ERROR (-1) if not connected or if the outbox is full
+		 */
+		int Send(const char *pData, const int size);
+
+		long long Connects() const { return m_connects.load(); }
+		long long BytesReceived() const { return m_bytesReceived.load(); }
+		long long BytesSent() const { return m_bytesSent.load(); }
+
+		/** \brief Bytes refused by a full outbox or discarded from it when the connection was lost
+		 */
+		long long BytesDropped() const { return m_bytesDropped.load(); }
+
+	private:
+		//not copyable
+		RobotLink(const RobotLink&);
+		RobotLink& operator=(const RobotLink&);
+
+		void LinkLoop();
+		bool Connect(EventPoller &poller);
+		void Disconnect(EventPoller &poller);
+		bool ReadAll();
+		bool FlushOutbox();	//m_sendMutex held
+		void SleepUnlessStopped(const int milliseconds);
+
+		std::string					m_host;
+		int							m_port;
+		int							m_connectTimeout;
+		int							m_reconnectMin;
+		int							m_reconnectMax;
+		DataHandler					m_dataHandler;
+		ConnectHandler				m_connectHandler;
+
+		std::thread					m_thread;
+		std::atomic<bool>			m_stop;
+		std::atomic<bool>			m_connected;
+
+		std::mutex					m_sendMutex;	//m_socket changes and all sends
+		SOCKET						m_socket;
+		std::vector<char>			m_outbox;		//bytes the socket did not take yet
+		size_t						m_outboxLimit;
+		bool						m_writeWatched;	//EVENT_WRITE set in the poller, link thread only
+
+		char						m_receiveBuffer[8192];
+
+		std::atomic<long long>		m_connects;
+		std::atomic<long long>		m_bytesReceived;
+		std::atomic<long long>		m_bytesSent;
+		std::atomic<long long>		m_bytesDropped;
+	};
+
+};//namespace rm
+
+
+
+#endif //ROBOT_LINK_H_
@@ -0,0 +1,315 @@
+/* *
+	RobotSimulator.cpp
+		The Implementation of the controller simulator
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "RobotSimulator.h"
+#include "LatencyTracker.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//how often the server thread checks for Stop while nothing happens
+	static const int SERVER_POLL_MS = 50;
+	//a client sending this much without a newline is not talking to a controller
+	static const size_t MAX_COMMAND_LENGTH = 4096;
+
+	RobotSimulator::RobotSimulator():m_listenSocket(INVALID_SOCKET),m_port(0),m_feedbackRate(0),m_stop(false),
+		m_pPoller(NULL),m_commandsReceived(0),m_movesReceived(0),m_badCommands(0),m_numClients(0)
+	{
+		memset(&m_pose,0,sizeof(m_pose));
+	}
+
+	RobotSimulator::~RobotSimulator()
+	{
+		Stop();
+	}
+
+	void RobotSimulator::SetFeedbackRate(const float rate)
+	{
+		m_feedbackRate = rate;
+	}
+
+	int RobotSimulator::Start(const char *bindAddress, const int port)
+	{
+		if(m_thread.joinable())
+		{
+			throw("RobotSimulator::Start: the simulator is already running");
+		}
+		m_listenSocket = ListenSocket(bindAddress,port);
+		if(m_listenSocket == INVALID_SOCKET)
+		{
+			throw("RobotSimulator::Start: failed to listen on the given address and port");
+		}
+		SetSocketNonBlocking(m_listenSocket,true);
+		m_port = SocketPort(m_listenSocket);
+		m_stop = false;
+		m_thread = thread(&RobotSimulator::ServerLoop,this);
+		return m_port;
+	}
+
+	void RobotSimulator::Stop()
+	{
+		m_stop = true;
+		if(m_thread.joinable())
+		{
+			m_thread.join();
+		}
+		CloseSocket(m_listenSocket);
+		m_listenSocket = INVALID_SOCKET;
+	}
+
+	RobotPose RobotSimulator::Pose() const
+	{
+		lock_guard<mutex> lock(m_poseMutex);
+		return m_pose;
+	}
+
+	int RobotSimulator::EncodePose(char *pBuffer, const bool newline) const
+	{
+		const RobotPose pose = Pose();
+		char *p = pBuffer;
+		*p++ = 'p';
+		*p++ = '[';
+		const float values[6] = {pose.m_x,pose.m_y,pose.m_z,pose.m_rx,pose.m_ry,pose.m_rz};
+		for(int i=0; i<6; i++)
+		{
+			if(i > 0)
+			{
+				*p++ = ',';
+				*p++ = ' ';
+			}
+			p += FormatFixed(p,values[i],6);
+		}
+		*p++ = ']';
+		if(newline)
+		{
+			*p++ = '\n';
+		}
+		return (int)(p - pBuffer);
+	}
+
+	//
+	//Execute one command line and queue the reply
+	void RobotSimulator::HandleCommand(const std::string &command, Client &client)
+	{
+		m_commandsReceived.fetch_add(1,memory_order_relaxed);
+		const size_t start = command.find("movel(p[");
+		if(start != string::npos)
+		{
+			double values[6];
+			const char *p = command.c_str() + start + 8;
+			int count = 0;
+			for(; count<6; count++)
+			{
+				char *pEnd;
+				values[count] = strtod(p,&pEnd);
+				if(pEnd == p)
+				{
+					break;
+				}
+				p = pEnd;
+				while(*p == ',' || *p == ' ')
+				{
+					p++;
+				}
+			}
+			if(count == 6 && *p == ']')
+			{
+				lock_guard<mutex> lock(m_poseMutex);
+				m_pose.m_x = (float)values[0];
+				m_pose.m_y = (float)values[1];
+				m_pose.m_z = (float)values[2];
+				m_pose.m_rx = (float)values[3];
+				m_pose.m_ry = (float)values[4];
+				m_pose.m_rz = (float)values[5];
+				m_movesReceived.fetch_add(1,memory_order_relaxed);
+			}
+			else
+			{
+				m_badCommands.fetch_add(1,memory_order_relaxed);
+			}
+		}
+		char reply[256];
+		const int length = EncodePose(reply,true);
+		client.m_output.insert(client.m_output.end(),reply,reply + length);
+	}
+
+	//
+	//Read what the client sent and execute the complete lines
+	//return false if the client is gone
+	bool RobotSimulator::HandleInput(SOCKET theSocket, Client &client)
+	{
+		char buffer[8192];
+		while(true)
+		{
+			const int received = recv(theSocket,buffer,sizeof(buffer),0);
+			if(received == SOCKET_ERROR && SocketWouldBlock(SocketLastError()))
+			{
+				return true;
+			}
+			if(received <= 0)
+			{
+				return false;
+			}
+			for(int i=0; i<received; i++)
+			{
+				if(buffer[i] == '\n')
+				{
+					HandleCommand(client.m_input,client);
+					client.m_input.clear();
+				}
+				else if(buffer[i] != '\r')
+				{
+					client.m_input += buffer[i];
+				}
+			}
+			if(client.m_input.size() > MAX_COMMAND_LENGTH)
+			{
+				return false;
+			}
+		}
+	}
+
+	//
+	//Send the queued replies, watch the socket for writability while some are left
+	//return false if the client is gone
+	bool RobotSimulator::FlushOutput(SOCKET theSocket, Client &client)
+	{
+		const bool wasPending = !client.m_output.empty();
+		size_t sent = 0;
+		while(sent < client.m_output.size())
+		{
+			const int status = send(theSocket,&client.m_output[sent],(int)(client.m_output.size() - sent),SOCKET_SEND_FLAGS);
+			if(status == SOCKET_ERROR)
+			{
+				if(SocketWouldBlock(SocketLastError()))
+				{
+					break;
+				}
+				return false;
+			}
+			sent += status;
+		}
+		client.m_output.erase(client.m_output.begin(),client.m_output.begin() + sent);
+		const bool pending = !client.m_output.empty();
+		if(pending || wasPending)
+		{
+			m_pPoller->Modify(theSocket,EventPoller::EVENT_READ | (pending ? EventPoller::EVENT_WRITE : 0));
+		}
+		return true;
+	}
+
+	void RobotSimulator::CloseClient(SOCKET theSocket)
+	{
+		m_pPoller->Remove(theSocket);
+		CloseSocket(theSocket);
+		m_clients.erase(theSocket);
+		m_numClients = (int)m_clients.size();
+	}
+
+	void RobotSimulator::ServerLoop()
+	{
+		EventPoller poller;
+		m_pPoller = &poller;
+		poller.Add(m_listenSocket,EventPoller::EVENT_READ);
+		vector<EventPoller::Event> events;
+		const long long feedbackPeriod = m_feedbackRate > 0 ? (long long)(1e9/m_feedbackRate) : 0;
+		long long nextFeedback = MonotonicNanoseconds() + feedbackPeriod;
+
+		while(!m_stop)
+		{
+			int timeoutMs = SERVER_POLL_MS;
+			if(feedbackPeriod > 0)
+			{
+				const long long wait = nextFeedback - MonotonicNanoseconds();
+				timeoutMs = (int)max(0LL,min((long long)SERVER_POLL_MS,wait/1000000));
+			}
+			if(poller.Wait(events,timeoutMs) < 0)
+			{
+				break;
+			}
+			for(size_t i=0; i<events.size(); i++)
+			{
+				const SOCKET s = events[i].m_socket;
+				if(s == m_listenSocket)
+				{
+					SOCKET client;
+					while((client = accept(m_listenSocket,NULL,NULL)) != INVALID_SOCKET)
+					{
+						SetSocketNonBlocking(client,true);
+						SetSocketNoDelay(client);
+						poller.Add(client,EventPoller::EVENT_READ);
+						m_clients[client];
+						m_numClients = (int)m_clients.size();
+					}
+					continue;
+				}
+				map<SOCKET,Client>::iterator it = m_clients.find(s);
+				if(it == m_clients.end())
+				{
+					continue;
+				}
+				bool ok = true;
+				if(events[i].m_events & (EventPoller::EVENT_READ | EventPoller::EVENT_ERROR))
+				{
+					ok = HandleInput(s,it->second);
+				}
+				if(ok)
+				{
+					ok = FlushOutput(s,it->second);
+				}
+				if(!ok)
+				{
+					CloseClient(s);
+				}
+			}
+
+			if(feedbackPeriod > 0 && MonotonicNanoseconds() >= nextFeedback)
+			{
+				char message[256];
+				const int length = EncodePose(message,false);
+				vector<SOCKET> failed;
+				for(map<SOCKET,Client>::iterator it=m_clients.begin(); it!=m_clients.end(); ++it)
+				{
+					it->second.m_output.insert(it->second.m_output.end(),message,message + length);
+					if(!FlushOutput(it->first,it->second))
+					{
+						failed.push_back(it->first);
+					}
+				}
+				for(size_t i=0; i<failed.size(); i++)
+				{
+					CloseClient(failed[i]);
+				}
+				nextFeedback += feedbackPeriod;
+				if(nextFeedback < MonotonicNanoseconds())
+				{//do not try to catch up after a stall
+					nextFeedback = MonotonicNanoseconds() + feedbackPeriod;
+				}
+			}
+		}
+
+		//stop listening first, clients that reconnect right away must not land in the backlog
+		poller.Remove(m_listenSocket);
+		CloseSocket(m_listenSocket);
+		m_listenSocket = INVALID_SOCKET;
+		while(!m_clients.empty())
+		{
+			CloseClient(m_clients.begin()->first);
+		}
+		m_pPoller = NULL;
+	}
+
+}
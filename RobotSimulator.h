@@ -0,0 +1,117 @@
+/* *
+	RobotSimulator.h
+		A stand-in for the robot controller on the local host, for tests
+		and benchmarks of the robot link without a robot
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef ROBOT_SIMULATOR_H_
+#define ROBOT_SIMULATOR_H_
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "RobotSocket.h"
+#include "TrajectoryStreamer.h"
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The RobotSimulator class
+	 *	Accepts any number of clients and reads newline terminated commands
+	 *	from them. A "movel(p[...], ...)" moves the simulated tool to the
+	 *	pose at once; every command is answered with the current pose as
+	 *	one line "p[x, y, z, rx, ry, rz]\n", which is what the streamer
+	 *	counts as acknowledgment (TrajectoryStreamer::ACK_LINE).
+	 *	With a feedback rate, the pose is also sent to all clients
+	 *	periodically, like get_actual_tcp_pose() in a controller loop; these
+	 *	messages have no newline, so they are not taken for acknowledgments
+	 *	(RobotStateReceiver parses both).
+	 ***************************************************************/
+	class RobotSimulator
+	{
+	public:
+		RobotSimulator();
+		~RobotSimulator();
+
+		/** \brief Pose messages sent per second to every client, 0 = none (default)
+		 */
+		void SetFeedbackRate(const float rate);
+
+		/** \brief Start listening
+		 *	\param[in] bindAddress The interface, default the loopback
+		 *	\param[in] port The port, 0 = any free port
+		 *	\return The port
+		 */
+		int Start(const char *bindAddress = "127.0.0.1", const int port = 0);
+
+		/** \brief Disconnect all the clients and stop listening
+		 */
+		void Stop();
+
+		int Port() const { return m_port; }
+
+		/** \brief The simulated tool pose
+		 */
+		RobotPose Pose() const;
+
+		long long CommandsReceived() const { return m_commandsReceived.load(); }
+		long long MovesReceived() const { return m_movesReceived.load(); }
+		long long BadCommands() const { return m_badCommands.load(); }
+		int NumClients() const { return m_numClients.load(); }
+
+	private:
+		struct Client
+		{
+			std::string			m_input;	//incomplete command
+			std::vector<char>	m_output;	//replies the socket did not take yet
+		};
+
+		//not copyable
+		RobotSimulator(const RobotSimulator&);
+		RobotSimulator& operator=(const RobotSimulator&);
+
+		void ServerLoop();
+		bool HandleInput(SOCKET theSocket, Client &client);
+		void HandleCommand(const std::string &command, Client &client);
+		int EncodePose(char *pBuffer, const bool newline) const;
+		bool FlushOutput(SOCKET theSocket, Client &client);
+		void CloseClient(SOCKET theSocket);
+
+		SOCKET						m_listenSocket;
+		int							m_port;
+		float						m_feedbackRate;
+		std::thread					m_thread;
+		std::atomic<bool>			m_stop;
+
+		//server thread only
+		EventPoller					*m_pPoller;
+		std::map<SOCKET,Client>		m_clients;
+
+		mutable std::mutex			m_poseMutex;
+		RobotPose					m_pose;
+
+		std::atomic<long long>		m_commandsReceived;
+		std::atomic<long long>		m_movesReceived;
+		std::atomic<long long>		m_badCommands;
+		std::atomic<int>			m_numClients;
+	};
+
+};//namespace rm
+
+
+
+#endif //ROBOT_SIMULATOR_H_
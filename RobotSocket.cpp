@@ -0,0 +1,455 @@
+/* *
+	RobotSocket.cpp
+		The Implementation of the socket layer of the robot link
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "RobotSocket.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+using namespace std;
+
+
+namespace rm
+{
+
+	bool SocketStartup()
+	{
+#ifdef _WIN32
+		//the static is initialized once even if several threads get here at the same time
+		static const bool s_started = []()
+		{
+			WSADATA wsaData;
+			return WSAStartup(MAKEWORD(2,2),&wsaData) == 0;
+		}();
+		return s_started;
+#else
+		return true;
+#endif
+	}
+
+	int SocketLastError()
+	{
+#ifdef _WIN32
+		return WSAGetLastError();
+#else
+		return errno;
+#endif
+	}
+
+	bool SocketWouldBlock(const int error)
+	{
+#ifdef _WIN32
+		return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+#else
+		return error == EWOULDBLOCK || error == EAGAIN || error == EINPROGRESS || error == EINTR;
+#endif
+	}
+
+	bool SetSocketNonBlocking(SOCKET theSocket, const bool nonBlocking)
+	{
+#ifdef _WIN32
+		u_long mode = nonBlocking ? 1 : 0;
+		return ioctlsocket(theSocket,FIONBIO,&mode) == 0;
+#else
+		const int flags = fcntl(theSocket,F_GETFL,0);
+		if(flags < 0)
+		{
+			return false;
+		}
+		return fcntl(theSocket,F_SETFL,nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) == 0;
+#endif
+	}
+
+	bool SetSocketNoDelay(SOCKET theSocket)
+	{
+		int noDelay = 1;
+		return setsockopt(theSocket,IPPROTO_TCP,TCP_NODELAY,(const char*)&noDelay,sizeof(noDelay)) == 0;
+	}
+
+	//
+	//poll on POSIX: FD_SET is undefined for descriptors >= FD_SETSIZE, which a busy process reaches.
+	//A Windows fd_set is a list of sockets, select has no such limit there
+	int WaitSocket(SOCKET theSocket, const bool forWrite, const int timeoutMs)
+	{
+#ifndef _WIN32
+		pollfd entry;
+		entry.fd = theSocket;
+		entry.events = forWrite ? POLLOUT : POLLIN;
+		entry.revents = 0;
+		const int ready = poll(&entry,1,timeoutMs < 0 ? -1 : timeoutMs);
+#else
+		fd_set set;
+		FD_ZERO(&set);
+		FD_SET(theSocket,&set);
+		timeval timeout;
+		timeout.tv_sec = timeoutMs/1000;
+		timeout.tv_usec = (timeoutMs%1000)*1000;
+		const int ready = select((int)theSocket + 1,forWrite ? NULL : &set,forWrite ? &set : NULL,NULL,
+			timeoutMs < 0 ? NULL : &timeout);
+#endif
+		if(ready < 0)
+		{
+			return SocketWouldBlock(SocketLastError()) ? 0 : -1;
+		}
+		return ready > 0 ? 1 : 0;
+	}
+
+	static bool IsSelfConnected(SOCKET theSocket)
+	{
+		sockaddr_storage local, peer;
+		socklen_t localLength = sizeof(local), peerLength = sizeof(peer);
+		if(getsockname(theSocket,(sockaddr*)&local,&localLength) != 0 || getpeername(theSocket,(sockaddr*)&peer,&peerLength) != 0)
+		{
+			return false;
+		}
+		return localLength == peerLength && memcmp(&local,&peer,localLength) == 0;
+	}
+
+	//
+	//Try the addresses of the host in turn, each one with a non-blocking connect
+	//that is given up after timeoutMs
+	SOCKET ConnectSocket(const char *host, const int port, const int timeoutMs, const bool nonBlocking)
+	{
+		if(!SocketStartup())
+		{
+			return INVALID_SOCKET;
+		}
+		char portText[16];
+		sprintf(portText,"%d",port);
+		addrinfo hints;
+		memset(&hints,0,sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+		addrinfo *pAddresses = NULL;
+		if(getaddrinfo(host,portText,&hints,&pAddresses) != 0)
+		{
+			return INVALID_SOCKET;
+		}
+
+		SOCKET theSocket = INVALID_SOCKET;
+		for(addrinfo *pAddress=pAddresses; pAddress; pAddress=pAddress->ai_next)
+		{
+			theSocket = socket(pAddress->ai_family,pAddress->ai_socktype,pAddress->ai_protocol);
+			if(theSocket == INVALID_SOCKET)
+			{
+				continue;
+			}
+			SetSocketNonBlocking(theSocket,true);
+			bool connected = (connect(theSocket,pAddress->ai_addr,(int)pAddress->ai_addrlen) == 0);
+			if(!connected && SocketWouldBlock(SocketLastError()) && WaitSocket(theSocket,true,timeoutMs) > 0)
+			{
+				int error = 0;
+				socklen_t length = sizeof(error);
+				connected = getsockopt(theSocket,SOL_SOCKET,SO_ERROR,(char*)&error,&length) == 0 && error == 0;
+			}
+			if(connected && IsSelfConnected(theSocket))
+			{//a loopback connect to a free port can connect the socket to itself
+				connected = false;
+			}
+			if(connected)
+			{
+				SetSocketNonBlocking(theSocket,nonBlocking);
+				break;
+			}
+			closesocket(theSocket);
+			theSocket = INVALID_SOCKET;
+		}
+		freeaddrinfo(pAddresses);
+		return theSocket;
+	}
+
+	SOCKET ListenSocket(const char *bindAddress, const int port)
+	{
+		if(!SocketStartup())
+		{
+			return INVALID_SOCKET;
+		}
+		SOCKET theSocket = socket(AF_INET,SOCK_STREAM,IPPROTO_TCP);
+		if(theSocket == INVALID_SOCKET)
+		{
+			return INVALID_SOCKET;
+		}
+		//a restarted server gets its port back right away
+		int reuse = 1;
+		setsockopt(theSocket,SOL_SOCKET,SO_REUSEADDR,(const char*)&reuse,sizeof(reuse));
+
+		sockaddr_in service;
+		memset(&service,0,sizeof(service));
+		service.sin_family = AF_INET;
+		service.sin_port = htons((unsigned short)port);
+		if(bindAddress && bindAddress[0])
+		{
+			if(inet_pton(AF_INET,bindAddress,&service.sin_addr) != 1)
+			{
+				closesocket(theSocket);
+				return INVALID_SOCKET;
+			}
+		}
+		else
+		{
+			service.sin_addr.s_addr = htonl(INADDR_ANY);
+		}
+		if(bind(theSocket,(sockaddr*)&service,sizeof(service)) == SOCKET_ERROR || listen(theSocket,SOMAXCONN) == SOCKET_ERROR)
+		{
+			closesocket(theSocket);
+			return INVALID_SOCKET;
+		}
+		return theSocket;
+	}
+
+	SOCKET AcceptSocket(SOCKET listenSocket, const int timeoutMs)
+	{
+		if(timeoutMs >= 0 && WaitSocket(listenSocket,false,timeoutMs) <= 0)
+		{
+			return INVALID_SOCKET;
+		}
+		return accept(listenSocket,NULL,NULL);
+	}
+
+	int SocketPort(SOCKET theSocket)
+	{
+		sockaddr_in address;
+		socklen_t length = sizeof(address);
+		if(getsockname(theSocket,(sockaddr*)&address,&length) != 0)
+		{
+			return -1;
+		}
+		return ntohs(address.sin_port);
+	}
+
+	void CloseSocket(SOCKET theSocket)
+	{
+		if(theSocket != INVALID_SOCKET)
+		{
+			closesocket(theSocket);
+		}
+	}
+
+
+	/******************************/
+	/* EventPoller                */
+	/******************************/
+
+#ifdef __linux__
+
+	static unsigned int EpollMask(const int events)
+	{
+		return ((events & EventPoller::EVENT_READ) ? (unsigned int)EPOLLIN : 0u) |
+			((events & EventPoller::EVENT_WRITE) ? (unsigned int)EPOLLOUT : 0u);
+	}
+
+	EventPoller::EventPoller():m_epoll(epoll_create1(EPOLL_CLOEXEC)),m_epollEvents(64)
+	{
+		if(m_epoll < 0)
+		{
+			throw("EventPoller: failed to create the epoll instance");
+		}
+	}
+
+	EventPoller::~EventPoller()
+	{
+		close(m_epoll);
+	}
+
+	bool EventPoller::Add(SOCKET theSocket, const int events)
+	{
+		epoll_event event;
+		memset(&event,0,sizeof(event));
+		event.events = EpollMask(events);
+		event.data.fd = theSocket;
+		return epoll_ctl(m_epoll,EPOLL_CTL_ADD,theSocket,&event) == 0;
+	}
+
+	bool EventPoller::Modify(SOCKET theSocket, const int events)
+	{
+		epoll_event event;
+		memset(&event,0,sizeof(event));
+		event.events = EpollMask(events);
+		event.data.fd = theSocket;
+		return epoll_ctl(m_epoll,EPOLL_CTL_MOD,theSocket,&event) == 0;
+	}
+
+	void EventPoller::Remove(SOCKET theSocket)
+	{
+		epoll_event event;
+		memset(&event,0,sizeof(event));
+		epoll_ctl(m_epoll,EPOLL_CTL_DEL,theSocket,&event);
+	}
+
+	int EventPoller::Wait(std::vector<Event> &events, const int timeoutMs)
+	{
+		events.clear();
+		const int count = epoll_wait(m_epoll,&m_epollEvents[0],(int)m_epollEvents.size(),timeoutMs);
+		if(count < 0)
+		{
+			return errno == EINTR ? 0 : -1;
+		}
+		for(int i=0; i<count; i++)
+		{
+			const unsigned int mask = m_epollEvents[i].events;
+			Event event;
+			event.m_socket = m_epollEvents[i].data.fd;
+			event.m_events = ((mask & EPOLLIN) ? EVENT_READ : 0) | ((mask & EPOLLOUT) ? EVENT_WRITE : 0) |
+				((mask & (EPOLLERR | EPOLLHUP)) ? EVENT_ERROR : 0);
+			events.push_back(event);
+		}
+		if(count == (int)m_epollEvents.size())
+		{//more may be ready, make room for them next time
+			m_epollEvents.resize(2*m_epollEvents.size());
+		}
+		return count;
+	}
+
+#else
+
+	EventPoller::EventPoller()
+	{
+	}
+
+	EventPoller::~EventPoller()
+	{
+	}
+
+	bool EventPoller::Add(SOCKET theSocket, const int events)
+	{
+		for(size_t i=0; i<m_sockets.size(); i++)
+		{
+			if(m_sockets[i].m_socket == theSocket)
+			{
+				return false;
+			}
+		}
+		Event entry;
+		entry.m_socket = theSocket;
+		entry.m_events = events;
+		m_sockets.push_back(entry);
+		return true;
+	}
+
+	bool EventPoller::Modify(SOCKET theSocket, const int events)
+	{
+		for(size_t i=0; i<m_sockets.size(); i++)
+		{
+			if(m_sockets[i].m_socket == theSocket)
+			{
+				m_sockets[i].m_events = events;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void EventPoller::Remove(SOCKET theSocket)
+	{
+		for(size_t i=0; i<m_sockets.size(); i++)
+		{
+			if(m_sockets[i].m_socket == theSocket)
+			{
+				m_sockets.erase(m_sockets.begin() + i);
+				return;
+			}
+		}
+	}
+
+#ifndef _WIN32
+
+	//
+	//poll, select would limit the descriptors to FD_SETSIZE
+	int EventPoller::Wait(std::vector<Event> &events, const int timeoutMs)
+	{
+		events.clear();
+		vector<pollfd> entries(m_sockets.size());
+		for(size_t i=0; i<m_sockets.size(); i++)
+		{
+			entries[i].fd = m_sockets[i].m_socket;
+			entries[i].events = (short)(((m_sockets[i].m_events & EVENT_READ) ? POLLIN : 0) |
+				((m_sockets[i].m_events & EVENT_WRITE) ? POLLOUT : 0));
+			entries[i].revents = 0;
+		}
+		const int count = poll(entries.empty() ? NULL : &entries[0],(nfds_t)entries.size(),timeoutMs < 0 ? -1 : timeoutMs);
+		if(count < 0)
+		{
+			return SocketWouldBlock(SocketLastError()) ? 0 : -1;
+		}
+		for(size_t i=0; i<entries.size() && count > 0; i++)
+		{
+			const short mask = entries[i].revents;
+			Event event;
+			event.m_socket = entries[i].fd;
+			event.m_events = ((mask & POLLIN) ? EVENT_READ : 0) | ((mask & POLLOUT) ? EVENT_WRITE : 0) |
+				((mask & (POLLERR | POLLHUP | POLLNVAL)) ? EVENT_ERROR : 0);
+			if(event.m_events)
+			{
+				events.push_back(event);
+			}
+		}
+		return (int)events.size();
+	}
+
+#else
+
+	int EventPoller::Wait(std::vector<Event> &events, const int timeoutMs)
+	{
+		events.clear();
+		fd_set readSet, writeSet, errorSet;
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		FD_ZERO(&errorSet);
+		int maxSocket = 0;
+		for(size_t i=0; i<m_sockets.size(); i++)
+		{
+			const SOCKET s = m_sockets[i].m_socket;
+			if(m_sockets[i].m_events & EVENT_READ)
+			{
+				FD_SET(s,&readSet);
+			}
+			if(m_sockets[i].m_events & EVENT_WRITE)
+			{
+				FD_SET(s,&writeSet);
+			}
+			FD_SET(s,&errorSet);
+			if((int)s > maxSocket)
+			{
+				maxSocket = (int)s;
+			}
+		}
+		timeval timeout;
+		timeout.tv_sec = timeoutMs/1000;
+		timeout.tv_usec = (timeoutMs%1000)*1000;
+		const int count = select(maxSocket + 1,&readSet,&writeSet,&errorSet,timeoutMs < 0 ? NULL : &timeout);
+		if(count < 0)
+		{
+			return SocketWouldBlock(SocketLastError()) ? 0 : -1;
+		}
+		for(size_t i=0; i<m_sockets.size() && count > 0; i++)
+		{
+			const SOCKET s = m_sockets[i].m_socket;
+			Event event;
+			event.m_socket = s;
+			event.m_events = (FD_ISSET(s,&readSet) ? EVENT_READ : 0) | (FD_ISSET(s,&writeSet) ? EVENT_WRITE : 0) |
+				(FD_ISSET(s,&errorSet) ? EVENT_ERROR : 0);
+			if(event.m_events)
+			{
+				events.push_back(event);
+			}
+		}
+		return (int)events.size();
+	}
+
+#endif
+
+#endif
+
+}
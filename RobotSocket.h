@@ -0,0 +1,166 @@
+/* *
+	RobotSocket.h
+		Socket layer of the robot link: Winsock on Windows, BSD sockets
+		elsewhere, and an event poller (epoll on Linux, select otherwise)
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef ROBOT_SOCKET_H_
+#define ROBOT_SOCKET_H_
+
+
+#include <vector>
+
+#ifdef _WIN32
+//before Windows.h, which would pull in the old winsock.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <Windows.h>
+#define SOCKET_SEND_FLAGS	0
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+typedef int SOCKET;
+#define INVALID_SOCKET		(-1)
+#define SOCKET_ERROR		(-1)
+#define closesocket			close
+//a closed peer must not kill the process with SIGPIPE
+#define SOCKET_SEND_FLAGS	MSG_NOSIGNAL
+#endif
+
+//return values of the robot link functions
+#ifndef NETWORK_ERROR
+#define NETWORK_ERROR -1
+#define NETWORK_OK     0
+#endif
+
+
+
+namespace rm
+{
+
+	/** \brief Initialize the socket library, once per process (WSAStartup on Windows)
+	 *	Can be called any number of times from any thread.
+	 *	\return false if the library could not be initialized
+	 */
+	bool SocketStartup();
+
+	/** \brief Error code of the last failed socket call of this thread
+	 */
+	int SocketLastError();
+
+	/** \brief Check if an error code means "try again later" (non-blocking sockets)
+	 */
+	bool SocketWouldBlock(const int error);
+
+	bool SetSocketNonBlocking(SOCKET theSocket, const bool nonBlocking);
+	bool SetSocketNoDelay(SOCKET theSocket);
+
+	/** \brief Wait until the socket is readable or writable
+	 *	\param[in] timeoutMs Max time to wait, 0 = poll, -1 = forever
+	 *	\return 1 if ready, 0 on timeout, -1 on error
+	 */
+	int WaitSocket(SOCKET theSocket, const bool forWrite, const int timeoutMs);
+
+	/** \brief Connect to a TCP server
+	 *	The host is resolved with getaddrinfo (numeric addresses do not touch DNS),
+	 *	the connection attempt is given up after timeoutMs.
+	 *	\param[in] host Host name or address
+	 *	\param[in] port The port
+	 *	\param[in] timeoutMs Connect timeout, -1 = the system default
+	 *	\param[in] nonBlocking Leave the socket in non-blocking mode
+	 *	\return The connected socket, INVALID_SOCKET on failure
+	 */
+	SOCKET ConnectSocket(const char *host, const int port, const int timeoutMs, const bool nonBlocking = false);
+
+	/** \brief Create a listening TCP socket
+	 *	\param[in] bindAddress Address of the interface to listen on, NULL or "" = all interfaces
+	 *	\param[in] port The port, 0 = any free port (see SocketPort)
+	 *	\return The socket, INVALID_SOCKET on failure
+	 */
+	SOCKET ListenSocket(const char *bindAddress, const int port);
+
+	/** \brief Accept a connection
+	 *	\param[in] timeoutMs Max time to wait, -1 = forever
+	 *	\return The client socket, INVALID_SOCKET on timeout or failure
+	 */
+	SOCKET AcceptSocket(SOCKET listenSocket, const int timeoutMs);
+
+	/** \brief Local port of a bound socket, -1 on failure
+	 */
+	int SocketPort(SOCKET theSocket);
+
+	void CloseSocket(SOCKET theSocket);
+
+
+	/************************************************************//**
+	 *	The EventPoller class
+	 *	Waits for any of a set of sockets to become ready: epoll on Linux,
+	 *	select on Windows and other systems. Not thread safe, meant to be
+	 *	used by the one thread running an event loop.
+	 ***************************************************************/
+	class EventPoller
+	{
+	public:
+		enum
+		{
+			EVENT_READ = 1,
+			EVENT_WRITE = 2,
+			EVENT_ERROR = 4		//reported only, hang up or socket error
+		};
+
+		struct Event
+		{
+			SOCKET			m_socket;
+			int				m_events;
+		};
+
+		EventPoller();
+		~EventPoller();
+
+		/** \brief Watch a socket
+		 *	\param[in] events EVENT_READ and/or EVENT_WRITE
+		 */
+		bool Add(SOCKET theSocket, const int events);
+		bool Modify(SOCKET theSocket, const int events);
+		void Remove(SOCKET theSocket);
+
+		/** \brief Wait for events
+		 *	\param[out] events The ready sockets
+		 *	\param[in] timeoutMs Max time to wait, 0 = poll, -1 = forever
+		 *	\return Number of ready sockets, 0 on timeout, -1 on error
+		 */
+		int Wait(std::vector<Event> &events, const int timeoutMs);
+
+	private:
+		//not copyable
+		EventPoller(const EventPoller&);
+		EventPoller& operator=(const EventPoller&);
+
+#ifdef __linux__
+		int						m_epoll;
+		std::vector<epoll_event>	m_epollEvents;
+#else
+		std::vector<Event>		m_sockets;
+#endif
+	};
+
+};//namespace rm
+
+
+
+#endif //ROBOT_SOCKET_H_
@@ -0,0 +1,221 @@
+/* *
+	RobotStateReceiver.cpp
+		The Implementation of the robot state receiver
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "RobotStateReceiver.h"
+#include "LatencyTracker.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//how often the receiver thread checks for Stop while the socket is quiet
+	static const int RECEIVE_POLL_MS = 100;
+
+	RobotStateReceiver::RobotStateReceiver(SOCKET theSocket, const int historySize):m_socket(theSocket),m_stop(false),
+		m_running(false),m_messageLength(-1),m_messageIsPose(false),m_previousChar(0),m_history(max(historySize,0)),
+		m_historyCount(0),m_messagesParsed(0),m_parseErrors(0)
+	{
+		memset(&m_current,0,sizeof(m_current));
+	}
+
+	RobotStateReceiver::~RobotStateReceiver()
+	{
+		Stop();
+	}
+
+	void RobotStateReceiver::Start()
+	{
+		if(m_thread.joinable())
+		{
+			return;
+		}
+		m_stop = false;
+		m_running = true;
+		m_thread = thread(&RobotStateReceiver::ReceiveLoop,this);
+	}
+
+	void RobotStateReceiver::Stop()
+	{
+		m_stop = true;
+		if(m_thread.joinable())
+		{
+			m_thread.join();
+		}
+		m_running = false;
+	}
+
+	bool RobotStateReceiver::LatestPose(RobotPose &pose) const
+	{
+		RobotState state;
+		if(!m_latest.Load(state) || !(state.m_flags & RobotState::HAS_POSE))
+		{
+			return false;
+		}
+		pose = state.m_pose;
+		return true;
+	}
+
+	//
+	//History entry k (0 based) holds the state of message k+1 in slot k % size,
+	//entries the receiver overwrote while they were copied are left out
+	int RobotStateReceiver::History(std::vector<RobotState> &states, const int maxCount) const
+	{
+		states.clear();
+		const long long size = (long long)m_history.size();
+		if(size == 0)
+		{
+			return 0;
+		}
+		const long long count = m_historyCount.load(memory_order_acquire);
+		long long wanted = min(count,size);
+		if(maxCount > 0)
+		{
+			wanted = min(wanted,(long long)maxCount);
+		}
+		states.reserve((size_t)wanted);
+		RobotState state;
+		for(long long k=count-wanted; k<count; k++)
+		{
+			if(m_history[(size_t)(k % size)].Load(state) && state.m_sequence == k + 1)
+			{
+				states.push_back(state);
+			}
+		}
+		return (int)states.size();
+	}
+
+	void RobotStateReceiver::ReceiveLoop()
+	{
+		while(!m_stop)
+		{
+			const int ready = WaitSocket(m_socket,false,RECEIVE_POLL_MS);
+			if(ready < 0)
+			{
+				break;
+			}
+			if(ready == 0)
+			{
+				continue;
+			}
+			const int received = recv(m_socket,m_receiveBuffer,sizeof(m_receiveBuffer),0);
+			if(received == SOCKET_ERROR && SocketWouldBlock(SocketLastError()))
+			{
+				continue;
+			}
+			if(received <= 0)
+			{//closed by the controller or failed
+				break;
+			}
+			Feed(m_receiveBuffer,received);
+		}
+		m_running = false;
+	}
+
+	//
+	//Collect the text between '[' and ']', a 'p' right before '[' marks a pose
+	void RobotStateReceiver::Feed(const char *pData, const int size)
+	{
+		for(int i=0; i<size; i++)
+		{
+			const char c = pData[i];
+			if(m_messageLength < 0)
+			{
+				if(c == '[')
+				{
+					m_messageLength = 0;
+					m_messageIsPose = (m_previousChar == 'p');
+				}
+			}
+			else if(c == ']')
+			{
+				m_message[m_messageLength] = 0;
+				ParseMessage();
+				m_messageLength = -1;
+			}
+			else if(c == '[' || m_messageLength >= (int)sizeof(m_message) - 1)
+			{//nested or too long, not a message of ours
+				m_parseErrors.fetch_add(1,memory_order_relaxed);
+				m_messageLength = -1;
+			}
+			else
+			{
+				m_message[m_messageLength++] = c;
+			}
+			m_previousChar = c;
+		}
+	}
+
+	void RobotStateReceiver::ParseMessage()
+	{
+		double values[6];
+		int count = 0;
+		const char *p = m_message;
+		while(*p)
+		{
+			char *pEnd;
+			const double value = strtod(p,&pEnd);
+			if(pEnd == p)
+			{
+				break;
+			}
+			if(count == 6)
+			{
+				count++;
+				break;
+			}
+			values[count++] = value;
+			p = pEnd;
+			while(*p == ' ' || *p == ',' || *p == '\t' || *p == '\r' || *p == '\n')
+			{
+				p++;
+			}
+		}
+		if(count != 6 || *p)
+		{
+			m_parseErrors.fetch_add(1,memory_order_relaxed);
+			return;
+		}
+		if(m_messageIsPose)
+		{
+			m_current.m_pose.m_x = (float)values[0];
+			m_current.m_pose.m_y = (float)values[1];
+			m_current.m_pose.m_z = (float)values[2];
+			m_current.m_pose.m_rx = (float)values[3];
+			m_current.m_pose.m_ry = (float)values[4];
+			m_current.m_pose.m_rz = (float)values[5];
+			m_current.m_flags |= RobotState::HAS_POSE;
+		}
+		else
+		{
+			memcpy(m_current.m_joints,values,sizeof(values));
+			m_current.m_flags |= RobotState::HAS_JOINTS;
+		}
+		Publish();
+	}
+
+	void RobotStateReceiver::Publish()
+	{
+		m_current.m_sequence = m_messagesParsed.load(memory_order_relaxed) + 1;
+		m_current.m_receiveTime = MonotonicNanoseconds();
+		if(!m_history.empty())
+		{
+			const long long k = m_historyCount.load(memory_order_relaxed);
+			m_history[(size_t)(k % (long long)m_history.size())].Store(m_current);
+			m_historyCount.store(k + 1,memory_order_release);
+		}
+		m_latest.Store(m_current);
+		m_messagesParsed.store(m_current.m_sequence,memory_order_release);
+	}
+
+}
@@ -0,0 +1,210 @@
+/* *
+	RobotStateReceiver.h
+		Reads the state stream of the robot controller on a thread of its
+		own and publishes the latest pose without locks
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef ROBOT_STATE_RECEIVER_H_
+#define ROBOT_STATE_RECEIVER_H_
+
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstring>
+
+#include "TrajectoryStreamer.h"
+
+
+
+namespace rm
+{
+
+	/** \brief The state of the robot as last reported by the controller
+	 */
+	struct RobotState
+	{
+		enum
+		{
+			HAS_POSE = 1,
+			HAS_JOINTS = 2
+		};
+
+		RobotPose			m_pose;			//tool pose, valid if m_flags & HAS_POSE
+		double				m_joints[6];	//joint positions in rad, valid if m_flags & HAS_JOINTS
+		int					m_flags;
+		long long			m_sequence;		//number of messages parsed so far, 1 for the first one
+		long long			m_receiveTime;	//monotonic ns (see LatencyTracker.h) of the last message
+	};
+
+
+	/************************************************************//**
+	 *	The SeqLockSlot class
+	 *	A value written by one thread and read by any number of threads
+	 *	without locks: readers retry if the writer was busy. Reading costs
+	 *	a copy of the value, writing never waits. T must be trivially copyable.
+	 ***************************************************************/
+	template<typename T>
+	class SeqLockSlot
+	{
+	public:
+		SeqLockSlot():m_sequence(0)
+		{
+			for(int i=0; i<NUM_WORDS; i++)
+			{
+				m_words[i].store(0,std::memory_order_relaxed);
+			}
+		}
+
+		/** \brief Publish a value (one writer thread only)
+		 */
+		void Store(const T &value)
+		{
+			unsigned long long words[NUM_WORDS] = {0};
+			memcpy(words,&value,sizeof(T));
+			const unsigned long long sequence = m_sequence.load(std::memory_order_relaxed);
+			m_sequence.store(sequence + 1,std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for(int i=0; i<NUM_WORDS; i++)
+			{
+				m_words[i].store(words[i],std::memory_order_relaxed);
+			}
+			m_sequence.store(sequence + 2,std::memory_order_release);
+		}
+
+		/** \brief Copy the last published value
+		 *	\return false if nothing was published yet
+		 */
+		bool Load(T &value) const
+		{
+			unsigned long long words[NUM_WORDS];
+			unsigned long long before, after;
+			do
+			{
+				before = m_sequence.load(std::memory_order_acquire);
+				for(int i=0; i<NUM_WORDS; i++)
+				{
+					words[i] = m_words[i].load(std::memory_order_relaxed);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				after = m_sequence.load(std::memory_order_relaxed);
+			}
+			while((before & 1) || before != after);
+			if(before == 0)
+			{
+				return false;
+			}
+			memcpy(&value,words,sizeof(T));
+			return true;
+		}
+
+	private:
+		static const int NUM_WORDS = (int)((sizeof(T) + 7)/8);
+
+		std::atomic<unsigned long long>		m_sequence;		//odd while the writer is busy, 0 = empty
+		std::atomic<unsigned long long>		m_words[NUM_WORDS];
+	};
+
+
+	/************************************************************//**
+	 *	The RobotStateReceiver class
+	 *	A thread reads the socket and parses what the controller sends:
+	 *	"p[x, y, z, rx, ry, rz]" is a tool pose (get_actual_tcp_pose()),
+	 *	"[j0, ..., j5]" are joint positions (get_actual_joint_positions()).
+	 *	Messages may be split across reads or sent without separators.
+	 *	The latest state is kept in a SeqLockSlot, so the control loop reads
+	 *	it in nanoseconds without touching the socket, and optionally the
+	 *	last historySize states in a ring.
+	 *
+	 *	The receiver does not own the socket.
+	 ***************************************************************/
+	class RobotStateReceiver
+	{
+	public:
+		/** \brief Create the receiver
+		 *	\param[in] theSocket The connected socket the controller sends its state to
+		 *	\param[in] historySize Number of states kept in the history, 0 = none
+		 */
+		RobotStateReceiver(SOCKET theSocket, const int historySize = 0);
+		~RobotStateReceiver();
+
+		/** \brief Start the receiver thread
+		 */
+		void Start();
+
+		/** \brief Stop the receiver thread (returns within about 100ms)
+		 */
+		void Stop();
+
+		/** \brief False before Start, after Stop and after the connection failed or closed
+		 */
+		bool IsRunning() const { return m_running.load(); }
+
+		/** \brief Copy the latest state
+		 *	\return false if nothing was received yet
+		 */
+		bool LatestState(RobotState &state) const { return m_latest.Load(state); }
+
+		/** \brief Copy the latest pose
+		 *	\return false if no pose was received yet
+		 */
+		bool LatestPose(RobotPose &pose) const;
+
+		/** \brief Copy the most recent states of the history
+		 *	\param[out] states The states, oldest first
+		 *	\param[in] maxCount Max number of states, 0 = the whole history
+		 *	\return Number of states
+		 */
+		int History(std::vector<RobotState> &states, const int maxCount = 0) const;
+
+		/** \brief Parse bytes of the state stream
+		 *	Called by the receiver thread; can be used without Start when the
+		 *	bytes arrive another way (e.g. the data handler of a RobotLink).
+		 *	One thread at a time.
+		 */
+		void Feed(const char *pData, const int size);
+
+		long long MessagesParsed() const { return m_messagesParsed.load(); }
+		long long ParseErrors() const { return m_parseErrors.load(); }
+
+	private:
+		//not copyable
+		RobotStateReceiver(const RobotStateReceiver&);
+		RobotStateReceiver& operator=(const RobotStateReceiver&);
+
+		void ReceiveLoop();
+		void ParseMessage();
+		void Publish();
+
+		SOCKET								m_socket;
+		std::thread							m_thread;
+		std::atomic<bool>					m_stop;
+		std::atomic<bool>					m_running;
+
+		//parser, only used by the thread feeding the bytes
+		char								m_receiveBuffer[4096];
+		char								m_message[512];	//values between the brackets
+		int									m_messageLength;	//-1 = outside of a message
+		bool								m_messageIsPose;
+		char								m_previousChar;
+		RobotState							m_current;
+
+		//published
+		SeqLockSlot<RobotState>				m_latest;
+		std::vector< SeqLockSlot<RobotState> >	m_history;
+		std::atomic<long long>				m_historyCount;	//states written to the history
+		std::atomic<long long>				m_messagesParsed;
+		std::atomic<long long>				m_parseErrors;
+	};
+
+};//namespace rm
+
+
+
+#endif //ROBOT_STATE_RECEIVER_H_
@@ -0,0 +1,437 @@
+/* *
+	ScanScheduler.cpp
+		The Implementation of the scan scheduler
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "ScanScheduler.h"
+#include "Camera.h"
+#include "FileIO.h"
+#include "RobotStateReceiver.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//how often the pose feedback is checked while waiting for arrival
+	static const int ARRIVAL_POLL_US = 100;
+
+	const char* ScanReport::StageName(const Stage stage)
+	{
+		switch(stage)
+		{
+		case STAGE_MOVE:
+			return "move";
+		case STAGE_CAPTURE:
+			return "capture";
+		case STAGE_SAVE_WAIT:
+			return "saveWait";
+		case STAGE_SAVE:
+			return "save";
+		case STAGE_CYCLE:
+			return "cycle";
+		default:
+			return "unknown";
+		}
+	}
+
+	ScanScheduler::ScanScheduler(Camera &camera, TrajectoryStreamer &streamer, const RobotStateReceiver *pReceiver):
+		m_camera(camera),m_streamer(streamer),m_pReceiver(pReceiver),m_positionTolerance(0.0005f),m_rotationTolerance(0.005f),
+		m_settleTime(0),m_arrivalTimeout(10000),m_saveQueueDepth(8),m_serial(false),m_saving(0),m_stopSaver(false),
+		m_pSaveError(NULL),m_streamId(-1),m_lastWrittenTime(0)
+	{
+	}
+
+	ScanScheduler::~ScanScheduler()
+	{
+		StopSaver();
+		CloseOutputs();
+	}
+
+	void ScanScheduler::SetTolerance(const float position, const float rotation)
+	{
+		m_positionTolerance = position;
+		m_rotationTolerance = rotation;
+	}
+
+	void ScanScheduler::SetSettleTime(const int milliseconds)
+	{
+		m_settleTime = max(milliseconds,0);
+	}
+
+	void ScanScheduler::SetArrivalTimeout(const int milliseconds)
+	{
+		m_arrivalTimeout = max(milliseconds,0);
+	}
+
+	void ScanScheduler::SetSaveQueueDepth(const int depth)
+	{
+		m_saveQueueDepth = max(depth,1);
+	}
+
+	void ScanScheduler::SetSerial(const bool serial)
+	{
+		m_serial = serial;
+	}
+
+	void ScanScheduler::SetSavePath(const std::string &saveDir, const std::string &prefix)
+	{
+		m_saveDir = saveDir;
+		m_savePrefix = prefix;
+	}
+
+	//
+	//Capture at waypoint i while the robot is already on its way to i+1:
+	//	send(0); for i: wait arrival(i), grab(i), send(i+1), queue save(i)
+	ScanReport ScanScheduler::Run(const std::vector<RobotPose> &waypoints, const int firstFrameId, const int streamId)
+	{
+		if(m_saveThread.joinable())
+		{
+			throw("ScanScheduler::Run: a scan is already running");
+		}
+		for(int i=0; i<ScanReport::NUM_STAGES; i++)
+		{
+			m_histograms[i].Reset();
+		}
+		ScanReport report;
+		memset(&report,0,sizeof(report));
+
+		OpenOutputs(streamId);
+		m_stopSaver = false;
+		m_pSaveError = NULL;
+		m_saveThread = thread(&ScanScheduler::SaveLoop,this);
+
+		const long long start = MonotonicNanoseconds();
+		m_lastWrittenTime = start;
+		long long sentTime = start;
+		long long lastArrival = 0;
+		bool ok = false;
+		try
+		{
+			ok = waypoints.empty() || SendMove(waypoints[0]);
+			for(size_t i=0; i<waypoints.size() && ok && !SaveFailed(); i++)
+			{
+				SaveJob job;
+				job.m_frameId = firstFrameId + (int)i;
+				job.m_target = waypoints[i];
+				job.m_arrived = WaitForArrival(waypoints[i],sentTime,job.m_pose);
+				const long long arrival = MonotonicNanoseconds();
+				m_histograms[ScanReport::STAGE_MOVE].Record(arrival - sentTime);
+				if(lastArrival != 0)
+				{
+					m_histograms[ScanReport::STAGE_CYCLE].Record(arrival - lastArrival);
+				}
+				lastArrival = arrival;
+				if(!job.m_arrived)
+				{
+					report.m_arrivalTimeouts++;
+				}
+				if(m_settleTime > 0)
+				{
+					this_thread::sleep_for(chrono::milliseconds(m_settleTime));
+				}
+
+				job.m_grabTime = MonotonicNanoseconds();
+				m_camera.GrabOne();
+				m_camera.AcquireCapture(job.m_frames);
+				const long long latched = MonotonicNanoseconds();
+				m_histograms[ScanReport::STAGE_CAPTURE].Record(latched - job.m_grabTime);
+				report.m_frames++;
+
+				if(i+1 < waypoints.size() && !m_serial)
+				{
+					sentTime = MonotonicNanoseconds();
+					ok = SendMove(waypoints[i+1]);
+				}
+				QueueSave(job);
+				job.m_frames.clear();
+				if(i+1 < waypoints.size() && m_serial)
+				{
+					WaitSaved();
+					sentTime = MonotonicNanoseconds();
+					ok = SendMove(waypoints[i+1]);
+				}
+			}
+		}
+		catch(...)
+		{//e.g. the camera failed, the frames captured so far are still written
+			StopSaver();
+			CloseOutputs();
+			m_pSaveError = NULL;
+			throw;
+		}
+
+		StopSaver();
+		CloseOutputs();
+		const char *pSaveError = m_pSaveError;
+		m_pSaveError = NULL;
+		if(pSaveError)
+		{
+			throw(pSaveError);
+		}
+		if(ok)
+		{
+			ok = m_streamer.Drain() == NETWORK_OK;
+		}
+		if(!ok)
+		{
+			throw("ScanScheduler::Run: failed to send a move to the robot");
+		}
+
+		report.m_seconds = (max(m_lastWrittenTime,lastArrival) - start)*1e-9;
+		report.m_framesPerSecond = report.m_seconds > 0 ? report.m_frames / report.m_seconds : 0;
+		for(int i=0; i<ScanReport::NUM_STAGES; i++)
+		{
+			report.m_stages[i] = m_histograms[i].Summary();
+		}
+		return report;
+	}
+
+	bool ScanScheduler::SendMove(const RobotPose &pose)
+	{
+		return m_streamer.SendTrajectory(&pose,1) == NETWORK_OK;
+	}
+
+	bool ScanScheduler::IsWithinTolerance(const RobotPose &pose, const RobotPose &target) const
+	{
+		const float dx = pose.m_x - target.m_x;
+		const float dy = pose.m_y - target.m_y;
+		const float dz = pose.m_z - target.m_z;
+		if(dx*dx + dy*dy + dz*dz > m_positionTolerance*m_positionTolerance)
+		{
+			return false;
+		}
+		return fabs(pose.m_rx - target.m_rx) <= m_rotationTolerance && fabs(pose.m_ry - target.m_ry) <= m_rotationTolerance &&
+			fabs(pose.m_rz - target.m_rz) <= m_rotationTolerance;
+	}
+
+	//
+	//Wait for a pose received after the move was sent that is within tolerance
+	//return false on timeout, reached is the last pose reported (the target without feedback)
+	bool ScanScheduler::WaitForArrival(const RobotPose &target, const long long sentTime, RobotPose &reached)
+	{
+		reached = target;
+		if(!m_pReceiver)
+		{
+			return true;
+		}
+		const long long deadline = sentTime + m_arrivalTimeout*1000000LL;
+		RobotState state;
+		while(true)
+		{
+			//collect the acknowledgments so that the window never fills up during a scan
+			if(m_streamer.Poll() < 0)
+			{
+				return false;
+			}
+			if(m_pReceiver->LatestState(state) && (state.m_flags & RobotState::HAS_POSE))
+			{
+				reached = state.m_pose;
+				if(state.m_receiveTime >= sentTime && IsWithinTolerance(state.m_pose,target))
+				{
+					return true;
+				}
+			}
+			if(MonotonicNanoseconds() > deadline)
+			{
+				return false;
+			}
+			this_thread::sleep_for(chrono::microseconds(ARRIVAL_POLL_US));
+		}
+	}
+
+	void ScanScheduler::QueueSave(const SaveJob &job)
+	{
+		const long long before = MonotonicNanoseconds();
+		unique_lock<mutex> lock(m_saveMutex);
+		while((int)m_saveQueue.size() >= m_saveQueueDepth)
+		{
+			m_cvProducer.wait(lock);
+		}
+		if(m_pSaveError)
+		{//the saver stopped writing, Run throws its error
+			return;
+		}
+		m_saveQueue.push_back(job);
+		m_saveQueue.back().m_queueTime = MonotonicNanoseconds();
+		m_histograms[ScanReport::STAGE_SAVE_WAIT].Record(m_saveQueue.back().m_queueTime - before);
+		lock.unlock();
+		m_cvSaver.notify_one();
+	}
+
+	bool ScanScheduler::SaveFailed()
+	{
+		lock_guard<mutex> lock(m_saveMutex);
+		return m_pSaveError != NULL;
+	}
+
+	void ScanScheduler::WaitSaved()
+	{
+		unique_lock<mutex> lock(m_saveMutex);
+		while(!m_saveQueue.empty() || m_saving > 0)
+		{
+			m_cvProducer.wait(lock);
+		}
+	}
+
+	//
+	//Let the saver write what is queued, then end its thread
+	void ScanScheduler::StopSaver()
+	{
+		{
+			lock_guard<mutex> lock(m_saveMutex);
+			m_stopSaver = true;
+		}
+		m_cvSaver.notify_all();
+		if(m_saveThread.joinable())
+		{
+			m_saveThread.join();
+		}
+	}
+
+	void ScanScheduler::SaveLoop()
+	{
+		unique_lock<mutex> lock(m_saveMutex);
+		while(true)
+		{
+			while(m_saveQueue.empty() && !m_stopSaver)
+			{
+				m_cvSaver.wait(lock);
+			}
+			if(m_saveQueue.empty())
+			{
+				return;
+			}
+			//copying the handles only counts references
+			SaveJob job = m_saveQueue.front();
+			m_saveQueue.pop_front();
+			m_saving++;
+			lock.unlock();
+
+			const char *pError = NULL;
+			try
+			{
+				SaveJobFrames(job);
+			}
+			catch(const char *pMessage)
+			{
+				pError = pMessage;
+			}
+			catch(...)
+			{
+				pError = "ScanScheduler::SaveLoop: failed to write a capture";
+			}
+			//the buffers go back to the camera pools before the capture thread is woken
+			job.m_frames.clear();
+			const long long written = MonotonicNanoseconds();
+
+			lock.lock();
+			if(pError && !m_pSaveError)
+			{
+				m_pSaveError = pError;
+			}
+			if(m_pSaveError)
+			{//the scan stops, the captures queued behind the failed one are not written
+				m_saveQueue.clear();
+			}
+			else
+			{
+				m_histograms[ScanReport::STAGE_SAVE].Record(written - job.m_queueTime);
+				m_lastWrittenTime = written;
+			}
+			m_saving--;
+			m_cvProducer.notify_all();
+		}
+	}
+
+	void ScanScheduler::SaveJobFrames(const SaveJob &job)
+	{
+		char buffer[64];
+		for(size_t k=0; k<job.m_frames.size(); k++)
+		{
+			if(!job.m_frames[k].IsValid())
+			{
+				continue;
+			}
+			if(m_streamId == -1)
+			{
+				sprintf(buffer,"%04d",job.m_frameId);
+				cv::imwrite(m_saveDir + m_savePrefix + m_camera.ImageName((int)k) + buffer + m_camera.FileNameExtension((int)k),
+					job.m_frames[k].Mat());
+			}
+			else if(k < m_streams.size())
+			{
+				m_streams[k]->WriteFrameToStream(job.m_frames[k],job.m_frameId);
+			}
+		}
+
+		if(m_poseFile.is_open())
+		{
+			const RobotPose &p = job.m_pose;
+			const RobotPose &t = job.m_target;
+			char line[512];
+			sprintf(line,"%d %lld %f %f %f %f %f %f %f %f %f %f %f %f %d\n",job.m_frameId,job.m_grabTime,
+				p.m_x,p.m_y,p.m_z,p.m_rx,p.m_ry,p.m_rz,t.m_x,t.m_y,t.m_z,t.m_rx,t.m_ry,t.m_rz,job.m_arrived ? 1 : 0);
+			m_poseFile << line;
+		}
+	}
+
+	void ScanScheduler::OpenOutputs(const int streamId)
+	{
+		CloseOutputs();
+		m_poseFile.open((m_saveDir + m_savePrefix + "poses.txt").c_str(),ios::out | ios::app);
+		if(!m_poseFile)
+		{
+			throw("ScanScheduler::OpenOutputs: failed to create the pose file");
+		}
+		m_streamId = streamId;
+		if(streamId == -1)
+		{
+			return;
+		}
+		char buffer[64];
+		sprintf(buffer,"_stream%03d.bin",streamId);
+		for(int k=0; k<m_camera.NumImages(); k++)
+		{
+			ImageSequenceIO *pStream = new ImageSequenceIO;
+			m_streams.push_back(pStream);
+			ImageSequenceHeader header;
+			header.m_imaHeight = m_camera.Height(k);
+			header.m_imaWidth = m_camera.Width(k);
+			header.m_imaChannels = m_camera.Channels(k);
+			header.m_imaBytesPerPixel = m_camera.BytesPerPixel(k);
+			pStream->SetWriteHeader(header);
+			pStream->OpenWriteStream(m_saveDir + m_savePrefix + m_camera.ImageName(k) + buffer);
+			pStream->WriteHeader();
+		}
+	}
+
+	void ScanScheduler::CloseOutputs()
+	{
+		for(size_t i=0; i<m_streams.size(); i++)
+		{
+			m_streams[i]->CloseWriteStream();
+			delete m_streams[i];
+		}
+		m_streams.clear();
+		m_streamId = -1;
+		if(m_poseFile.is_open())
+		{
+			m_poseFile.close();
+		}
+	}
+
+}
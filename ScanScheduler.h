@@ -0,0 +1,191 @@
+/* *
+	ScanScheduler.h
+		Runs a scan (move, wait for arrival, capture, save) as a pipeline,
+		so that the robot moves while the previous frames are saved
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef SCAN_SCHEDULER_H_
+#define SCAN_SCHEDULER_H_
+
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "FramePool.h"
+#include "LatencyTracker.h"
+#include "TrajectoryStreamer.h"
+
+
+
+namespace rm
+{
+
+	class Camera;
+	class ImageSequenceIO;
+	class RobotStateReceiver;
+
+	/** \brief Timing and counters of a scan, all durations in nanoseconds
+	 */
+	struct ScanReport
+	{
+		enum Stage
+		{
+			STAGE_MOVE = 0,		//move sent -> arrival reported by the pose feedback
+			STAGE_CAPTURE,		//GrabOne and frame handoff
+			STAGE_SAVE_WAIT,	//capture thread blocked because the save queue was full
+			STAGE_SAVE,			//frames queued -> written
+			STAGE_CYCLE,		//one waypoint, arrival to arrival
+			NUM_STAGES
+		};
+
+		long long			m_frames;			//captures taken
+		long long			m_arrivalTimeouts;	//captures taken without a confirmed arrival
+		double				m_seconds;			//first move sent -> last frame written
+		double				m_framesPerSecond;
+		LatencySummary		m_stages[NUM_STAGES];
+
+		/** \brief Short name of a stage, e.g. for reports
+		 */
+		static const char* StageName(const Stage stage);
+	};
+
+
+	/************************************************************//**
+	 *	The ScanScheduler class
+	 *	Takes one capture per waypoint. The next move is sent as soon as
+	 *	GrabOne returned and the frames were handed over (the capture is
+	 *	latched), the frames are written by a saver thread meanwhile. The
+	 *	capture is triggered when the pose feedback, newer than the move
+	 *	command, is within tolerance of the waypoint (plus an optional
+	 *	settle time); without a state receiver only the settle time is
+	 *	waited.
+	 *
+	 *	Every frame is saved with the pose reported at capture time, in
+	 *	<saveDir><prefix>poses.txt, one line per frame:
+	 *		frameId grabTime(ns) x y z rx ry rz targetX ... targetRz arrived
+	 *
+	 *	The scheduler does not own the camera, the streamer or the receiver.
+	 *	The streamer must not share its socket with the receiver.
+	 ***************************************************************/
+	class ScanScheduler
+	{
+	public:
+		/** \brief Create the scheduler
+		 *	\param[in] camera The camera, initialized and ready for GrabOne
+		 *	\param[in] streamer Sends the moves
+		 *	\param[in] pReceiver Pose feedback, NULL = wait the settle time only
+		 */
+		ScanScheduler(Camera &camera, TrajectoryStreamer &streamer, const RobotStateReceiver *pReceiver);
+		~ScanScheduler();
+
+		/** \brief Arrival tolerance (default 0.5mm and 0.005rad)
+		 *	\param[in] position Max distance in m
+		 *	\param[in] rotation Max difference of each rotation vector component in rad
+		 */
+		void SetTolerance(const float position, const float rotation);
+
+		/** \brief Time to wait after arrival before capturing (default 0)
+		 */
+		void SetSettleTime(const int milliseconds);
+
+		/** \brief Max time to wait for arrival, the capture is taken anyway after it (default 10000ms)
+		 */
+		void SetArrivalTimeout(const int milliseconds);
+
+		/** \brief Number of captures that may wait for the saver (default 8)
+		 */
+		void SetSaveQueueDepth(const int depth);
+
+		/** \brief Wait until the frames of a waypoint are written before the next move (default false)
+		 *	The serial behavior, to compare with.
+		 */
+		void SetSerial(const bool serial);
+
+		/** \brief Set where the frames and the pose file are written, as Camera::SetSavePath
+		 */
+		void SetSavePath(const std::string &saveDir, const std::string &prefix);
+
+		/** \brief Run a scan, returns when all the frames are written
+		 *	If writing a capture fails, no more captures are taken nor written and the
+		 *	error of the saver thread is thrown once it has stopped.
+		 *	\param[in] waypoints The poses to capture at
+		 *	\param[in] firstFrameId Frame id of the first capture
+		 *	\param[in] streamId -1 = one file per frame and image, else the index of
+		 *	the stream files, as Camera::SaveData
+		 *	\return The report of this scan
+		 */
+		ScanReport Run(const std::vector<RobotPose> &waypoints, const int firstFrameId = 0, const int streamId = -1);
+
+	private:
+		struct SaveJob
+		{
+			int							m_frameId;
+			std::vector<FrameHandle>	m_frames;		//one per image
+			RobotPose					m_pose;			//reported at capture time
+			RobotPose					m_target;
+			bool						m_arrived;
+			long long					m_grabTime;
+			long long					m_queueTime;
+		};
+
+		//not copyable
+		ScanScheduler(const ScanScheduler&);
+		ScanScheduler& operator=(const ScanScheduler&);
+
+		bool SendMove(const RobotPose &pose);
+		bool WaitForArrival(const RobotPose &target, const long long sentTime, RobotPose &reached);
+		bool IsWithinTolerance(const RobotPose &pose, const RobotPose &target) const;
+		void QueueSave(const SaveJob &job);
+		void WaitSaved();
+		void StopSaver();
+		void SaveLoop();
+		void SaveJobFrames(const SaveJob &job);
+		bool SaveFailed();
+		void OpenOutputs(const int streamId);
+		void CloseOutputs();
+
+		Camera						&m_camera;
+		TrajectoryStreamer			&m_streamer;
+		const RobotStateReceiver	*m_pReceiver;
+		float						m_positionTolerance;
+		float						m_rotationTolerance;
+		int							m_settleTime;
+		int							m_arrivalTimeout;
+		int							m_saveQueueDepth;
+		bool						m_serial;
+		std::string					m_saveDir;
+		std::string					m_savePrefix;
+
+		//saver, outputs are owned by the saver thread while a scan runs
+		std::thread					m_saveThread;
+		std::mutex					m_saveMutex;
+		std::condition_variable		m_cvSaver;
+		std::condition_variable		m_cvProducer;
+		std::deque<SaveJob>			m_saveQueue;
+		int							m_saving;		//jobs taken by the saver, not written yet
+		bool						m_stopSaver;
+		const char					*m_pSaveError;	//first error of the saver thread
+		int							m_streamId;
+		std::vector<ImageSequenceIO*>	m_streams;	//one per image
+		std::ofstream				m_poseFile;
+		long long					m_lastWrittenTime;
+
+		LatencyHistogram			m_histograms[ScanReport::NUM_STAGES];
+	};
+
+};//namespace rm
+
+
+
+#endif //SCAN_SCHEDULER_H_
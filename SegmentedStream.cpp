@@ -0,0 +1,522 @@
+/* *
+	SegmentedStream.cpp
+		The Implementation of the segmented stream writer and reader
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "SegmentedStream.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <exception>
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	static const char *MANIFEST_MAGIC = "RMSEG";
+	static const int MANIFEST_VERSION = 1;
+
+	static string WithSeparator(const string &dir)
+	{
+		if(!dir.empty() && dir[dir.size()-1] != '/' && dir[dir.size()-1] != '\\')
+		{
+			return dir + "/";
+		}
+		return dir;
+	}
+
+	bool IsSegmentManifest(const std::string &fileName)
+	{
+		ifstream ifs(fileName.c_str());
+		string magic;
+		return (ifs >> magic) && magic == MANIFEST_MAGIC;
+	}
+
+	//
+	//The manifest is text:
+	//	RMSEG <version>
+	//	lanes <number of lanes>
+	//	<lane> <index> <numFrames> <firstFrameId> <lastFrameId> <fileName>	(one line per segment)
+	bool LoadSegmentManifest(const std::string &fileName, int &numLanes, std::vector<SegmentInfo> &segments)
+	{
+		segments.clear();
+		numLanes = 0;
+		ifstream ifs(fileName.c_str());
+		string magic, key;
+		int version;
+		if(!(ifs >> magic >> version) || magic != MANIFEST_MAGIC || version > MANIFEST_VERSION)
+		{
+			return false;
+		}
+		if(!(ifs >> key >> numLanes) || key != "lanes" || numLanes <= 0)
+		{
+			return false;
+		}
+		SegmentInfo segment;
+		while(ifs >> segment.m_lane >> segment.m_index >> segment.m_numFrames >> segment.m_firstFrameId >> segment.m_lastFrameId)
+		{
+			ifs.get();	//the separator, the file name may contain spaces
+			if(!getline(ifs,segment.m_fileName))
+			{
+				return false;
+			}
+			if(!segment.m_fileName.empty() && segment.m_fileName[segment.m_fileName.size()-1] == '\r')
+			{
+				segment.m_fileName.erase(segment.m_fileName.size()-1);
+			}
+			if(segment.m_lane < 0 || segment.m_lane >= numLanes)
+			{
+				return false;
+			}
+			segments.push_back(segment);
+		}
+		return true;
+	}
+
+
+	/******************************/
+	/* SegmentedStreamWriter      */
+	/******************************/
+
+	SegmentedStreamWriter::SegmentedStreamWriter():m_pLatencyTracker(&LatencyTracker::Global()),m_nextLane(0),m_droppedFrames(0)
+	{
+	}
+
+	SegmentedStreamWriter::~SegmentedStreamWriter()
+	{
+		try
+		{
+			Close();
+		}
+		catch(...)
+		{//a destructor must not throw, the segments are as complete as they could be made
+		}
+	}
+
+	void SegmentedStreamWriter::SetOptions(const SegmentOptions &options)
+	{
+		m_options = options;
+		for(size_t i=0; i<m_options.m_stripeDirs.size(); i++)
+		{
+			m_options.m_stripeDirs[i] = WithSeparator(m_options.m_stripeDirs[i]);
+		}
+	}
+
+	void SegmentedStreamWriter::SetWriteFormat(const StreamFormat &format)
+	{
+		m_format = format;
+	}
+
+	void SegmentedStreamWriter::SetAsyncOptions(const AsyncStreamWriter::Options &options)
+	{
+		m_asyncOptions = options;
+	}
+
+	void SegmentedStreamWriter::SetLatencyTracker(LatencyTracker *pTracker)
+	{
+		m_pLatencyTracker = pTracker;
+	}
+
+	void SegmentedStreamWriter::ImportSettings(const std::string &configFn, const char *secName)
+	{
+		Settings settings(configFn);
+		ImportSettings(settings,secName);
+	}
+
+	void SegmentedStreamWriter::ImportSettings(const Settings &settings, const char *secName)
+	{
+		double dSetting;
+		string strSetting;
+		if(settings.ReadSetting(secName,"segmentMaxMB",dSetting,true))
+		{
+			m_options.m_maxSegmentBytes = (long long)(dSetting * 1024 * 1024);
+		}
+		if(settings.ReadSetting(secName,"segmentMaxFrames",dSetting,true))
+		{
+			m_options.m_maxSegmentFrames = (int)dSetting;
+		}
+		if(settings.ReadSetting(secName,"segmentPreallocate",dSetting,true))
+		{
+			m_options.m_preallocate = (dSetting != 0);
+		}
+		if(settings.ReadSetting(secName,"stripeDirs",strSetting,true))
+		{
+			m_options.m_stripeDirs.clear();
+			stringstream ss(strSetting);
+			string dir;
+			while(getline(ss,dir,';'))
+			{
+				if(!dir.empty())
+				{
+					m_options.m_stripeDirs.push_back(WithSeparator(dir));
+				}
+			}
+		}
+	}
+
+	void SegmentedStreamWriter::SetWriteHeader(const ImageSequenceHeader &header)
+	{
+		m_header = header;
+	}
+
+	void SegmentedStreamWriter::Open(const std::string &manifestName)
+	{
+		Close();
+		m_manifestName = manifestName;
+		const size_t slash = manifestName.find_last_of("/\\");
+		const string dir = (slash == string::npos) ? string() : manifestName.substr(0,slash + 1);
+		m_baseName = (slash == string::npos) ? manifestName : manifestName.substr(slash + 1);
+		const size_t dot = m_baseName.rfind('.');
+		if(dot != string::npos && dot > 0)
+		{
+			m_baseName.erase(dot);
+		}
+		m_segments.clear();
+		m_droppedFrames = 0;
+		m_nextLane = 0;
+
+		const vector<string> dirs = m_options.m_stripeDirs.empty() ? vector<string>(1,dir) : m_options.m_stripeDirs;
+		m_lanes.resize(dirs.size());
+		for(size_t i=0; i<dirs.size(); i++)
+		{
+			Lane &lane = m_lanes[i];
+			lane.m_pStream = new ImageSequenceIO;
+			AsyncStreamWriter::Options options = m_asyncOptions;
+			if(m_options.m_preallocate && m_options.m_maxSegmentBytes > 0)
+			{
+				options.m_preallocateSize = m_options.m_maxSegmentBytes;
+			}
+			lane.m_pStream->SetAsyncWrite(true,options);
+			lane.m_pStream->SetWriteFormat(m_format);
+			lane.m_pStream->SetLatencyTracker(m_pLatencyTracker);
+			lane.m_pStream->SetWriteHeader(m_header);
+			lane.m_dir = dirs[i];
+			lane.m_current.m_lane = (int)i;
+			lane.m_current.m_index = 0;
+			lane.m_current.m_numFrames = 0;
+			lane.m_current.m_firstFrameId = lane.m_current.m_lastFrameId = -1;
+			lane.m_lastRecordSize = 0;
+		}
+		try
+		{
+			for(size_t i=0; i<m_lanes.size(); i++)
+			{
+				OpenSegment(m_lanes[i]);
+			}
+		}
+		catch(...)
+		{
+			try
+			{
+				Close();
+			}
+			catch(...)
+			{//the error of the open is the one to report
+			}
+			throw;
+		}
+		SaveManifest();
+	}
+
+	//
+	//Start segment m_current.m_index of the lane in its stripe directory
+	void SegmentedStreamWriter::OpenSegment(Lane &lane)
+	{
+		SegmentInfo &segment = lane.m_current;
+		char buffer[64];
+		sprintf(buffer,"_%02d_%04d.bin",segment.m_lane,segment.m_index);
+		segment.m_fileName = lane.m_dir + m_baseName + buffer;
+		segment.m_numFrames = 0;
+		segment.m_firstFrameId = segment.m_lastFrameId = -1;
+		lane.m_pStream->OpenWriteStream(segment.m_fileName);
+		lane.m_pStream->WriteHeader();
+	}
+
+	//
+	//Complete the current segment of the lane and list it in the manifest
+	void SegmentedStreamWriter::CloseSegment(Lane &lane)
+	{
+		const AsyncStreamWriter *pWriter = lane.m_pStream->AsyncWriter();
+		lane.m_pStream->CloseWriteStream();
+		SegmentInfo segment = lane.m_current;
+		if(pWriter && segment.m_numFrames > 0)
+		{//the frames that made it to the file, the writer may have dropped any of the others
+		 //(the statistics stay valid after the writer is closed)
+			const vector<AsyncStreamWriter::RecordInfo> &records = pWriter->WrittenRecords();
+			m_droppedFrames += pWriter->DroppedRecords();
+			segment.m_numFrames = (int)records.size();
+			if(!records.empty())
+			{
+				segment.m_firstFrameId = (int)records.front().m_tag;
+				segment.m_lastFrameId = (int)records.back().m_tag;
+			}
+		}
+		if(segment.m_numFrames <= 0)
+		{//header only, e.g. a lane that never got a frame
+			remove(segment.m_fileName.c_str());
+			remove((segment.m_fileName + ".idx").c_str());
+			return;
+		}
+		m_segments.push_back(segment);
+		SaveManifest();
+	}
+
+	//
+	//Every lane is completed and deleted even if one of them fails, the first error is thrown afterwards
+	void SegmentedStreamWriter::Close()
+	{
+		if(m_lanes.empty())
+		{
+			return;
+		}
+		vector<Lane> lanes;
+		lanes.swap(m_lanes);
+		exception_ptr error;
+		for(size_t i=0; i<lanes.size(); i++)
+		{
+			try
+			{
+				CloseSegment(lanes[i]);
+			}
+			catch(...)
+			{
+				if(!error)
+				{
+					error = current_exception();
+				}
+			}
+			delete lanes[i].m_pStream;
+		}
+		if(error)
+		{
+			rethrow_exception(error);
+		}
+		SaveManifest();
+	}
+
+	void SegmentedStreamWriter::SaveManifest() const
+	{
+		ofstream ofs(m_manifestName.c_str(),ios::out | ios::trunc);
+		if(!ofs)
+		{
+			throw("SegmentedStreamWriter::SaveManifest: failed to write the manifest");
+		}
+		ofs << MANIFEST_MAGIC << " " << MANIFEST_VERSION << "\n";
+		ofs << "lanes " << max((int)m_lanes.size(),m_options.m_stripeDirs.empty() ? 1 : (int)m_options.m_stripeDirs.size()) << "\n";
+		for(size_t i=0; i<m_segments.size(); i++)
+		{
+			const SegmentInfo &s = m_segments[i];
+			ofs << s.m_lane << " " << s.m_index << " " << s.m_numFrames << " " << s.m_firstFrameId << " " << s.m_lastFrameId << " "
+				<< s.m_fileName << "\n";
+		}
+	}
+
+	void SegmentedStreamWriter::WriteFrameToStream(const FrameHandle &frame, const int frameId)
+	{
+		WriteImageToStream(frame.Mat(),frameId,frame.Timing());
+	}
+
+	//
+	//The lane rotates when the record would push its segment past the size limit
+	//(estimated from the previous record, exact for uncompressed streams)
+	void SegmentedStreamWriter::WriteImageToStream(const cv::Mat &image, const int frameId, const FrameTiming &timing)
+	{
+		if(m_lanes.empty())
+		{
+			throw("SegmentedStreamWriter::WriteImageToStream: the stream is not open");
+		}
+		Lane &lane = m_lanes[m_nextLane];
+		m_nextLane = (m_nextLane + 1) % (int)m_lanes.size();
+
+		const long long size = lane.m_pStream->WriteStreamSize();
+		if(lane.m_current.m_numFrames > 0 &&
+			((m_options.m_maxSegmentFrames > 0 && lane.m_current.m_numFrames >= m_options.m_maxSegmentFrames) ||
+			(m_options.m_maxSegmentBytes > 0 && size + lane.m_lastRecordSize > m_options.m_maxSegmentBytes)))
+		{
+			CloseSegment(lane);
+			lane.m_current.m_index++;
+			OpenSegment(lane);
+		}
+
+		const long long before = lane.m_pStream->WriteStreamSize();
+		lane.m_pStream->WriteImageToStream(image,frameId,timing);
+		lane.m_lastRecordSize = lane.m_pStream->WriteStreamSize() - before;
+		SegmentInfo &segment = lane.m_current;
+		if(segment.m_numFrames == 0)
+		{
+			segment.m_firstFrameId = frameId;
+		}
+		segment.m_lastFrameId = frameId;
+		segment.m_numFrames++;
+	}
+
+
+	/******************************/
+	/* SegmentedStreamReader      */
+	/******************************/
+
+	SegmentedStreamReader::SegmentedStreamReader():m_memoryMapped(false),m_currentLane(-1)
+	{
+	}
+
+	SegmentedStreamReader::~SegmentedStreamReader()
+	{
+		Close();
+	}
+
+	void SegmentedStreamReader::SetMemoryMapped(const bool enable)
+	{
+		m_memoryMapped = enable;
+	}
+
+	void SegmentedStreamReader::Open(const std::string &manifestName)
+	{
+		Close();
+		int numLanes;
+		if(!LoadSegmentManifest(manifestName,numLanes,m_segments))
+		{
+			throw("SegmentedStreamReader::Open: failed to read the segment manifest");
+		}
+		m_lanes.resize(numLanes);
+		for(int i=0; i<numLanes; i++)
+		{
+			m_lanes[i].m_pStream = new ImageSequenceIO;
+			m_lanes[i].m_pStream->SetMemoryMapped(m_memoryMapped);
+			m_lanes[i].m_nextSegment = 0;
+			m_lanes[i].m_hasFrame = false;
+		}
+		//segments of a lane in the order they were written
+		vector< pair<int,int> > order;
+		for(size_t i=0; i<m_segments.size(); i++)
+		{
+			order.push_back(make_pair(m_segments[i].m_index,(int)i));
+		}
+		sort(order.begin(),order.end());
+		for(size_t i=0; i<order.size(); i++)
+		{
+			m_lanes[m_segments[order[i].second].m_lane].m_segments.push_back(order[i].second);
+		}
+
+		try
+		{
+			for(size_t i=0; i<m_lanes.size(); i++)
+			{
+				Advance(m_lanes[i]);
+				if(m_lanes[i].m_hasFrame && m_header.totalSize() == 0)
+				{
+					m_header = m_lanes[i].m_pStream->GetReadHeader();
+				}
+			}
+		}
+		catch(...)
+		{
+			Close();
+			throw;
+		}
+	}
+
+	void SegmentedStreamReader::Close()
+	{
+		for(size_t i=0; i<m_lanes.size(); i++)
+		{
+			m_lanes[i].m_pStream->CloseReadStream();
+			delete m_lanes[i].m_pStream;
+		}
+		m_lanes.clear();
+		m_segments.clear();
+		m_currentLane = -1;
+		m_header = ImageSequenceHeader();
+	}
+
+	//
+	//Read the next frame of the lane, going on with its next segment at the end of one
+	void SegmentedStreamReader::Advance(Lane &lane)
+	{
+		while(true)
+		{
+			if(lane.m_pStream->ReadNextImage() != -1)
+			{
+				lane.m_hasFrame = true;
+				return;
+			}
+			if(lane.m_nextSegment >= lane.m_segments.size())
+			{
+				lane.m_pStream->CloseReadStream();
+				lane.m_hasFrame = false;
+				return;
+			}
+			lane.m_pStream->OpenReadStream(m_segments[lane.m_segments[lane.m_nextSegment++]].m_fileName);
+		}
+	}
+
+	//
+	//Every lane holds its next frame, the one with the lowest frame id is returned
+	//and its lane moves on at the next call (so the returned frame stays valid until then)
+	int SegmentedStreamReader::ReadNextImage()
+	{
+		if(m_currentLane >= 0)
+		{
+			Advance(m_lanes[m_currentLane]);
+		}
+		m_currentLane = -1;
+		int frameId = -1;
+		for(size_t i=0; i<m_lanes.size(); i++)
+		{
+			if(!m_lanes[i].m_hasFrame)
+			{
+				continue;
+			}
+			const int id = m_lanes[i].m_pStream->LastReadFrameId();
+			if(m_currentLane == -1 || id < frameId)
+			{
+				m_currentLane = (int)i;
+				frameId = id;
+			}
+		}
+		return frameId;
+	}
+
+	const cv::Mat& SegmentedStreamReader::LastReadFrame() const
+	{
+		static const cv::Mat s_empty;
+		return m_currentLane >= 0 ? m_lanes[m_currentLane].m_pStream->LastReadFrame() : s_empty;
+	}
+
+	int SegmentedStreamReader::LastReadFrameId() const
+	{
+		return m_currentLane >= 0 ? m_lanes[m_currentLane].m_pStream->LastReadFrameId() : -1;
+	}
+
+	const FrameTiming& SegmentedStreamReader::LastReadFrameTiming() const
+	{
+		static const FrameTiming s_none;
+		return m_currentLane >= 0 ? m_lanes[m_currentLane].m_pStream->LastReadFrameTiming() : s_none;
+	}
+
+	const ImageSequenceHeader& SegmentedStreamReader::GetReadHeader() const
+	{
+		return m_header;
+	}
+
+	int SegmentedStreamReader::NumFrames() const
+	{
+		int count = 0;
+		for(size_t i=0; i<m_segments.size(); i++)
+		{
+			count += m_segments[i].m_numFrames;
+		}
+		return count;
+	}
+
+}
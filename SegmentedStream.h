@@ -0,0 +1,251 @@
+/* *
+	SegmentedStream.h
+		Streams written as a set of segment files, rotated at a size or
+		frame limit and striped over several directories (disks)
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef SEGMENTED_STREAM_H_
+#define SEGMENTED_STREAM_H_
+
+
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "FileIO.h"
+#include "AsyncStreamWriter.h"
+#include "StreamFormat.h"
+#include "LatencyTracker.h"
+#include "FramePool.h"
+
+// forward declaration
+namespace cv
+{
+	class Mat;
+};
+
+
+
+namespace rm
+{
+
+	/** \brief How a segmented stream is split
+	 */
+	struct SegmentOptions
+	{
+		long long					m_maxSegmentBytes;	//rotate before a segment grows past this, 0 = no limit
+		int							m_maxSegmentFrames;	//rotate after this many frames, 0 = no limit
+		std::vector<std::string>	m_stripeDirs;		//one lane per directory (a missing trailing separator is added),
+														//empty = one lane in the directory of the manifest
+		bool						m_preallocate;		//reserve m_maxSegmentBytes on disk for every segment
+
+		SegmentOptions():m_maxSegmentBytes(4LL<<30),m_maxSegmentFrames(0),m_preallocate(true)
+		{
+		}
+	};
+
+	/** \brief A segment as listed in the manifest
+	 */
+	struct SegmentInfo
+	{
+		int							m_lane;
+		int							m_index;			//position in the lane
+		int							m_numFrames;		//frames in the file (without the ones dropped by the background writer)
+		int							m_firstFrameId;		//of the first and last frame in the file
+		int							m_lastFrameId;
+		std::string					m_fileName;
+	};
+
+	/** \brief Check if a file is the manifest of a segmented stream
+	 */
+	bool IsSegmentManifest(const std::string &fileName);
+
+	/** \brief Read the segments of a manifest
+	 *	\param[out] numLanes Number of lanes
+	 *	\return False if the file is not a manifest
+	 */
+	bool LoadSegmentManifest(const std::string &fileName, int &numLanes, std::vector<SegmentInfo> &segments);
+
+
+	/************************************************************//**
+	 *	The SegmentedStreamWriter class
+	 *	Frames go round-robin to the lanes, one lane per stripe directory,
+	 *	and every lane writes its own stream file (a segment) through a
+	 *	background writer, so the lanes write to their disks in parallel.
+	 *	A lane starts a new segment at the size or frame limit; every
+	 *	segment is a complete stream (header, frames, .idx sidecar) and
+	 *	is reserved on disk at its full size when it is created, so that
+	 *	long captures do not fragment the file system.
+	 *
+	 *	The manifest (the file name given to Open) lists the segments and
+	 *	is rewritten whenever a segment is completed, so an interrupted
+	 *	capture leaves a readable set. Segments are named
+	 *		<stripeDir><manifest name without extension>_<lane>_<index>.bin
+	 *
+	 *	Settings (section "SegmentedStream" by default):
+	 *		segmentMaxMB, segmentMaxFrames, segmentPreallocate,
+	 *		stripeDirs (separated by ';')
+	 ***************************************************************/
+	class SegmentedStreamWriter
+	{
+	public:
+		SegmentedStreamWriter();
+		~SegmentedStreamWriter();
+
+		void SetOptions(const SegmentOptions &options);
+		const SegmentOptions& GetOptions() const { return m_options; }
+
+		/** \brief Format (version, codec...) of the segments
+		 */
+		void SetWriteFormat(const StreamFormat &format);
+
+		/** \brief Options of the background writer of every lane (the preallocation is set per segment)
+		 */
+		void SetAsyncOptions(const AsyncStreamWriter::Options &options);
+
+		/** \brief Set the tracker receiving the written latency of camera frames
+		 */
+		void SetLatencyTracker(LatencyTracker *pTracker);
+
+		void ImportSettings(const std::string &configFn, const char *secName = "SegmentedStream");
+		void ImportSettings(const Settings &settings, const char *secName = "SegmentedStream");
+
+		/** \brief Set the image header of the stream, before Open
+		 */
+		void SetWriteHeader(const ImageSequenceHeader &header);
+
+		/** \brief Create the first segment of every lane
+		 *	\param[in] manifestName The manifest, the name of the stream as a whole
+		 */
+		void Open(const std::string &manifestName);
+
+		/** \brief Write everything, complete the segments and the manifest
+		 *	Every lane is released even if one of them fails, the first error is thrown afterwards
+		 */
+		void Close();
+
+		bool IsOpen() const { return !m_lanes.empty(); }
+
+		/** \brief Write a frame to the next lane
+		 */
+		void WriteImageToStream(const cv::Mat &image, const int frameId, const FrameTiming &timing);
+		void WriteFrameToStream(const FrameHandle &frame, const int frameId);
+
+		/** \brief Segments completed so far
+		 */
+		const std::vector<SegmentInfo>& Segments() const { return m_segments; }
+
+		/** \brief Frames dropped by the background writers (AsyncStreamWriter::BACKPRESSURE_DROP_OLDEST)
+		 */
+		long long DroppedFrames() const { return m_droppedFrames; }
+
+	private:
+		struct Lane
+		{
+			ImageSequenceIO			*m_pStream;
+			std::string				m_dir;			//stripe directory, with the trailing separator
+			SegmentInfo				m_current;
+			long long				m_lastRecordSize;
+		};
+
+		//not copyable
+		SegmentedStreamWriter(const SegmentedStreamWriter&);
+		SegmentedStreamWriter& operator=(const SegmentedStreamWriter&);
+
+		void OpenSegment(Lane &lane);
+		void CloseSegment(Lane &lane);
+		void SaveManifest() const;
+
+		SegmentOptions				m_options;
+		StreamFormat				m_format;
+		AsyncStreamWriter::Options	m_asyncOptions;
+		LatencyTracker				*m_pLatencyTracker;
+		ImageSequenceHeader			m_header;
+
+		std::string					m_manifestName;
+		std::string					m_baseName;		//manifest name without directory and extension
+		std::vector<Lane>			m_lanes;
+		int							m_nextLane;
+		std::vector<SegmentInfo>	m_segments;
+		long long					m_droppedFrames;
+	};
+
+
+	/************************************************************//**
+	 *	The SegmentedStreamReader class
+	 *	Reads the segment set of a manifest as one stream: every lane reads
+	 *	its segments in order and the frames of the lanes are merged by
+	 *	frame id, so the frames come in frame order as long as the frame
+	 *	ids were increasing when they were written.
+	 ***************************************************************/
+	class SegmentedStreamReader
+	{
+	public:
+		SegmentedStreamReader();
+		~SegmentedStreamReader();
+
+		/** \brief Read the segments of the streams opened afterwards through memory mapping
+		 */
+		void SetMemoryMapped(const bool enable);
+
+		/** \brief Open a segmented stream
+		 *	\param[in] manifestName The manifest written by SegmentedStreamWriter
+		 */
+		void Open(const std::string &manifestName);
+
+		void Close();
+
+		/** \brief Read the next frame in frame order
+		 *	\return The frame id, -1 if the end of the stream is reached
+		 */
+		int ReadNextImage();
+
+		/** \brief The last read frame, valid until the next ReadNextImage
+		 */
+		const cv::Mat& LastReadFrame() const;
+		int LastReadFrameId() const;
+		const FrameTiming& LastReadFrameTiming() const;
+
+		/** \brief Header of the stream (of its first segment)
+		 */
+		const ImageSequenceHeader& GetReadHeader() const;
+
+		/** \brief Number of frames in all the segments, according to the manifest
+		 */
+		int NumFrames() const;
+
+		const std::vector<SegmentInfo>& Segments() const { return m_segments; }
+
+	private:
+		struct Lane
+		{
+			ImageSequenceIO			*m_pStream;
+			std::vector<int>		m_segments;		//positions in m_segments, in lane order
+			size_t					m_nextSegment;
+			bool					m_hasFrame;		//a frame is read and waits to be merged
+		};
+
+		//not copyable
+		SegmentedStreamReader(const SegmentedStreamReader&);
+		SegmentedStreamReader& operator=(const SegmentedStreamReader&);
+
+		void Advance(Lane &lane);
+
+		bool						m_memoryMapped;
+		std::vector<SegmentInfo>	m_segments;
+		std::vector<Lane>			m_lanes;
+		int							m_currentLane;	//lane of the last read frame, -1 = none
+		ImageSequenceHeader			m_header;
+	};
+
+};//namespace rm
+
+
+
+#endif //SEGMENTED_STREAM_H_
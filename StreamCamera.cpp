@@ -0,0 +1,593 @@
+/* *
+	StreamCamera.cpp
+		The Implementation of the replay camera
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "StreamCamera.h"
+#include "FileIO.h"
+#include "StreamFormat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include <opencv2\opencv.hpp>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//frames decoded ahead for compressed streams that are not preloaded
+	static const int REPLAY_PREFETCH_DEPTH = 4;
+
+	struct StreamCamera::Track
+	{
+		string					m_fileName;
+		string					m_name;
+		int						m_height;
+		int						m_width;
+		int						m_channels;
+		int						m_bytesPerPixel;
+		ImageSequenceIO			m_stream;
+
+		//preloaded frames, if not the frames are read from the stream
+		bool					m_preloaded;
+		vector<cv::Mat>			m_frames;
+		vector<int>				m_frameIds;
+		vector<FrameTiming>		m_timings;
+		size_t					m_position;
+
+		//the next frame to replay
+		bool					m_hasNext;
+		int						m_nextId;
+		const cv::Mat			*m_pNext;
+		FrameTiming				m_nextTiming;
+
+		Track():m_height(0),m_width(0),m_channels(0),m_bytesPerPixel(0),m_preloaded(false),m_position(0),m_hasNext(false),m_nextId(-1),m_pNext(NULL)
+		{
+		}
+	};
+
+	StreamCamera::StreamCamera():m_pacing(PACE_RECORDED),m_frameRate(0),m_speed(1),m_loop(true),m_preload(false),
+		m_extension(".png"),m_paceOrigin(0),m_recordOrigin(0),m_nextGrabTime(0),m_lastFrameId(-1),
+		m_loops(0),m_finished(false),m_stopGrab(false)
+	{
+	}
+
+	StreamCamera::~StreamCamera()
+	{
+		try
+		{
+			ShutDown();
+		}
+		catch(...)
+		{//a saver error was for the caller of ShutDown
+		}
+		ClearStreams();
+	}
+
+	void StreamCamera::AddStream(const string &fileName, const string &name)
+	{
+		if(m_grabThread.joinable())
+		{//the grab thread iterates over the tracks
+			throw("StreamCamera::AddStream: the camera is grabbing");
+		}
+		Track *pTrack = new Track;
+		pTrack->m_fileName = fileName;
+		pTrack->m_name = name;
+		if(pTrack->m_name.empty())
+		{
+			const size_t slash = fileName.find_last_of("/\\");
+			pTrack->m_name = (slash == string::npos) ? fileName : fileName.substr(slash + 1);
+			const size_t dot = pTrack->m_name.find_last_of('.');
+			if(dot != string::npos && dot > 0)
+			{
+				pTrack->m_name.erase(dot);
+			}
+		}
+		try
+		{
+			OpenTrack(*pTrack);
+		}
+		catch(...)
+		{
+			delete pTrack;
+			throw;
+		}
+		m_tracks.push_back(pTrack);
+	}
+
+	//
+	//The streams are released before the error of the saver thread, if any, is reported
+	void StreamCamera::ClearStreams()
+	{
+		StopGrab();
+		for(size_t i=0; i<m_tracks.size(); i++)
+		{
+			delete m_tracks[i];
+		}
+		m_tracks.clear();
+		m_saver.ShutDown();
+	}
+
+	void StreamCamera::SetPacing(const Pacing pacing)
+	{
+		m_pacing = pacing;
+		m_paceOrigin = 0;
+		m_nextGrabTime = 0;
+	}
+
+	void StreamCamera::SetFrameRate(const float frameRate)
+	{
+		m_frameRate = frameRate;
+		m_paceOrigin = 0;
+		m_nextGrabTime = 0;
+	}
+
+	void StreamCamera::SetSpeed(const float speed)
+	{
+		if(speed <= 0)
+		{
+			throw("StreamCamera::SetSpeed: the speed must be positive");
+		}
+		m_speed = speed;
+		m_paceOrigin = 0;
+		m_nextGrabTime = 0;
+	}
+
+	void StreamCamera::SetLoop(const bool loop)
+	{
+		m_loop = loop;
+	}
+
+	void StreamCamera::SetPreload(const bool preload)
+	{
+		m_preload = preload;
+	}
+
+	//
+	//(Re)open the stream of a track; the format is known from the header, the frames
+	//are preloaded or mapped depending on the current setting
+	void StreamCamera::OpenTrack(Track &track)
+	{
+		track.m_stream.CloseReadStream();
+		track.m_stream.SetPrefetchDepth(0);
+		track.m_stream.SetMemoryMapped(true);
+		track.m_stream.OpenReadStream(track.m_fileName);
+		const StreamFormat &format = track.m_stream.GetReadFormat();
+		const ImageSequenceHeader &header = track.m_stream.GetReadHeader();
+		if(track.m_height == 0)
+		{//first open (AddStream); the format is read by other threads from then on
+			track.m_height = header.m_imaHeight;
+			track.m_width = header.m_imaWidth;
+			track.m_channels = header.m_imaChannels;
+			track.m_bytesPerPixel = header.m_imaBytesPerPixel;
+		}
+		else if(header.m_imaHeight != track.m_height || header.m_imaWidth != track.m_width ||
+			header.m_imaChannels != track.m_channels || header.m_imaBytesPerPixel != track.m_bytesPerPixel)
+		{
+			throw("StreamCamera::OpenTrack: the stream format changed");
+		}
+		track.m_frames.clear();
+		track.m_frameIds.clear();
+		track.m_timings.clear();
+		track.m_position = 0;
+		track.m_hasNext = false;
+		track.m_preloaded = m_preload;
+
+		if(m_preload)
+		{
+			while(track.m_stream.ReadNextImage() >= 0)
+			{
+				track.m_frames.push_back(track.m_stream.LastReadRawFrame().clone());
+				track.m_frameIds.push_back(track.m_stream.LastReadFrameId());
+				track.m_timings.push_back(track.m_stream.LastReadFrameTiming());
+			}
+			track.m_stream.CloseReadStream();
+		}
+		else if(format.m_codec != STREAM_CODEC_NONE)
+		{//the mapped pixels are copied by GrabOne, only compressed frames are worth reading ahead
+			track.m_stream.SetPrefetchDepth(REPLAY_PREFETCH_DEPTH);
+		}
+		Advance(track);
+	}
+
+	//
+	//Move to the next frame of a track (the previous one must have been copied)
+	void StreamCamera::Advance(Track &track)
+	{
+		if(track.m_preloaded)
+		{
+			track.m_hasNext = track.m_position < track.m_frames.size();
+			if(track.m_hasNext)
+			{
+				track.m_nextId = track.m_frameIds[track.m_position];
+				track.m_pNext = &track.m_frames[track.m_position];
+				track.m_nextTiming = track.m_timings[track.m_position];
+				track.m_position++;
+			}
+			return;
+		}
+		const int frameId = track.m_stream.ReadNextImage();
+		track.m_hasNext = (frameId >= 0);
+		if(track.m_hasNext)
+		{
+			track.m_nextId = frameId;
+			track.m_pNext = &track.m_stream.LastReadRawFrame();
+			track.m_nextTiming = track.m_stream.LastReadFrameTiming();
+		}
+	}
+
+	//
+	//The frame id of the next capture: the lowest next frame id of the tracks
+	//return false if every track is at its end
+	bool StreamCamera::NextFrameId(int &frameId) const
+	{
+		bool found = false;
+		for(size_t k=0; k<m_tracks.size(); k++)
+		{
+			const Track &track = *m_tracks[k];
+			if(track.m_hasNext && (!found || track.m_nextId < frameId))
+			{
+				frameId = track.m_nextId;
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	void StreamCamera::Rewind()
+	{
+		StopGrab();
+		for(size_t k=0; k<m_tracks.size(); k++)
+		{
+			Track &track = *m_tracks[k];
+			if(m_preload && track.m_preloaded)
+			{
+				track.m_position = 0;
+				Advance(track);
+			}
+			else
+			{//also switches between preloaded and mapped
+				OpenTrack(track);
+			}
+		}
+		m_paceOrigin = 0;
+		m_nextGrabTime = 0;
+		m_finished = false;
+	}
+
+	//
+	//Wait until the capture of a recorded frame is due
+	void StreamCamera::Pace(const FrameTiming &recorded)
+	{
+		if(m_pacing == PACE_NONE)
+		{
+			return;
+		}
+		const long long now = MonotonicNanoseconds();
+		if(m_pacing == PACE_RECORDED && recorded.m_grabTime > 0)
+		{
+			long long due = m_paceOrigin + (long long)((recorded.m_grabTime - m_recordOrigin)/m_speed);
+			if(m_paceOrigin == 0 || recorded.m_grabTime < m_recordOrigin || now > due)
+			{//first capture, start over or late: this capture is on time from now on
+				m_paceOrigin = now;
+				m_recordOrigin = recorded.m_grabTime;
+				due = now;
+			}
+			if(due > now)
+			{
+				this_thread::sleep_for(chrono::nanoseconds(due - now));
+			}
+			return;
+		}
+		if(m_frameRate <= 0)
+		{
+			return;
+		}
+		//as MockCamera: pace to the frame rate, do not try to catch up after a stall
+		const long long period = (long long)(1e9/(m_frameRate*m_speed));
+		if(m_nextGrabTime == 0 || now > m_nextGrabTime + period)
+		{
+			m_nextGrabTime = now;
+		}
+		if(m_nextGrabTime > now)
+		{
+			this_thread::sleep_for(chrono::nanoseconds(m_nextGrabTime - now));
+		}
+		m_nextGrabTime += period;
+	}
+
+	void StreamCamera::GrabOne()
+	{
+		int frameId;
+		if(!NextFrameId(frameId))
+		{
+			if(!m_loop)
+			{
+				m_finished = true;
+				return;
+			}
+			Rewind();
+			m_loops++;
+			if(!NextFrameId(frameId))
+			{//empty streams
+				m_finished = true;
+				return;
+			}
+		}
+
+		const Track *pLead = NULL;
+		for(size_t k=0; k<m_tracks.size() && !pLead; k++)
+		{
+			if(m_tracks[k]->m_hasNext && m_tracks[k]->m_nextId == frameId)
+			{
+				pLead = m_tracks[k];
+			}
+		}
+		const FrameTiming recorded = pLead->m_nextTiming;
+		Pace(recorded);
+
+		if(!BeginCapture())
+		{//all slots held by readers, like a real camera this capture is lost
+			for(size_t k=0; k<m_tracks.size(); k++)
+			{
+				if(m_tracks[k]->m_hasNext && m_tracks[k]->m_nextId == frameId)
+				{
+					Advance(*m_tracks[k]);
+				}
+			}
+			return;
+		}
+		for(size_t k=0; k<m_tracks.size(); k++)
+		{
+			Track &track = *m_tracks[k];
+			cv::Mat &image = CaptureImage((int)k);
+			if(track.m_hasNext && track.m_nextId == frameId)
+			{
+				track.m_pNext->copyTo(image);
+				Advance(track);
+				continue;
+			}
+			//no frame of this id in the stream, repeat the previous one
+			FrameHandle previous = AcquireFrame((int)k);
+			if(previous.IsValid())
+			{
+				previous.Mat().copyTo(image);
+			}
+			else
+			{
+				for(int r=0; r<image.rows; r++)
+				{
+					memset(image.ptr(r),0,image.cols*image.elemSize());
+				}
+			}
+		}
+		//the replay time is the grab time, the recorded device clock is kept
+		SetCaptureTiming(0,recorded.m_deviceTime);
+		PublishCapture();
+		m_lastFrameId = frameId;
+	}
+
+	const string& StreamCamera::FileNameExtension(const int index) const
+	{
+		return m_extension;
+	}
+
+	int StreamCamera::Height(const int index) const
+	{
+		return m_tracks.at(index)->m_height;
+	}
+
+	int StreamCamera::Width(const int index) const
+	{
+		return m_tracks.at(index)->m_width;
+	}
+
+	float StreamCamera::FrameRate(const int index) const
+	{
+		return m_frameRate;
+	}
+
+	int StreamCamera::TriggerMode(const int index) const
+	{
+		return 0;
+	}
+
+	void StreamCamera::ConfigCamera(const CameraSettings &camSettings, const int index)
+	{
+	}
+
+	int StreamCamera::Channels(const int index) const
+	{
+		return m_tracks.at(index)->m_channels;
+	}
+
+	int StreamCamera::BytesPerPixel(const int index) const
+	{
+		return m_tracks.at(index)->m_bytesPerPixel;
+	}
+
+	bool StreamCamera::IsVizEnabled(const int index) const
+	{
+		return true;
+	}
+
+	void StreamCamera::GetVizImage(cv::Mat &vizIma, const int index) const
+	{
+		FrameHandle frame = AcquireFrame(index);
+		const cv::Mat &image = frame.Mat();
+		if(image.empty())
+		{
+			vizIma.release();
+			return;
+		}
+		if(image.type() == CV_16U)
+		{
+			vizIma.create(image.rows,image.cols,CV_8U);
+			VisibleDepth((const uInt16*)image.ptr(),vizIma.ptr(),image.rows*image.cols);
+		}
+		else
+		{
+			image.copyTo(vizIma);
+		}
+	}
+
+	int StreamCamera::NumImages() const
+	{
+		return (int)m_tracks.size();
+	}
+
+	const string& StreamCamera::ImageName(const int index) const
+	{
+		return m_tracks.at(index)->m_name;
+	}
+
+	void StreamCamera::ImportSettings(const string &fn, const char *secName)
+	{
+		Settings settings(fn);
+		ImportSettings(settings,secName);
+	}
+
+	void StreamCamera::ImportSettings(const Settings &settings, const char *secName)
+	{
+		double dSetting;
+		string strSetting;
+		if(settings.ReadSetting(secName,"pacing",strSetting,true))
+		{
+			if(strSetting == "recorded")
+			{
+				SetPacing(PACE_RECORDED);
+			}
+			else if(strSetting == "frameRate")
+			{
+				SetPacing(PACE_FRAME_RATE);
+			}
+			else if(strSetting == "none")
+			{
+				SetPacing(PACE_NONE);
+			}
+			else
+			{
+				throw("StreamCamera::ImportSettings: unknown pacing");
+			}
+		}
+		if(settings.ReadSetting(secName,"frameRate",dSetting,true))
+		{
+			SetFrameRate((float)dSetting);
+		}
+		if(settings.ReadSetting(secName,"speed",dSetting,true))
+		{
+			SetSpeed((float)dSetting);
+		}
+		if(settings.ReadSetting(secName,"loop",dSetting,true))
+		{
+			SetLoop(dSetting != 0);
+		}
+		if(settings.ReadSetting(secName,"preload",dSetting,true))
+		{
+			SetPreload(dSetting != 0);
+		}
+		m_saver.ImportSettings(settings,secName);
+
+		int numStreams = 0;
+		if(settings.ReadSetting(secName,"numStreams",dSetting,true))
+		{
+			numStreams = (int)dSetting;
+		}
+		ClearStreams();
+		for(int i=0; i<numStreams; i++)
+		{
+			char key[32];
+			string fileName, name;
+			sprintf(key,"stream%d",i);
+			if(!settings.ReadSetting(secName,key,fileName,true))
+			{
+				throw("StreamCamera::ImportSettings: missing stream file name");
+			}
+			sprintf(key,"name%d",i);
+			settings.ReadSetting(secName,key,name,true);
+			AddStream(fileName,name);
+		}
+	}
+
+	//
+	//Apply the preload setting and start from the first frame
+	int StreamCamera::Init(void* pData)
+	{
+		if(m_tracks.empty())
+		{
+			return -1;
+		}
+		Rewind();
+		m_loops = 0;
+		m_lastFrameId = -1;
+		return 0;
+	}
+
+	//
+	//Replay continuously on a thread of its own, until the streams end (without looping)
+	void StreamCamera::StartGrab()
+	{
+		if(m_grabThread.joinable())
+		{
+			return;
+		}
+		m_stopGrab = false;
+		m_grabThread = thread(&StreamCamera::GrabLoop,this);
+	}
+
+	void StreamCamera::GrabLoop()
+	{
+		while(!m_stopGrab && !m_finished)
+		{
+			GrabOne();
+		}
+	}
+
+	void StreamCamera::StopGrab()
+	{
+		if(m_grabThread.joinable() && this_thread::get_id() != m_grabThread.get_id())
+		{
+			m_stopGrab = true;
+			m_grabThread.join();
+		}
+	}
+
+	void StreamCamera::SetSavePath(const string &saveDir,const string &prefix)
+	{
+		m_saveDir = saveDir;
+		if(!m_saveDir.empty() && m_saveDir[m_saveDir.size()-1] != '/' && m_saveDir[m_saveDir.size()-1] != '\\')
+		{
+			m_saveDir += "/";
+		}
+		m_savePrefix = prefix;
+		m_saver.ShutDown();
+	}
+
+	void StreamCamera::SaveData(const int frameId, const int streamId)
+	{
+		if(PublishedCaptures() == 0)
+		{//nothing captured yet
+			return;
+		}
+		if(!m_saver.IsRunning())
+		{
+			m_saver.Start(*this,m_saveDir,m_savePrefix);
+		}
+		m_saver.Save(*this,frameId,streamId);
+	}
+
+	void StreamCamera::ShutDown()
+	{
+		StopGrab();
+		m_saver.ShutDown();
+	}
+
+}
@@ -0,0 +1,187 @@
+/* *
+	StreamCamera.h
+		A camera that replays recorded stream files, for load testing the
+		processing without hardware
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef STREAM_CAMERA_H_
+#define STREAM_CAMERA_H_
+
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "BufferedCamera.h"
+#include "AsyncSaver.h"
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The StreamCamera class
+	 *	Plays back stream files (ImageSequenceIO) through the Camera
+	 *	interface, one stream per image. The streams are synchronized by
+	 *	frame id: a capture holds the frames of the lowest next frame id
+	 *	of all the streams, a stream without a frame of that id repeats
+	 *	its previous frame. The frames are stored as recorded (no
+	 *	demosaicing).
+	 *
+	 *	Pacing:
+	 *		PACE_RECORDED	the recorded grab times, divided by the speed
+	 *						(streams without timing use FrameRate())
+	 *		PACE_FRAME_RATE	FrameRate()*speed captures per second
+	 *		PACE_NONE		as fast as possible
+	 *	A capture that is late (e.g. the consumer stalled GrabOne) shifts
+	 *	the schedule, the replay does not try to catch up.
+	 *
+	 *	The frames come either from memory (preload, every frame decoded
+	 *	when the stream is opened) or from memory mapped streams (compressed streams are
+	 *	decoded ahead on the prefetch thread), so that a capture costs one
+	 *	copy per image, like MockCamera. At the end of the streams the
+	 *	camera starts over if looping, else it stops capturing
+	 *	(IsFinished). SaveData goes through an AsyncSaver.
+	 *
+	 *	Settings (section "StreamCamera" by default):
+	 *		numStreams, stream<i> (file name), name<i>,
+	 *		pacing (recorded|frameRate|none), frameRate, speed,
+	 *		loop (0|1), preload (0|1) and the AsyncSaver settings
+	 ***************************************************************/
+	class StreamCamera : public BufferedCamera
+	{
+	public:
+		enum Pacing
+		{
+			PACE_RECORDED = 0,
+			PACE_FRAME_RATE,
+			PACE_NONE
+		};
+
+		StreamCamera();
+		virtual ~StreamCamera();
+
+		/** \brief Add a stream as the next image of every capture, the stream is opened here
+		 *	Throws if the camera is grabbing (StartGrab), the streams are fixed until ShutDown.
+		 *	\param[in] fileName The stream file
+		 *	\param[in] name The image name (used for file names), default = the file name without directory and extension
+		 */
+		void AddStream(const std::string &fileName, const std::string &name = "");
+
+		/** \brief Remove all the streams
+		 */
+		void ClearStreams();
+
+		void SetPacing(const Pacing pacing);
+		Pacing GetPacing() const { return m_pacing; }
+
+		/** \brief Set the rate of PACE_FRAME_RATE (and of PACE_RECORDED for streams without timing)
+		 *	\param[in] frameRate Captures per second, 0 = as fast as possible
+		 */
+		void SetFrameRate(const float frameRate);
+
+		/** \brief Replay faster (> 1) or slower (< 1) than paced
+		 */
+		void SetSpeed(const float speed);
+
+		/** \brief Start over at the end of the streams (default true)
+		 */
+		void SetLoop(const bool loop);
+
+		/** \brief Decode every frame into memory (default false: memory mapped streams)
+		 *	Applies to the streams added afterwards, and to all the streams from Init or Rewind.
+		 */
+		void SetPreload(const bool preload);
+
+		/** \brief Go back to the first frame of the streams (stops the capture thread)
+		 */
+		void Rewind();
+
+		/** \brief True when the streams ended without looping
+		 */
+		bool IsFinished() const { return m_finished.load(); }
+
+		/** \brief Frame id of the latest published capture, -1 before the first one
+		 */
+		int LastFrameId() const { return m_lastFrameId.load(); }
+
+		/** \brief Number of times the replay started over
+		 */
+		long long Loops() const { return m_loops.load(); }
+
+		/** \brief The saver used by SaveData, for its options and counters
+		 */
+		AsyncSaver& Saver() { return m_saver; }
+		const AsyncSaver& Saver() const { return m_saver; }
+
+		//Camera interface
+		virtual void GrabOne();
+		virtual const std::string& FileNameExtension(const int index = 0) const;
+		virtual int Height(const int index = 0) const;
+		virtual int Width(const int index = 0) const;
+		virtual float FrameRate(const int index = 0) const;
+		virtual int TriggerMode(const int index = 0) const;
+		virtual void ConfigCamera(const CameraSettings &camSettings, const int index = 0);
+		virtual int Channels(const int index = 0) const;
+		virtual int BytesPerPixel(const int index = 0) const;
+		virtual bool IsVizEnabled(const int index = 0) const;
+		virtual void GetVizImage(cv::Mat &vizIma, const int index = 0) const;
+		virtual int NumImages() const;
+		virtual const std::string& ImageName(const int index = 0) const;
+		virtual void ImportSettings(const std::string &fn, const char *secName = "StreamCamera");
+		virtual void ImportSettings(const Settings &settings, const char *secName = "StreamCamera");
+		virtual int Init(void* pData = NULL);
+		virtual void StartGrab();
+		virtual void SetSavePath(const std::string &saveDir,const std::string &prefix);
+		virtual void SaveData(const int frameId, const int streamId = -1);
+		virtual void ShutDown();
+
+	private:
+		struct Track;
+
+		void OpenTrack(Track &track);
+		void Advance(Track &track);
+		bool NextFrameId(int &frameId) const;
+		void Pace(const FrameTiming &recorded);
+		void GrabLoop();
+		void StopGrab();
+
+		std::vector<Track*>			m_tracks;
+		Pacing						m_pacing;
+		float						m_frameRate;
+		float						m_speed;
+		bool						m_loop;
+		bool						m_preload;
+		std::string					m_extension;
+
+		//replay schedule (grab thread)
+		long long					m_paceOrigin;		//monotonic ns of the first paced capture, 0 = not started
+		long long					m_recordOrigin;		//recorded grab time of that capture
+		long long					m_nextGrabTime;		//PACE_FRAME_RATE
+		std::atomic<int>			m_lastFrameId;
+		std::atomic<long long>		m_loops;
+		std::atomic<bool>			m_finished;
+
+		//free running capture thread (StartGrab)
+		std::thread					m_grabThread;
+		std::atomic<bool>			m_stopGrab;
+
+		//saving
+		std::string					m_saveDir;
+		std::string					m_savePrefix;
+		AsyncSaver					m_saver;
+	};
+
+};//namespace rm
+
+
+
+#endif //STREAM_CAMERA_H_
@@ -0,0 +1,326 @@
+/* *
+	StreamCodec.cpp
+		The Implementation of the RMZ lossless frame codec
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "StreamCodec.h"
+
+#include <string.h>
+#include <stdint.h>
+
+
+namespace rm
+{
+
+	/******************************/
+	/* Prediction + byte shuffle  */
+	/******************************/
+
+	template<class T>
+	static inline T ZigZag(const T d)
+	{
+		const T sign = (T)(d >> (8*sizeof(T) - 1));
+		return (T)((T)(d << 1) ^ (T)(0 - sign));
+	}
+
+	template<class T>
+	static inline T UnZigZag(const T z)
+	{
+		return (T)((T)(z >> 1) ^ (T)(0 - (T)(z & 1)));
+	}
+
+	//
+	//Residuals of the left (or upper) neighbour prediction, stored as byte planes
+	template<class T>
+	static void PredictShuffle(const unsigned char *pSrc, const size_t srcStep, const int rows, const int samplesPerRow,
+		const int channels, unsigned char *pPlanes)
+	{
+		const size_t n = (size_t)rows * samplesPerRow;
+		for(int r=0; r<rows; r++)
+		{
+			const T *pRow = (const T*)(pSrc + r*srcStep);
+			const T *pAbove = (r > 0) ? (const T*)(pSrc + (r-1)*srcStep) : pRow;
+			unsigned char *pOut = pPlanes + (size_t)r*samplesPerRow;
+			for(int i=0; i<samplesPerRow; i++)
+			{
+				const T pred = (i >= channels) ? pRow[i-channels] : (r > 0 ? pAbove[i] : (T)0);
+				const T z = ZigZag<T>((T)(pRow[i] - pred));
+				for(size_t b=0; b<sizeof(T); b++)
+				{
+					pOut[b*n + i] = (unsigned char)(z >> (8*b));
+				}
+			}
+		}
+	}
+
+	template<class T>
+	static void UnshufflePredict(const unsigned char *pPlanes, unsigned char *pDst, const size_t dstStep, const int rows,
+		const int samplesPerRow, const int channels)
+	{
+		const size_t n = (size_t)rows * samplesPerRow;
+		for(int r=0; r<rows; r++)
+		{
+			T *pRow = (T*)(pDst + r*dstStep);
+			const T *pAbove = (r > 0) ? (const T*)(pDst + (r-1)*dstStep) : pRow;
+			const unsigned char *pIn = pPlanes + (size_t)r*samplesPerRow;
+			for(int i=0; i<samplesPerRow; i++)
+			{
+				T z = 0;
+				for(size_t b=0; b<sizeof(T); b++)
+				{
+					z |= (T)((T)pIn[b*n + i] << (8*b));
+				}
+				const T pred = (i >= channels) ? pRow[i-channels] : (r > 0 ? pAbove[i] : (T)0);
+				pRow[i] = (T)(UnZigZag<T>(z) + pred);
+			}
+		}
+	}
+
+
+	/******************************/
+	/* LZ77 byte coder            */
+	/******************************/
+	/* *
+		The coded data is a list of sequences:
+		[token][extra literal length][literals][offset(2 bytes)][extra match length]
+		The high nibble of the token is the literal length, the low nibble the
+		match length - MIN_MATCH, a nibble of 15 is continued by 255-valued bytes.
+		The last sequence has no match part.
+	* */
+	static const int MIN_MATCH = 4;
+	static const int HASH_BITS = 14;
+	static const size_t HASH_SIZE = (size_t)1 << HASH_BITS;
+	static const size_t MAX_OFFSET = 65535;
+	static const size_t LAST_LITERALS = 8;	//the tail is always coded as literals
+
+	static inline uint32_t Read32(const unsigned char *p)
+	{
+		uint32_t v;
+		memcpy(&v,p,sizeof(v));
+		return v;
+	}
+
+	static inline unsigned char* WriteLength(unsigned char *pOut, size_t len)
+	{
+		while(len >= 255)
+		{
+			*pOut++ = 255;
+			len -= 255;
+		}
+		*pOut++ = (unsigned char)len;
+		return pOut;
+	}
+
+	static inline unsigned char* WriteSequence(unsigned char *pOut, const unsigned char *pLiterals, const size_t litLen,
+		const size_t offset, const size_t matchLen)
+	{
+		unsigned char *pToken = pOut++;
+		unsigned char token = (unsigned char)((litLen >= 15 ? 15 : litLen) << 4);
+		if(litLen >= 15)
+		{
+			pOut = WriteLength(pOut,litLen - 15);
+		}
+		memcpy(pOut,pLiterals,litLen);
+		pOut += litLen;
+		if(matchLen > 0)
+		{
+			*pOut++ = (unsigned char)(offset & 0xff);
+			*pOut++ = (unsigned char)(offset >> 8);
+			const size_t code = matchLen - MIN_MATCH;
+			token |= (unsigned char)(code >= 15 ? 15 : code);
+			if(code >= 15)
+			{
+				pOut = WriteLength(pOut,code - 15);
+			}
+		}
+		*pToken = token;
+		return pOut;
+	}
+
+	//the match table lives after the shuffled slice in the scratch buffer
+	static inline size_t HashTableOffset(const size_t rawSize)
+	{
+		return (rawSize + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+	}
+
+	static size_t LzCompress(const unsigned char *pSrc, const size_t size, unsigned char *pDst, uint32_t *pTable)
+	{
+		unsigned char *pOut = pDst;
+		size_t anchor = 0;
+		if(size > LAST_LITERALS + MIN_MATCH)
+		{
+			//positions + 1, 0 = empty
+			memset(pTable,0,HASH_SIZE*sizeof(uint32_t));
+
+			const size_t limit = size - LAST_LITERALS - MIN_MATCH;
+			size_t ip = 0;
+			unsigned int misses = 0;
+			while(ip < limit)
+			{
+				const uint32_t seq = Read32(pSrc + ip);
+				const uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+				const size_t ref = pTable[h];
+				pTable[h] = (uint32_t)(ip + 1);
+				if(ref > 0 && ip - (ref - 1) <= MAX_OFFSET && Read32(pSrc + ref - 1) == seq)
+				{
+					const size_t matchPos = ref - 1;
+					size_t matchLen = MIN_MATCH;
+					const size_t maxLen = size - LAST_LITERALS - ip;
+					while(matchLen < maxLen && pSrc[matchPos + matchLen] == pSrc[ip + matchLen])
+					{
+						matchLen++;
+					}
+					pOut = WriteSequence(pOut,pSrc + anchor,ip - anchor,ip - matchPos,matchLen);
+					ip += matchLen;
+					anchor = ip;
+					misses = 0;
+				}
+				else
+				{
+					//skip faster through incompressible data
+					ip += 1 + (misses++ >> 6);
+				}
+			}
+		}
+		pOut = WriteSequence(pOut,pSrc + anchor,size - anchor,0,0);
+		return (size_t)(pOut - pDst);
+	}
+
+	static inline bool ReadLength(const unsigned char *&pIn, const unsigned char *pEnd, size_t &len)
+	{
+		unsigned char b;
+		do
+		{
+			if(pIn >= pEnd)
+			{
+				return false;
+			}
+			b = *pIn++;
+			len += b;
+		} while(b == 255);
+		return true;
+	}
+
+	static bool LzDecompress(const unsigned char *pSrc, const size_t srcSize, unsigned char *pDst, const size_t dstSize)
+	{
+		const unsigned char *pIn = pSrc;
+		const unsigned char *pEnd = pSrc + srcSize;
+		size_t op = 0;
+		while(pIn < pEnd)
+		{
+			const unsigned char token = *pIn++;
+			size_t litLen = token >> 4;
+			if(litLen == 15 && !ReadLength(pIn,pEnd,litLen))
+			{
+				return false;
+			}
+			if(litLen > (size_t)(pEnd - pIn) || litLen > dstSize - op)
+			{
+				return false;
+			}
+			memcpy(pDst + op,pIn,litLen);
+			pIn += litLen;
+			op += litLen;
+			if(pIn == pEnd)
+			{//last sequence
+				break;
+			}
+			if(pEnd - pIn < 2)
+			{
+				return false;
+			}
+			const size_t offset = (size_t)pIn[0] | ((size_t)pIn[1] << 8);
+			pIn += 2;
+			size_t matchLen = token & 15;
+			if(matchLen == 15 && !ReadLength(pIn,pEnd,matchLen))
+			{
+				return false;
+			}
+			matchLen += MIN_MATCH;
+			if(offset == 0 || offset > op || matchLen > dstSize - op)
+			{
+				return false;
+			}
+			const unsigned char *pMatch = pDst + op - offset;
+			unsigned char *pOut = pDst + op;
+			if(offset >= matchLen)
+			{
+				memcpy(pOut,pMatch,matchLen);
+			}
+			else
+			{//overlapping copy (runs)
+				for(size_t i=0; i<matchLen; i++)
+				{
+					pOut[i] = pMatch[i];
+				}
+			}
+			op += matchLen;
+		}
+		return op == dstSize;
+	}
+
+
+	/******************************/
+	/* Slice API                  */
+	/******************************/
+
+	size_t RmzCompressBound(const size_t rawSize)
+	{
+		return rawSize + rawSize/255 + 16;
+	}
+
+	size_t RmzCompressScratchSize(const size_t rawSize)
+	{
+		return HashTableOffset(rawSize) + HASH_SIZE*sizeof(uint32_t);
+	}
+
+	size_t RmzCompress(const unsigned char *pSrc, const size_t srcStep, const int rows, const int samplesPerRow,
+		const int channels, const int bytesPerSample, unsigned char *pDst, unsigned char *pScratch)
+	{
+		switch(bytesPerSample)
+		{
+		case 1:
+			PredictShuffle<uint8_t>(pSrc,srcStep,rows,samplesPerRow,channels,pScratch);
+			break;
+		case 2:
+			PredictShuffle<uint16_t>(pSrc,srcStep,rows,samplesPerRow,channels,pScratch);
+			break;
+		case 4:
+			PredictShuffle<uint32_t>(pSrc,srcStep,rows,samplesPerRow,channels,pScratch);
+			break;
+		default:
+			throw("RmzCompress: unsupported sample size");
+		}
+		const size_t rawSize = (size_t)rows*samplesPerRow*bytesPerSample;
+		return LzCompress(pScratch,rawSize,pDst,reinterpret_cast<uint32_t*>(pScratch + HashTableOffset(rawSize)));
+	}
+
+	bool RmzDecompress(const unsigned char *pSrc, const size_t srcSize, unsigned char *pDst, const size_t dstStep,
+		const int rows, const int samplesPerRow, const int channels, const int bytesPerSample, unsigned char *pScratch)
+	{
+		if(!LzDecompress(pSrc,srcSize,pScratch,(size_t)rows*samplesPerRow*bytesPerSample))
+		{
+			return false;
+		}
+		switch(bytesPerSample)
+		{
+		case 1:
+			UnshufflePredict<uint8_t>(pScratch,pDst,dstStep,rows,samplesPerRow,channels);
+			break;
+		case 2:
+			UnshufflePredict<uint16_t>(pScratch,pDst,dstStep,rows,samplesPerRow,channels);
+			break;
+		case 4:
+			UnshufflePredict<uint32_t>(pScratch,pDst,dstStep,rows,samplesPerRow,channels);
+			break;
+		default:
+			return false;
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,77 @@
+/* *
+	StreamCodec.h
+		Lossless frame compression for image sequence streams
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef STREAM_CODEC_H_
+#define STREAM_CODEC_H_
+
+
+#include <stddef.h>
+
+
+
+namespace rm
+{
+
+	/**********************************************************************/
+	//	RMZ is a fast lossless codec for camera frames, tuned for 16-bit
+	//	depth and IR maps:
+	//	1. every sample is predicted from its left neighbour (the first
+	//	   sample of a row from the one above) and the residual is zigzag
+	//	   coded, so that small differences become small numbers;
+	//	2. the residual bytes are shuffled into byte planes, which turns the
+	//	   mostly zero high bytes into long runs;
+	//	3. the planes are compressed with a byte oriented LZ77 coder.
+	//	A frame is split into horizontal slices that are coded independently,
+	//	so that slices can be compressed and decompressed in parallel.
+	/**********************************************************************/
+
+	/** \brief Upper bound of the coded size of a slice
+	 *	\param[in] rawSize The size of the slice in bytes
+	 */
+	size_t RmzCompressBound(const size_t rawSize);
+
+	/** \brief Size of the scratch buffer RmzCompress needs for a slice
+	 *	\param[in] rawSize The size of the slice in bytes
+	 */
+	size_t RmzCompressScratchSize(const size_t rawSize);
+
+	/** \brief Compress one slice of an image
+	 *	\param[in] pSrc The first row of the slice
+	 *	\param[in] srcStep Distance between two rows in bytes
+	 *	\param[in] rows Number of rows in the slice
+	 *	\param[in] samplesPerRow Number of samples per row (width * channels)
+	 *	\param[in] channels Number of interleaved channels
+	 *	\param[in] bytesPerSample 1, 2 or 4
+	 *	\param[out] pDst The coded slice, at least RmzCompressBound(rows*samplesPerRow*bytesPerSample) bytes
+	 *	\param[in] pScratch Temporary buffer of RmzCompressScratchSize(rows*samplesPerRow*bytesPerSample) bytes,
+	 *	allocated with new so that it is aligned for the match table
+	 *	\return The coded size in bytes
+	 */
+	size_t RmzCompress(const unsigned char *pSrc, const size_t srcStep, const int rows, const int samplesPerRow,
+		const int channels, const int bytesPerSample, unsigned char *pDst, unsigned char *pScratch);
+
+	/** \brief Decompress one slice coded by RmzCompress
+	 *	\param[in] pSrc The coded slice
+	 *	\param[in] srcSize Size of the coded slice in bytes
+	 *	\param[out] pDst The first row of the decoded slice
+	 *	\param[in] dstStep Distance between two rows in bytes
+	 *	\param[in] rows, samplesPerRow, channels, bytesPerSample Same as for RmzCompress
+	 *	\param[in] pScratch Temporary buffer of rows*samplesPerRow*bytesPerSample bytes
+	 *	\return False if the data is corrupted
+	 */
+	bool RmzDecompress(const unsigned char *pSrc, const size_t srcSize, unsigned char *pDst, const size_t dstStep,
+		const int rows, const int samplesPerRow, const int channels, const int bytesPerSample, unsigned char *pScratch);
+
+};//namespace rm
+
+
+
+#endif //STREAM_CODEC_H_
@@ -0,0 +1,263 @@
+/* *
+	StreamFormat.cpp
+		The Implementation of the stream file layout
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include <string.h>
+
+#include <opencv2\opencv.hpp>
+
+#include "StreamFormat.h"
+#include "PixelFormat.h"
+
+using namespace std;
+
+
+namespace rm
+{
+
+	//number of int fields in the v2 header
+	static const int STREAM_V2_HEADER_FIELDS = 12;
+	//number of int fields appended with STREAM_FLAG_GEOMETRY
+	static const int STREAM_GEOMETRY_FIELDS = 7;
+
+	bool StreamFormat::StoredHeader(const ImageSequenceHeader &source, ImageSequenceHeader &stored) const
+	{
+		stored = source;
+		int roiWidth = source.m_imaWidth, roiHeight = source.m_imaHeight;
+		if(m_roiWidth > 0)
+		{
+			if(m_roiX < 0 || m_roiY < 0 || m_roiHeight <= 0 ||
+				m_roiX + m_roiWidth > source.m_imaWidth || m_roiY + m_roiHeight > source.m_imaHeight)
+			{
+				return false;
+			}
+			roiWidth = m_roiWidth;
+			roiHeight = m_roiHeight;
+		}
+		if(m_binning < 1 || roiWidth < m_binning || roiHeight < m_binning)
+		{
+			return false;
+		}
+		stored.m_imaWidth = roiWidth/m_binning;
+		stored.m_imaHeight = roiHeight/m_binning;
+		return true;
+	}
+
+	size_t StreamFormat::HeaderSize() const
+	{
+		if(m_version == STREAM_VERSION_LEGACY)
+		{
+			return STREAM_LEGACY_HEADER_SIZE;
+		}
+		return (HasGeometry() ? STREAM_V2_HEADER_FIELDS + STREAM_GEOMETRY_FIELDS : STREAM_V2_HEADER_FIELDS)*sizeof(int);
+	}
+
+	size_t StreamFormat::RecordPrefixSize() const
+	{
+		if(m_version == STREAM_VERSION_LEGACY)
+		{
+			return sizeof(int);
+		}
+		return (m_version < STREAM_VERSION_TIMESTAMPS) ? 2*sizeof(int) : 2*sizeof(int) + 2*sizeof(long long);
+	}
+
+	int PixelFormatFromHeader(const ImageSequenceHeader &header)
+	{
+		if(Pixel8UC3::Matches(header))
+		{//regular color image
+			return Pixel8UC3::TYPE;
+		}
+		else if(Pixel8U::Matches(header))
+		{//regular gray scale image
+			return Pixel8U::TYPE;
+		}
+		else if(Pixel16U::Matches(header))
+		{//16-bit image
+			return Pixel16U::TYPE;
+		}
+		else if(Pixel16UC3::Matches(header))
+		{//16-bit color image
+			return Pixel16UC3::TYPE;
+		}
+		else if(Pixel32F::Matches(header))
+		{//float image (processing output)
+			return Pixel32F::TYPE;
+		}
+		else if(Pixel32FC3::Matches(header))
+		{//float color image
+			return Pixel32FC3::TYPE;
+		}
+		return -1;
+	}
+
+	void EncodeStreamHeader(const ImageSequenceHeader &header, const StreamFormat &format, vector<unsigned char> &buffer)
+	{
+		if(format.m_version == STREAM_VERSION_LEGACY)
+		{
+			int fields[4] = {header.m_imaHeight,header.m_imaWidth,header.m_imaChannels,header.m_imaBytesPerPixel};
+			buffer.assign((const unsigned char*)fields,(const unsigned char*)fields + sizeof(fields));
+			return;
+		}
+		const bool geometry = format.HasGeometry();
+		int fields[STREAM_V2_HEADER_FIELDS + STREAM_GEOMETRY_FIELDS] =
+		{
+			STREAM_MAGIC,
+			format.m_version,
+			(int)format.HeaderSize(),
+			header.m_imaHeight,
+			header.m_imaWidth,
+			header.m_imaChannels,
+			header.m_imaBytesPerPixel,
+			format.m_pixelFormat >= 0 ? format.m_pixelFormat : PixelFormatFromHeader(header),
+			format.m_codec,
+			format.m_codecSlices,
+			geometry ? (format.m_flags | STREAM_FLAG_GEOMETRY) : (format.m_flags & ~STREAM_FLAG_GEOMETRY),
+			0,
+			//geometry extension
+			format.m_sourceHeight,
+			format.m_sourceWidth,
+			format.m_roiX,
+			format.m_roiY,
+			format.m_roiWidth,
+			format.m_roiHeight,
+			format.m_binning
+		};
+		buffer.assign((const unsigned char*)fields,(const unsigned char*)fields + format.HeaderSize());
+	}
+
+	bool DecodeStreamHeader(const unsigned char *pData, const size_t available, ImageSequenceHeader &header,
+		StreamFormat &format, size_t &headerSize)
+	{
+		if(available < STREAM_LEGACY_HEADER_SIZE)
+		{
+			return false;
+		}
+		int fields[STREAM_V2_HEADER_FIELDS];
+		memcpy(fields,pData,STREAM_LEGACY_HEADER_SIZE);
+		if(fields[0] != STREAM_MAGIC)
+		{//legacy stream, starts with the image geometry
+			header.m_imaHeight = fields[0];
+			header.m_imaWidth = fields[1];
+			header.m_imaChannels = fields[2];
+			header.m_imaBytesPerPixel = fields[3];
+			format = StreamFormat();
+			format.m_version = STREAM_VERSION_LEGACY;
+			format.m_codecSlices = 1;
+			format.m_pixelFormat = PixelFormatFromHeader(header);
+			headerSize = STREAM_LEGACY_HEADER_SIZE;
+			return true;
+		}
+		if(available < sizeof(fields))
+		{
+			return false;
+		}
+		memcpy(fields,pData,sizeof(fields));
+		if(fields[1] < 2 || fields[1] > STREAM_VERSION_CURRENT || fields[2] < (int)sizeof(fields) || (size_t)fields[2] > available)
+		{
+			return false;
+		}
+		format.m_version = fields[1];
+		headerSize = (size_t)fields[2];
+		header.m_imaHeight = fields[3];
+		header.m_imaWidth = fields[4];
+		header.m_imaChannels = fields[5];
+		header.m_imaBytesPerPixel = fields[6];
+		format.m_pixelFormat = fields[7];
+		format.m_codec = fields[8];
+		format.m_codecSlices = fields[9] > 0 ? fields[9] : 1;
+		format.m_flags = fields[10];
+		//stored frames are the whole camera frames unless the header says otherwise
+		format.m_roiX = 0;
+		format.m_roiY = 0;
+		format.m_roiWidth = 0;
+		format.m_roiHeight = 0;
+		format.m_binning = 1;
+		format.m_sourceHeight = header.m_imaHeight;
+		format.m_sourceWidth = header.m_imaWidth;
+		if(format.m_flags & STREAM_FLAG_GEOMETRY)
+		{
+			int geometry[STREAM_GEOMETRY_FIELDS];
+			if(headerSize < sizeof(fields) + sizeof(geometry))
+			{
+				return false;
+			}
+			memcpy(geometry,pData + sizeof(fields),sizeof(geometry));
+			format.m_sourceHeight = geometry[0];
+			format.m_sourceWidth = geometry[1];
+			format.m_roiX = geometry[2];
+			format.m_roiY = geometry[3];
+			format.m_roiWidth = geometry[4];
+			format.m_roiHeight = geometry[5];
+			format.m_binning = geometry[6] > 0 ? geometry[6] : 1;
+		}
+		return true;
+	}
+
+	bool ReadStreamHeader(istream &is, ImageSequenceHeader &header, StreamFormat &format, size_t &headerSize)
+	{
+		vector<unsigned char> buffer(STREAM_LEGACY_HEADER_SIZE);
+		if(!is.read((char*)&buffer[0],buffer.size()))
+		{
+			return false;
+		}
+		int magic, size;
+		memcpy(&magic,&buffer[0],sizeof(int));
+		if(magic == STREAM_MAGIC)
+		{//the header size follows the magic number and the version
+			memcpy(&size,&buffer[2*sizeof(int)],sizeof(int));
+			if(size < (int)(STREAM_V2_HEADER_FIELDS*sizeof(int)))
+			{
+				return false;
+			}
+			buffer.resize(size);
+			if(!is.read((char*)&buffer[STREAM_LEGACY_HEADER_SIZE],size - STREAM_LEGACY_HEADER_SIZE))
+			{
+				return false;
+			}
+		}
+		return DecodeStreamHeader(&buffer[0],buffer.size(),header,format,headerSize);
+	}
+
+	void EncodeRecordPrefix(const StreamFormat &format, const StreamRecordPrefix &prefix, unsigned char *pDst)
+	{
+		memcpy(pDst,&prefix.m_frameId,sizeof(int));
+		if(format.m_version != STREAM_VERSION_LEGACY)
+		{
+			memcpy(pDst + sizeof(int),&prefix.m_payloadSize,sizeof(int));
+		}
+		if(format.m_version >= STREAM_VERSION_TIMESTAMPS)
+		{
+			memcpy(pDst + 2*sizeof(int),&prefix.m_grabTime,sizeof(long long));
+			memcpy(pDst + 2*sizeof(int) + sizeof(long long),&prefix.m_deviceTime,sizeof(long long));
+		}
+	}
+
+	void DecodeRecordPrefix(const StreamFormat &format, const unsigned char *pData, const int frameSize, StreamRecordPrefix &prefix)
+	{
+		memcpy(&prefix.m_frameId,pData,sizeof(int));
+		if(format.m_version == STREAM_VERSION_LEGACY)
+		{
+			prefix.m_payloadSize = frameSize;
+		}
+		else
+		{
+			memcpy(&prefix.m_payloadSize,pData + sizeof(int),sizeof(int));
+		}
+		if(format.m_version >= STREAM_VERSION_TIMESTAMPS)
+		{
+			memcpy(&prefix.m_grabTime,pData + 2*sizeof(int),sizeof(long long));
+			memcpy(&prefix.m_deviceTime,pData + 2*sizeof(int) + sizeof(long long),sizeof(long long));
+		}
+		else
+		{
+			prefix.m_grabTime = 0;
+			prefix.m_deviceTime = 0;
+		}
+	}
+
+}
@@ -0,0 +1,176 @@
+/* *
+	StreamFormat.h
+		On-disk layout of image sequence stream files
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef STREAM_FORMAT_H_
+#define STREAM_FORMAT_H_
+
+
+#include <istream>
+#include <vector>
+#include <stddef.h>
+
+#include "FileIO.h"
+
+
+
+namespace rm
+{
+
+	/**********************************************************************/
+	//	Stream file layout
+	//	v1 (legacy): [int height][int width][int channels][int bytesPerPixel]
+	//		followed by [int frameId][pixels] records
+	//	v2: [int magic][int version][int headerSize][int height][int width]
+	//		[int channels][int bytesPerPixel][int pixelFormat][int codec]
+	//		[int codecSlices][int flags][int reserved]
+	//		followed by [int frameId][int payloadSize][payload] records.
+	//		With STREAM_CODEC_RMZ the payload is [int sliceSize[codecSlices]]
+	//		followed by the coded slices.
+	//	v3: same header as v2, the records carry the capture timing:
+	//		[int frameId][int payloadSize][int64 grabTime][int64 deviceTime][payload]
+	//		grabTime is on the monotonic clock (see LatencyTracker.h) in ns.
+	//	Readers skip headerSize bytes, so fields can be appended to the header.
+	//	With STREAM_FLAG_GEOMETRY in flags (v2 and later), the header continues
+	//	with [int sourceHeight][int sourceWidth][int roiX][int roiY]
+	//	[int roiWidth][int roiHeight][int binning]: the frames hold that region
+	//	of the camera frames, binned. height and width are those of the stored
+	//	frames, so readers that ignore the extension still read the stream.
+	/**********************************************************************/
+
+	static const int STREAM_MAGIC = 0x51534d52;	//"RMSQ"
+	static const int STREAM_VERSION_LEGACY = 1;
+	static const int STREAM_VERSION_TIMESTAMPS = 3;
+	static const int STREAM_VERSION_CURRENT = 3;
+	static const size_t STREAM_LEGACY_HEADER_SIZE = 4*sizeof(int);
+
+	/** \brief Header flags
+	 */
+	static const int STREAM_FLAG_GEOMETRY = 1;	//the region and binning fields follow the v2 header
+
+	/** \brief Frame codecs
+	 */
+	enum StreamCodecId
+	{
+		STREAM_CODEC_NONE = 0,	//raw pixels
+		STREAM_CODEC_RMZ = 1	//lossless, see StreamCodec.h
+	};
+
+	/************************************************************//**
+	 *	The StreamFormat struct
+	 *	Everything about a stream file that is not in ImageSequenceHeader
+	 ***************************************************************/
+	struct StreamFormat
+	{
+		int				m_version;
+		int				m_pixelFormat;	//OpenCV type of the frames, -1 = derive from the header
+		int				m_codec;
+		int				m_codecSlices;	//number of independently coded horizontal slices per frame,
+										//0 = one per codec thread (writing only)
+		int				m_flags;
+
+		//stored part of the camera frames: the region, in camera pixels, averaged over
+		//binning x binning blocks (rows and columns that do not fill a block are dropped)
+		int				m_roiX;
+		int				m_roiY;
+		int				m_roiWidth;		//0 = the whole frame (the other region fields must then be 0)
+		int				m_roiHeight;
+		int				m_binning;		//1 = none
+		int				m_sourceHeight;	//camera frame size, set by WriteHeader and by the readers
+		int				m_sourceWidth;
+
+		StreamFormat():m_version(STREAM_VERSION_CURRENT),m_pixelFormat(-1),m_codec(STREAM_CODEC_NONE),
+			m_codecSlices(0),m_flags(0),m_roiX(0),m_roiY(0),m_roiWidth(0),m_roiHeight(0),m_binning(1),
+			m_sourceHeight(0),m_sourceWidth(0)
+		{
+		}
+
+		/** \brief Check if the frames are a region or binned (the header carries the geometry)
+		 */
+		bool HasGeometry() const { return m_roiWidth > 0 || m_binning > 1; }
+
+		/** \brief The stored frame size for camera frames of the given header
+		 *	\param[in] source The camera frame geometry
+		 *	\param[out] stored source with the stored height and width
+		 *	\return False if the region is not inside the frame or the binning is invalid
+		 */
+		bool StoredHeader(const ImageSequenceHeader &source, ImageSequenceHeader &stored) const;
+
+		/** \brief Size of the stream header in bytes
+		 */
+		size_t HeaderSize() const;
+
+		/** \brief Size of the part of a frame record that precedes the payload
+		 */
+		size_t RecordPrefixSize() const;
+	};
+
+	/** \brief The fixed part of a frame record
+	 */
+	struct StreamRecordPrefix
+	{
+		int				m_frameId;
+		int				m_payloadSize;
+		long long		m_grabTime;		//0 before v3
+		long long		m_deviceTime;	//0 before v3
+
+		StreamRecordPrefix():m_frameId(0),m_payloadSize(0),m_grabTime(0),m_deviceTime(0)
+		{
+		}
+	};
+
+	/** \brief OpenCV type for the image format described by the header
+	 *	\return -1 if the format is not one of the stream pixel formats (see PixelFormat.h)
+	 */
+	int PixelFormatFromHeader(const ImageSequenceHeader &header);
+
+	/** \brief Serialize the stream header
+	 *	\param[in] header The image geometry
+	 *	\param[in] format The stream format (the pixel format is derived from the header if not set)
+	 *	\param[out] buffer The header bytes
+	 */
+	void EncodeStreamHeader(const ImageSequenceHeader &header, const StreamFormat &format, std::vector<unsigned char> &buffer);
+
+	/** \brief Parse the stream header from memory, v1 and v2 are recognized
+	 *	\param[in] pData The beginning of the stream
+	 *	\param[in] available The number of bytes available at pData
+	 *	\param[out] header The image geometry
+	 *	\param[out] format The stream format
+	 *	\param[out] headerSize The size of the header, i.e. the offset of the first record
+	 *	\return False if the header is truncated or invalid
+	 */
+	bool DecodeStreamHeader(const unsigned char *pData, const size_t available, ImageSequenceHeader &header,
+		StreamFormat &format, size_t &headerSize);
+
+	/** \brief Read and parse the stream header from a stream positioned at the beginning of the file
+	 *	\return False if the header is truncated or invalid
+	 */
+	bool ReadStreamHeader(std::istream &is, ImageSequenceHeader &header, StreamFormat &format, size_t &headerSize);
+
+	/** \brief Serialize a record prefix
+	 *	\param[in] format The stream format
+	 *	\param[in] prefix The values to be written
+	 *	\param[out] pDst At least format.RecordPrefixSize() bytes
+	 */
+	void EncodeRecordPrefix(const StreamFormat &format, const StreamRecordPrefix &prefix, unsigned char *pDst);
+
+	/** \brief Parse a record prefix
+	 *	\param[in] format The stream format
+	 *	\param[in] pData format.RecordPrefixSize() bytes
+	 *	\param[in] frameSize Size of an uncompressed frame (payload size of v1 records)
+	 *	\param[out] prefix The parsed values
+	 */
+	void DecodeRecordPrefix(const StreamFormat &format, const unsigned char *pData, const int frameSize, StreamRecordPrefix &prefix);
+
+};//namespace rm
+
+
+
+#endif //STREAM_FORMAT_H_
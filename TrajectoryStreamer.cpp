@@ -0,0 +1,317 @@
+/* *
+	TrajectoryStreamer.cpp
+		The Implementation of the trajectory streamer
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "TrajectoryStreamer.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+
+namespace rm
+{
+
+	static MetricCounter &s_commandsSent = MetricsRegistry::Global().Counter("robot.commandsSent");
+	static MetricCounter &s_bytesSent = MetricsRegistry::Global().Counter("robot.bytesSent");
+	static MetricHistogram &s_roundTrip = MetricsRegistry::Global().Histogram("robot.commandRoundTripNs");
+
+	static const unsigned long long s_pow10[] =
+	{
+		1ULL,10ULL,100ULL,1000ULL,10000ULL,100000ULL,1000000ULL,10000000ULL,100000000ULL,1000000000ULL
+	};
+
+	//
+	//Same text as printf("%.*f") for the values a robot sees, without printf's
+	//parsing, locale and (on some platforms) heap use. Differences: values that
+	//round to zero have no sign, and exact ties may round up where printf rounds down.
+	int FormatFixed(char *pBuffer, const double value, const int decimals)
+	{
+		const int d = min(max(decimals,0),9);
+		const bool negative = value < 0;
+		const double magnitude = negative ? -value : value;
+		if(!(magnitude < 1e9))
+		{//huge or not a number, rare enough for printf; the largest double takes 320 characters
+			char text[352];
+			const int length = min(sprintf(text,"%.*f",d,value),MAX_FIXED_LENGTH);
+			memcpy(pBuffer,text,length);
+			return length;
+		}
+		unsigned long long scaled = (unsigned long long)(magnitude*s_pow10[d] + 0.5);
+		unsigned long long integer = scaled / s_pow10[d];
+		unsigned long long fraction = scaled % s_pow10[d];
+
+		char *p = pBuffer;
+		if(negative && scaled != 0)
+		{
+			*p++ = '-';
+		}
+		char digits[24];
+		int n = 0;
+		do
+		{
+			digits[n++] = (char)('0' + integer % 10);
+			integer /= 10;
+		}
+		while(integer);
+		while(n)
+		{
+			*p++ = digits[--n];
+		}
+		if(d > 0)
+		{
+			*p++ = '.';
+			for(int i=d-1; i>=0; i--)
+			{
+				p[i] = (char)('0' + fraction % 10);
+				fraction /= 10;
+			}
+			p += d;
+		}
+		return (int)(p - pBuffer);
+	}
+
+	static inline char* Append(char *p, const char *pText, const int length)
+	{
+		memcpy(p,pText,length);
+		return p + length;
+	}
+
+	int EncodeMoveL(char *pBuffer, const RobotPose &pose, const float a, const float v, const int decimals, const float r)
+	{
+		char *p = pBuffer;
+		p = Append(p,"movel(p[",8);
+		p += FormatFixed(p,pose.m_x,decimals);
+		p = Append(p,", ",2);
+		p += FormatFixed(p,pose.m_y,decimals);
+		p = Append(p,", ",2);
+		p += FormatFixed(p,pose.m_z,decimals);
+		p = Append(p,", ",2);
+		p += FormatFixed(p,pose.m_rx,decimals);
+		p = Append(p,", ",2);
+		p += FormatFixed(p,pose.m_ry,decimals);
+		p = Append(p,", ",2);
+		p += FormatFixed(p,pose.m_rz,decimals);
+		p = Append(p,"], a=",5);
+		p += FormatFixed(p,a,decimals);
+		p = Append(p,", v=",4);
+		p += FormatFixed(p,v,decimals);
+		if(r > 0)
+		{
+			p = Append(p,", r=",4);
+			p += FormatFixed(p,r,decimals);
+		}
+		p = Append(p,")\n",2);
+		return (int)(p - pBuffer);
+	}
+
+
+	/******************************/
+	/* TrajectoryStreamer         */
+	/******************************/
+
+	TrajectoryStreamer::TrajectoryStreamer(SOCKET theSocket, const AckMode ackMode, const int window):m_socket(theSocket),
+		m_ackMode(ackMode),m_window(max(window,1)),m_acceleration(1.2f),m_speed(0.25f),m_decimals(6),m_ackTimeout(5000),
+		m_pLog(NULL),m_inFlight(0),m_commandsSent(0),m_commandsAcked(0),m_bytesSent(0)
+	{
+		//the commands of a batch go out at once, do not let Nagle hold back the tail
+		SetSocketNoDelay(m_socket);
+		m_buffer.resize(m_window*MAX_MOVEL_LENGTH);
+		m_sendTimes.resize(m_window);
+	}
+
+	void TrajectoryStreamer::SetMotion(const float a, const float v)
+	{
+		m_acceleration = a;
+		m_speed = v;
+	}
+
+	void TrajectoryStreamer::SetPrecision(const int decimals)
+	{
+		m_decimals = min(max(decimals,0),9);
+	}
+
+	void TrajectoryStreamer::SetAckTimeout(const int milliseconds)
+	{
+		m_ackTimeout = milliseconds;
+	}
+
+	void TrajectoryStreamer::SetLog(std::ostream *pLog)
+	{
+		m_pLog = pLog;
+	}
+
+	int TrajectoryStreamer::SendTrajectory(const std::vector<RobotPose> &poses)
+	{
+		return poses.empty() ? NETWORK_OK : SendTrajectory(&poses[0],(int)poses.size());
+	}
+
+	int TrajectoryStreamer::SendTrajectory(const std::vector<RobotPose> &poses, const std::vector<float> &blendRadii)
+	{
+		if(blendRadii.size() != poses.size())
+		{
+			throw("TrajectoryStreamer::SendTrajectory: need one blend radius per pose");
+		}
+		return poses.empty() ? NETWORK_OK : SendTrajectory(&poses[0],(int)poses.size(),&blendRadii[0]);
+	}
+
+	//
+	//Encode up to a window of commands, send them with one call, repeat.
+	//With acknowledgments, a full window is drained to half before the next batch,
+	//so that the batches stay large instead of degenerating to one command each.
+	int TrajectoryStreamer::SendTrajectory(const RobotPose *pPoses, const int count, const float *pBlendRadii)
+	{
+		int i = 0;
+		while(i < count)
+		{
+			int room = m_window;
+			if(m_ackMode == ACK_LINE)
+			{
+				if(m_inFlight > 0 && ReceiveAcks(0) == NETWORK_ERROR)
+				{
+					return NETWORK_ERROR;
+				}
+				if(m_inFlight >= m_window)
+				{
+					while(m_inFlight > m_window/2)
+					{
+						if(ReceiveAcks(m_ackTimeout) == NETWORK_ERROR)
+						{
+							return NETWORK_ERROR;
+						}
+					}
+				}
+				room = m_window - m_inFlight;
+			}
+			const int n = min(room,count - i);
+			char *pStart = &m_buffer[0];
+			char *p = pStart;
+			for(int k=0; k<n; k++)
+			{
+				p += EncodeMoveL(p,pPoses[i+k],m_acceleration,m_speed,m_decimals,pBlendRadii ? pBlendRadii[i+k] : 0);
+			}
+			const int size = (int)(p - pStart);
+			if(SendAll(pStart,size) == NETWORK_ERROR)
+			{
+				return NETWORK_ERROR;
+			}
+			if(m_pLog)
+			{
+				m_pLog->write(pStart,size);
+			}
+			if(m_ackMode == ACK_LINE)
+			{
+				const long long now = MonotonicNanoseconds();
+				for(int k=0; k<n; k++)
+				{
+					m_sendTimes[(m_commandsSent + k)%m_window] = now;
+				}
+				m_inFlight += n;
+			}
+			m_commandsSent += n;
+			m_bytesSent += size;
+			s_commandsSent.Add(n);
+			s_bytesSent.Add(size);
+			i += n;
+		}
+		return NETWORK_OK;
+	}
+
+	int TrajectoryStreamer::Drain()
+	{
+		while(m_inFlight > 0)
+		{
+			if(ReceiveAcks(m_ackTimeout) == NETWORK_ERROR)
+			{
+				return NETWORK_ERROR;
+			}
+		}
+		return NETWORK_OK;
+	}
+
+	int TrajectoryStreamer::Poll()
+	{
+		if(m_ackMode == ACK_LINE && m_inFlight > 0 && ReceiveAcks(0) == NETWORK_ERROR)
+		{
+			return NETWORK_ERROR;
+		}
+		return m_inFlight;
+	}
+
+	//
+	//Blocking and non-blocking sockets, the latter wait at most the ack timeout for room
+	int TrajectoryStreamer::SendAll(const char *pData, const int size)
+	{
+		int sent = 0;
+		while(sent < size)
+		{
+			const int status = send(m_socket,pData + sent,size - sent,SOCKET_SEND_FLAGS);
+			if(status == SOCKET_ERROR && SocketWouldBlock(SocketLastError()))
+			{
+				if(WaitSocket(m_socket,true,m_ackTimeout) <= 0)
+				{
+					return NETWORK_ERROR;
+				}
+				continue;
+			}
+			if(status == SOCKET_ERROR || status == 0)
+			{
+				return NETWORK_ERROR;
+			}
+			sent += status;
+		}
+		return NETWORK_OK;
+	}
+
+	//
+	//Count the acknowledgment lines that arrive within timeoutMs (0 = only what is there)
+	//return the number of acknowledgments, NETWORK_ERROR if the socket failed, closed or timed out
+	int TrajectoryStreamer::ReceiveAcks(const int timeoutMs)
+	{
+		const int ready = WaitSocket(m_socket,false,timeoutMs);
+		if(ready < 0)
+		{
+			return NETWORK_ERROR;
+		}
+		if(ready == 0)
+		{
+			return timeoutMs > 0 ? NETWORK_ERROR : 0;
+		}
+		const int received = recv(m_socket,m_ackBuffer,sizeof(m_ackBuffer),0);
+		if(received == SOCKET_ERROR && SocketWouldBlock(SocketLastError()))
+		{
+			return 0;
+		}
+		if(received <= 0)
+		{
+			return NETWORK_ERROR;
+		}
+		int acks = 0;
+		for(int i=0; i<received; i++)
+		{
+			if(m_ackBuffer[i] == '\n')
+			{
+				acks++;
+			}
+		}
+		acks = min(acks,m_inFlight);
+		//the controller answers in order: these are the oldest commands in flight
+		const long long now = MonotonicNanoseconds();
+		for(int a=0; a<acks; a++)
+		{
+			s_roundTrip.Record(now - m_sendTimes[(m_commandsAcked + a)%m_window]);
+		}
+		m_inFlight -= acks;
+		m_commandsAcked += acks;
+		return acks;
+	}
+
+}
@@ -0,0 +1,160 @@
+/* *
+	TrajectoryStreamer.h
+		Streams dense tool paths to the robot controller as batches of
+		movel commands over the robot socket
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef TRAJECTORY_STREAMER_H_
+#define TRAJECTORY_STREAMER_H_
+
+
+#include <vector>
+#include <ostream>
+
+#include "RobotSocket.h"
+
+
+
+namespace rm
+{
+
+	//longest text EncodeMoveL can write
+	static const int MAX_MOVEL_LENGTH = 512;
+	//longest text FormatFixed can write
+	static const int MAX_FIXED_LENGTH = 64;
+
+	/** \brief A tool pose: position in m, rotation vector in rad
+	 */
+	struct RobotPose
+	{
+		float				m_x, m_y, m_z;
+		float				m_rx, m_ry, m_rz;
+	};
+
+	/** \brief Write value with a fixed number of decimals, without allocation or locale
+	 *	\param[out] pBuffer Receives the text (not terminated), at most MAX_FIXED_LENGTH characters:
+	 *	values below 1e9 in magnitude take at most 20, the text of larger values (and of inf and nan)
+	 *	is cut after MAX_FIXED_LENGTH characters (a float, 39 digits at most, is never cut)
+	 *	\param[in] value The value
+	 *	\param[in] decimals Number of decimals, 0 to 9
+	 *	\return Number of characters written
+	 */
+	int FormatFixed(char *pBuffer, const double value, const int decimals);
+
+	/** \brief Write "movel(p[x, y, z, rx, ry, rz], a=a, v=v)\n", or with ", r=r" before the ")" if r > 0
+	 *	\param[out] pBuffer Receives the text (not terminated), room for MAX_MOVEL_LENGTH characters is enough
+	 *	\param[in] r Blend radius in m, 0 = stop at the pose
+	 *	\return Number of characters written
+	 */
+	int EncodeMoveL(char *pBuffer, const RobotPose &pose, const float a, const float v, const int decimals = 6, const float r = 0);
+
+
+	/************************************************************//**
+	 *	The TrajectoryStreamer class
+	 *	Sends a path as movel commands, many commands per send() so that
+	 *	dense paths are not throttled by the per-command overhead. The
+	 *	commands are encoded into a buffer that is reused for the whole
+	 *	session and the socket is switched to TCP_NODELAY.
+	 *
+	 *	With ACK_LINE the controller program answers every command with
+	 *	one line; at most the window size of commands are in flight, the
+	 *	streamer waits for acknowledgments before it sends more. With
+	 *	ACK_NONE (e.g. URScript sent to the controller interface port)
+	 *	the commands are only batched.
+	 *
+	 *	The streamer does not own the socket.
+	 ***************************************************************/
+	class TrajectoryStreamer
+	{
+	public:
+		enum AckMode
+		{
+			ACK_NONE = 0,	//fire and forget
+			ACK_LINE		//one newline terminated line per command
+		};
+
+		/** \brief Attach to a connected socket and set TCP_NODELAY
+		 *	\param[in] theSocket The socket from initializeSocket/initializeSocket_New
+		 *	\param[in] ackMode How the controller acknowledges the commands
+		 *	\param[in] window Max commands in flight (ACK_LINE) or per send (both modes)
+		 */
+		TrajectoryStreamer(SOCKET theSocket, const AckMode ackMode = ACK_NONE, const int window = 32);
+
+		/** \brief Acceleration and speed of the movel commands (default 1.2 m/s^2, 0.25 m/s)
+		 */
+		void SetMotion(const float a, const float v);
+
+		/** \brief Number of decimals of the coordinates (default 6, as sendCoordinates)
+		 */
+		void SetPrecision(const int decimals);
+
+		/** \brief Time to wait for an acknowledgment before giving up (default 5000ms)
+		 */
+		void SetAckTimeout(const int milliseconds);
+
+		/** \brief Log every sent batch to the stream, NULL (default) = no logging
+		 *	The text is written after the batch was sent.
+		 */
+		void SetLog(std::ostream *pLog);
+
+		/** \brief Send a path
+		 *	Returns when all the commands are handed to the socket, call Drain to
+		 *	wait for the acknowledgments of the last window.
+		 *	\param[in] pPoses The poses
+		 *	\param[in] count Number of poses
+		 *	\param[in] pBlendRadii [optional] Blend radius of each pose (see PathSimplifier), NULL = no blending
+		 *	\return NETWORK_OK (0) or NETWORK_ERROR (-1)
+		 */
+		int SendTrajectory(const RobotPose *pPoses, const int count, const float *pBlendRadii = NULL);
+		int SendTrajectory(const std::vector<RobotPose> &poses);
+		int SendTrajectory(const std::vector<RobotPose> &poses, const std::vector<float> &blendRadii);
+
+		/** \brief Wait until every command sent is acknowledged (no-op for ACK_NONE)
+		 *	\return NETWORK_OK (0) or NETWORK_ERROR (-1)
+		 */
+		int Drain();
+
+		/** \brief Collect acknowledgments that already arrived, without waiting
+		 *	\return Number of commands still in flight, NETWORK_ERROR (-1) on error
+		 */
+		int Poll();
+
+		int InFlight() const { return m_inFlight; }
+		long long CommandsSent() const { return m_commandsSent; }
+		long long CommandsAcked() const { return m_commandsAcked; }
+		long long BytesSent() const { return m_bytesSent; }
+
+	private:
+		int SendAll(const char *pData, const int size);
+		int ReceiveAcks(const int timeoutMs);
+
+		SOCKET					m_socket;
+		AckMode					m_ackMode;
+		int						m_window;
+		float					m_acceleration;
+		float					m_speed;
+		int						m_decimals;
+		int						m_ackTimeout;
+		std::ostream			*m_pLog;
+
+		std::vector<char>		m_buffer;		//encoded batch, reused
+		char					m_ackBuffer[256];
+		std::vector<long long>	m_sendTimes;	//of the commands in flight, command n at n%window (ACK_LINE)
+
+		int						m_inFlight;
+		long long				m_commandsSent;
+		long long				m_commandsAcked;
+		long long				m_bytesSent;
+	};
+
+};//namespace rm
+
+
+
+#endif //TRAJECTORY_STREAMER_H_
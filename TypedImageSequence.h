@@ -0,0 +1,333 @@
+/* *
+	TypedImageSequence.h
+		Stream readers and writers with the pixel format fixed at compile time
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef TYPED_IMAGE_SEQUENCE_H_
+#define TYPED_IMAGE_SEQUENCE_H_
+
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include <opencv2\opencv.hpp>
+
+#include "FileIO.h"
+#include "StreamFormat.h"
+#include "PixelFormat.h"
+#include "LatencyTracker.h"
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The TypedFrameKernels struct
+	 *	The per-frame work on the samples of a Traits stream: the record
+	 *	layout of a row, the conversion to float and the binning. The typed
+	 *	reader and writer call them directly; ImageSequenceIO selects the
+	 *	table of its stream once (FindFrameKernels) when the stream is
+	 *	opened or its header written, and calls through it per frame.
+	 ***************************************************************/
+	template<class Traits>
+	struct TypedFrameKernels
+	{
+		typedef typename Traits::Sample		Sample;
+
+		/** \brief Bytes of a stored row of width pixels
+		 */
+		static size_t RowBytes(const int width)
+		{
+			return (size_t)width*Traits::CHANNELS*sizeof(Sample);
+		}
+
+		/** \brief pDst[i] = pSrc[i]*scale for count samples of the stream
+		 */
+		static void ToFloat(const unsigned char *pSrc, float *pDst, const size_t count, const float scale)
+		{
+			ScaleSamples((const Sample*)pSrc,pDst,count,scale);
+		}
+
+		/** \brief Average of binning x binning pixel blocks, per channel
+		 *	\param[in] src binning times the rows and columns of dst
+		 *	\param[out] dst Allocated, of type Traits::TYPE
+		 */
+		static void Bin(const cv::Mat &src, cv::Mat &dst, const int binning)
+		{
+			const int channels = Traits::CHANNELS;
+			const int cols = dst.cols;
+			const float scale = 1.0f/(binning*binning);
+			const float rounding = std::numeric_limits<Sample>::is_integer ? 0.5f : 0.0f;
+			std::vector<float> sums(cols*channels);
+			for(int y=0; y<dst.rows; y++)
+			{
+				std::fill(sums.begin(),sums.end(),0.0f);
+				for(int dy=0; dy<binning; dy++)
+				{
+					const Sample *pSrc = src.ptr<Sample>(y*binning + dy);
+					for(int x=0; x<cols; x++)
+					{
+						for(int dx=0; dx<binning; dx++, pSrc+=channels)
+						{
+							for(int c=0; c<channels; c++)
+							{
+								sums[x*channels + c] += pSrc[c];
+							}
+						}
+					}
+				}
+				Sample *pDst = dst.ptr<Sample>(y);
+				for(int i=0; i<cols*channels; i++)
+				{
+					pDst[i] = (Sample)(sums[i]*scale + rounding);
+				}
+			}
+		}
+	};
+
+	/** \brief The TypedFrameKernels of a pixel format, for code that knows the format at run time only
+	 */
+	struct FrameKernels
+	{
+		int			m_type;				//OpenCV type of the frames
+		int			m_floatType;		//OpenCV type of the frames converted to float
+		int			m_channels;
+		int			m_bytesPerSample;
+		size_t		(*RowBytes)(const int width);
+		void		(*ToFloat)(const unsigned char *pSrc, float *pDst, const size_t count, const float scale);
+		void		(*Bin)(const cv::Mat &src, cv::Mat &dst, const int binning);
+	};
+
+	/** \brief The FrameKernels table of Traits
+	 */
+	template<class Traits>
+	const FrameKernels& FrameKernelsOf()
+	{
+		static const FrameKernels kernels =
+		{
+			Traits::TYPE,
+			CV_MAKETYPE(CV_32F,Traits::CHANNELS),
+			Traits::CHANNELS,
+			Traits::BYTES_PER_SAMPLE,
+			&TypedFrameKernels<Traits>::RowBytes,
+			&TypedFrameKernels<Traits>::ToFloat,
+			&TypedFrameKernels<Traits>::Bin
+		};
+		return kernels;
+	}
+
+	//selects the table in FindFrameKernels (see DispatchPixelFormat)
+	struct SelectFrameKernels
+	{
+		const FrameKernels		*m_pKernels;
+
+		template<class Traits>
+		void Run()
+		{
+			m_pKernels = &FrameKernelsOf<Traits>();
+		}
+	};
+
+	/** \brief The FrameKernels table of an OpenCV type
+	 *	\return NULL if the type is not a stream pixel format
+	 */
+	inline const FrameKernels* FindFrameKernels(const int type)
+	{
+		SelectFrameKernels select = {NULL};
+		DispatchPixelFormat(type,select);
+		return select.m_pKernels;
+	}
+
+
+	/************************************************************//**
+	 *	The TypedSequenceReader class
+	 *	Reads a stream whose pixel format is Traits (a PixelTraits, e.g.
+	 *	Pixel16U). The format is checked once when the stream is opened,
+	 *	the frames are then accessed as rows of Traits::Pixel:
+	 *
+	 *		TypedSequenceReader<Pixel16U> reader;
+	 *		reader.Open("depth.bin");
+	 *		while(reader.ReadNext() >= 0)
+	 *		{
+	 *			const unsigned short *pRow = reader.Row(y);
+	 *			...
+	 *		}
+	 *
+	 *	The frames are the raw stream frames (no demosaicing), everything
+	 *	else (memory mapping, prefetch, seeking) goes through Stream().
+	 ***************************************************************/
+	template<class Traits>
+	class TypedSequenceReader
+	{
+	public:
+		typedef typename Traits::Sample		Sample;
+		typedef typename Traits::Pixel		Pixel;
+
+		TypedSequenceReader():m_pFrame(NULL),m_height(0),m_width(0)
+		{
+		}
+
+		/** \brief Open a stream, throws if its pixel format is not Traits
+		 */
+		void Open(const std::string &fileName)
+		{
+			m_stream.OpenReadStream(fileName);
+			if(m_stream.GetReadFormat().m_pixelFormat != Traits::TYPE)
+			{
+				m_stream.CloseReadStream();
+				throw("TypedSequenceReader::Open: the stream has another pixel format");
+			}
+			m_height = m_stream.GetReadHeader().m_imaHeight;
+			m_width = m_stream.GetReadHeader().m_imaWidth;
+			m_pFrame = NULL;
+		}
+
+		void Close()
+		{
+			m_stream.CloseReadStream();
+			m_pFrame = NULL;
+		}
+
+		/** \brief Read the next frame
+		 *	\return The frame id, -1 if the end of the stream is reached
+		 */
+		int ReadNext()
+		{
+			const int frameId = m_stream.ReadNextImage();
+			m_pFrame = (frameId >= 0) ? &m_stream.LastReadRawFrame() : NULL;
+			return frameId;
+		}
+
+		/** \brief Read the frame of a frame id
+		 *	\return The frame id, -1 if it is not in the stream
+		 */
+		int Read(const int frameId)
+		{
+			const int readId = m_stream.ReadFrame(frameId);
+			m_pFrame = (readId >= 0) ? &m_stream.LastReadRawFrame() : NULL;
+			return readId;
+		}
+
+		int Height() const { return m_height; }
+		int Width() const { return m_width; }
+
+		/** \brief A row of the last read frame, valid until the next read
+		 */
+		const Pixel* Row(const int y) const
+		{
+			return (const Pixel*)m_pFrame->ptr(y);
+		}
+
+		/** \brief The last read frame, of type Traits::TYPE
+		 */
+		const cv::Mat& Frame() const { return *m_pFrame; }
+		int FrameId() const { return m_stream.LastReadFrameId(); }
+		const FrameTiming& Timing() const { return m_stream.LastReadFrameTiming(); }
+
+		/** \brief Convert the last read frame to another sample type, pDst[i] = sample*scale
+		 *	\param[out] pDst Height()*Width()*Traits::CHANNELS samples
+		 */
+		template<typename Dst>
+		void Convert(Dst *pDst, const float scale = 1.0f) const
+		{
+			const size_t rowSamples = (size_t)m_width*Traits::CHANNELS;
+			for(int y=0; y<m_height; y++)
+			{
+				ScaleSamples((const Sample*)m_pFrame->ptr(y),pDst + y*rowSamples,rowSamples,scale);
+			}
+		}
+
+		ImageSequenceIO& Stream() { return m_stream; }
+
+	private:
+		//not copyable
+		TypedSequenceReader(const TypedSequenceReader&);
+		TypedSequenceReader& operator=(const TypedSequenceReader&);
+
+		ImageSequenceIO			m_stream;
+		const cv::Mat			*m_pFrame;	//NULL if no frame is read
+		int						m_height;
+		int						m_width;
+	};
+
+
+	/************************************************************//**
+	 *	The TypedSequenceWriter class
+	 *	Writes a stream of Traits frames; the header is derived from the
+	 *	format, so it cannot disagree with the frames.
+	 ***************************************************************/
+	template<class Traits>
+	class TypedSequenceWriter
+	{
+	public:
+		typedef typename Traits::Sample		Sample;
+		typedef typename Traits::Pixel		Pixel;
+
+		TypedSequenceWriter()
+		{
+		}
+
+		/** \brief Create the stream and write its header
+		 *	\param[in] format Version, codec... (the pixel format is set to Traits::TYPE)
+		 */
+		void Open(const std::string &fileName, const int height, const int width, const StreamFormat &format = StreamFormat())
+		{
+			ImageSequenceHeader header;
+			Traits::SetHeader(header,height,width);
+			StreamFormat typedFormat = format;
+			typedFormat.m_pixelFormat = Traits::TYPE;
+			m_stream.SetWriteFormat(typedFormat);
+			m_stream.SetWriteHeader(header);
+			m_stream.OpenWriteStream(fileName);
+			m_stream.WriteHeader();
+		}
+
+		void Close()
+		{
+			m_stream.CloseWriteStream();
+		}
+
+		/** \brief Write a frame, throws if its type or size differs from the stream
+		 */
+		void Write(const cv::Mat &image, const int frameId, const FrameTiming &timing = FrameTiming())
+		{
+			const ImageSequenceHeader &header = m_stream.GetWriteHeader();
+			if(image.type() != Traits::TYPE || image.rows != header.m_imaHeight || image.cols != header.m_imaWidth || !image.isContinuous())
+			{
+				throw("TypedSequenceWriter::Write: the image does not match the stream");
+			}
+			m_stream.WriteImageToStream(image,frameId,timing);
+		}
+
+		/** \brief Write a frame of contiguous pixels, of the size given to Open
+		 */
+		void Write(const Pixel *pPixels, const int frameId, const FrameTiming &timing = FrameTiming())
+		{
+			const ImageSequenceHeader &header = m_stream.GetWriteHeader();
+			m_stream.WriteImageToStream(cv::Mat(header.m_imaHeight,header.m_imaWidth,Traits::TYPE,(void*)pPixels),frameId,timing);
+		}
+
+		ImageSequenceIO& Stream() { return m_stream; }
+
+	private:
+		//not copyable
+		TypedSequenceWriter(const TypedSequenceWriter&);
+		TypedSequenceWriter& operator=(const TypedSequenceWriter&);
+
+		ImageSequenceIO			m_stream;
+	};
+
+};//namespace rm
+
+
+
+#endif //TYPED_IMAGE_SEQUENCE_H_
@@ -0,0 +1,454 @@
+/* *
+	VisibleKernels.cpp
+		The Implementation of the 8-bit visualization kernels
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "VisibleKernels.h"
+#include "Camera.h"
+#include "WorkerPool.h"
+
+#include <atomic>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VISIBLE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+
+
+namespace rm
+{
+
+	/******************************/
+	/* Instruction set selection  */
+	/******************************/
+
+	static atomic<int> s_activeIsa(-1);	//-1 = not detected yet
+
+	VisibleKernelIsa DetectVisibleKernelIsa()
+	{
+#if defined(VISIBLE_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info,0);
+		const int maxLeaf = info[0];
+		__cpuid(info,1);
+		const bool sse41 = (info[2] & (1 << 19)) != 0;
+		const bool osAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+		bool avx2 = false;
+		if(maxLeaf >= 7 && osAvx)
+		{
+			__cpuidex(info,7,0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+		return avx2 ? VISIBLE_ISA_AVX2 : (sse41 ? VISIBLE_ISA_SSE41 : VISIBLE_ISA_SCALAR);
+#elif defined(VISIBLE_X86)
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2"))
+		{
+			return VISIBLE_ISA_AVX2;
+		}
+		if(__builtin_cpu_supports("sse4.1"))
+		{
+			return VISIBLE_ISA_SSE41;
+		}
+		return VISIBLE_ISA_SCALAR;
+#else
+		return VISIBLE_ISA_SCALAR;
+#endif
+	}
+
+	VisibleKernelIsa ActiveVisibleKernelIsa()
+	{
+		int isa = s_activeIsa.load();
+		if(isa < 0)
+		{
+			isa = DetectVisibleKernelIsa();
+			s_activeIsa = isa;
+		}
+		return (VisibleKernelIsa)isa;
+	}
+
+	void SetVisibleKernelIsa(const VisibleKernelIsa isa)
+	{
+		const VisibleKernelIsa supported = DetectVisibleKernelIsa();
+		s_activeIsa = (isa < supported) ? isa : supported;
+	}
+
+
+	/******************************/
+	/* Scalar kernels             */
+	/******************************/
+
+	//
+	//Same expression and conversion as the generic template: truncation, then the low byte
+	static inline unsigned char DepthToByte(const uInt16 depth, const double maxDepth)
+	{
+		return (unsigned char)(int)((depth/maxDepth) * 255.0);
+	}
+
+	static void VisibleDepthScalar(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		for(int i=0; i<size; i++)
+		{
+			pVisibleDepth[i] = DepthToByte(pDepth[i],maxDepth);
+		}
+	}
+
+	static void VisibleDepthRGBScalar(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		for(int i=0; i<size; i++)
+		{
+			const unsigned char val = DepthToByte(pDepth[i],maxDepth);
+			pVisibleDepth[3*i] = pVisibleDepth[3*i+1] = pVisibleDepth[3*i+2] = val;
+		}
+	}
+
+	static void VisibleIrScalar(const uInt16 *pIr, unsigned char *pVisibleIr, const int size)
+	{
+		for(int i=0; i<size; i++)
+		{
+			pVisibleIr[i] = (unsigned char)(pIr[i] >> 1);
+		}
+	}
+
+
+#ifdef VISIBLE_X86
+	/******************************/
+	/* SSE4.1 kernels             */
+	/******************************/
+
+	//
+	//Four depth values (int32) to four truncated int32
+	TARGET_SSE41 static inline __m128i DepthQuadSse41(const __m128i depth, const __m128d maxDepth, const __m128d scale)
+	{
+		const __m128d lo = _mm_mul_pd(_mm_div_pd(_mm_cvtepi32_pd(depth),maxDepth),scale);
+		const __m128d hi = _mm_mul_pd(_mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(depth,8)),maxDepth),scale);
+		return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo),_mm_cvttpd_epi32(hi));
+	}
+
+	//
+	//Low bytes of four int32 vectors, in order
+	TARGET_SSE41 static inline __m128i PackLowBytes(const __m128i q0, const __m128i q1, const __m128i q2, const __m128i q3)
+	{
+		const __m128i mask = _mm_set1_epi32(0xff);
+		const __m128i lo = _mm_packus_epi32(_mm_and_si128(q0,mask),_mm_and_si128(q1,mask));
+		const __m128i hi = _mm_packus_epi32(_mm_and_si128(q2,mask),_mm_and_si128(q3,mask));
+		return _mm_packus_epi16(lo,hi);
+	}
+
+	//
+	//Store 16 gray values as 48 bytes of BGR
+	TARGET_SSE41 static inline void StoreGrayAsRGB(const __m128i gray, unsigned char *pDst)
+	{
+		const __m128i shuffle0 = _mm_setr_epi8(0,0,0,1,1,1,2,2,2,3,3,3,4,4,4,5);
+		const __m128i shuffle1 = _mm_setr_epi8(5,5,6,6,6,7,7,7,8,8,8,9,9,9,10,10);
+		const __m128i shuffle2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+		_mm_storeu_si128((__m128i*)pDst,_mm_shuffle_epi8(gray,shuffle0));
+		_mm_storeu_si128((__m128i*)(pDst + 16),_mm_shuffle_epi8(gray,shuffle1));
+		_mm_storeu_si128((__m128i*)(pDst + 32),_mm_shuffle_epi8(gray,shuffle2));
+	}
+
+	TARGET_SSE41 static inline __m128i Depth16Sse41(const uInt16 *pDepth, const __m128d maxDepth, const __m128d scale)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i*)pDepth);
+		const __m128i b = _mm_loadu_si128((const __m128i*)(pDepth + 8));
+		return PackLowBytes(DepthQuadSse41(_mm_cvtepu16_epi32(a),maxDepth,scale),
+			DepthQuadSse41(_mm_cvtepu16_epi32(_mm_srli_si128(a,8)),maxDepth,scale),
+			DepthQuadSse41(_mm_cvtepu16_epi32(b),maxDepth,scale),
+			DepthQuadSse41(_mm_cvtepu16_epi32(_mm_srli_si128(b,8)),maxDepth,scale));
+	}
+
+	TARGET_SSE41 static void VisibleDepthSse41(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		const __m128d maxv = _mm_set1_pd(maxDepth);
+		const __m128d scale = _mm_set1_pd(255.0);
+		int i = 0;
+		for(; i + 16 <= size; i += 16)
+		{
+			_mm_storeu_si128((__m128i*)(pVisibleDepth + i),Depth16Sse41(pDepth + i,maxv,scale));
+		}
+		VisibleDepthScalar(pDepth + i,pVisibleDepth + i,size - i,maxDepth);
+	}
+
+	TARGET_SSE41 static void VisibleDepthRGBSse41(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		const __m128d maxv = _mm_set1_pd(maxDepth);
+		const __m128d scale = _mm_set1_pd(255.0);
+		int i = 0;
+		for(; i + 16 <= size; i += 16)
+		{
+			StoreGrayAsRGB(Depth16Sse41(pDepth + i,maxv,scale),pVisibleDepth + 3*i);
+		}
+		VisibleDepthRGBScalar(pDepth + i,pVisibleDepth + 3*i,size - i,maxDepth);
+	}
+
+	TARGET_SSE41 static void VisibleIrSse41(const uInt16 *pIr, unsigned char *pVisibleIr, const int size)
+	{
+		const __m128i mask = _mm_set1_epi16(0xff);
+		int i = 0;
+		for(; i + 16 <= size; i += 16)
+		{
+			const __m128i a = _mm_and_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)(pIr + i)),1),mask);
+			const __m128i b = _mm_and_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)(pIr + i + 8)),1),mask);
+			_mm_storeu_si128((__m128i*)(pVisibleIr + i),_mm_packus_epi16(a,b));
+		}
+		VisibleIrScalar(pIr + i,pVisibleIr + i,size - i);
+	}
+
+
+	/******************************/
+	/* AVX2 kernels               */
+	/******************************/
+
+	TARGET_AVX2 static inline __m128i DepthQuadAvx2(const __m128i depth, const __m256d maxDepth, const __m256d scale)
+	{
+		return _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_div_pd(_mm256_cvtepi32_pd(depth),maxDepth),scale));
+	}
+
+	TARGET_AVX2 static inline __m128i Depth16Avx2(const uInt16 *pDepth, const __m256d maxDepth, const __m256d scale)
+	{
+		const __m256i a = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)pDepth));
+		const __m256i b = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(pDepth + 8)));
+		return PackLowBytes(DepthQuadAvx2(_mm256_castsi256_si128(a),maxDepth,scale),
+			DepthQuadAvx2(_mm256_extracti128_si256(a,1),maxDepth,scale),
+			DepthQuadAvx2(_mm256_castsi256_si128(b),maxDepth,scale),
+			DepthQuadAvx2(_mm256_extracti128_si256(b,1),maxDepth,scale));
+	}
+
+	TARGET_AVX2 static void VisibleDepthAvx2(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		const __m256d maxv = _mm256_set1_pd(maxDepth);
+		const __m256d scale = _mm256_set1_pd(255.0);
+		int i = 0;
+		for(; i + 16 <= size; i += 16)
+		{
+			_mm_storeu_si128((__m128i*)(pVisibleDepth + i),Depth16Avx2(pDepth + i,maxv,scale));
+		}
+		VisibleDepthScalar(pDepth + i,pVisibleDepth + i,size - i,maxDepth);
+	}
+
+	TARGET_AVX2 static void VisibleDepthRGBAvx2(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		const __m256d maxv = _mm256_set1_pd(maxDepth);
+		const __m256d scale = _mm256_set1_pd(255.0);
+		int i = 0;
+		for(; i + 16 <= size; i += 16)
+		{
+			StoreGrayAsRGB(Depth16Avx2(pDepth + i,maxv,scale),pVisibleDepth + 3*i);
+		}
+		VisibleDepthRGBScalar(pDepth + i,pVisibleDepth + 3*i,size - i,maxDepth);
+	}
+
+	TARGET_AVX2 static void VisibleIrAvx2(const uInt16 *pIr, unsigned char *pVisibleIr, const int size)
+	{
+		const __m256i mask = _mm256_set1_epi16(0xff);
+		int i = 0;
+		for(; i + 32 <= size; i += 32)
+		{
+			const __m256i a = _mm256_and_si256(_mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)(pIr + i)),1),mask);
+			const __m256i b = _mm256_and_si256(_mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)(pIr + i + 16)),1),mask);
+			//packus works per 128-bit lane, put the quarters back in order
+			const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a,b),0xD8);
+			_mm256_storeu_si256((__m256i*)(pVisibleIr + i),packed);
+		}
+		VisibleIrScalar(pIr + i,pVisibleIr + i,size - i);
+	}
+#endif //VISIBLE_X86
+
+
+	/******************************/
+	/* Camera.h specializations   */
+	/******************************/
+
+	template<>
+	void VisibleDepth<unsigned char>(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		switch(ActiveVisibleKernelIsa())
+		{
+#ifdef VISIBLE_X86
+		case VISIBLE_ISA_AVX2:
+			VisibleDepthAvx2(pDepth,pVisibleDepth,size,maxDepth);
+			break;
+		case VISIBLE_ISA_SSE41:
+			VisibleDepthSse41(pDepth,pVisibleDepth,size,maxDepth);
+			break;
+#endif
+		default:
+			VisibleDepthScalar(pDepth,pVisibleDepth,size,maxDepth);
+		}
+	}
+
+	template<>
+	void VisibleDepthRGB<unsigned char>(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		switch(ActiveVisibleKernelIsa())
+		{
+#ifdef VISIBLE_X86
+		case VISIBLE_ISA_AVX2:
+			VisibleDepthRGBAvx2(pDepth,pVisibleDepth,size,maxDepth);
+			break;
+		case VISIBLE_ISA_SSE41:
+			VisibleDepthRGBSse41(pDepth,pVisibleDepth,size,maxDepth);
+			break;
+#endif
+		default:
+			VisibleDepthRGBScalar(pDepth,pVisibleDepth,size,maxDepth);
+		}
+	}
+
+	template<>
+	void VisibleIr<unsigned char>(const uInt16 *pIr, unsigned char *pVisibleIr, const int size)
+	{
+		switch(ActiveVisibleKernelIsa())
+		{
+#ifdef VISIBLE_X86
+		case VISIBLE_ISA_AVX2:
+			VisibleIrAvx2(pIr,pVisibleIr,size);
+			break;
+		case VISIBLE_ISA_SSE41:
+			VisibleIrSse41(pIr,pVisibleIr,size);
+			break;
+#endif
+		default:
+			VisibleIrScalar(pIr,pVisibleIr,size);
+		}
+	}
+
+
+	/******************************/
+	/* Lookup table               */
+	/******************************/
+
+	VisibleDepthLut::VisibleDepthLut(const double maxDepth):m_maxDepth(0)
+	{
+		Build(maxDepth);
+	}
+
+	void VisibleDepthLut::Build(const double maxDepth)
+	{
+		if(!m_table.empty() && maxDepth == m_maxDepth)
+		{
+			return;
+		}
+		m_maxDepth = maxDepth;
+		m_table.resize(65536);
+		for(int v=0; v<65536; v++)
+		{
+			m_table[v] = DepthToByte((uInt16)v,maxDepth);
+		}
+	}
+
+	void VisibleDepthLut::Convert(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size) const
+	{
+		const unsigned char *pTable = &m_table[0];
+		int i = 0;
+		for(; i + 4 <= size; i += 4)
+		{
+			pVisibleDepth[i] = pTable[pDepth[i]];
+			pVisibleDepth[i+1] = pTable[pDepth[i+1]];
+			pVisibleDepth[i+2] = pTable[pDepth[i+2]];
+			pVisibleDepth[i+3] = pTable[pDepth[i+3]];
+		}
+		for(; i<size; i++)
+		{
+			pVisibleDepth[i] = pTable[pDepth[i]];
+		}
+	}
+
+	void VisibleDepthLut::ConvertRGB(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size) const
+	{
+		const unsigned char *pTable = &m_table[0];
+		for(int i=0; i<size; i++)
+		{
+			const unsigned char val = pTable[pDepth[i]];
+			pVisibleDepth[3*i] = pVisibleDepth[3*i+1] = pVisibleDepth[3*i+2] = val;
+		}
+	}
+
+
+	/******************************/
+	/* Band parallel versions     */
+	/******************************/
+
+	//smaller frames are not worth waking up the pool
+	static const int MIN_PIXELS_PER_BAND = 64*1024;
+
+	//
+	//Call func(begin,end) for bands of [0,size) on the global pool,
+	//band boundaries are multiples of 64 pixels so that the vector loops see whole blocks
+	template<class Func>
+	static void ForEachBand(const int size, const Func &func)
+	{
+		WorkerPool &pool = WorkerPool::Global();
+		int numBands = size / MIN_PIXELS_PER_BAND;
+		if(numBands > 2*pool.NumThreads())
+		{
+			numBands = 2*pool.NumThreads();
+		}
+		if(numBands <= 1)
+		{
+			func(0,size);
+			return;
+		}
+		pool.ParallelFor(numBands,[&](int k)
+		{
+			const int begin = (int)((long long)size*k/numBands) & ~63;
+			const int end = (k == numBands-1) ? size : ((int)((long long)size*(k+1)/numBands) & ~63);
+			func(begin,end);
+		});
+	}
+
+	void VisibleDepthParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		ForEachBand(size,[&](int begin, int end)
+		{
+			VisibleDepth<unsigned char>(pDepth + begin,pVisibleDepth + begin,end - begin,maxDepth);
+		});
+	}
+
+	void VisibleDepthParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const VisibleDepthLut &lut)
+	{
+		ForEachBand(size,[&](int begin, int end)
+		{
+			lut.Convert(pDepth + begin,pVisibleDepth + begin,end - begin);
+		});
+	}
+
+	void VisibleDepthRGBParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+	{
+		ForEachBand(size,[&](int begin, int end)
+		{
+			VisibleDepthRGB<unsigned char>(pDepth + begin,pVisibleDepth + 3*begin,end - begin,maxDepth);
+		});
+	}
+
+	void VisibleDepthRGBParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const VisibleDepthLut &lut)
+	{
+		ForEachBand(size,[&](int begin, int end)
+		{
+			lut.ConvertRGB(pDepth + begin,pVisibleDepth + 3*begin,end - begin);
+		});
+	}
+
+	void VisibleIrParallel(const uInt16 *pIr, unsigned char *pVisibleIr, const int size)
+	{
+		ForEachBand(size,[&](int begin, int end)
+		{
+			VisibleIr<unsigned char>(pIr + begin,pVisibleIr + begin,end - begin);
+		});
+	}
+
+}
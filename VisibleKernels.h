@@ -0,0 +1,111 @@
+/* *
+	VisibleKernels.h
+		Fast conversions of 16-bit depth and IR maps into 8-bit images
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef VISIBLE_KERNELS_H_
+#define VISIBLE_KERNELS_H_
+
+
+#include <vector>
+
+#include "Common.h"
+
+
+
+namespace rm
+{
+
+	/**********************************************************************/
+	//	The 8-bit specializations of VisibleDepth, VisibleDepthRGB and
+	//	VisibleIr (see Camera.h) run on the widest instruction set the CPU
+	//	supports (AVX2, SSE4.1 or plain C++), selected at run time. All of
+	//	them produce exactly the same bytes as the generic templates.
+	//	For a fixed maxDepth, a VisibleDepthLut replaces the division by a
+	//	table lookup, and the *Parallel functions split large frames into
+	//	bands that are converted on WorkerPool::Global().
+	/**********************************************************************/
+
+	/** \brief Instruction sets used by the conversion kernels
+	 */
+	enum VisibleKernelIsa
+	{
+		VISIBLE_ISA_SCALAR = 0,
+		VISIBLE_ISA_SSE41,
+		VISIBLE_ISA_AVX2
+	};
+
+	/** \brief The best instruction set supported by this CPU
+	 */
+	VisibleKernelIsa DetectVisibleKernelIsa();
+
+	/** \brief The instruction set currently used by the kernels
+	 */
+	VisibleKernelIsa ActiveVisibleKernelIsa();
+
+	/** \brief Restrict the kernels to an instruction set (e.g. for comparisons)
+	 *	\param[in] isa The requested instruction set, clamped to what the CPU supports
+	 */
+	void SetVisibleKernelIsa(const VisibleKernelIsa isa);
+
+
+	/************************************************************//**
+	 *	The VisibleDepthLut class
+	 *	Precomputed uint16 -> uint8 depth conversion for one maxDepth
+	 ***************************************************************/
+	class VisibleDepthLut
+	{
+	public:
+		explicit VisibleDepthLut(const double maxDepth = 5.0*1000);
+
+		/** \brief Recompute the table if maxDepth changed
+		 */
+		void Build(const double maxDepth);
+
+		double MaxDepth() const { return m_maxDepth; }
+
+		/** \brief Same as VisibleDepth(pDepth,pVisibleDepth,size,MaxDepth())
+		 */
+		void Convert(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size) const;
+
+		/** \brief Same as VisibleDepthRGB(pDepth,pVisibleDepth,size,MaxDepth())
+		 */
+		void ConvertRGB(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size) const;
+
+	private:
+		double						m_maxDepth;
+		std::vector<unsigned char>	m_table;	//65536 entries
+	};
+
+
+	/** \brief VisibleDepth on bands of the frame in parallel
+	 */
+	void VisibleDepthParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth = 5.0*1000);
+
+	/** \brief VisibleDepth through a table on bands of the frame in parallel
+	 */
+	void VisibleDepthParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const VisibleDepthLut &lut);
+
+	/** \brief VisibleDepthRGB on bands of the frame in parallel
+	 */
+	void VisibleDepthRGBParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth = 5.0*1000);
+
+	/** \brief VisibleDepthRGB through a table on bands of the frame in parallel
+	 */
+	void VisibleDepthRGBParallel(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const VisibleDepthLut &lut);
+
+	/** \brief VisibleIr on bands of the frame in parallel
+	 */
+	void VisibleIrParallel(const uInt16 *pIr, unsigned char *pVisibleIr, const int size);
+
+};//namespace rm
+
+
+
+#endif //VISIBLE_KERNELS_H_
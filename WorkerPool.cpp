@@ -0,0 +1,140 @@
+/* *
+	WorkerPool.cpp
+		The Implementation of the worker thread pool
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include "WorkerPool.h"
+
+using namespace std;
+
+
+namespace rm
+{
+
+	WorkerPool::WorkerPool(const int numThreads):m_generation(0),m_stop(false),m_busyWorkers(0),
+		m_pFunc(NULL),m_count(0),m_next(0)
+	{
+		int total = numThreads;
+		if(total <= 0)
+		{
+			total = (int)thread::hardware_concurrency();
+		}
+		for(int i=1; i<total; i++)
+		{
+			m_threads.push_back(thread(&WorkerPool::WorkerLoop,this));
+		}
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cvStart.notify_all();
+		for(size_t i=0; i<m_threads.size(); i++)
+		{
+			m_threads[i].join();
+		}
+	}
+
+	WorkerPool& WorkerPool::Global()
+	{
+		static WorkerPool pool;
+		return pool;
+	}
+
+	void WorkerPool::ParallelFor(const int count, const function<void(int)> &func)
+	{
+		if(count <= 0)
+		{
+			return;
+		}
+		if(count == 1 || m_threads.empty())
+		{
+			for(int i=0; i<count; i++)
+			{
+				func(i);
+			}
+			return;
+		}
+
+		lock_guard<mutex> runLock(m_runMutex);
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_pFunc = &func;
+			m_count = count;
+			m_next = 0;
+			m_exception = exception_ptr();
+			m_busyWorkers = (int)m_threads.size();
+			m_generation++;
+		}
+		m_cvStart.notify_all();
+
+		RunIterations();
+
+		unique_lock<mutex> lock(m_mutex);
+		m_cvDone.wait(lock,[&]{ return m_busyWorkers == 0; });
+		m_pFunc = NULL;
+		if(m_exception)
+		{
+			exception_ptr e = m_exception;
+			m_exception = exception_ptr();
+			rethrow_exception(e);
+		}
+	}
+
+	//
+	//Take iterations until there are none left
+	void WorkerPool::RunIterations()
+	{
+		while(true)
+		{
+			const int i = m_next++;
+			if(i >= m_count)
+			{
+				return;
+			}
+			try
+			{
+				(*m_pFunc)(i);
+			}
+			catch(...)
+			{
+				lock_guard<mutex> lock(m_mutex);
+				if(!m_exception)
+				{
+					m_exception = current_exception();
+				}
+			}
+		}
+	}
+
+	void WorkerPool::WorkerLoop()
+	{
+		long long seenGeneration = 0;
+		while(true)
+		{
+			{
+				unique_lock<mutex> lock(m_mutex);
+				m_cvStart.wait(lock,[&]{ return m_stop || m_generation != seenGeneration; });
+				if(m_stop)
+				{
+					return;
+				}
+				seenGeneration = m_generation;
+			}
+			RunIterations();
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_busyWorkers--;
+			}
+			m_cvDone.notify_one();
+		}
+	}
+
+}
@@ -0,0 +1,88 @@
+/* *
+	WorkerPool.h
+		A small pool of persistent worker threads for data parallel loops
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+
+
+namespace rm
+{
+
+	/************************************************************//**
+	 *	The WorkerPool class
+	 *	Runs the iterations of a loop on a set of threads that are created
+	 *	once, so that per-frame parallelism does not pay for thread creation.
+	 ***************************************************************/
+	class WorkerPool
+	{
+	public:
+		/** \brief Create the pool
+		 *	\param[in] numThreads Total number of threads working on a loop, including
+		 *	the calling thread. 0 = one per core
+		 */
+		explicit WorkerPool(const int numThreads = 0);
+		~WorkerPool();
+
+		/** \brief Number of threads working on a loop (including the calling thread)
+		 */
+		int NumThreads() const { return (int)m_threads.size() + 1; }
+
+		/** \brief Run func(i) for every i in [0,count) and wait for all of them
+		 *	The calling thread takes part in the work. Calls from different threads are serialized.
+		 *	If an iteration throws, the first exception is rethrown after the loop finished.
+		 *	\param[in] count Number of iterations
+		 *	\param[in] func The loop body
+		 */
+		void ParallelFor(const int count, const std::function<void(int)> &func);
+
+		/** \brief A pool shared by the whole process (one thread per core)
+		 */
+		static WorkerPool& Global();
+
+	private:
+		//not copyable
+		WorkerPool(const WorkerPool&);
+		WorkerPool& operator=(const WorkerPool&);
+
+		void WorkerLoop();
+		void RunIterations();
+
+		std::vector<std::thread>			m_threads;
+		std::mutex							m_runMutex;		//one loop at a time
+		std::mutex							m_mutex;
+		std::condition_variable				m_cvStart;
+		std::condition_variable				m_cvDone;
+		long long							m_generation;	//incremented for every loop
+		bool								m_stop;
+		int									m_busyWorkers;
+
+		//current loop
+		const std::function<void(int)>		*m_pFunc;
+		int									m_count;
+		std::atomic<int>					m_next;
+		std::exception_ptr					m_exception;
+	};
+
+};//namespace rm
+
+
+
+#endif //WORKER_POOL_H_
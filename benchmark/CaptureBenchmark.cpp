@@ -0,0 +1,683 @@
+/* *
+	CaptureBenchmark.cpp
+		End-to-end throughput benchmarks of the capture and stream pipeline,
+		runs on MockCamera (and StreamCamera replaying its streams) so that
+		no hardware is needed.
+
+		usage: CaptureBenchmark [--frames N] [--width W] [--height H]
+				[--format 16U|8U|8UC3] [--images K] [--dir DIR]
+				[--filter SUBSTRING] [--out FILE.json]
+
+		The results are written as JSON (CaptureBenchmark.json by default,
+		stdout prints progress), one entry per case, so that runs of
+		different builds can be diffed.
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include <opencv2\opencv.hpp>
+
+#include "MockCamera.h"
+#include "StreamCamera.h"
+#include "FileIO.h"
+#include "StreamFormat.h"
+#include "LatencyTracker.h"
+
+using namespace std;
+using namespace rm;
+
+
+/******************************/
+/* Configuration and results  */
+/******************************/
+
+struct BenchmarkConfig
+{
+	int				m_frames;
+	int				m_width;
+	int				m_height;
+	int				m_type;
+	string			m_format;
+	int				m_images;
+	string			m_dir;
+
+	BenchmarkConfig():m_frames(300),m_width(640),m_height(480),m_type(CV_16U),m_format("16U"),m_images(1),m_dir(".")
+	{
+	}
+
+	string Path(const string &fileName) const
+	{
+		return m_dir + "/" + fileName;
+	}
+};
+
+struct BenchmarkResult
+{
+	string			m_name;
+	long long		m_frames;
+	long long		m_bytes;
+	double			m_seconds;
+	string			m_latencyStage;		//empty = no latency measured
+	LatencySummary	m_latency;
+	long long		m_checksum;			//of the data read (reported so that the reads are kept), -1 = none
+
+	BenchmarkResult():m_frames(0),m_bytes(0),m_seconds(0),m_checksum(-1)
+	{
+		memset(&m_latency,0,sizeof(m_latency));
+	}
+};
+
+typedef void (*BenchmarkFunc)(const BenchmarkConfig &config, BenchmarkResult &result);
+
+struct BenchmarkCase
+{
+	const char		*m_name;
+	BenchmarkFunc	m_run;
+};
+
+
+/******************************/
+/* Helpers                    */
+/******************************/
+
+static void SetupCamera(const BenchmarkConfig &config, MockCamera &camera)
+{
+	char name[32];
+	for(int k=0; k<config.m_images; k++)
+	{
+		sprintf(name,"image%d",k);
+		camera.AddImage(name,config.m_height,config.m_width,config.m_type);
+	}
+	camera.Init();
+}
+
+static long long CaptureBytes(const Camera &camera)
+{
+	long long bytes = 0;
+	for(int k=0; k<camera.NumImages(); k++)
+	{
+		bytes += (long long)camera.Height(k) * camera.Width(k) * camera.Channels(k) * camera.BytesPerPixel(k);
+	}
+	return bytes;
+}
+
+//
+//Read one byte of every page of a frame (each row: its first byte, every 4 KB and its last byte),
+//so that the mapped readers fault in the whole frame like the file readers read it
+static long long TouchFrame(const cv::Mat &frame)
+{
+	const size_t rowBytes = frame.cols*frame.elemSize();
+	long long sum = 0;
+	for(int y=0; y<frame.rows && rowBytes>0; y++)
+	{
+		const unsigned char *pRow = frame.ptr(y);
+		for(size_t x=0; x<rowBytes; x+=4096)
+		{
+			sum += pRow[x];
+		}
+		sum += pRow[rowBytes - 1];
+	}
+	return sum;
+}
+
+static ImageSequenceHeader HeaderOf(const Camera &camera, const int index)
+{
+	ImageSequenceHeader header;
+	header.m_imaHeight = camera.Height(index);
+	header.m_imaWidth = camera.Width(index);
+	header.m_imaChannels = camera.Channels(index);
+	header.m_imaBytesPerPixel = camera.BytesPerPixel(index);
+	return header;
+}
+
+//
+//Write config.m_frames captures of the first image into a stream file
+static void WriteStream(const BenchmarkConfig &config, const string &fileName, const StreamFormat &format,
+	const bool async, BenchmarkResult *pResult)
+{
+	MockCamera camera;
+	SetupCamera(config,camera);
+	LatencyTracker tracker;
+	camera.SetLatencyTracker(&tracker);
+
+	ImageSequenceIO io;
+	io.SetLatencyTracker(&tracker);
+	io.SetWriteFormat(format);
+	io.SetAsyncWrite(async);
+	io.SetWriteHeader(HeaderOf(camera,0));
+	io.OpenWriteStream(fileName);
+	io.WriteHeader();
+	const long long start = MonotonicNanoseconds();
+	for(int i=0; i<config.m_frames; i++)
+	{
+		camera.GrabOne();
+		io.WriteFrameToStream(camera.AcquireFrame(0),i);
+	}
+	io.CloseWriteStream();
+	if(pResult)
+	{
+		pResult->m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+		pResult->m_frames = config.m_frames;
+		pResult->m_bytes = config.m_frames * (long long)HeaderOf(camera,0).totalSize();
+		pResult->m_latencyStage = LatencyTracker::StageName(LatencyTracker::STAGE_GRAB_TO_WRITTEN);
+		pResult->m_latency = tracker.Summary(LatencyTracker::STAGE_GRAB_TO_WRITTEN);
+	}
+}
+
+//
+//Read the stream back, with process = true every frame is blurred like a replay that does some work per frame
+static void ReadStream(const BenchmarkConfig &config, const StreamFormat &format, const bool memoryMapped, const int prefetchDepth,
+	const bool process, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_read.bin");
+	WriteStream(config,fileName,format,false,NULL);
+
+	ImageSequenceIO io;
+	io.SetMemoryMapped(memoryMapped);
+	io.SetPrefetchDepth(prefetchDepth);
+	const long long start = MonotonicNanoseconds();
+	io.OpenReadStream(fileName);
+	long long checksum = 0;
+	cv::Mat blurred;
+	while(io.ReadNextImage() >= 0)
+	{
+		//touch the data, the mapped reader would not read anything otherwise
+		const cv::Mat &frame = io.LastReadFrame();
+		checksum += TouchFrame(frame);
+		if(process)
+		{
+			cv::GaussianBlur(frame,blurred,cv::Size(7,7),0);
+		}
+		result.m_frames++;
+	}
+	io.CloseReadStream();
+	result.m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+	result.m_bytes = result.m_frames * (long long)io.GetReadHeader().totalSize();
+	result.m_checksum = checksum;
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+//
+//Read the central quarter (half the rows and half the columns) of every frame of the stream
+static void ReadStreamRegion(const BenchmarkConfig &config, const StreamFormat &format, const bool memoryMapped, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_read_region.bin");
+	WriteStream(config,fileName,format,false,NULL);
+
+	ImageSequenceIO io;
+	io.SetMemoryMapped(memoryMapped);
+	const long long start = MonotonicNanoseconds();
+	io.OpenReadStream(fileName);
+	const ImageSequenceHeader &header = io.GetReadHeader();
+	const cv::Rect region(header.m_imaWidth/4,header.m_imaHeight/4,header.m_imaWidth/2,header.m_imaHeight/2);
+	long long checksum = 0;
+	while(io.ReadNextImageRegion(region) >= 0)
+	{
+		checksum += TouchFrame(io.LastReadFrame());
+		result.m_frames++;
+	}
+	io.CloseReadStream();
+	result.m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+	result.m_bytes = result.m_frames * (long long)header.totalSize();
+	result.m_checksum = checksum;
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+//
+//Write format storing the central quarter of the frames
+static StreamFormat RegionFormat(const BenchmarkConfig &config)
+{
+	StreamFormat format;
+	format.m_roiX = config.m_width/4;
+	format.m_roiY = config.m_height/4;
+	format.m_roiWidth = config.m_width/2;
+	format.m_roiHeight = config.m_height/2;
+	return format;
+}
+
+
+/******************************/
+/* Cases                      */
+/******************************/
+
+//
+//GrabOne alone: pattern copy into pooled frames and publishing
+static void BenchGrab(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	MockCamera camera;
+	SetupCamera(config,camera);
+	LatencyTracker tracker;
+	camera.SetLatencyTracker(&tracker);
+	const long long start = MonotonicNanoseconds();
+	for(int i=0; i<config.m_frames; i++)
+	{
+		camera.GrabOne();
+	}
+	result.m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+	result.m_frames = config.m_frames;
+	result.m_bytes = config.m_frames * CaptureBytes(camera);
+	result.m_latencyStage = LatencyTracker::StageName(LatencyTracker::STAGE_GRAB_TO_AVAILABLE);
+	result.m_latency = tracker.Summary(LatencyTracker::STAGE_GRAB_TO_AVAILABLE);
+}
+
+//
+//GrabOne -> SaveData into stream files (all images of the capture), in SaveData or
+//through the camera's AsyncSaver (the time includes draining its queue)
+static void GrabSaveStream(const BenchmarkConfig &config, const bool async, BenchmarkResult &result)
+{
+	MockCamera camera;
+	SetupCamera(config,camera);
+	LatencyTracker tracker;
+	camera.SetLatencyTracker(&tracker);
+	camera.SetSavePath(config.m_dir,"bench_");
+	camera.SetAsyncSave(async);
+	LatencyTracker::Global().Reset();
+	const long long start = MonotonicNanoseconds();
+	for(int i=0; i<config.m_frames; i++)
+	{
+		camera.GrabOne();
+		camera.SaveData(i,0);
+	}
+	camera.ShutDown();
+	result.m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+	result.m_frames = config.m_frames;
+	result.m_bytes = config.m_frames * CaptureBytes(camera);
+	//the streams of the camera report to the global tracker
+	result.m_latencyStage = LatencyTracker::StageName(LatencyTracker::STAGE_GRAB_TO_WRITTEN);
+	result.m_latency = LatencyTracker::Global().Summary(LatencyTracker::STAGE_GRAB_TO_WRITTEN);
+	for(int k=0; k<camera.NumImages(); k++)
+	{
+		const string fileName = config.Path("bench_" + camera.ImageName(k) + "_stream000.bin");
+		remove(fileName.c_str());
+		remove((fileName + ".idx").c_str());
+	}
+}
+
+static void BenchGrabSaveStream(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	GrabSaveStream(config,false,result);
+}
+
+static void BenchGrabSaveStreamAsync(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	GrabSaveStream(config,true,result);
+}
+
+static void BenchStreamWrite(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_write.bin");
+	WriteStream(config,fileName,StreamFormat(),false,&result);
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+static void BenchStreamWriteAsync(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_write_async.bin");
+	WriteStream(config,fileName,StreamFormat(),true,&result);
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+static void BenchStreamWriteRmz(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_write_rmz.bin");
+	StreamFormat format;
+	format.m_codec = STREAM_CODEC_RMZ;
+	WriteStream(config,fileName,format,false,&result);
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+//
+//Only a region or a binned frame is stored, the bytes are those of the camera frames
+static void BenchStreamWriteRoi(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_write_roi.bin");
+	WriteStream(config,fileName,RegionFormat(config),false,&result);
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+static void BenchStreamWriteBinned(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_write_binned.bin");
+	StreamFormat format;
+	format.m_binning = 2;
+	WriteStream(config,fileName,format,false,&result);
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+static void BenchStreamRead(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	ReadStream(config,StreamFormat(),false,0,false,result);
+}
+
+static void BenchStreamReadMapped(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	ReadStream(config,StreamFormat(),true,0,false,result);
+}
+
+static void BenchStreamReadPrefetch(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	ReadStream(config,StreamFormat(),false,8,false,result);
+}
+
+//
+//Region reads of full frame streams, the bytes are those of the whole frames
+static void BenchStreamReadRegion(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	ReadStreamRegion(config,StreamFormat(),false,result);
+}
+
+static void BenchStreamReadRegionMapped(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	ReadStreamRegion(config,StreamFormat(),true,result);
+}
+
+static void BenchStreamReadRegionRmz(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamFormat format;
+	format.m_codec = STREAM_CODEC_RMZ;
+	ReadStreamRegion(config,format,false,result);
+}
+
+//
+//The whole stream in batches of 32 frames, converted to float like for offline analysis
+static void BenchStreamReadBatch(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_read_batch.bin");
+	WriteStream(config,fileName,StreamFormat(),false,NULL);
+
+	ImageSequenceIO io;
+	const long long start = MonotonicNanoseconds();
+	io.OpenReadStream(fileName);
+	FrameHandle batch;
+	for(int first=0; first<config.m_frames; first+=32)
+	{
+		result.m_frames += io.ReadFrames(first,32,batch,1,0.001f);
+	}
+	io.CloseReadStream();
+	result.m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+	result.m_bytes = result.m_frames * (long long)io.GetReadHeader().totalSize();
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+//
+//Replay of a compressed stream with work per frame: decoding and processing alternate
+//without read-ahead, and overlap with it
+static void BenchReplayRmz(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamFormat format;
+	format.m_codec = STREAM_CODEC_RMZ;
+	ReadStream(config,format,false,0,true,result);
+}
+
+static void BenchReplayRmzPrefetch(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamFormat format;
+	format.m_codec = STREAM_CODEC_RMZ;
+	ReadStream(config,format,false,8,true,result);
+}
+
+//
+//GrabOne of StreamCamera replaying a stream as fast as possible, to compare with "grab":
+//the replay should cost about what MockCamera costs
+static void GrabReplay(const BenchmarkConfig &config, const StreamFormat &format, const bool preload, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_replay.bin");
+	WriteStream(config,fileName,format,false,NULL);
+	{
+		StreamCamera camera;
+		camera.SetPreload(preload);
+		camera.SetPacing(StreamCamera::PACE_NONE);
+		camera.SetLoop(false);
+		camera.AddStream(fileName);
+		camera.Init();
+		LatencyTracker tracker;
+		camera.SetLatencyTracker(&tracker);
+		const long long start = MonotonicNanoseconds();
+		while(true)
+		{
+			camera.GrabOne();
+			if(camera.IsFinished())
+			{
+				break;
+			}
+			result.m_frames++;
+		}
+		result.m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+		result.m_bytes = result.m_frames * CaptureBytes(camera);
+		result.m_latencyStage = LatencyTracker::StageName(LatencyTracker::STAGE_GRAB_TO_AVAILABLE);
+		result.m_latency = tracker.Summary(LatencyTracker::STAGE_GRAB_TO_AVAILABLE);
+	}
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+}
+
+static void BenchGrabReplayMapped(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	GrabReplay(config,StreamFormat(),false,result);
+}
+
+static void BenchGrabReplayPreload(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	GrabReplay(config,StreamFormat(),true,result);
+}
+
+static void BenchGrabReplayRmz(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamFormat format;
+	format.m_codec = STREAM_CODEC_RMZ;
+	GrabReplay(config,format,false,result);
+}
+
+//
+//ParseStream: stream -> one image file per frame (named by the default SequenceFileNames)
+static void BenchParseStream(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	const string fileName = config.Path("bench_parse.bin");
+	WriteStream(config,fileName,StreamFormat(),false,NULL);
+
+	ImageSequenceIO io;
+	SequenceFileNames fileNames;
+	fileNames.m_startIndex = 0;
+	fileNames.m_endIndex = MAX_INT;
+	fileNames.m_indexStep = 1;
+	const long long start = MonotonicNanoseconds();
+	io.ParseStream(fileName,fileNames);
+	result.m_seconds = (MonotonicNanoseconds() - start) * 1e-9;
+	result.m_frames = config.m_frames;
+	result.m_bytes = config.m_frames * (long long)io.GetReadHeader().totalSize();
+	remove(fileName.c_str());
+	remove((fileName + ".idx").c_str());
+	//the image files, named again the way ParseStream named them
+	fileNames.ResetCurrentIndex();
+	for(int i=0; i<config.m_frames; i++)
+	{
+		remove(fileNames.NextFileName().c_str());
+	}
+}
+
+static const BenchmarkCase s_cases[] =
+{
+	{"grab",BenchGrab},
+	{"grab_save_stream",BenchGrabSaveStream},
+	{"grab_save_stream_async",BenchGrabSaveStreamAsync},
+	{"stream_write",BenchStreamWrite},
+	{"stream_write_async",BenchStreamWriteAsync},
+	{"stream_write_rmz",BenchStreamWriteRmz},
+	{"stream_write_roi",BenchStreamWriteRoi},
+	{"stream_write_binned",BenchStreamWriteBinned},
+	{"stream_read",BenchStreamRead},
+	{"stream_read_mmap",BenchStreamReadMapped},
+	{"stream_read_prefetch",BenchStreamReadPrefetch},
+	{"stream_read_batch",BenchStreamReadBatch},
+	{"stream_read_region",BenchStreamReadRegion},
+	{"stream_read_region_mmap",BenchStreamReadRegionMapped},
+	{"stream_read_region_rmz",BenchStreamReadRegionRmz},
+	{"replay_rmz",BenchReplayRmz},
+	{"replay_rmz_prefetch",BenchReplayRmzPrefetch},
+	{"grab_replay_mmap",BenchGrabReplayMapped},
+	{"grab_replay_preload",BenchGrabReplayPreload},
+	{"grab_replay_rmz",BenchGrabReplayRmz},
+	{"parse_stream",BenchParseStream}
+};
+
+
+/******************************/
+/* Report                     */
+/******************************/
+
+static void WriteJson(ostream &os, const BenchmarkConfig &config, const vector<BenchmarkResult> &results)
+{
+	char buffer[512];
+	os << "{\n";
+	os << "\t\"benchmark\": \"capture\",\n";
+	sprintf(buffer,"\t\"config\": {\"frames\": %d, \"width\": %d, \"height\": %d, \"format\": \"%s\", \"images\": %d},\n",
+		config.m_frames,config.m_width,config.m_height,config.m_format.c_str(),config.m_images);
+	os << buffer;
+	os << "\t\"results\": [\n";
+	for(size_t i=0; i<results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		const double fps = r.m_seconds > 0 ? r.m_frames / r.m_seconds : 0;
+		const double mbps = r.m_seconds > 0 ? r.m_bytes / r.m_seconds / (1024.0*1024.0) : 0;
+		sprintf(buffer,"\t\t{\"name\": \"%s\", \"frames\": %lld, \"seconds\": %.6f, \"fps\": %.2f, \"mbPerSec\": %.2f",
+			r.m_name.c_str(),r.m_frames,r.m_seconds,fps,mbps);
+		os << buffer;
+		if(!r.m_latencyStage.empty())
+		{
+			sprintf(buffer,", \"latencyUs\": {\"stage\": \"%s\", \"count\": %lld, \"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+				r.m_latencyStage.c_str(),r.m_latency.m_count,r.m_latency.m_mean*1e-3,r.m_latency.m_p50*1e-3,
+				r.m_latency.m_p99*1e-3,r.m_latency.m_max*1e-3);
+			os << buffer;
+		}
+		if(r.m_checksum >= 0)
+		{
+			sprintf(buffer,", \"checksum\": %lld",r.m_checksum);
+			os << buffer;
+		}
+		os << ((i+1 < results.size()) ? "},\n" : "}\n");
+	}
+	os << "\t]\n";
+	os << "}\n";
+}
+
+
+int main(int argc, char **argv)
+{
+	BenchmarkConfig config;
+	string filter, outFile = "CaptureBenchmark.json";
+	for(int i=1; i<argc; i++)
+	{
+		const string arg = argv[i];
+		const char *pValue = (i+1 < argc) ? argv[i+1] : NULL;
+		if(!pValue)
+		{
+			cerr << "missing value for " << arg << endl;
+			return 1;
+		}
+		i++;
+		if(arg == "--frames")
+		{
+			config.m_frames = atoi(pValue);
+		}
+		else if(arg == "--width")
+		{
+			config.m_width = atoi(pValue);
+		}
+		else if(arg == "--height")
+		{
+			config.m_height = atoi(pValue);
+		}
+		else if(arg == "--images")
+		{
+			config.m_images = atoi(pValue);
+		}
+		else if(arg == "--format")
+		{
+			config.m_format = pValue;
+			if(config.m_format == "16U")
+			{
+				config.m_type = CV_16U;
+			}
+			else if(config.m_format == "8U")
+			{
+				config.m_type = CV_8U;
+			}
+			else if(config.m_format == "8UC3")
+			{
+				config.m_type = CV_8UC3;
+			}
+			else
+			{
+				cerr << "unknown format " << pValue << endl;
+				return 1;
+			}
+		}
+		else if(arg == "--dir")
+		{
+			config.m_dir = pValue;
+		}
+		else if(arg == "--filter")
+		{
+			filter = pValue;
+		}
+		else if(arg == "--out")
+		{
+			outFile = pValue;
+		}
+		else
+		{
+			cerr << "unknown option " << arg << endl;
+			return 1;
+		}
+	}
+
+	vector<BenchmarkResult> results;
+	try
+	{
+		for(size_t i=0; i<sizeof(s_cases)/sizeof(s_cases[0]); i++)
+		{
+			if(!filter.empty() && strstr(s_cases[i].m_name,filter.c_str()) == NULL)
+			{
+				continue;
+			}
+			cerr << "running " << s_cases[i].m_name << endl;
+			BenchmarkResult result;
+			result.m_name = s_cases[i].m_name;
+			s_cases[i].m_run(config,result);
+			results.push_back(result);
+		}
+	}
+	catch(const char *pMsg)
+	{
+		cerr << pMsg << endl;
+		return 1;
+	}
+
+	ofstream ofs(outFile.c_str());
+	if(!ofs)
+	{
+		cerr << "cannot open " << outFile << endl;
+		return 1;
+	}
+	WriteJson(ofs,config,results);
+	cerr << "results written to " << outFile << endl;
+	return 0;
+}
@@ -0,0 +1,311 @@
+/* *
+	MetricsBenchmark.cpp
+		Cost of updating the metrics of the registry, from one and from
+		several threads, against one atomic shared by all the threads
+
+		usage: MetricsBenchmark [--ops N] [--filter SUBSTRING] [--out FILE.json]
+
+		The results are written as JSON (MetricsBenchmark.json by default),
+		one entry per case, like CaptureBenchmark.
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <atomic>
+
+#include "Metrics.h"
+#include "LatencyTracker.h"
+
+using namespace std;
+using namespace rm;
+
+
+/******************************/
+/* Configuration and results  */
+/******************************/
+
+struct BenchmarkConfig
+{
+	int				m_ops;		//updates per thread
+
+	BenchmarkConfig():m_ops(10000000)
+	{
+	}
+};
+
+struct BenchmarkResult
+{
+	string			m_name;
+	int				m_threads;
+	long long		m_ops;		//all threads
+	double			m_seconds;
+	bool			m_correct;	//the metric holds what was added
+
+	BenchmarkResult():m_threads(0),m_ops(0),m_seconds(0),m_correct(true)
+	{
+	}
+};
+
+typedef void (*BenchmarkFunc)(const BenchmarkConfig &config, BenchmarkResult &result);
+
+struct BenchmarkCase
+{
+	const char		*m_name;
+	BenchmarkFunc	m_run;
+};
+
+
+/******************************/
+/* Helpers                    */
+/******************************/
+
+//
+//Run body(ops) on numThreads threads started together, time from the start to the last one done
+template<class Body>
+static void RunThreads(const BenchmarkConfig &config, const int numThreads, Body body, BenchmarkResult &result)
+{
+	atomic<int> ready(0);
+	atomic<bool> go(false);
+	vector<thread> threads;
+	for(int t=0; t<numThreads; t++)
+	{
+		threads.push_back(thread([&]
+		{
+			ready++;
+			while(!go.load())
+			{
+				this_thread::yield();
+			}
+			body(config.m_ops);
+		}));
+	}
+	while(ready.load() < numThreads)
+	{
+		this_thread::yield();
+	}
+	const long long start = MonotonicNanoseconds();
+	go = true;
+	for(size_t t=0; t<threads.size(); t++)
+	{
+		threads[t].join();
+	}
+	result.m_seconds = (MonotonicNanoseconds() - start)*1e-9;
+	result.m_threads = numThreads;
+	result.m_ops = (long long)numThreads*config.m_ops;
+}
+
+//
+//What the metrics replace: one counter shared by every thread
+static void SharedAtomic(const BenchmarkConfig &config, const int numThreads, BenchmarkResult &result)
+{
+	atomic<long long> counter(0);
+	RunThreads(config,numThreads,[&](const int ops)
+	{
+		for(int i=0; i<ops; i++)
+		{
+			counter.fetch_add(1,memory_order_relaxed);
+		}
+	},result);
+	result.m_correct = (counter.load() == result.m_ops);
+}
+
+static void Counter(const BenchmarkConfig &config, const int numThreads, BenchmarkResult &result)
+{
+	MetricsRegistry registry;
+	MetricCounter &counter = registry.Counter("benchmark.counter");
+	RunThreads(config,numThreads,[&](const int ops)
+	{
+		for(int i=0; i<ops; i++)
+		{
+			counter.Add();
+		}
+	},result);
+	result.m_correct = (counter.Value() == result.m_ops);
+}
+
+static void Gauge(const BenchmarkConfig &config, const int numThreads, BenchmarkResult &result)
+{
+	MetricsRegistry registry;
+	MetricGauge &gauge = registry.Gauge("benchmark.gauge");
+	RunThreads(config,numThreads,[&](const int ops)
+	{
+		for(int i=0; i<ops; i++)
+		{
+			gauge.Add(1);
+			gauge.Add(-1);
+		}
+	},result);
+	result.m_correct = (gauge.Value() == 0 && gauge.Max() >= 1 && gauge.Max() <= numThreads);
+}
+
+//
+//A timed section as SetLock has: two clock reads and a record
+static void TimedHistogram(const BenchmarkConfig &config, const int numThreads, BenchmarkResult &result)
+{
+	MetricsRegistry registry;
+	MetricHistogram &histogram = registry.Histogram("benchmark.histogramNs");
+	RunThreads(config,numThreads,[&](const int ops)
+	{
+		for(int i=0; i<ops; i++)
+		{
+			const long long before = MonotonicNanoseconds();
+			histogram.Record(MonotonicNanoseconds() - before);
+		}
+	},result);
+	result.m_correct = (histogram.Summary().m_count == result.m_ops);
+}
+
+//
+//Counters updated while the dump thread takes a snapshot every millisecond
+static void CounterWhileDumping(const BenchmarkConfig &config, const int numThreads, BenchmarkResult &result)
+{
+	MetricsRegistry registry;
+	MetricCounter &counter = registry.Counter("benchmark.counter");
+	registry.StartDump("MetricsBenchmark.dump.json",1);
+	RunThreads(config,numThreads,[&](const int ops)
+	{
+		for(int i=0; i<ops; i++)
+		{
+			counter.Add();
+		}
+	},result);
+	registry.StopDump();
+	remove("MetricsBenchmark.dump.json");
+	result.m_correct = (counter.Value() == result.m_ops);
+}
+
+
+/******************************/
+/* Cases                      */
+/******************************/
+
+static void BenchSharedAtomic1(const BenchmarkConfig &config, BenchmarkResult &result) { SharedAtomic(config,1,result); }
+static void BenchSharedAtomic4(const BenchmarkConfig &config, BenchmarkResult &result) { SharedAtomic(config,4,result); }
+static void BenchSharedAtomic8(const BenchmarkConfig &config, BenchmarkResult &result) { SharedAtomic(config,8,result); }
+static void BenchCounter1(const BenchmarkConfig &config, BenchmarkResult &result) { Counter(config,1,result); }
+static void BenchCounter4(const BenchmarkConfig &config, BenchmarkResult &result) { Counter(config,4,result); }
+static void BenchCounter8(const BenchmarkConfig &config, BenchmarkResult &result) { Counter(config,8,result); }
+static void BenchGauge1(const BenchmarkConfig &config, BenchmarkResult &result) { Gauge(config,1,result); }
+static void BenchGauge4(const BenchmarkConfig &config, BenchmarkResult &result) { Gauge(config,4,result); }
+static void BenchHistogram1(const BenchmarkConfig &config, BenchmarkResult &result) { TimedHistogram(config,1,result); }
+static void BenchHistogram4(const BenchmarkConfig &config, BenchmarkResult &result) { TimedHistogram(config,4,result); }
+static void BenchCounterDump4(const BenchmarkConfig &config, BenchmarkResult &result) { CounterWhileDumping(config,4,result); }
+
+static const BenchmarkCase s_cases[] =
+{
+	{"shared_atomic_1thread",BenchSharedAtomic1},
+	{"shared_atomic_4threads",BenchSharedAtomic4},
+	{"shared_atomic_8threads",BenchSharedAtomic8},
+	{"counter_1thread",BenchCounter1},
+	{"counter_4threads",BenchCounter4},
+	{"counter_8threads",BenchCounter8},
+	{"gauge_1thread",BenchGauge1},
+	{"gauge_4threads",BenchGauge4},
+	{"timed_histogram_1thread",BenchHistogram1},
+	{"timed_histogram_4threads",BenchHistogram4},
+	{"counter_dump_4threads",BenchCounterDump4}
+};
+
+
+/******************************/
+/* Report                     */
+/******************************/
+
+static void WriteJson(ostream &os, const BenchmarkConfig &config, const vector<BenchmarkResult> &results)
+{
+	char buffer[512];
+	os << "{\n";
+	os << "\t\"benchmark\": \"metrics\",\n";
+	sprintf(buffer,"\t\"config\": {\"ops\": %d},\n",config.m_ops);
+	os << buffer;
+	os << "\t\"results\": [\n";
+	for(size_t i=0; i<results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		//per thread: what an instrumented thread pays for one update
+		const double nsPerOp = r.m_ops > 0 ? r.m_seconds*1e9*r.m_threads / r.m_ops : 0;
+		sprintf(buffer,"\t\t{\"name\": \"%s\", \"threads\": %d, \"ops\": %lld, \"seconds\": %.6f, \"nsPerOp\": %.2f, \"correct\": %s",
+			r.m_name.c_str(),r.m_threads,r.m_ops,r.m_seconds,nsPerOp,r.m_correct ? "true" : "false");
+		os << buffer;
+		os << ((i+1 < results.size()) ? "},\n" : "}\n");
+	}
+	os << "\t]\n";
+	os << "}\n";
+}
+
+
+int main(int argc, char **argv)
+{
+	BenchmarkConfig config;
+	string filter, outFile = "MetricsBenchmark.json";
+	for(int i=1; i<argc; i++)
+	{
+		const string arg = argv[i];
+		const char *pValue = (i+1 < argc) ? argv[i+1] : NULL;
+		if(!pValue)
+		{
+			cerr << "missing value for " << arg << endl;
+			return 1;
+		}
+		i++;
+		if(arg == "--ops")
+		{
+			config.m_ops = atoi(pValue);
+		}
+		else if(arg == "--filter")
+		{
+			filter = pValue;
+		}
+		else if(arg == "--out")
+		{
+			outFile = pValue;
+		}
+		else
+		{
+			cerr << "unknown option " << arg << endl;
+			return 1;
+		}
+	}
+
+	vector<BenchmarkResult> results;
+	try
+	{
+		for(size_t i=0; i<sizeof(s_cases)/sizeof(s_cases[0]); i++)
+		{
+			if(!filter.empty() && strstr(s_cases[i].m_name,filter.c_str()) == NULL)
+			{
+				continue;
+			}
+			cerr << "running " << s_cases[i].m_name << endl;
+			BenchmarkResult result;
+			result.m_name = s_cases[i].m_name;
+			s_cases[i].m_run(config,result);
+			results.push_back(result);
+		}
+	}
+	catch(const char *pMsg)
+	{
+		cerr << pMsg << endl;
+		return 1;
+	}
+
+	ofstream ofs(outFile.c_str());
+	if(!ofs)
+	{
+		cerr << "cannot open " << outFile << endl;
+		return 1;
+	}
+	WriteJson(ofs,config,results);
+	cerr << "results written to " << outFile << endl;
+	return 0;
+}
@@ -0,0 +1,273 @@
+/* *
+	PathSimplifierBenchmark.cpp
+		Speed and compression of PathSimplifier on large synthetic paths
+
+		usage: PathSimplifierBenchmark [--poses N] [--position M] [--rotation RAD]
+				[--blend M] [--filter SUBSTRING] [--out FILE.json]
+
+		The results are written as JSON (PathSimplifierBenchmark.json by default),
+		one entry per path, like CaptureBenchmark.
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "PathSimplifier.h"
+#include "TrajectoryStreamer.h"
+#include "LatencyTracker.h"
+
+using namespace std;
+using namespace rm;
+
+
+/******************************/
+/* Configuration and results  */
+/******************************/
+
+struct BenchmarkConfig
+{
+	int				m_poses;		//poses per path
+	float			m_position;		//tolerance, m
+	float			m_rotation;		//tolerance, rad
+	float			m_blend;		//blend radius, m
+
+	BenchmarkConfig():m_poses(1000000),m_position(0.0002f),m_rotation(0.002f),m_blend(0.001f)
+	{
+	}
+};
+
+struct BenchmarkResult
+{
+	string			m_name;
+	PathStatistics	m_statistics;
+	double			m_seconds;
+	long long		m_denseBytes;		//movel text of the dense path
+	long long		m_simplifiedBytes;	//movel text of the simplified path, with blend radii
+};
+
+typedef void (*PathFunc)(const BenchmarkConfig &config, vector<RobotPose> &path);
+
+struct BenchmarkCase
+{
+	const char		*m_name;
+	PathFunc		m_make;
+};
+
+
+/******************************/
+/* Paths                      */
+/******************************/
+
+//
+//Uniform noise in [-amplitude, amplitude], reproducible
+static float Noise(unsigned int &state, const float amplitude)
+{
+	state = state*1664525u + 1013904223u;
+	return amplitude*((state >> 8)*(2.0f/16777216.0f) - 1.0f);
+}
+
+//
+//A straight move sampled every 0.05mm, with jitter well below the tolerance
+static void MakeLine(const BenchmarkConfig &config, vector<RobotPose> &path)
+{
+	unsigned int state = 1;
+	path.resize(config.m_poses);
+	for(int i=0; i<config.m_poses; i++)
+	{
+		const float s = i*0.00005f;
+		RobotPose pose = {0.3f + s*0.8f + Noise(state,0.00001f),-0.2f + s*0.6f + Noise(state,0.00001f),0.4f,0,3.14159f,0};
+		path[i] = pose;
+	}
+}
+
+//
+//A helix (radius 50mm, 10mm per turn) sampled every 0.1mm, the tool turning about z
+static void MakeHelix(const BenchmarkConfig &config, vector<RobotPose> &path)
+{
+	path.resize(config.m_poses);
+	const double step = 0.0001/0.05;	//rad per pose
+	for(int i=0; i<config.m_poses; i++)
+	{
+		const double angle = i*step;
+		RobotPose pose = {(float)(0.4 + 0.05*cos(angle)),(float)(0.05*sin(angle)),(float)(0.2 + 0.01*angle/(2*M_PI)),
+			0,3.14159f,(float)(0.1*sin(0.05*angle))};
+		path[i] = pose;
+	}
+}
+
+//
+//The helix with noise of a quarter of the tolerance, like a recorded or tracked path
+static void MakeNoisyHelix(const BenchmarkConfig &config, vector<RobotPose> &path)
+{
+	MakeHelix(config,path);
+	unsigned int state = 7;
+	for(size_t i=0; i<path.size(); i++)
+	{
+		path[i].m_x += Noise(state,0.25f*config.m_position);
+		path[i].m_y += Noise(state,0.25f*config.m_position);
+		path[i].m_z += Noise(state,0.25f*config.m_position);
+		path[i].m_rz += Noise(state,0.25f*config.m_rotation);
+	}
+}
+
+//
+//A serpentine scan of a 200mm wide area, 2mm between the lines, sampled every 0.1mm
+static void MakeRaster(const BenchmarkConfig &config, vector<RobotPose> &path)
+{
+	path.resize(config.m_poses);
+	const int perLine = 2000;
+	for(int i=0; i<config.m_poses; i++)
+	{
+		const int line = i/perLine;
+		const int k = i%perLine;
+		const float along = 0.0001f*((line & 1) ? perLine - 1 - k : k);
+		RobotPose pose = {0.3f + along,-0.1f + 0.002f*(line%100),0.25f,0,3.14159f,0};
+		path[i] = pose;
+	}
+}
+
+static const BenchmarkCase s_cases[] =
+{
+	{"line",MakeLine},
+	{"helix",MakeHelix},
+	{"noisy_helix",MakeNoisyHelix},
+	{"raster",MakeRaster}
+};
+
+
+/******************************/
+/* Run and report             */
+/******************************/
+
+static long long EncodedBytes(const vector<RobotPose> &poses, const vector<float> *pBlendRadii)
+{
+	char buffer[MAX_MOVEL_LENGTH];
+	long long bytes = 0;
+	for(size_t i=0; i<poses.size(); i++)
+	{
+		bytes += EncodeMoveL(buffer,poses[i],1.2f,0.25f,6,pBlendRadii ? (*pBlendRadii)[i] : 0);
+	}
+	return bytes;
+}
+
+static void Run(const BenchmarkConfig &config, const BenchmarkCase &theCase, BenchmarkResult &result)
+{
+	vector<RobotPose> path, poses;
+	vector<float> radii;
+	theCase.m_make(config,path);
+
+	PathSimplifier simplifier;
+	simplifier.SetTolerance(config.m_position,config.m_rotation);
+	simplifier.SetBlendRadius(config.m_blend);
+	const long long start = MonotonicNanoseconds();
+	simplifier.Simplify(path,poses,radii);
+	result.m_seconds = (MonotonicNanoseconds() - start)*1e-9;
+	result.m_statistics = simplifier.Statistics();
+	result.m_denseBytes = EncodedBytes(path,NULL);
+	result.m_simplifiedBytes = EncodedBytes(poses,&radii);
+}
+
+static void WriteJson(ostream &os, const BenchmarkConfig &config, const vector<BenchmarkResult> &results)
+{
+	char buffer[1024];
+	os << "{\n";
+	os << "\t\"benchmark\": \"path_simplifier\",\n";
+	sprintf(buffer,"\t\"config\": {\"poses\": %d, \"positionTolerance\": %g, \"rotationTolerance\": %g, \"blendRadius\": %g},\n",
+		config.m_poses,config.m_position,config.m_rotation,config.m_blend);
+	os << buffer;
+	os << "\t\"results\": [\n";
+	for(size_t i=0; i<results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		const PathStatistics &s = r.m_statistics;
+		sprintf(buffer,"\t\t{\"name\": \"%s\", \"inputPoses\": %d, \"outputPoses\": %d, \"compressionRatio\": %.1f, "
+			"\"maxPositionDeviation\": %.7f, \"maxRotationDeviation\": %.7f, \"seconds\": %.6f, \"posesPerSec\": %.0f, "
+			"\"denseBytes\": %lld, \"simplifiedBytes\": %lld}",
+			r.m_name.c_str(),s.m_inputPoses,s.m_outputPoses,s.m_compressionRatio,s.m_maxPositionDeviation,s.m_maxRotationDeviation,
+			r.m_seconds,r.m_seconds > 0 ? s.m_inputPoses/r.m_seconds : 0,r.m_denseBytes,r.m_simplifiedBytes);
+		os << buffer << ((i+1 < results.size()) ? ",\n" : "\n");
+	}
+	os << "\t]\n";
+	os << "}\n";
+}
+
+
+int main(int argc, char **argv)
+{
+	BenchmarkConfig config;
+	string filter, outFile = "PathSimplifierBenchmark.json";
+	for(int i=1; i<argc; i++)
+	{
+		const string arg = argv[i];
+		const char *pValue = (i+1 < argc) ? argv[i+1] : NULL;
+		if(!pValue)
+		{
+			cerr << "missing value for " << arg << endl;
+			return 1;
+		}
+		i++;
+		if(arg == "--poses")
+		{
+			config.m_poses = atoi(pValue);
+		}
+		else if(arg == "--position")
+		{
+			config.m_position = (float)atof(pValue);
+		}
+		else if(arg == "--rotation")
+		{
+			config.m_rotation = (float)atof(pValue);
+		}
+		else if(arg == "--blend")
+		{
+			config.m_blend = (float)atof(pValue);
+		}
+		else if(arg == "--filter")
+		{
+			filter = pValue;
+		}
+		else if(arg == "--out")
+		{
+			outFile = pValue;
+		}
+		else
+		{
+			cerr << "unknown option " << arg << endl;
+			return 1;
+		}
+	}
+
+	vector<BenchmarkResult> results;
+	for(size_t i=0; i<sizeof(s_cases)/sizeof(s_cases[0]); i++)
+	{
+		if(!filter.empty() && strstr(s_cases[i].m_name,filter.c_str()) == NULL)
+		{
+			continue;
+		}
+		cerr << "running " << s_cases[i].m_name << endl;
+		BenchmarkResult result;
+		result.m_name = s_cases[i].m_name;
+		Run(config,s_cases[i],result);
+		results.push_back(result);
+	}
+
+	ofstream ofs(outFile.c_str());
+	if(!ofs)
+	{
+		cerr << "cannot open " << outFile << endl;
+		return 1;
+	}
+	WriteJson(ofs,config,results);
+	cerr << "results written to " << outFile << endl;
+	return 0;
+}
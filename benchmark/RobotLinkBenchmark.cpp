@@ -0,0 +1,359 @@
+/* *
+	RobotLinkBenchmark.cpp
+		Round trip latency and command rate of the robot link, against
+		RobotSimulator on the loopback interface so that no robot is needed
+
+		usage: RobotLinkBenchmark [--commands N] [--roundtrips N]
+				[--filter SUBSTRING] [--out FILE.json]
+
+		The results are written as JSON (RobotLinkBenchmark.json by default),
+		one entry per case, like CaptureBenchmark.
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+		Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+#include "RobotSocket.h"
+#include "RobotSimulator.h"
+#include "RobotLink.h"
+#include "RobotStateReceiver.h"
+#include "TrajectoryStreamer.h"
+#include "LatencyTracker.h"
+
+using namespace std;
+using namespace rm;
+
+
+/******************************/
+/* Configuration and results  */
+/******************************/
+
+struct BenchmarkConfig
+{
+	int				m_commands;		//commands per streaming case
+	int				m_roundTrips;
+
+	BenchmarkConfig():m_commands(20000),m_roundTrips(2000)
+	{
+	}
+};
+
+struct BenchmarkResult
+{
+	string			m_name;
+	long long		m_commands;
+	double			m_seconds;
+	bool			m_hasLatency;
+	LatencySummary	m_latency;
+
+	BenchmarkResult():m_commands(0),m_seconds(0),m_hasLatency(false)
+	{
+		memset(&m_latency,0,sizeof(m_latency));
+	}
+};
+
+typedef void (*BenchmarkFunc)(const BenchmarkConfig &config, BenchmarkResult &result);
+
+struct BenchmarkCase
+{
+	const char		*m_name;
+	BenchmarkFunc	m_run;
+};
+
+
+/******************************/
+/* Helpers                    */
+/******************************/
+
+static vector<RobotPose> MakePath(const int count)
+{
+	vector<RobotPose> path(count);
+	for(int i=0; i<count; i++)
+	{
+		const float t = i*1e-4f;
+		RobotPose pose = {0.5f + t,-0.12f + 0.5f*t,0.41f,0.0877f,2.677f,-0.116f};
+		path[i] = pose;
+	}
+	return path;
+}
+
+static SOCKET ConnectTo(const RobotSimulator &simulator)
+{
+	SOCKET theSocket = ConnectSocket("127.0.0.1",simulator.Port(),1000);
+	if(theSocket == INVALID_SOCKET)
+	{
+		throw("RobotLinkBenchmark: failed to connect to the simulator");
+	}
+	return theSocket;
+}
+
+//
+//Wait until the simulator executed count moves (commands without acknowledgment)
+static void WaitForMoves(const RobotSimulator &simulator, const long long count)
+{
+	const long long deadline = MonotonicNanoseconds() + 30000000000LL;
+	while(simulator.MovesReceived() < count)
+	{
+		if(MonotonicNanoseconds() > deadline)
+		{
+			throw("RobotLinkBenchmark: the simulator did not receive all the commands");
+		}
+		this_thread::yield();
+	}
+}
+
+static void StreamWithAcks(const BenchmarkConfig &config, const int window, BenchmarkResult &result)
+{
+	RobotSimulator simulator;
+	simulator.Start();
+	SOCKET theSocket = ConnectTo(simulator);
+	const vector<RobotPose> path = MakePath(config.m_commands);
+	TrajectoryStreamer streamer(theSocket,TrajectoryStreamer::ACK_LINE,window);
+	const long long start = MonotonicNanoseconds();
+	if(streamer.SendTrajectory(path) != NETWORK_OK || streamer.Drain() != NETWORK_OK)
+	{
+		CloseSocket(theSocket);
+		throw("RobotLinkBenchmark: streaming failed");
+	}
+	result.m_seconds = (MonotonicNanoseconds() - start)*1e-9;
+	result.m_commands = streamer.CommandsAcked();
+	CloseSocket(theSocket);
+}
+
+static void StreamWithoutAcks(const BenchmarkConfig &config, const int window, BenchmarkResult &result)
+{
+	RobotSimulator simulator;
+	simulator.Start();
+	SOCKET theSocket = ConnectTo(simulator);
+	const vector<RobotPose> path = MakePath(config.m_commands);
+	TrajectoryStreamer streamer(theSocket,TrajectoryStreamer::ACK_NONE,window);
+	const long long start = MonotonicNanoseconds();
+	if(streamer.SendTrajectory(path) != NETWORK_OK)
+	{
+		CloseSocket(theSocket);
+		throw("RobotLinkBenchmark: streaming failed");
+	}
+	WaitForMoves(simulator,config.m_commands);
+	result.m_seconds = (MonotonicNanoseconds() - start)*1e-9;
+	result.m_commands = simulator.MovesReceived();
+	CloseSocket(theSocket);
+}
+
+
+/******************************/
+/* Cases                      */
+/******************************/
+
+//
+//One movel, wait for its acknowledgment, repeat
+static void BenchRoundTrip(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	RobotSimulator simulator;
+	simulator.Start();
+	SOCKET theSocket = ConnectTo(simulator);
+	const vector<RobotPose> path = MakePath(config.m_roundTrips);
+	TrajectoryStreamer streamer(theSocket,TrajectoryStreamer::ACK_LINE,1);
+	LatencyHistogram histogram;
+	const long long start = MonotonicNanoseconds();
+	for(int i=0; i<config.m_roundTrips; i++)
+	{
+		const long long sent = MonotonicNanoseconds();
+		if(streamer.SendTrajectory(&path[i],1) != NETWORK_OK || streamer.Drain() != NETWORK_OK)
+		{
+			CloseSocket(theSocket);
+			throw("RobotLinkBenchmark: round trip failed");
+		}
+		histogram.Record(MonotonicNanoseconds() - sent);
+	}
+	result.m_seconds = (MonotonicNanoseconds() - start)*1e-9;
+	result.m_commands = config.m_roundTrips;
+	result.m_hasLatency = true;
+	result.m_latency = histogram.Summary();
+	CloseSocket(theSocket);
+}
+
+static void BenchAckWindow1(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamWithAcks(config,1,result);
+}
+
+static void BenchAckWindow8(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamWithAcks(config,8,result);
+}
+
+static void BenchAckWindow32(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamWithAcks(config,32,result);
+}
+
+static void BenchAckWindow128(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamWithAcks(config,128,result);
+}
+
+//
+//One send per command, what sendCoordinates does (without its printing)
+static void BenchNoAckPerCommand(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamWithoutAcks(config,1,result);
+}
+
+static void BenchNoAckBatched(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	StreamWithoutAcks(config,64,result);
+}
+
+//
+//Pose feedback at 500Hz through RobotLink into RobotStateReceiver, for one second
+static void BenchStateFeedback(const BenchmarkConfig &/*config: the simulator sets the rate*/, BenchmarkResult &result)
+{
+	RobotSimulator simulator;
+	simulator.SetFeedbackRate(500);
+	simulator.Start();
+	RobotStateReceiver receiver(INVALID_SOCKET,100);
+	RobotLink link;
+	link.SetDataHandler([&](const char *pData, const int size){ receiver.Feed(pData,size); });
+	link.Start("127.0.0.1",simulator.Port());
+	while(!link.IsConnected())
+	{
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+	const long long before = receiver.MessagesParsed();
+	const long long start = MonotonicNanoseconds();
+	this_thread::sleep_for(chrono::seconds(1));
+	result.m_seconds = (MonotonicNanoseconds() - start)*1e-9;
+	result.m_commands = receiver.MessagesParsed() - before;
+	link.Stop();
+}
+
+static const BenchmarkCase s_cases[] =
+{
+	{"round_trip",BenchRoundTrip},
+	{"stream_ack_window1",BenchAckWindow1},
+	{"stream_ack_window8",BenchAckWindow8},
+	{"stream_ack_window32",BenchAckWindow32},
+	{"stream_ack_window128",BenchAckWindow128},
+	{"stream_noack_per_command",BenchNoAckPerCommand},
+	{"stream_noack_batched",BenchNoAckBatched},
+	{"state_feedback",BenchStateFeedback}
+};
+
+
+/******************************/
+/* Report                     */
+/******************************/
+
+static void WriteJson(ostream &os, const BenchmarkConfig &config, const vector<BenchmarkResult> &results)
+{
+	char buffer[512];
+	os << "{\n";
+	os << "\t\"benchmark\": \"robot_link\",\n";
+	sprintf(buffer,"\t\"config\": {\"commands\": %d, \"roundTrips\": %d},\n",config.m_commands,config.m_roundTrips);
+	os << buffer;
+	os << "\t\"results\": [\n";
+	for(size_t i=0; i<results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		const double rate = r.m_seconds > 0 ? r.m_commands / r.m_seconds : 0;
+		sprintf(buffer,"\t\t{\"name\": \"%s\", \"commands\": %lld, \"seconds\": %.6f, \"commandsPerSec\": %.1f",
+			r.m_name.c_str(),r.m_commands,r.m_seconds,rate);
+		os << buffer;
+		if(r.m_hasLatency)
+		{
+			sprintf(buffer,", \"latencyUs\": {\"stage\": \"roundTrip\", \"count\": %lld, \"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+				r.m_latency.m_count,r.m_latency.m_mean*1e-3,r.m_latency.m_p50*1e-3,r.m_latency.m_p99*1e-3,r.m_latency.m_max*1e-3);
+			os << buffer;
+		}
+		os << ((i+1 < results.size()) ? "},\n" : "}\n");
+	}
+	os << "\t]\n";
+	os << "}\n";
+}
+
+
+int main(int argc, char **argv)
+{
+	BenchmarkConfig config;
+	string filter, outFile = "RobotLinkBenchmark.json";
+	for(int i=1; i<argc; i++)
+	{
+		const string arg = argv[i];
+		const char *pValue = (i+1 < argc) ? argv[i+1] : NULL;
+		if(!pValue)
+		{
+			cerr << "missing value for " << arg << endl;
+			return 1;
+		}
+		i++;
+		if(arg == "--commands")
+		{
+			config.m_commands = atoi(pValue);
+		}
+		else if(arg == "--roundtrips")
+		{
+			config.m_roundTrips = atoi(pValue);
+		}
+		else if(arg == "--filter")
+		{
+			filter = pValue;
+		}
+		else if(arg == "--out")
+		{
+			outFile = pValue;
+		}
+		else
+		{
+			cerr << "unknown option " << arg << endl;
+			return 1;
+		}
+	}
+
+	if(!SocketStartup())
+	{
+		cerr << "failed to initialize the sockets" << endl;
+		return 1;
+	}
+	vector<BenchmarkResult> results;
+	try
+	{
+		for(size_t i=0; i<sizeof(s_cases)/sizeof(s_cases[0]); i++)
+		{
+			if(!filter.empty() && strstr(s_cases[i].m_name,filter.c_str()) == NULL)
+			{
+				continue;
+			}
+			cerr << "running " << s_cases[i].m_name << endl;
+			BenchmarkResult result;
+			result.m_name = s_cases[i].m_name;
+			s_cases[i].m_run(config,result);
+			results.push_back(result);
+		}
+	}
+	catch(const char *pMsg)
+	{
+		cerr << pMsg << endl;
+		return 1;
+	}
+
+	ofstream ofs(outFile.c_str());
+	if(!ofs)
+	{
+		cerr << "cannot open " << outFile << endl;
+		return 1;
+	}
+	WriteJson(ofs,config,results);
+	cerr << "results written to " << outFile << endl;
+	return 0;
+}
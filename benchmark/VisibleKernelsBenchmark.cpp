@@ -0,0 +1,559 @@
+/* *
+	VisibleKernelsBenchmark.cpp
+		Byte equality and speed of the 8-bit VisibleDepth, VisibleDepthRGB
+		and VisibleIr kernels against the loops of the Camera.h templates,
+		on every instruction set the CPU supports
+
+		usage: VisibleKernelsBenchmark [--iterations N] [--width W] [--height H]
+				[--maxdepth D] [--filter SUBSTRING] [--out FILE.json]
+
+		The verify_* cases compare the kernels with the template loops on
+		odd sizes and vector tails, with source and destination pointers
+		off the vector alignment. The other cases time one frame.
+		The results are written as JSON (VisibleKernelsBenchmark.json by
+		default), one entry per case, like CaptureBenchmark.
+
+	Authors: Ricky Mason(ricky.mason@uky.edu)
+        Department of Electrical and Computer Engineering
+		University of Kentucky
+* */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "Camera.h"
+#include "VisibleKernels.h"
+#include "LatencyTracker.h"
+
+using namespace std;
+using namespace rm;
+
+
+/******************************/
+/* Configuration and results  */
+/******************************/
+
+struct BenchmarkConfig
+{
+	int				m_iterations;
+	int				m_width;
+	int				m_height;
+	double			m_maxDepth;
+
+	BenchmarkConfig():m_iterations(200),m_width(640),m_height(480),m_maxDepth(5.0*1000)
+	{
+	}
+
+	int Size() const { return m_width*m_height; }
+};
+
+struct BenchmarkResult
+{
+	string			m_name;
+	string			m_isa;		//instruction set the kernels ran on
+	long long		m_pixels;	//all iterations
+	double			m_seconds;
+	bool			m_skipped;	//the CPU does not support the instruction set
+	bool			m_correct;	//same bytes as the template loops
+	int				m_checks;	//compared buffers (verify cases)
+
+	BenchmarkResult():m_pixels(0),m_seconds(0),m_skipped(false),m_correct(true),m_checks(0)
+	{
+	}
+};
+
+typedef void (*BenchmarkFunc)(const BenchmarkConfig &config, BenchmarkResult &result);
+
+struct BenchmarkCase
+{
+	const char		*m_name;
+	BenchmarkFunc	m_run;
+};
+
+
+/******************************/
+/* Reference loops            */
+/******************************/
+
+//The bodies of the VisibleDepth, VisibleDepthRGB and VisibleIr templates of Camera.h,
+//the 8-bit instantiations of which are now the specialized kernels
+
+static void RefVisibleDepth(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+{
+	for(int i=0; i<size; i++)
+	{
+		pVisibleDepth[i] = static_cast<unsigned char>( (/*1 - */pDepth[i]/maxDepth) * 255.0);
+	}
+}
+
+static void RefVisibleDepthRGB(const uInt16 *pDepth, unsigned char *pVisibleDepth, const int size, const double maxDepth)
+{
+	for(int i=0; i<size; i++)
+	{
+		const unsigned char &val = static_cast<unsigned char>( (/*1 - */pDepth[i]/maxDepth) * 255.0);
+		pVisibleDepth[3*i] = pVisibleDepth[3*i+1] = pVisibleDepth[3*i+2] = val;
+	}
+}
+
+static void RefVisibleIr(const uInt16 *pIr, unsigned char *pVisibleIr, const int size)
+{
+	for(int i=0; i<size; i++)
+	{
+		pVisibleIr[i] = static_cast<unsigned char>( pIr[i] >> 1);
+	}
+}
+
+
+/******************************/
+/* Helpers                    */
+/******************************/
+
+static const char* IsaName(const VisibleKernelIsa isa)
+{
+	switch(isa)
+	{
+	case VISIBLE_ISA_AVX2:
+		return "avx2";
+	case VISIBLE_ISA_SSE41:
+		return "sse41";
+	default:
+		return "scalar";
+	}
+}
+
+//
+//Select the instruction set of a case, false if the CPU does not have it
+static bool UseIsa(const VisibleKernelIsa isa, BenchmarkResult &result)
+{
+	SetVisibleKernelIsa(isa);
+	result.m_isa = IsaName(ActiveVisibleKernelIsa());
+	result.m_skipped = (ActiveVisibleKernelIsa() != isa);
+	return !result.m_skipped;
+}
+
+//
+//A depth map of a scene between 0.5 and 6 m, with some pixels above maxDepth and some at 0
+static void MakeDepth(const int size, const double maxDepth, vector<uInt16> &depth)
+{
+	depth.resize(size);
+	srand(12345);
+	const int range = (int)(maxDepth*1.2) + 1;
+	for(int i=0; i<size; i++)
+	{
+		depth[i] = (uInt16)((i % 97 == 0) ? 0 : 500 + rand() % range);
+	}
+}
+
+//
+//Time body() over the iterations of the config
+template<class Body>
+static void Time(const BenchmarkConfig &config, Body body, BenchmarkResult &result)
+{
+	body();	//warm up the caches and the worker pool
+	const long long start = MonotonicNanoseconds();
+	for(int it=0; it<config.m_iterations; it++)
+	{
+		body();
+	}
+	result.m_seconds = (MonotonicNanoseconds() - start)*1e-9;
+	result.m_pixels = (long long)config.m_iterations*config.Size();
+}
+
+//
+//Compare the kernels of the active instruction set with the reference loops
+//on all sizes up to a few vectors and on a long run, for every source and destination misalignment
+static void VerifyKernels(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	//every uint16 value once, then random values, then a tail
+	const int longSize = 65536 + 4099;
+	vector<uInt16> depth(longSize + 8);
+	srand(54321);
+	for(size_t i=0; i<depth.size(); i++)
+	{
+		depth[i] = (uInt16)(i < 65536 ? i : rand() & 0xffff);
+	}
+	const double maxDepths[] = {config.m_maxDepth, 1000.0, 4096.0, 65535.0, 3.7, 12345.678};
+	const int numMaxDepths = (int)(sizeof(maxDepths)/sizeof(maxDepths[0]));
+	vector<int> sizes;
+	for(int size=1; size<=3*32+5; size++)
+	{
+		sizes.push_back(size);
+	}
+	sizes.push_back(config.m_width | 1);	//an odd row
+	sizes.push_back(longSize);
+
+	//the destinations start at offsets 0..3 of a buffer allocated with new (16-byte aligned)
+	vector<unsigned char> expected(3*(longSize + 8)), actual(3*(longSize + 8));
+	for(int d=0; d<numMaxDepths; d++)
+	{
+		const VisibleDepthLut lut(maxDepths[d]);
+		for(size_t s=0; s<sizes.size(); s++)
+		{
+			const int size = sizes[s];
+			for(int srcOffset=0; srcOffset<4; srcOffset++)
+			{
+				const uInt16 *pSrc = &depth[srcOffset];
+				for(int dstOffset=0; dstOffset<4; dstOffset++)
+				{
+					unsigned char *pExpected = &expected[dstOffset];
+					unsigned char *pActual = &actual[dstOffset];
+					//the byte past the output must stay untouched
+					RefVisibleDepth(pSrc,pExpected,size,maxDepths[d]);
+					pActual[size] = pExpected[size] = 0xcd;
+					VisibleDepth<unsigned char>(pSrc,pActual,size,maxDepths[d]);
+					result.m_correct = result.m_correct && memcmp(pExpected,pActual,size+1) == 0;
+					lut.Convert(pSrc,pActual,size);
+					result.m_correct = result.m_correct && memcmp(pExpected,pActual,size+1) == 0;
+
+					RefVisibleDepthRGB(pSrc,pExpected,size,maxDepths[d]);
+					pActual[3*size] = pExpected[3*size] = 0xcd;
+					VisibleDepthRGB<unsigned char>(pSrc,pActual,size,maxDepths[d]);
+					result.m_correct = result.m_correct && memcmp(pExpected,pActual,3*size+1) == 0;
+					lut.ConvertRGB(pSrc,pActual,size);
+					result.m_correct = result.m_correct && memcmp(pExpected,pActual,3*size+1) == 0;
+					result.m_checks += 4;
+
+					if(d == 0)
+					{//no maxDepth
+						RefVisibleIr(pSrc,pExpected,size);
+						pActual[size] = pExpected[size] = 0xcd;
+						VisibleIr<unsigned char>(pSrc,pActual,size);
+						result.m_correct = result.m_correct && memcmp(pExpected,pActual,size+1) == 0;
+						result.m_checks++;
+					}
+				}
+			}
+		}
+	}
+}
+
+//
+//Check the last output of a timed case against the reference loop
+static bool SameAsReference(const vector<unsigned char> &expected, const vector<unsigned char> &actual)
+{
+	return expected.size() == actual.size() && memcmp(&expected[0],&actual[0],expected.size()) == 0;
+}
+
+
+/******************************/
+/* Cases                      */
+/******************************/
+
+static void BenchVerifyScalar(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	if(UseIsa(VISIBLE_ISA_SCALAR,result))
+	{
+		VerifyKernels(config,result);
+	}
+}
+
+static void BenchVerifySse41(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	if(UseIsa(VISIBLE_ISA_SSE41,result))
+	{
+		VerifyKernels(config,result);
+	}
+}
+
+static void BenchVerifyAvx2(const BenchmarkConfig &config, BenchmarkResult &result)
+{
+	if(UseIsa(VISIBLE_ISA_AVX2,result))
+	{
+		VerifyKernels(config,result);
+	}
+}
+
+//
+//The depth conversions, channels = 1 for VisibleDepth and 3 for VisibleDepthRGB
+enum DepthVariant
+{
+	DEPTH_TEMPLATE = 0,	//the Camera.h loop
+	DEPTH_KERNEL,		//the specialization on one instruction set
+	DEPTH_LUT,			//VisibleDepthLut
+	DEPTH_PARALLEL,		//the specialization on bands
+	DEPTH_LUT_PARALLEL	//VisibleDepthLut on bands
+};
+
+static void DepthCase(const BenchmarkConfig &config, const int channels, const DepthVariant variant,
+	const VisibleKernelIsa isa, BenchmarkResult &result)
+{
+	if(!UseIsa(isa,result))
+	{
+		return;
+	}
+	const int size = config.Size();
+	const double maxDepth = config.m_maxDepth;
+	vector<uInt16> depth;
+	MakeDepth(size,maxDepth,depth);
+	vector<unsigned char> expected(channels*size), actual(channels*size);
+	if(channels == 1)
+	{
+		RefVisibleDepth(&depth[0],&expected[0],size,maxDepth);
+	}
+	else
+	{
+		RefVisibleDepthRGB(&depth[0],&expected[0],size,maxDepth);
+	}
+	const uInt16 *pDepth = &depth[0];
+	unsigned char *pOut = &actual[0];
+	const VisibleDepthLut lut(maxDepth);
+	Time(config,[&]
+	{
+		switch(variant)
+		{
+		case DEPTH_TEMPLATE:
+			if(channels == 1)
+			{
+				RefVisibleDepth(pDepth,pOut,size,maxDepth);
+			}
+			else
+			{
+				RefVisibleDepthRGB(pDepth,pOut,size,maxDepth);
+			}
+			break;
+		case DEPTH_KERNEL:
+			if(channels == 1)
+			{
+				VisibleDepth<unsigned char>(pDepth,pOut,size,maxDepth);
+			}
+			else
+			{
+				VisibleDepthRGB<unsigned char>(pDepth,pOut,size,maxDepth);
+			}
+			break;
+		case DEPTH_LUT:
+			if(channels == 1)
+			{
+				lut.Convert(pDepth,pOut,size);
+			}
+			else
+			{
+				lut.ConvertRGB(pDepth,pOut,size);
+			}
+			break;
+		case DEPTH_PARALLEL:
+			if(channels == 1)
+			{
+				VisibleDepthParallel(pDepth,pOut,size,maxDepth);
+			}
+			else
+			{
+				VisibleDepthRGBParallel(pDepth,pOut,size,maxDepth);
+			}
+			break;
+		case DEPTH_LUT_PARALLEL:
+			if(channels == 1)
+			{
+				VisibleDepthParallel(pDepth,pOut,size,lut);
+			}
+			else
+			{
+				VisibleDepthRGBParallel(pDepth,pOut,size,lut);
+			}
+			break;
+		}
+	},result);
+	result.m_correct = SameAsReference(expected,actual);
+}
+
+static void IrCase(const BenchmarkConfig &config, const bool kernel, const bool parallel,
+	const VisibleKernelIsa isa, BenchmarkResult &result)
+{
+	if(!UseIsa(isa,result))
+	{
+		return;
+	}
+	const int size = config.Size();
+	vector<uInt16> ir;
+	MakeDepth(size,65535.0/1.2,ir);
+	vector<unsigned char> expected(size), actual(size);
+	RefVisibleIr(&ir[0],&expected[0],size);
+	const uInt16 *pIr = &ir[0];
+	unsigned char *pOut = &actual[0];
+	Time(config,[&]
+	{
+		if(!kernel)
+		{
+			RefVisibleIr(pIr,pOut,size);
+		}
+		else if(parallel)
+		{
+			VisibleIrParallel(pIr,pOut,size);
+		}
+		else
+		{
+			VisibleIr<unsigned char>(pIr,pOut,size);
+		}
+	},result);
+	result.m_correct = SameAsReference(expected,actual);
+}
+
+static void BenchDepthTemplate(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,1,DEPTH_TEMPLATE,VISIBLE_ISA_SCALAR,result); }
+static void BenchDepthScalar(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,1,DEPTH_KERNEL,VISIBLE_ISA_SCALAR,result); }
+static void BenchDepthSse41(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,1,DEPTH_KERNEL,VISIBLE_ISA_SSE41,result); }
+static void BenchDepthAvx2(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,1,DEPTH_KERNEL,VISIBLE_ISA_AVX2,result); }
+static void BenchDepthLut(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,1,DEPTH_LUT,DetectVisibleKernelIsa(),result); }
+static void BenchDepthParallel(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,1,DEPTH_PARALLEL,DetectVisibleKernelIsa(),result); }
+static void BenchDepthLutParallel(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,1,DEPTH_LUT_PARALLEL,DetectVisibleKernelIsa(),result); }
+static void BenchRgbTemplate(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,3,DEPTH_TEMPLATE,VISIBLE_ISA_SCALAR,result); }
+static void BenchRgbScalar(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,3,DEPTH_KERNEL,VISIBLE_ISA_SCALAR,result); }
+static void BenchRgbSse41(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,3,DEPTH_KERNEL,VISIBLE_ISA_SSE41,result); }
+static void BenchRgbAvx2(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,3,DEPTH_KERNEL,VISIBLE_ISA_AVX2,result); }
+static void BenchRgbLut(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,3,DEPTH_LUT,DetectVisibleKernelIsa(),result); }
+static void BenchRgbLutParallel(const BenchmarkConfig &config, BenchmarkResult &result) { DepthCase(config,3,DEPTH_LUT_PARALLEL,DetectVisibleKernelIsa(),result); }
+static void BenchIrTemplate(const BenchmarkConfig &config, BenchmarkResult &result) { IrCase(config,false,false,VISIBLE_ISA_SCALAR,result); }
+static void BenchIrScalar(const BenchmarkConfig &config, BenchmarkResult &result) { IrCase(config,true,false,VISIBLE_ISA_SCALAR,result); }
+static void BenchIrSse41(const BenchmarkConfig &config, BenchmarkResult &result) { IrCase(config,true,false,VISIBLE_ISA_SSE41,result); }
+static void BenchIrAvx2(const BenchmarkConfig &config, BenchmarkResult &result) { IrCase(config,true,false,VISIBLE_ISA_AVX2,result); }
+static void BenchIrParallel(const BenchmarkConfig &config, BenchmarkResult &result) { IrCase(config,true,true,DetectVisibleKernelIsa(),result); }
+
+static const BenchmarkCase s_cases[] =
+{
+	{"verify_scalar",BenchVerifyScalar},
+	{"verify_sse41",BenchVerifySse41},
+	{"verify_avx2",BenchVerifyAvx2},
+	{"depth_template",BenchDepthTemplate},
+	{"depth_scalar",BenchDepthScalar},
+	{"depth_sse41",BenchDepthSse41},
+	{"depth_avx2",BenchDepthAvx2},
+	{"depth_lut",BenchDepthLut},
+	{"depth_parallel",BenchDepthParallel},
+	{"depth_lut_parallel",BenchDepthLutParallel},
+	{"depth_rgb_template",BenchRgbTemplate},
+	{"depth_rgb_scalar",BenchRgbScalar},
+	{"depth_rgb_sse41",BenchRgbSse41},
+	{"depth_rgb_avx2",BenchRgbAvx2},
+	{"depth_rgb_lut",BenchRgbLut},
+	{"depth_rgb_lut_parallel",BenchRgbLutParallel},
+	{"ir_template",BenchIrTemplate},
+	{"ir_scalar",BenchIrScalar},
+	{"ir_sse41",BenchIrSse41},
+	{"ir_avx2",BenchIrAvx2},
+	{"ir_parallel",BenchIrParallel}
+};
+
+
+/******************************/
+/* Report                     */
+/******************************/
+
+static void WriteJson(ostream &os, const BenchmarkConfig &config, const vector<BenchmarkResult> &results)
+{
+	char buffer[512];
+	os << "{\n";
+	os << "\t\"benchmark\": \"visible_kernels\",\n";
+	sprintf(buffer,"\t\"config\": {\"iterations\": %d, \"width\": %d, \"height\": %d, \"maxDepth\": %.3f, \"detectedIsa\": \"%s\"},\n",
+		config.m_iterations,config.m_width,config.m_height,config.m_maxDepth,IsaName(DetectVisibleKernelIsa()));
+	os << buffer;
+	os << "\t\"results\": [\n";
+	for(size_t i=0; i<results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		const double msPerFrame = r.m_pixels > 0 ? r.m_seconds*1e3*config.Size() / r.m_pixels : 0;
+		const double mpixPerSecond = r.m_seconds > 0 ? r.m_pixels*1e-6 / r.m_seconds : 0;
+		sprintf(buffer,"\t\t{\"name\": \"%s\", \"isa\": \"%s\", \"skipped\": %s, \"correct\": %s, \"checks\": %d, "
+			"\"seconds\": %.6f, \"msPerFrame\": %.4f, \"mpixPerSecond\": %.1f",
+			r.m_name.c_str(),r.m_isa.c_str(),r.m_skipped ? "true" : "false",r.m_correct ? "true" : "false",r.m_checks,
+			r.m_seconds,msPerFrame,mpixPerSecond);
+		os << buffer;
+		os << ((i+1 < results.size()) ? "},\n" : "}\n");
+	}
+	os << "\t]\n";
+	os << "}\n";
+}
+
+
+int main(int argc, char **argv)
+{
+	BenchmarkConfig config;
+	string filter, outFile = "VisibleKernelsBenchmark.json";
+	for(int i=1; i<argc; i++)
+	{
+		const string arg = argv[i];
+		const char *pValue = (i+1 < argc) ? argv[i+1] : NULL;
+		if(!pValue)
+		{
+			cerr << "missing value for " << arg << endl;
+			return 1;
+		}
+		i++;
+		if(arg == "--iterations")
+		{
+			config.m_iterations = atoi(pValue);
+		}
+		else if(arg == "--width")
+		{
+			config.m_width = atoi(pValue);
+		}
+		else if(arg == "--height")
+		{
+			config.m_height = atoi(pValue);
+		}
+		else if(arg == "--maxdepth")
+		{
+			config.m_maxDepth = atof(pValue);
+		}
+		else if(arg == "--filter")
+		{
+			filter = pValue;
+		}
+		else if(arg == "--out")
+		{
+			outFile = pValue;
+		}
+		else
+		{
+			cerr << "unknown option " << arg << endl;
+			return 1;
+		}
+	}
+	if(config.m_width <= 0 || config.m_height <= 0 || config.m_iterations <= 0 || config.m_maxDepth <= 0)
+	{
+		cerr << "invalid configuration" << endl;
+		return 1;
+	}
+
+	vector<BenchmarkResult> results;
+	bool allCorrect = true;
+	try
+	{
+		for(size_t i=0; i<sizeof(s_cases)/sizeof(s_cases[0]); i++)
+		{
+			if(!filter.empty() && strstr(s_cases[i].m_name,filter.c_str()) == NULL)
+			{
+				continue;
+			}
+			cerr << "running " << s_cases[i].m_name << endl;
+			BenchmarkResult result;
+			result.m_name = s_cases[i].m_name;
+			s_cases[i].m_run(config,result);
+			if(!result.m_correct)
+			{
+				cerr << s_cases[i].m_name << ": the output differs from the template loop" << endl;
+				allCorrect = false;
+			}
+			results.push_back(result);
+		}
+	}
+	catch(const char *pMsg)
+	{
+		cerr << pMsg << endl;
+		return 1;
+	}
+	SetVisibleKernelIsa(DetectVisibleKernelIsa());
+
+	ofstream ofs(outFile.c_str());
+	if(!ofs)
+	{
+		cerr << "cannot open " << outFile << endl;
+		return 1;
+	}
+	WriteJson(ofs,config,results);
+	cerr << "results written to " << outFile << endl;
+	return allCorrect ? 0 : 1;
+}